@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include <sys/mman.h>
+#include "allocation.h"
+
+namespace MT {
+
+const size_t hugePageSize = 2 * 1024 * 1024; // x86-64 and ARM64 with 4 KB pages
+
+void* AllocateAligned(size_t size, size_t alignment) {
+    void* p = NULL;
+    if (::posix_memalign(&p, alignment, size == 0 ? alignment : size) != 0)
+        return NULL;
+    return p;
+}
+
+void FreeAligned(void* p) {
+    ::free(p);
+}
+
+void* AllocateBuffer(size_t size) {
+    if (size < hugePageSize)
+        return AllocateAligned(size);
+
+    void* p = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    ::madvise(p, size, MADV_HUGEPAGE); // only a hint: fails if THP is disabled
+    return p;
+}
+
+void FreeBuffer(void* p, size_t size) {
+    if (p == NULL)
+        return;
+    if (size < hugePageSize)
+        FreeAligned(p);
+    else
+        ::munmap(p, size);
+}
+
+} // namespace MT
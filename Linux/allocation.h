@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+namespace MT {
+
+// Cache line is the destructive interference size of x86-64 and most ARM64 processors:
+// threads writing different variables of one line invalidate each other's cache
+// (false sharing).
+const size_t CACHE_LINE = 64;
+
+#define MT_CACHE_ALIGN __attribute__((aligned(64)))
+
+// value on its own cache line: aligned and padded to the line size
+template <class T> struct MT_CACHE_ALIGN CacheAligned {
+    T value;
+};
+
+// heap block aligned to the cache line (operator new of C++03 does not honour the
+// alignment of the type)
+void* AllocateAligned(size_t size, size_t alignment = CACHE_LINE);
+void  FreeAligned(void* p);
+
+// Buffers of shared structures: cache-aligned block, the blocks of at least 2 MB are
+// mapped separately and offered to transparent huge pages (madvise(MADV_HUGEPAGE)).
+// see: https://www.kernel.org/doc/html/latest/admin-guide/mm/transhuge.html
+void* AllocateBuffer(size_t size);
+void  FreeBuffer(void* p, size_t size);
+
+// zero-initialised array of cache-aligned POD items
+template <class T> class AlignedArray {
+public:
+    AlignedArray(size_t size) : m_size(size),
+        m_items( static_cast<T*>(AllocateAligned(size * sizeof(T))) ) {
+        if (m_items != NULL)
+            memset(m_items, 0, size * sizeof(T));
+    }
+    ~AlignedArray() {
+        FreeAligned(m_items);
+    }
+
+    bool isValid() const {
+        return m_items != NULL;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    T& operator[](size_t i) {
+        return m_items[i];
+    }
+    const T& operator[](size_t i) const {
+        return m_items[i];
+    }
+
+private:
+    AlignedArray(const AlignedArray&);
+    AlignedArray& operator=(const AlignedArray&);
+
+    size_t m_size;
+    T*     m_items;
+};
+
+} // namespace MT
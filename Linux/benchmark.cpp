@@ -0,0 +1,813 @@
+#include "stdafx.h"
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <sched.h>
+#include "threads.h"
+#include "topology.h"
+#include "waitstrategy.h"
+#include "batchkernel.h"
+#include "workstack.h"
+#include "perfcounters.h"
+
+// Microbenchmarks of the synchronisation primitives used by the runners (threads.h),
+// Linux build.
+//
+// For every primitive it measures
+//   - uncontended cost of one acquire/release pair in a single pinned thread,
+//   - contended cost of the same pair when several pinned threads use one object,
+//   - ping-pong round trip between two threads pinned to different processors,
+//   - handoff latency (half of the round trip) of the primitives of each SyncType for
+//     every placement of the two threads on this machine (topology.h), and the best one.
+//
+// Global service accessors (Singleton, threads.h) against the former locked accessor
+// when 64 threads start at once and each calls them, as the thread functions do.
+//
+// Wait strategies (waitstrategy.h): wake-up latency of a consumer waiting for items
+// published at random intervals, against the processor time the consumer takes.
+//
+// Batch consumer (batchkernel.h): cost per item of popping the items in batches of
+// growing size, decoding their records and running each kernel level the processor has.
+//
+// Dispatch order against the cache (workstack.h): throughput of a bulk job whose backlog
+// is bigger than the cache, the time of reading the payload of an item and the last level
+// cache misses per item, over the FIFO queue, the lock-free LIFO stack and the per-thread
+// deques with stealing. The misses of the workers are counted by perf_event_open(2)
+// (perfcounters.h) where the system allows it (kernel.perf_event_paranoid, a virtual
+// machine may not pass the counters).
+//
+// Each measurement is repeated (after a warm-up pass) and the median and the minimum
+// are reported. Results are written as CSV to the output file, so the numbers of
+// different builds can be compared to track regressions.
+//
+// Usage: benchmark [output file] [repetitions]
+
+namespace MT {
+
+const char   defResultFile[] = "bench_results.csv";
+const int    defRepetitions  = 7;
+const unsigned uncontendedIterations = 1000000;
+const unsigned contendedIterations   = 100000; // per thread
+const unsigned pingPongIterations    = 50000;  // round trips
+const unsigned startupThreads        = 64;     // started at once
+const unsigned startupIterations     = 1000;   // per thread, calls of a thread function on its start
+const unsigned wakeupItems           = 500;
+const unsigned wakeupMaxGapMs        = 4;      // between the items
+const unsigned batchQueueItems       = 4096;   // popped in batches until the queue is empty
+const unsigned batchRounds           = 16;     // of the queue per repetition
+const unsigned maxBatch              = 512;
+
+// keep the working thread on one processor to avoid migrations between repetitions
+bool PinCurrentThread(unsigned cpu) {
+    return PinThread(::pthread_self(), cpu); // anyCpu: not pinned
+}
+
+// Measured operations: Run() is one acquire/release pair, Pass() hands the turn
+// to the other ping-pong side if it is ours (lock-like primitives only).
+
+struct CSOp {
+    static const char* Name() { return "CriticalSection"; }
+    bool Init() { return m_cs.isValid(); }
+    void Run() {
+        m_cs.Enter();
+        m_cs.Leave();
+    }
+    bool Pass(volatile int& turn, int side) {
+        m_cs.Enter();
+        bool passed = (turn == side);
+        if (passed)
+            turn = 1 - side;
+        m_cs.Leave();
+        return passed;
+    }
+
+    CriticalSection m_cs;
+};
+
+struct LockOp {
+    static const char* Name() { return "Lock"; }
+    bool Init() { return m_cs.isValid(); }
+    void Run() {
+        Lock lock(m_cs);
+    }
+    bool Pass(volatile int& turn, int side) {
+        Lock lock(m_cs);
+        if (turn != side)
+            return false;
+        turn = 1 - side;
+        return true;
+    }
+
+    CriticalSection m_cs;
+};
+
+struct MutexOp {
+    static const char* Name() { return "Mutex"; }
+    bool Init() { return m_mutex.isValid(); }
+    void Run() {
+        m_mutex.Enter();
+        m_mutex.Leave();
+    }
+    bool Pass(volatile int& turn, int side) {
+        m_mutex.Enter();
+        bool passed = (turn == side);
+        if (passed)
+            turn = 1 - side;
+        m_mutex.Leave();
+        return passed;
+    }
+
+    Mutex m_mutex;
+};
+
+struct SemaphoreOp {
+    static const char* Name() { return "Semaphore"; }
+    bool Init() {
+        return m_semaphore.Init(1); // binary semaphore
+    }
+    void Run() {
+        m_semaphore.Wait();
+        m_semaphore.Release();
+    }
+
+    Semaphore m_semaphore;
+};
+
+struct EventOp { // set and wait of auto-reset event by the same thread
+    static const char* Name() { return "Event"; }
+    bool Init() { return m_event.isValid(); }
+    void Run() {
+        m_event.Set();
+        m_event.Wait();
+    }
+
+    Event m_event;
+};
+
+struct SyncTimerInstanceOp {
+    static const char* Name() { return "SyncTimer::Instance"; }
+    bool Init() { return SyncTimer::Instance().isValid(); }
+    void Run() {
+        m_timer = &SyncTimer::Instance();
+    }
+
+    const SyncTimer* volatile m_timer; // result must be stored, elsewhere call can be optimised
+};
+
+struct SyncTimerStateOp {
+    static const char* Name() { return "SyncTimer::State"; }
+    bool Init() {
+        m_timer = &SyncTimer::Instance();
+        return m_timer->isValid();
+    }
+    void Run() {
+        m_state = m_timer->State();
+    }
+
+    const SyncTimer* m_timer;
+    volatile SyncTimerState m_state;
+};
+
+struct LoggerInstanceOp {
+    static const char* Name() { return "Logger::Instance"; }
+    bool Init() { return true; }
+    void Run() {
+        m_logger = &Logger::Instance();
+    }
+
+    Logger* volatile m_logger;
+};
+
+// former accessor of the global services: every call takes the lock
+// around the local static, as SyncTimer::Instance() did before Singleton
+struct LockedInstanceOp {
+    static const char* Name() { return "locked Instance"; }
+    bool Init() { return m_cs.isValid(); }
+    void Run() {
+        Lock lock(m_cs);
+        static int instance;
+        m_instance = &instance;
+    }
+
+    CriticalSection m_cs;
+    int* volatile   m_instance;
+};
+
+struct QueueOp { // ring storage: no allocation by push/pop
+    static const char* Name() { return "Queue push/pop"; }
+    QueueOp() : m_queue(8) {
+    }
+    bool Init() { return true; }
+    void Run() {
+        m_queue.push(1);
+        m_queue.pop();
+    }
+
+    Queue<int> m_queue;
+};
+
+// ping-pong of the wait objects: each side waits for its own object and signals the other one
+struct EventPingPong {
+    static const char* Name() { return "Event"; }
+    bool Init() {
+        m_events[0].Set(); // side 0 starts
+        return true;
+    }
+    void Step(int side) {
+        m_events[side].Wait();
+        m_events[1 - side].Set();
+    }
+
+    Event m_events[2];
+};
+
+struct SemaphorePingPong {
+    static const char* Name() { return "Semaphore"; }
+    bool Init() {
+        return m_sems[0].Init(1) && m_sems[1].Init(0);
+    }
+    void Step(int side) {
+        m_sems[side].Wait();
+        m_sems[1 - side].Release();
+    }
+
+    Semaphore m_sems[2];
+};
+
+// ping-pong of locks: the turn variable protected by the lock is polled by both sides
+template <class Op> struct LockPingPong {
+    static const char* Name() { return Op::Name(); }
+    bool Init() {
+        m_turn = 0;
+        return m_op.Init();
+    }
+    void Step(int side) {
+        for (unsigned spin = 1; !m_op.Pass(m_turn, side); spin++) {
+            if (spin % 64 == 0)
+                ::sched_yield(); // both sides may share one processor
+            else
+                CpuRelax();      // spin-wait hint
+        }
+    }
+
+    Op m_op;
+    volatile int m_turn;
+};
+
+// one item at a time published to the consumer waiting by the strategy
+struct WakeupOp {
+    WakeupOp(WaitPolicy policy) : strategy(policy), stamp(0), published(0), consumed(0),
+        cpuNs(0), wallNs(0) {
+    }
+
+    struct Ready {
+        Ready(const WakeupOp& op) : m_op(op) {
+        }
+        bool operator()() const {
+            return __atomic_load_n(&m_op.published, __ATOMIC_ACQUIRE) != m_op.consumed;
+        }
+        const WakeupOp& m_op;
+    };
+
+    WaitStrategy        strategy;
+    Event               wake;      // auto-reset, set after each item
+    long long           stamp;     // when the last item was published
+    volatile int        published;
+    volatile int        consumed;
+    std::vector<double> latencies; // ns
+    double              cpuNs;     // of the consumer
+    double              wallNs;
+};
+
+struct BenchResult {
+    std::string primitive;
+    std::string scenario;
+    unsigned threads;
+    unsigned iterations;
+    double median;
+    double best;      // minimum or maximum, depends on unit
+    std::string unit; // ns per operation (or per round trip)
+};
+
+class Benchmark {
+public:
+    Benchmark(int repetitions) : m_repetitions(repetitions),
+        m_cpus(static_cast<unsigned>(Topology::Instance().Cpus())) {
+    }
+
+    template <class Op> void Uncontended();
+    template <class Op> void Contended(unsigned threads);
+    template <class Op> void Startup(unsigned threads);
+    template <class PingPong> void RoundTrip();
+    template <class PingPong> void Handoff(const char* syncType);
+    void Wakeup(WaitPolicy policy);
+    void BatchConsume(KernelLevel level, unsigned batch);
+    void BulkDispatch(unsigned workers);
+
+    unsigned Processors() const {
+        return m_cpus;
+    }
+
+    bool Write(const char* fileName) const;
+
+private:
+    template <class Op> struct ThreadArgs {
+        Op*      op;
+        unsigned cpu;
+        unsigned iterations;
+        int      side;      // ping-pong only
+        Event*   start;     // manual-reset event releasing all threads at once
+        double   elapsedNs; // output
+    };
+
+    template <class Op> static unsigned ContendedThread(void* args);
+    template <class PingPong> static unsigned PingPongThread(void* args);
+    static THREAD_FUNCTION WakeupThread;
+
+    template <class Op> bool RunThreads(THREAD_FUNCTION* func, std::vector< ThreadArgs<Op> >& args);
+    template <class PingPong> bool RunRoundTrips(unsigned cpu0, unsigned cpu1, std::vector<double>& samples);
+    template <class Op> bool RunContended(Op& op, unsigned threads, unsigned iterations, double& avgNs);
+
+    void Add(const char* primitive, const char* scenario, unsigned threads, unsigned iterations,
+             std::vector<double>& samples, const char* unit = "ns", bool higherIsBetter = false);
+
+    const int      m_repetitions;
+    const unsigned m_cpus;
+    std::vector<BenchResult> m_results;
+};
+
+template <class Op> void Benchmark::Uncontended() {
+    Op op;
+    if (!op.Init())
+        return;
+
+    PinCurrentThread(0);
+    for (unsigned i = 0; i < uncontendedIterations; i++) // warm-up
+        op.Run();
+
+    std::vector<double> samples;
+    for (int rep = 0; rep < m_repetitions; rep++) {
+        Stopwatch sw;
+        for (unsigned i = 0; i < uncontendedIterations; i++)
+            op.Run();
+        samples.push_back(sw.ElapsedNs() / uncontendedIterations);
+    }
+    Add(Op::Name(), "uncontended", 1, uncontendedIterations, samples);
+}
+
+template <class Op> void Benchmark::Contended(unsigned threads) {
+    Op op;
+    if (!op.Init())
+        return;
+
+    std::vector<double> samples;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        double avgNs = 0;
+        if (!RunContended(op, threads, contendedIterations, avgNs))
+            return;
+        if (rep > 0)
+            samples.push_back(avgNs);
+    }
+    Add(Op::Name(), "contended", threads, contendedIterations, samples);
+}
+
+// Cost of the global service accessors when many threads start at once and each calls
+// them a few times, as the thread functions do on their start. There are usually more
+// threads than processors, so a lock taken by a preempted thread stalls the others.
+template <class Op> void Benchmark::Startup(unsigned threads) {
+    Op op;
+    if (!op.Init())
+        return;
+
+    std::vector<double> samples;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        double avgNs = 0;
+        if (!RunContended(op, threads, startupIterations, avgNs))
+            return;
+        if (rep > 0)
+            samples.push_back(avgNs);
+    }
+    Add(Op::Name(), "start burst", threads, startupIterations, samples);
+}
+
+// average cost of Op::Run() seen by a thread when all threads run it simultaneously
+template <class Op> bool Benchmark::RunContended(Op& op, unsigned threads, unsigned iterations,
+                                                 double& avgNs) {
+    std::vector< ThreadArgs<Op> > args(threads);
+    for (unsigned i = 0; i < threads; i++) {
+        args[i].op         = &op;
+        args[i].cpu        = i % m_cpus;
+        args[i].iterations = iterations;
+        args[i].side       = 0;
+        args[i].elapsedNs  = 0;
+    }
+    if (!RunThreads(&ContendedThread<Op>, args))
+        return false;
+
+    double total = 0;
+    for (unsigned i = 0; i < threads; i++)
+        total += args[i].elapsedNs / iterations;
+    avgNs = total / threads;
+    return true;
+}
+
+// Wake-up latency (from the publication of an item until the consumer sees it) against
+// the processor time of the consumer in per cent of the run time: the spinning strategies
+// buy latency with the processor.
+void Benchmark::Wakeup(WaitPolicy policy) {
+    std::vector<double> latency, cpu;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        WakeupOp op(policy);
+        op.latencies.reserve(wakeupItems);
+
+        std::vector< ThreadArgs<WakeupOp> > args(2);
+        for (unsigned i = 0; i < 2; i++) {
+            args[i].op         = &op;
+            args[i].cpu        = i % m_cpus;
+            args[i].iterations = wakeupItems;
+            args[i].side       = i; // 0 - producer, 1 - consumer
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&WakeupThread, args) || op.latencies.size() != wakeupItems)
+            return;
+        if (rep == 0)
+            continue;
+        std::sort(op.latencies.begin(), op.latencies.end());
+        latency.push_back(op.latencies[op.latencies.size() / 2] / 1000);
+        cpu.push_back(100 * op.cpuNs / op.wallNs);
+    }
+    const std::string name = std::string("Wait ") + WaitPolicyName(policy);
+    Add(name.c_str(), "wake-up latency", 2, wakeupItems, latency, "us");
+    Add(name.c_str(), "consumer cpu", 2, wakeupItems, cpu, "%");
+}
+
+// Consumer side of the batch consumer (ProducerConsumerBatchRunner): the items are popped
+// under one lock per batch, their records decoded and processed by the kernel. The lock
+// and the call of the kernel are paid once per batch, the wider kernels process more
+// words per instruction.
+void Benchmark::BatchConsume(KernelLevel level, unsigned batch) {
+    Queue<int> queue(batchQueueItems);
+    CriticalSection cs;
+    AlignedArray<int> records(batch * RECORD_WORDS);
+    if (!records.isValid())
+        return;
+    std::vector<int> msgs(batch);
+
+    // the kernel must give the result of the scalar one, with a tail and without
+    for (unsigned i = 0; i < batch; i++)
+        DecodeRecord(static_cast<int>(i), &records[i * RECORD_WORDS]);
+    const size_t sizes[] = { batch * RECORD_WORDS, batch * RECORD_WORDS - 3 };
+    for (int i = 0; i < 2; i++) {
+        BatchSummary expected, summary;
+        RunBatchKernel(KL_SCALAR, &records[0], sizes[i], 0, expected);
+        RunBatchKernel(level, &records[0], sizes[i], 0, summary);
+        if (summary.checksum != expected.checksum || summary.selected != expected.selected ||
+            summary.sum != expected.sum) {
+            cout << "Kernel " << KernelLevelName(level) << " differs from the scalar one" << endl;
+            return;
+        }
+    }
+
+    PinCurrentThread(0);
+    std::vector<double> samples;
+    unsigned checksum = 0;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        double elapsedNs = 0;
+        for (unsigned round = 0; round < batchRounds; round++) {
+            for (unsigned i = 0; i < batchQueueItems; i++)
+                queue.push(static_cast<int>(i));
+
+            Stopwatch sw;
+            while (!queue.empty()) {
+                size_t count = 0;
+                {
+                    Lock lock(cs);
+                    while (count < batch && !queue.empty()) {
+                        msgs[count++] = queue.front();
+                        queue.pop();
+                    }
+                }
+                for (size_t i = 0; i < count; i++)
+                    DecodeRecord(msgs[i], &records[i * RECORD_WORDS]);
+                BatchSummary summary;
+                RunBatchKernel(level, &records[0], count * RECORD_WORDS, 0, summary);
+                checksum ^= summary.checksum;
+            }
+            elapsedNs += sw.ElapsedNs();
+        }
+        if (rep > 0)
+            samples.push_back(elapsedNs / (batchRounds * batchQueueItems));
+    }
+    volatile unsigned result = checksum; // the kernel must not be optimised away
+    (void)result;
+
+    stringstream scenario;
+    scenario << "batch of " << batch;
+    const std::string name = std::string("Batch consume ") + KernelLevelName(level);
+    Add(name.c_str(), scenario.str().c_str(), 1, batchRounds * batchQueueItems, samples);
+}
+
+// Each repetition runs the job over every dispatch structure in turn, so slow drifts of
+// the machine affect all of them alike
+void Benchmark::BulkDispatch(unsigned workers) {
+    const unsigned variants = 3;
+    std::vector<double> itemsPerSec[variants], readNs[variants], misses[variants];
+    const char* names[variants] = { 0 };
+
+    BulkJob job(workers);
+    if (!job.isValid())
+        return;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        CSQueue          fifo(BulkJob::Capacity(workers));
+        TreiberStack     lifo(BulkJob::Capacity(workers));
+        WorkStealingPool hybrid(BulkJob::Capacity(workers), workers);
+        SharedQueue* dispatches[variants] = { &fifo, &lifo, &hybrid };
+
+        for (unsigned v = 0; v < variants; v++) {
+            BulkJobResult result;
+            PerfCounters counters; // of the worker threads
+            counters.Start();
+            const int ret = job.Run(*dispatches[v], result);
+            counters.Stop();
+            const long long count = counters.Total(PC_LLC_MISSES);
+            if (ret != RET_OK) {
+                cout << "Bulk job over " << dispatches[v]->Name() << " failed" << endl;
+                return;
+            }
+            names[v] = dispatches[v]->Name();
+            if (rep == 0)
+                continue;
+            itemsPerSec[v].push_back(result.itemsPerSec);
+            readNs[v].push_back(result.readNsPerItem);
+            if (count >= 0)
+                misses[v].push_back(static_cast<double>(count) / job.TotalItems());
+        }
+    }
+    for (unsigned v = 0; v < variants; v++) {
+        const std::string name = std::string("Dispatch ") + names[v];
+        const unsigned items = static_cast<unsigned>(job.TotalItems());
+        Add(name.c_str(), "bulk job", workers, items, itemsPerSec[v], "items/s", true);
+        Add(name.c_str(), "payload read", workers, items, readNs[v]);
+        Add(name.c_str(), "LLC misses", workers, items, misses[v], "per item"); // none if not counted
+    }
+}
+
+template <class PingPong> void Benchmark::RoundTrip() {
+    std::vector<double> samples;
+    if (RunRoundTrips<PingPong>(0, m_cpus > 1 ? 1 : 0, samples)) // different processors if possible
+        Add(PingPong::Name(), "ping-pong", 2, pingPongIterations, samples);
+}
+
+// Handoff latency for each placement the machine has: one side wakes the other and the
+// time until the other side runs is half of the round trip.
+template <class PingPong> void Benchmark::Handoff(const char* syncType) {
+    const Topology& topology = Topology::Instance();
+    Placement best = PL_TOTAL;
+    double bestNs  = 0;
+
+    for (int p = 0; p < PL_TOTAL; p++) {
+        const Placement placement = static_cast<Placement>(p);
+        std::vector<unsigned> cpus;
+        if (!topology.Place(placement, 2, cpus))
+            continue; // e.g. one socket
+
+        std::vector<double> samples;
+        if (!RunRoundTrips<PingPong>(cpus[0], cpus[1], samples))
+            return;
+        for (size_t i = 0; i < samples.size(); i++)
+            samples[i] /= 2;
+
+        const std::string scenario = std::string("handoff, ") + PlacementName(placement);
+        Add(syncType, scenario.c_str(), 2, pingPongIterations, samples);
+        const double median = m_results.back().median;
+        if (best == PL_TOTAL || median < bestNs) {
+            best   = placement;
+            bestNs = median;
+        }
+    }
+    if (best != PL_TOTAL)
+        cout << syncType << ": best placement " << PlacementName(best) << ", handoff "
+             << bestNs << " ns" << endl;
+}
+
+// round trip time of each repetition, the first pass is warm-up
+template <class PingPong> bool Benchmark::RunRoundTrips(unsigned cpu0, unsigned cpu1,
+                                                        std::vector<double>& samples) {
+    for (int rep = 0; rep <= m_repetitions; rep++) {
+        PingPong pp;
+        if (!pp.Init())
+            return false;
+
+        std::vector< ThreadArgs<PingPong> > args(2);
+        for (unsigned i = 0; i < 2; i++) {
+            args[i].op         = &pp;
+            args[i].cpu        = (i == 0 ? cpu0 : cpu1);
+            args[i].iterations = pingPongIterations;
+            args[i].side       = i;
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&PingPongThread<PingPong>, args))
+            return false;
+        if (rep > 0)
+            samples.push_back(args[0].elapsedNs / pingPongIterations);
+    }
+    return true;
+}
+
+template <class Op> unsigned Benchmark::ContendedThread(void* args) {
+    ThreadArgs<Op>* a = static_cast<ThreadArgs<Op>*>(args);
+    PinCurrentThread(a->cpu);
+    a->start->Wait();
+
+    Stopwatch sw;
+    for (unsigned i = 0; i < a->iterations; i++)
+        a->op->Run();
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+template <class PingPong> unsigned Benchmark::PingPongThread(void* args) {
+    ThreadArgs<PingPong>* a = static_cast<ThreadArgs<PingPong>*>(args);
+    PinCurrentThread(a->cpu);
+    a->start->Wait();
+
+    Stopwatch sw;
+    for (unsigned i = 0; i < a->iterations; i++)
+        a->op->Step(a->side);
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+static double ThreadCpuNs() { // user and system time of the calling thread
+    timespec ts;
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+unsigned Benchmark::WakeupThread(void* args) {
+    ThreadArgs<WakeupOp>* a = static_cast<ThreadArgs<WakeupOp>*>(args);
+    WakeupOp& op = *a->op;
+    PinCurrentThread(a->cpu);
+    a->start->Wait();
+
+    if (a->side == 0) { // producer: the next item after the previous one is taken
+        for (unsigned i = 0; i < a->iterations; i++) {
+            ::usleep((rand() % (wakeupMaxGapMs + 1)) * 1000);
+            while (__atomic_load_n(&op.consumed, __ATOMIC_ACQUIRE) != op.published)
+                ::sched_yield();
+            op.stamp = MonotonicNs();
+            __atomic_store_n(&op.published, op.published + 1, __ATOMIC_RELEASE);
+            op.wake.Set();
+        }
+        return RET_OK;
+    }
+
+    const double cpuStart = ThreadCpuNs();
+    Stopwatch sw;
+    while (static_cast<unsigned>(op.consumed) < a->iterations) {
+        if (op.strategy.Wait(WakeupOp::Ready(op), &op.wake, INFINITE) == WR_FAILED)
+            return ERR_SYNC;
+        if (__atomic_load_n(&op.published, __ATOMIC_ACQUIRE) == op.consumed)
+            continue; // woken up by the signal of an item seen by spinning
+        op.latencies.push_back(static_cast<double>(MonotonicNs() - op.stamp));
+        __atomic_store_n(&op.consumed, op.consumed + 1, __ATOMIC_RELEASE);
+    }
+    op.wallNs = sw.ElapsedNs();
+    op.cpuNs  = ThreadCpuNs() - cpuStart;
+    return RET_OK;
+}
+
+template <class Op> bool Benchmark::RunThreads(THREAD_FUNCTION* func, std::vector< ThreadArgs<Op> >& args) {
+
+    Event start(true); // manual reset
+
+    std::vector<pthread_t> threads;
+    for (size_t i = 0; i < args.size(); i++) {
+        args[i].start = &start;
+        pthread_t thread;
+        if (!StartThread(func, &args[i], 0, thread))
+            break;
+        threads.push_back(thread);
+    }
+
+    start.Set(); // also releases already created threads if some creation failed
+    for (size_t i = 0; i < threads.size(); i++) {
+        unsigned code = RET_OK;
+        JoinThread(threads[i], code);
+    }
+
+    return threads.size() == args.size();
+}
+
+void Benchmark::Add(const char* primitive, const char* scenario, unsigned threads, unsigned iterations,
+                    std::vector<double>& samples, const char* unit, bool higherIsBetter) {
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult r;
+    r.primitive  = primitive;
+    r.scenario   = scenario;
+    r.threads    = threads;
+    r.iterations = iterations;
+    r.median     = samples[samples.size() / 2];
+    r.best       = (higherIsBetter ? samples.back() : samples[0]);
+    r.unit       = unit;
+    m_results.push_back(r);
+
+    cout << primitive << ", " << scenario << ", threads: " << threads
+         << ", median: " << r.median << ' ' << unit << ", best: " << r.best << ' ' << unit << endl;
+}
+
+bool Benchmark::Write(const char* fileName) const {
+    std::ofstream out(fileName);
+    if (!out)
+        return false;
+
+#ifdef NDEBUG
+    const char build[] = "Release";
+#else
+    const char build[] = "Debug";
+#endif
+    out << "# processors: " << m_cpus << ", clock: CLOCK_MONOTONIC"
+        << ", repetitions: " << m_repetitions << ", build: " << build << endl;
+    out << "primitive,scenario,threads,iterations,median,best,unit" << endl;
+    for (size_t i = 0; i < m_results.size(); i++) {
+        const BenchResult& r = m_results[i];
+        out << r.primitive << ',' << r.scenario << ',' << r.threads << ',' << r.iterations << ','
+            << r.median << ',' << r.best << ',' << r.unit << endl;
+    }
+    return out.good();
+}
+
+} // namespace MT
+
+int main(int argc, char* argv[])
+{
+    const char* fileName = (argc > 1 ? argv[1] : MT::defResultFile);
+    int repetitions      = (argc > 2 ? atoi(argv[2]) : MT::defRepetitions);
+    if (repetitions < 1)
+        repetitions = MT::defRepetitions;
+
+    // the timer must be set and not expired to measure the working state
+    if (!MT::SyncTimer::Instance().SetTimer(3600 * 1000)) { // 1 hour
+        cout << "System call failed, exiting." << endl;
+        return ERR_API;
+    }
+
+    MT::Benchmark bench(repetitions);
+
+    bench.Uncontended<MT::CSOp>();
+    bench.Uncontended<MT::LockOp>();
+    bench.Uncontended<MT::MutexOp>();
+    bench.Uncontended<MT::SemaphoreOp>();
+    bench.Uncontended<MT::EventOp>();
+    bench.Uncontended<MT::SyncTimerInstanceOp>();
+    bench.Uncontended<MT::SyncTimerStateOp>();
+    bench.Uncontended<MT::QueueOp>();
+
+    for (unsigned threads = 2; threads <= bench.Processors(); threads *= 2) {
+        bench.Contended<MT::CSOp>(threads);
+        bench.Contended<MT::LockOp>(threads);
+        bench.Contended<MT::MutexOp>(threads);
+        bench.Contended<MT::SemaphoreOp>(threads);
+        bench.Contended<MT::SyncTimerInstanceOp>(threads);
+        bench.Contended<MT::SyncTimerStateOp>(threads);
+    }
+
+    bench.Startup<MT::LockedInstanceOp>(MT::startupThreads);
+    bench.Startup<MT::SyncTimerInstanceOp>(MT::startupThreads);
+    bench.Startup<MT::LoggerInstanceOp>(MT::startupThreads);
+    bench.Startup<MT::SyncTimerStateOp>(MT::startupThreads);
+
+    bench.RoundTrip< MT::LockPingPong<MT::CSOp> >();
+    bench.RoundTrip< MT::LockPingPong<MT::LockOp> >();
+    bench.RoundTrip< MT::LockPingPong<MT::MutexOp> >();
+    bench.RoundTrip<MT::EventPingPong>();
+    bench.RoundTrip<MT::SemaphorePingPong>();
+
+    MT::Topology::Instance().Report(cout); // handoff by SyncType, names as in the menu
+    bench.Handoff< MT::LockPingPong<MT::CSOp> >("Critical sections");
+    bench.Handoff<MT::EventPingPong>("Critical sections and events");
+    bench.Handoff< MT::LockPingPong<MT::MutexOp> >("Mutex");
+    bench.Handoff<MT::SemaphorePingPong>("Semaphore");
+
+    for (int policy = 0; policy < MT::WP_TOTAL; policy++)
+        bench.Wakeup(static_cast<MT::WaitPolicy>(policy));
+
+    for (int level = 0; level <= MT::BestKernelLevel(); level++) {
+        for (unsigned batch = 1; batch <= MT::maxBatch; batch *= 8)
+            bench.BatchConsume(static_cast<MT::KernelLevel>(level), batch);
+    }
+
+    for (unsigned workers = 1; workers <= bench.Processors() && workers <= MT::BulkJob::m_maxWorkers; workers *= 2)
+        bench.BulkDispatch(workers);
+
+    if (!bench.Write(fileName)) {
+        cout << "Cannot write results to " << fileName << endl;
+        return ERR_STD;
+    }
+    cout << endl << "Results are written to " << fileName << endl;
+    return RET_OK;
+}
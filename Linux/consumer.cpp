@@ -0,0 +1,345 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::Queue<int> g_msgs;
+extern MT::CriticalSection g_cs;
+extern MT::Event g_emptyEvent, g_fullEvent, g_emptyMutEvent, g_fullMutEvent;
+extern MT::Mutex g_mutex;
+
+const char EMPTY_BUFFER[]     = "Consumer: empty buffer, waiting";
+const char CONSUMER_WAKE_UP[] = "Consumer: waking up";
+const char BUFFER_DRAINED[]   = "Consumer: buffer drained, exiting.";
+const char FORCE_STOPPED[]    = "Consumer: grace deadline passed, exiting.";
+
+namespace MT {
+
+// Just locking shared data structure with Critical Sections.
+// Using RAAI idiom for aquiring locks
+unsigned ProducerConsumerCSRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferWait = 1000; // 1 sec
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+        bool isEmpty = false;
+        int cur_msg = 0;
+        {
+            Lock lock(g_cs);      // acquire lock
+            if (g_msgs.empty()) { // nothing to produce, need synchronisation
+                isEmpty = true;
+                Print(EMPTY_BUFFER);
+            } else {
+                try {
+                    cur_msg = g_msgs.front();
+                    g_msgs.pop();
+                    SampleDepth();
+                } catch(std::exception& ex) {
+                    Print(ex.what());
+                    return ERR_STD;
+                } catch(...) {
+                    Print("Unknown error ");
+                    return ERR_UNKNOWN;
+                }
+                Print("received:", cur_msg);
+            }
+        } // release lock
+        if (isEmpty) {
+            if (Draining())
+                break;
+            stats.Add(SC_WAITS);
+            m_wait.Wait(ItemReady(g_msgs, g_cs), NULL, emptyBufferWait);
+            continue; // wait until there will be some input in the buffer or timeout occurs
+        }
+        Consume(cur_msg);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Using Critical Sections and Events for synchronisation
+unsigned ProducerConsumerEventRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        bool isEmpty = false;
+        {
+            Lock lock(g_cs); // any access to writable shared memory should be protected by lock
+            isEmpty = g_msgs.empty();
+            if (isEmpty) {
+                Print(EMPTY_BUFFER);
+                g_fullEvent.Reset(); // nothing to consume, need synchronisation
+            }
+        }
+
+        if (isEmpty) {
+            if (Draining())
+                break;
+            stats.Add(SC_WAITS);
+            const WaitResult result = m_wait.Wait(ItemReady(g_msgs, g_cs), &g_fullEvent, emptyBufferTimeout);
+            if (result == WR_FAILED)
+                return ERR_SYNC;
+            if (result == WR_TIMEOUT) {
+                stats.Add(SC_TIMEOUTS);
+                continue; // check global timer
+            }
+
+            // event signalled
+            if (m_phase != SP_RUN)
+                continue; // woken up by the shutdown
+            Print(CONSUMER_WAKE_UP);
+        }
+
+        int cur_msg = 0;
+        {
+            Lock lock(g_cs);
+            try {
+                cur_msg = g_msgs.front();
+                g_msgs.pop();
+                SampleDepth();
+
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error ");
+                return ERR_UNKNOWN;
+            }
+
+            Print("received:", cur_msg);
+            g_emptyEvent.Set();
+        }
+
+        Consume(cur_msg);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Using mutex for synchronisation
+unsigned ProducerConsumerMutexRunner::Consumer(void* args) {
+
+    // not using Instance() each time to increase performance (no locks)
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        g_mutex.Enter();
+            
+        if (g_msgs.empty()) {    // nothing to consume, need synchronisation
+            // under the mutex: a push after the check is counted
+            const long seen = __atomic_load_n(&m_fullSignals, __ATOMIC_RELAXED);
+            Print(EMPTY_BUFFER); // protected by lock to synchonise output
+            g_fullMutEvent.Reset();
+            g_mutex.Leave();
+            if (Draining())
+                break;
+
+            stats.Add(SC_WAITS);
+            const WaitResult result = m_wait.Wait(SignalReady(m_fullSignals, seen, true), &g_fullMutEvent,
+                                                  emptyBufferTimeout);
+            if (result == WR_FAILED)
+                return ERR_SYNC;
+            if (result == WR_TIMEOUT) { // check global timer
+                stats.Add(SC_TIMEOUTS);
+                continue;
+            }
+            if (m_phase != SP_RUN)
+                continue; // woken up by the shutdown
+
+            Print(CONSUMER_WAKE_UP);
+            continue; // take the mutex again and check
+        }
+
+        int cur_msg = 0;
+        try {
+            cur_msg = g_msgs.front();
+            g_msgs.pop();
+            SampleDepth();
+
+        } catch(std::exception& ex) {
+            Print(ex.what());
+            g_mutex.Leave();
+            return ERR_STD;
+        } catch(...) {  
+            Print("Unknown error");
+            g_mutex.Leave();
+            return ERR_UNKNOWN;
+        }
+
+        Print("received:", cur_msg);
+        g_mutex.Leave();
+        Signal(g_emptyMutEvent, m_emptySignals);
+        Consume(cur_msg);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Serves the items in the order they were sent and stamps their completion
+unsigned OpenLoopRunner::Consumer(void* args) {
+
+    StepArgs& a = *static_cast<StepArgs*>(args);
+    for (;;) {
+        Task task;
+        if (!m_queue.Pop(task, m_queueTimeout))
+            return ERR_SYNC;
+        if (task.request < 0)
+            break; // the producer has sent all items
+
+        for (volatile unsigned i = 0; i < m_serviceSpin; i++) // imitate work
+            ;
+        a.doneNs[task.request] = a.clock->ElapsedNs();
+    }
+    return RET_OK;
+}
+
+// Serves the items until the producer stops, latency is from the send to the end of the work
+unsigned SoakRunner::Consumer(void*) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    for (;;) {
+        Task task;
+        if (!m_queue.Pop(task, syncTimer.State() == ST_WORK ? m_queueTimeout : m_stopTimeout)) {
+            if (syncTimer.State() == ST_WORK)
+                continue; // empty for the whole timeout
+            return ERR_SYNC; // the producer has not sent the last item
+        }
+        if (task.request < 0)
+            break;
+
+        for (volatile unsigned i = 0; i < m_serviceSpin; i++) // imitate work
+            ;
+        const double latencyNs = m_clock.ElapsedNs() - m_sentNs[task.request];
+        {
+            Lock lock(m_latencyCs);
+            m_latency.Record(latencyNs);
+        }
+        m_consumed = m_consumed + 1; // the only writer
+    }
+    return RET_OK;
+}
+
+// Critical sections and events as ProducerConsumerEventRunner, but all items in the buffer
+// are taken at once and the kernel processes their records together
+unsigned ProducerConsumerBatchRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    AlignedArray<int> records(m_maxBatch * RECORD_WORDS);
+    if (!records.isValid())
+        return ERR_STD;
+    int msgs[m_maxBatch];
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        bool isEmpty = false;
+        {
+            Lock lock(g_cs);
+            isEmpty = g_msgs.empty();
+            if (isEmpty) {
+                Print(EMPTY_BUFFER);
+                g_fullEvent.Reset(); // nothing to consume, need synchronisation
+            }
+        }
+
+        if (isEmpty) {
+            if (Draining())
+                break;
+            stats.Add(SC_WAITS);
+            const WaitResult result = m_wait.Wait(ItemReady(g_msgs, g_cs), &g_fullEvent, emptyBufferTimeout);
+            if (result == WR_FAILED)
+                return ERR_SYNC;
+            if (result == WR_TIMEOUT)
+                stats.Add(SC_TIMEOUTS);
+            if (result == WR_TIMEOUT || m_phase != SP_RUN)
+                continue; // check the shutdown
+            Print(CONSUMER_WAKE_UP);
+        }
+
+        size_t count = 0;
+        {
+            Lock lock(g_cs); // one acquisition for the whole batch
+            try {
+                while (count < m_maxBatch && !g_msgs.empty()) {
+                    msgs[count++] = g_msgs.front();
+                    g_msgs.pop();
+                }
+                SampleDepth();
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error ");
+                return ERR_UNKNOWN;
+            }
+            if (count == 0)
+                continue; // taken by the check after the wake-up
+
+            stringstream ss;
+            ss << "received batch: " << msgs[0] << "-" << msgs[count - 1];
+            Print(ss.str().c_str());
+            g_emptyEvent.Set();
+        }
+
+        ConsumeBatch(msgs, count, records);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+void ProducerConsumerBatchRunner::ConsumeBatch(const int* msgs, size_t count, AlignedArray<int>& records) {
+    Wait(rand()%14 * 50); // imitated work of the whole batch
+
+    for (size_t i = 0; i < count; i++)
+        DecodeRecord(msgs[i], &records[i * RECORD_WORDS]);
+
+    Stopwatch sw;
+    BatchSummary summary;
+    RunBatchKernel(m_kernel, &records[0], count * RECORD_WORDS, m_threshold, summary);
+    const double kernelNs = sw.ElapsedNs();
+
+    m_totals.batches  = m_totals.batches + 1; // the only writer
+    m_totals.items    = m_totals.items + static_cast<unsigned>(count);
+    m_totals.checksum = ((m_totals.checksum << 5) | (m_totals.checksum >> 27)) ^ summary.checksum;
+    m_totals.selected = m_totals.selected + summary.selected;
+    m_totals.sum      = m_totals.sum + summary.sum;
+    m_totals.kernelNs = m_totals.kernelNs + kernelNs;
+    Stats::Instance().Add(SC_CONSUMED, static_cast<long>(count));
+}
+
+} // namespace MT
@@ -0,0 +1,138 @@
+#include "stdafx.h"
+#include <cmath>
+#include <algorithm>
+#include "threads.h"
+#include "loadgen.h"
+
+namespace MT {
+
+const char* const arrivalNames[AP_TOTAL] = {
+    "constant", "poisson"
+};
+
+const char* ArrivalName(ArrivalProcess process) {
+    return arrivalNames[process];
+}
+
+bool ParseArrival(const std::string& name, ArrivalProcess& process) {
+    for (int p = 0; p < AP_TOTAL; p++) {
+        if (name == arrivalNames[p]) {
+            process = static_cast<ArrivalProcess>(p);
+            return true;
+        }
+    }
+    return false;
+}
+
+ArrivalSchedule::ArrivalSchedule(ArrivalProcess process, double ratePerSec, unsigned seed) :
+    m_process(process),
+    m_meanGapNs(1e9 / ratePerSec),
+    m_nextNs(0),
+    m_random(seed == 0 ? 1 : seed)
+{
+}
+
+double ArrivalSchedule::Uniform() {
+    // xorshift32 (Marsaglia): the schedule is the same on every run with the same seed
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return (static_cast<double>(m_random) + 1) / 4294967296.0;
+}
+
+double ArrivalSchedule::NextNs() {
+    const double due = m_nextNs;
+    if (m_process == AP_POISSON)
+        m_nextNs += -std::log(Uniform()) * m_meanGapNs; // exponential gap
+    else
+        m_nextNs += m_meanGapNs;
+    return due;
+}
+
+static double Percentile(const std::vector<double>& sorted, double fraction) {
+    size_t i = static_cast<size_t>(sorted.size() * fraction);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+void LoadStepResult::Compute(double rate, const std::vector<double>& intendedNs,
+                             const std::vector<double>& sentNs, const std::vector<double>& doneNs,
+                             double maxP99Us) {
+    targetRate = rate;
+    items      = static_cast<unsigned>(doneNs.size());
+    achievedRate = p50Us = p99Us = p999Us = maxUs = uncorrectedP99Us = 0;
+    sustained  = false;
+    if (items == 0)
+        return;
+
+    std::vector<double> corrected(items), uncorrected(items);
+    double lastNs = 0;
+    for (unsigned i = 0; i < items; i++) {
+        corrected[i]   = (doneNs[i] - intendedNs[i]) / 1000;
+        uncorrected[i] = (doneNs[i] - sentNs[i]) / 1000;
+        lastNs = std::max(lastNs, doneNs[i]);
+    }
+    std::sort(corrected.begin(), corrected.end());
+    std::sort(uncorrected.begin(), uncorrected.end());
+
+    achievedRate     = lastNs > 0 ? items * 1e9 / lastNs : 0;
+    p50Us            = Percentile(corrected, 0.5);
+    p99Us            = Percentile(corrected, 0.99);
+    p999Us           = Percentile(corrected, 0.999);
+    maxUs            = corrected.back();
+    uncorrectedP99Us = Percentile(uncorrected, 0.99);
+    sustained        = achievedRate >= 0.95 * targetRate && p99Us <= maxP99Us;
+}
+
+void LoadStepResult::Print(std::ostream& out) const {
+    out << "  rate " << targetRate << "/s: achieved " << achievedRate << "/s, latency us p50 "
+        << p50Us << " p99 " << p99Us << " p99.9 " << p999Us << " max " << maxUs
+        << " (p99 from the actual send " << uncorrectedP99Us << ")"
+        << (sustained ? "" : " - saturated");
+}
+
+void LatencyHistogram::Reset() {
+    std::fill(m_counts, m_counts + m_buckets, 0ULL);
+    m_total = 0;
+    m_maxNs = 0;
+}
+
+unsigned LatencyHistogram::Bucket(unsigned long long ns) {
+    if (ns < m_sub)
+        return static_cast<unsigned>(ns);
+    unsigned msb = m_subBits;
+    while (msb < m_maxBits && (ns >> (msb + 1)) != 0)
+        msb++;
+    if ((ns >> (msb + 1)) != 0)
+        return m_buckets - 1;
+    // the power of two and the m_subBits bits below the leading one
+    return (msb - m_subBits + 1) * m_sub + static_cast<unsigned>((ns >> (msb - m_subBits)) - m_sub);
+}
+
+unsigned long long LatencyHistogram::Upper(unsigned bucket) {
+    if (bucket < m_sub)
+        return bucket;
+    const unsigned shift = bucket / m_sub - 1;
+    return ((static_cast<unsigned long long>(m_sub + bucket % m_sub) + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(double ns) {
+    const unsigned long long value = ns > 0 ? static_cast<unsigned long long>(ns) : 0;
+    m_counts[Bucket(value)]++;
+    m_total++;
+    m_maxNs = std::max(m_maxNs, ns);
+}
+
+double LatencyHistogram::PercentileUs(double fraction) const {
+    if (m_total == 0)
+        return 0;
+    const unsigned long long rank = std::max(1ULL, static_cast<unsigned long long>(m_total * fraction + 0.5));
+    unsigned long long seen = 0;
+    for (unsigned b = 0; b < m_buckets; b++) {
+        seen += m_counts[b];
+        if (seen >= rank)
+            return std::min(static_cast<double>(Upper(b)), m_maxNs) / 1000;
+    }
+    return MaxUs();
+}
+
+} // namespace MT
@@ -0,0 +1,227 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "threads.h"
+#include "threadrunner.h"
+#include "statspage.h"
+#include "perfcounters.h"
+
+// Linux build of the sample demonstrating synchronisation objects by example of
+// solving producer-consumer problem.
+// ( http://en.wikipedia.org/wiki/Producer-consumer_problem )
+//
+// The objects are native: futex-based critical sections, mutex and events, eventfd
+// semaphore and timerfd SyncTimer (threads.h), threads are pthreads. Runners and
+// thread functions are the same as in the Windows build.
+//
+// Usage: multithreading [-stack <KB>] [-place default|smt|l3|cross-socket|spread]
+//                       [-wait block|spin|yield|backoff|park] [-spins <count>] [-backoff <ms>]
+//                       [-arrival constant|poisson] [-kernel scalar|sse2|avx2]
+//                       [-record <trace>] [-replay <trace> [-speed <x>] [-loop <count>]]
+//                       [-soak <minutes>] [-interval <seconds>] [-statspage] [-counters]
+//        multithreading -convert <log> <trace>
+// With -stack the stack size of the started threads is set (0 - default of the process).
+// With -place producer and consumer threads are pinned by the placement policy (topology.h).
+// With -wait producer and consumer wait for the buffer by the policy (waitstrategy.h):
+// -spins is the number of checks before yielding, backing off or parking, -backoff is
+// the longest sleep of the backoff.
+// With -arrival the open-loop producer sends at equal or at exponential intervals (loadgen.h).
+// With -kernel the batch consumer uses at most the given level (batchkernel.h), by default
+// the best one the processor has.
+// With -record the arrivals of the produced items are written to the workload trace,
+// with -replay the producers take the arrivals from the trace (workload.h), -speed
+// scales its time (10 - ten times faster), -loop plays it again (0 - until the timeout).
+// -convert makes a trace of the log with lines "<timestamp us> [size] [priority]".
+// -soak sets the duration of the soak run, -interval the period of its stats (memstats.h).
+// With -statspage the statistics are published to shared memory for ./statsreader
+// and other scrapers while the runs go (statspage.h).
+// With -counters CPU counters of the threads of each run are reported in total and per
+// consumed item (perfcounters.h).
+//
+// Alexey Voytenko, alexvgml@gmail.com
+
+// value of the option argv[i], i is moved to it; NULL if it is missing
+static const char* OptionValue(int argc, char* argv[], int& i) {
+    if (i + 1 >= argc) {
+        cout << "Missing value of " << argv[i] << endl;
+        return NULL;
+    }
+    return argv[++i];
+}
+
+int main(int argc, char* argv[])
+{
+    srand(static_cast<unsigned int>(time(0))); // init RND generator
+    
+    int ret    = RET_OK;
+    int choice = 0;
+    MT::WaitPolicy waitPolicy = MT::WP_BLOCK;
+    MT::WaitBudget waitBudget;
+    const char* replayFile = NULL;
+    double   replaySpeed = 1;
+    unsigned replayLoops = 1;
+    bool     statsPage   = false;
+    bool     counters    = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string flag(argv[i]);
+        if (flag == "-stack") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                MT::ThreadRunner::m_stackSize = static_cast<size_t>(atol(value)) * 1024;
+        } else if (flag == "-statspage") {
+            statsPage = true;
+        } else if (flag == "-counters") {
+            counters = true;
+        } else if (flag == "-place") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && !MT::ParsePlacement(value, MT::ThreadRunner::m_placement))
+                cout << "Unknown placement " << value << ", threads are not pinned" << endl;
+        } else if (flag == "-wait") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && !MT::ParseWaitPolicy(value, waitPolicy))
+                cout << "Unknown wait policy " << value << ", threads block" << endl;
+        } else if (flag == "-arrival") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && !MT::ParseArrival(value, MT::OpenLoopRunner::m_arrival))
+                cout << "Unknown arrival process " << value << ", arrivals are constant" << endl;
+        } else if (flag == "-kernel") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL &&
+                !MT::ParseKernelLevel(value, MT::ProducerConsumerBatchRunner::m_kernel))
+                cout << "Unknown kernel level " << value << ", the best one is used" << endl;
+        } else if (flag == "-spins") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                waitBudget.spins = static_cast<unsigned>(atoi(value));
+        } else if (flag == "-backoff") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                waitBudget.maxBackoffMs = static_cast<unsigned>(atoi(value));
+        } else if (flag == "-replay") {
+            replayFile = OptionValue(argc, argv, i);
+        } else if (flag == "-speed") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                replaySpeed = atof(value);
+        } else if (flag == "-loop") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                replayLoops = static_cast<unsigned>(atoi(value));
+        } else if (flag == "-soak") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                MT::SoakRunner::m_durationMin = std::max(1, atoi(value));
+        } else if (flag == "-interval") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                MT::SoakRunner::m_intervalSec = std::max(1, atoi(value));
+        } else if (flag == "-record") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && MT::ThreadRunner::m_recorder.Open(value) != RET_OK)
+                cout << "Cannot create trace " << value << ", arrivals are not recorded" << endl;
+        } else if (flag == "-convert") {
+            if (i + 2 >= argc) {
+                cout << "Missing log or trace of -convert" << endl;
+                return ERR_STD;
+            }
+            const char* logFile   = argv[++i];
+            const char* traceFile = argv[++i];
+            unsigned converted = 0, skipped = 0;
+            ret = MT::ConvertWorkloadLog(logFile, traceFile, converted, skipped);
+            if (ret == RET_OK)
+                cout << "Trace " << traceFile << ": " << converted << " items, "
+                     << skipped << " lines skipped" << endl;
+            else
+                cout << "Cannot convert " << logFile << " to " << traceFile << endl;
+            return ret;
+        } else {
+            cout << "Unknown option " << flag << endl;
+        }
+    }
+    if (replayFile != NULL) {
+        if (MT::ThreadRunner::m_replay.Open(replayFile, replaySpeed, replayLoops) == RET_OK)
+            cout << "Replaying " << replayFile << " at " << replaySpeed << "x, loops: "
+                 << replayLoops << " (0 - until the timeout)" << endl;
+        else
+            cout << "Cannot open trace " << replayFile << ", producers imitate work" << endl;
+    }
+    MT::ThreadRunner::m_wait = MT::WaitStrategy(waitPolicy, waitBudget);
+    if (waitPolicy != MT::WP_BLOCK)
+        MT::ThreadRunner::PrintWaitStrategy(cout);
+    if (MT::ThreadRunner::m_placement != MT::PL_DEFAULT)
+        MT::Topology::Instance().Report(cout);
+    MT::StatsPublisher publisher;
+    if (statsPage) {
+        if (publisher.Start() == RET_OK)
+            cout << "Statistics are published to /dev/shm" << MT::StatsPageName(::getpid())
+                 << ", ./statsreader " << ::getpid() << endl;
+        else
+            cout << "Cannot create the stats page" << endl;
+    }
+    const int exitChoice = WORK_STACK + 1; // the last menu item
+
+    // primary thread of the application
+    while (true) {
+
+        cout << "Choose type of synchronisation objects (enter 1-" << exitChoice << "):" << endl << endl
+             << "1. Critical sections (Producer-Consumer)" << endl
+             << "2. Critical sections and events (Producer-Consumer)" << endl
+             << "3. Mutex (Producer-Consumer)" << endl
+             << "4. Semaphore" << endl
+             << "5. Open-loop load at the target rate, rate sweep over all queue types" << endl
+             << "6. Soak: sustained load for -soak minutes, stats every -interval seconds" << endl
+             << "7. Critical sections and events, batch consumer with a vectorised kernel" << endl
+             << "8. Bulk job against the cache: FIFO queue, lock-free LIFO stack, work stealing" << endl
+             << exitChoice << ". Exit" << endl;
+        
+        while ( !(cin >> choice) || !(1 <= choice && choice <= exitChoice) ) {
+            if (cin.eof())
+                return ret;
+            if (cin.fail()) { // not an integer
+                cin.clear();  // clear failbit
+
+                // ignore all input before <Enter>
+                cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            }
+            cout << "Please input an integer from 1 to " << exitChoice << ":" << endl;
+        }
+        if (choice == exitChoice)
+            break;
+
+        // although auto_ptr is deprecated it can be used  here as scoped ptr (not using C++11 yet)
+        std::auto_ptr <MT::ThreadRunner> spTR( 
+                    MT::ThreadRunnerCreator::Create(static_cast<SyncType>(choice)) );
+
+        MT::Stats& stats = MT::Stats::Instance();
+        stats.Reset();
+
+        MT::PerfCounters perf;
+        if (counters)
+            perf.Start();
+
+        publisher.SetRunner(choice);
+        ret = spTR->RunThreads();
+        publisher.SetRunner(0);
+
+        stringstream ss; // all threads are finished
+        stats.Report(ss);
+        if (counters) {
+            perf.Stop();
+            perf.Report(ss, stats.Sum(MT::SC_CONSUMED));
+        }
+        cout << endl << ss.str();
+
+        if (ret!=RET_OK) {
+            if (ret==ERR_SYNC) {
+                cout << endl << "Not all threads finished correctly, exiting." << endl;
+            } else if (ret == ERR_API) {
+                cout << endl << "System call failed, exiting." << endl;
+            } else {
+                cout << endl << "Error ocurred with the code " << ret << ", exiting." << endl;
+            }
+            break;
+        }
+    }
+    if (MT::ThreadRunner::m_recorder.isEnabled() && MT::ThreadRunner::m_recorder.Close() != RET_OK)
+        cout << "Cannot write the recorded trace" << endl;
+    return ret;
+}
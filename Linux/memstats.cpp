@@ -0,0 +1,96 @@
+#include "stdafx.h"
+#include <new>
+#include <algorithm>
+#include <fstream>
+#include "threads.h"
+#include "memstats.h"
+
+namespace {
+
+unsigned long g_allocations    = 0;
+unsigned long g_frees          = 0;
+unsigned long g_allocatedBytes = 0;
+
+void* Allocate(size_t size) {
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p != NULL) {
+        __atomic_fetch_add(&g_allocations, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_allocatedBytes, size, __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+void Free(void* p) {
+    if (p == NULL)
+        return;
+    __atomic_fetch_add(&g_frees, 1, __ATOMIC_RELAXED);
+    free(p);
+}
+
+void* AllocateOrThrow(size_t size) {
+    for (;;) {
+        void* p = Allocate(size);
+        if (p != NULL)
+            return p;
+        std::new_handler handler = std::set_new_handler(NULL); // no getter before C++11
+        std::set_new_handler(handler);
+        if (handler == NULL)
+            throw std::bad_alloc();
+        handler(); // frees memory or throws
+    }
+}
+
+} // namespace
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+    return Allocate(size);
+}
+
+void operator delete(void* p) throw() {
+    Free(p);
+}
+
+void operator delete[](void* p) throw() {
+    Free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() {
+    Free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw() {
+    Free(p);
+}
+
+namespace MT {
+
+bool ReadMemoryCounts(MemoryCounts& counts) {
+    counts.allocations    = __atomic_load_n(&g_allocations, __ATOMIC_RELAXED);
+    counts.frees          = __atomic_load_n(&g_frees, __ATOMIC_RELAXED);
+    counts.allocatedBytes = __atomic_load_n(&g_allocatedBytes, __ATOMIC_RELAXED);
+    counts.residentBytes  = counts.anonymousBytes = 0;
+
+    // pages: size resident shared text lib data dt, shared are the file-backed ones
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0, shared = 0;
+    if (!(statm >> size >> resident >> shared))
+        return false;
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    counts.residentBytes  = resident * page;
+    counts.anonymousBytes = (resident - std::min(shared, resident)) * page;
+    return true;
+}
+
+} // namespace MT
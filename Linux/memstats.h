@@ -0,0 +1,25 @@
+#pragma once
+
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+// Memory of the process for the long runs: resident memory read from /proc and the
+// counts of the interposed counting allocator.
+//
+// Global operator new and delete are replaced (memstats.cpp) to count the allocations,
+// frees and allocated bytes with one relaxed atomic add each. The counters wrap, so
+// they are compared as differences: allocations - frees are the live blocks, a number
+// growing under steady load is a leak.
+struct MemoryCounts {
+    size_t        residentBytes;  // RSS
+    size_t        anonymousBytes; // resident and not backed by a file: heap, stacks
+    unsigned long allocations;
+    unsigned long frees;
+    unsigned long allocatedBytes;
+};
+
+bool ReadMemoryCounts(MemoryCounts& counts); // false if the process memory is not known
+
+} // namespace MT
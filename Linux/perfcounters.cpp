@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include "perfcounters.h"
+
+namespace MT {
+
+const char* const perfCounterNames[PC_TOTAL] = {
+    "cycles", "instructions", "LLC misses", "context switches", "CPU migrations"
+};
+
+const struct {
+    __u32 type;
+    __u64 config;
+} perfEvents[PC_TOTAL] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS }
+};
+
+ThreadCounters::ThreadCounters() {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = perfEvents[i].type;
+        attr.config         = perfEvents[i].config;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled       = 1;
+        attr.exclude_kernel = (attr.type == PERF_TYPE_HARDWARE);
+        attr.exclude_hv     = 1;
+        m_fd[i].SetHandle(static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)));
+        m_error[i] = m_fd[i].isValid() ? 0 : errno;
+    }
+}
+
+void ThreadCounters::Start() {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        if (m_fd[i].isValid()) {
+            ::ioctl(m_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(m_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void ThreadCounters::Stop(long long values[PC_TOTAL]) {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        values[i] = -1;
+        if (!m_fd[i].isValid())
+            continue;
+        ::ioctl(m_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        unsigned long long data[3] = { 0 }; // value, time enabled, time running
+        if (::read(m_fd[i], data, sizeof(data)) != sizeof(data))
+            continue;
+        if (data[2] == 0 || data[2] >= data[1])
+            values[i] = static_cast<long long>(data[0]); // no time at all, or all the time
+        else
+            values[i] = static_cast<long long>(static_cast<double>(data[0]) * data[1] / data[2]);
+    }
+}
+
+PerfCounters* volatile PerfCounters::m_collecting = NULL;
+
+PerfCounters::PerfCounters() : m_threads(0) {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        m_total[i] = 0;
+        m_error[i] = 0;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    Stop();
+}
+
+const char* PerfCounters::Name(PerfCounterId id) {
+    return perfCounterNames[id];
+}
+
+void PerfCounters::Start() {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        m_total[i] = 0;
+        m_error[i] = 0;
+    }
+    m_threads = 0;
+    __atomic_store_n(&m_collecting, this, __ATOMIC_RELEASE);
+}
+
+void PerfCounters::Stop() {
+    PerfCounters* expected = this;
+    __atomic_compare_exchange_n(&m_collecting, &expected, static_cast<PerfCounters*>(NULL),
+                                false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+void PerfCounters::Add(const ThreadCounters& counters, const long long values[PC_TOTAL]) {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        int error = counters.Error(static_cast<PerfCounterId>(i));
+        if (error == 0 && values[i] < 0)
+            error = EIO; // opened but not read
+        if (error != 0) {
+            int none = 0; // the first one is kept
+            __atomic_compare_exchange_n(&m_error[i], &none, error, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_fetch_add(&m_total[i], values[i], __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&m_threads, 1, __ATOMIC_RELEASE);
+}
+
+void PerfCounters::Report(std::ostream& out, unsigned long long items) const {
+    out << "Performance counters of the run, " << m_threads << " threads";
+    if (items > 0)
+        out << ", " << items << " items consumed";
+    out << ":" << endl;
+
+    for (int i = 0; i < PC_TOTAL; i++) {
+        out << "  " << perfCounterNames[i] << ": ";
+        if (m_error[i] == EACCES || m_error[i] == ENOENT) { // not provided by the system
+            out << "n/a" << endl;
+            continue;
+        }
+        if (m_error[i] != 0) {
+            out << "error: " << strerror(m_error[i]) << endl;
+            continue;
+        }
+        out << m_total[i];
+        if (items > 0)
+            out << " (" << static_cast<double>(m_total[i]) / items << " per item)";
+        out << endl;
+    }
+}
+
+PerfCounters::ThreadScope::ThreadScope() :
+    m_owner(__atomic_load_n(&m_collecting, __ATOMIC_ACQUIRE)), m_counters(NULL) {
+    if (m_owner == NULL)
+        return;
+    m_counters = new (std::nothrow) ThreadCounters;
+    if (m_counters != NULL)
+        m_counters->Start();
+}
+
+PerfCounters::ThreadScope::~ThreadScope() {
+    if (m_counters == NULL)
+        return;
+    long long values[PC_TOTAL];
+    m_counters->Stop(values);
+    m_owner->Add(*m_counters, values);
+    delete m_counters;
+}
+
+} // namespace MT
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+enum PerfCounterId {
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_CONTEXT_SWITCHES,
+    PC_MIGRATIONS,
+    PC_TOTAL
+};
+
+// Counters of the calling thread only (perf_event_open(2) with pid 0 and inherit off),
+// opened disabled. Cycles, instructions and cache misses are counted in user mode,
+// which kernel.perf_event_paranoid 2 still allows, context switches and migrations
+// happen in the kernel and are counted there.
+// Counts are scaled by the time the counter was on the PMU when the kernel multiplexes.
+// see: http://man7.org/linux/man-pages/man2/perf_event_open.2.html
+class ThreadCounters {
+public:
+    ThreadCounters();
+
+    // errno of perf_event_open, 0 if the counter is open
+    int Error(PerfCounterId id) const {
+        return m_error[id];
+    }
+
+    void Start();
+    void Stop(long long values[PC_TOTAL]); // -1 if not counted
+
+private:
+    ThreadCounters(const ThreadCounters&);
+    ThreadCounters& operator=(const ThreadCounters&);
+
+    HandleWrapper m_fd[PC_TOTAL];
+    int           m_error[PC_TOTAL];
+};
+
+// Counters of the threads started by StartThread() between Start() and Stop() (the
+// producers and consumers of a run), each thread counts itself and adds its counts
+// when it exits. A counter the system does not provide (EACCES: not allowed by
+// kernel.perf_event_paranoid, ENOENT: no such event, as in most virtual machines)
+// is reported as n/a instead of failing the run, other errors are reported as such.
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    static const char* Name(PerfCounterId id);
+
+    void Start();
+    void Stop(); // after the threads are joined
+
+    long long Total(PerfCounterId id) const { // -1 if not counted
+        return m_error[id] == 0 ? m_total[id] : -1;
+    }
+    // totals and counts per item (if items were counted)
+    void Report(std::ostream& out, unsigned long long items) const;
+
+    // Counts the calling thread for the collecting instance if there is one
+    class ThreadScope {
+    public:
+        ThreadScope();
+        ~ThreadScope();
+    private:
+        ThreadScope(const ThreadScope&);
+        ThreadScope& operator=(const ThreadScope&);
+
+        PerfCounters*   m_owner;
+        ThreadCounters* m_counters;
+    };
+
+private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    void Add(const ThreadCounters& counters, const long long values[PC_TOTAL]);
+
+    static PerfCounters* volatile m_collecting; // at most one at a time
+
+    // added by the exiting threads without a lock
+    long long m_total[PC_TOTAL];
+    int       m_error[PC_TOTAL]; // the first error of the threads
+    unsigned  m_threads;         // counted
+};
+
+} // namespace MT
@@ -0,0 +1,289 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::Queue<int> g_msgs;
+extern MT::CriticalSection g_cs;
+extern MT::Event g_emptyEvent, g_fullEvent, g_emptyMutEvent, g_fullMutEvent;
+extern MT::Mutex g_mutex;
+
+const char FULL_BUFFER[]      = "Producer: full buffer, waiting";
+const char PRODUCER_WAKE_UP[] = "Producer: waking up";
+const char TASKS_FINISHED[]   = "Producer: tasks finished, exiting.";
+
+namespace MT {
+
+// Just locking shared data structure with Critical Sections
+unsigned ProducerConsumerCSRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+        const int fullBufferWait = 300; // 0.3 sec
+
+        bool isFull = false;
+        do {
+            {   // all access to shared writable memory should be protected by exclusive lock
+                Lock lock(g_cs);    // acquire lock
+                isFull = g_msgs.isFull();
+            } // release lock
+            if (isFull) {
+                Print(FULL_BUFFER);   // buffer is full -
+                stats.Add(SC_WAITS);
+                m_wait.Wait(SlotReady(g_msgs, g_cs), NULL, fullBufferWait); // wait for consumer
+            }
+        } while ( (tState = syncTimer.State())==ST_WORK && isFull ) ; // check timeout waiting for free buffer
+
+        if (tState != ST_WORK) { // check timeout
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        {
+            Lock lock(g_cs);
+            try {
+                g_msgs.push(nTask);
+                SampleDepth();
+
+            } catch(std::exception& ex) { // in case of uncaught exception Lock desctructor
+                Print(ex.what());         // will release the lock
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error");
+                return ERR_UNKNOWN;
+            }
+        }
+        stats.Add(SC_PRODUCED);
+        Record(item);
+        Print("sent: ", nTask);
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Using Events for synchronisation
+unsigned ProducerConsumerEventRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+
+        const int fullBufferTimeout = 5000; // 5 sec
+        bool isFull = true;
+        while ( (tState = syncTimer.State())==ST_WORK && isFull) { // check timeout waiting for free buffer
+            {
+                Lock lock(g_cs);
+                isFull = g_msgs.isFull();
+                if (isFull) {
+                    Print(FULL_BUFFER);
+                    g_emptyEvent.Reset(); // under the lock: a slot freed after the check sets it again
+                }
+            } // release lock
+
+            if (isFull) { // buffer is full, wait event from consumer
+                stats.Add(SC_WAITS);
+                const WaitResult result = m_wait.Wait(SlotReady(g_msgs, g_cs), &g_emptyEvent, fullBufferTimeout);
+                if (result == WR_FAILED)
+                    return ERR_SYNC;
+                if (result == WR_TIMEOUT) {
+                    stats.Add(SC_TIMEOUTS);
+                    continue; // buffer is still full, check global timer
+                }
+
+                // event signalled, buffer is free
+                Print(PRODUCER_WAKE_UP);
+                isFull = false;
+            }
+        } // while
+
+        if (tState != ST_WORK) {
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        {
+            Lock lock(g_cs);
+            try {
+                g_msgs.push(nTask);
+                SampleDepth();
+
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error");
+                return ERR_UNKNOWN;
+            }
+            stats.Add(SC_PRODUCED);
+            Record(item);
+            Print("sent: ", nTask);
+            g_fullEvent.Set();
+        }
+
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Using mutex for synchronisation
+unsigned ProducerConsumerMutexRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer  = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+        const int fullBufferTimeout = 5000; // 5 sec
+
+        bool isFull = true;
+        while ( (tState = syncTimer.State())==ST_WORK && isFull) { // check timeout waiting for free buffer
+
+            Produce(); // imitate work, exception safe
+
+            g_mutex.Enter();
+
+            // now we own the mutex
+            isFull = g_msgs.isFull();
+            if (isFull) {  // buffer is full, wait event from consumer
+
+                // under the mutex: a pop after the check is counted
+                const long seen = __atomic_load_n(&m_emptySignals, __ATOMIC_RELAXED);
+                Print(FULL_BUFFER);
+                g_emptyMutEvent.Reset();
+                g_mutex.Leave();
+
+                stats.Add(SC_WAITS);
+                const WaitResult result = m_wait.Wait(SignalReady(m_emptySignals, seen, false), &g_emptyMutEvent,
+                                                      fullBufferTimeout);
+                if (result == WR_FAILED)
+                    return ERR_SYNC;
+                if (result == WR_TIMEOUT) {
+                    stats.Add(SC_TIMEOUTS);
+                    continue; // buffer is still full, check global timer
+                }
+
+                // event signalled, buffer is free
+                Print(PRODUCER_WAKE_UP);
+                isFull = true; // take the mutex again and check
+            }
+        } // while
+
+        if (tState != ST_WORK) {
+            if (!isFull)
+                g_mutex.Leave();
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        // now we own the mutex
+
+        try {
+            g_msgs.push(nTask);
+            SampleDepth();
+        
+        } catch(std::exception& ex) { // should catch all exception in the thread to avoid indefinite locks
+            Print( ex.what());        // by not releasing mutex
+            g_mutex.Leave();
+            return ERR_STD;
+        } catch(...) {  
+            Print("Unknown error");
+            g_mutex.Leave();
+            return ERR_UNKNOWN;
+        }
+
+        stats.Add(SC_PRODUCED);
+        Record(item);
+        Print("sent: ", nTask);
+        g_mutex.Leave();
+        Signal(g_fullMutEvent, m_fullSignals);
+
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Sends the items on the schedule: an item is due at its intended time even if the
+// queue was full when the previous one was sent, so a blocked producer sends the overdue
+// items at once and the queueing delay shows in the latency of the consumer
+unsigned OpenLoopRunner::Producer(void* args) {
+
+    StepArgs& a = *static_cast<StepArgs*>(args);
+    ArrivalSchedule schedule(m_arrival, a.rate);
+    const unsigned items = static_cast<unsigned>(a.intendedNs.size());
+
+    for (unsigned i = 0; i < items; i++) {
+        const double due = schedule.NextNs();
+        double now = a.clock->ElapsedNs();
+        while (now < due) { // the sleep may oversleep the short gaps: spin
+            if (due - now > m_sleepAheadMs * 1e6)
+                ::usleep(1000);
+            else
+                CpuRelax();
+            now = a.clock->ElapsedNs();
+        }
+        a.intendedNs[i] = due;
+        a.sentNs[i]     = now;
+
+        Task task;
+        task.request = static_cast<int>(i);
+        if (!m_queue.Push(task, m_queueTimeout))
+            return ERR_SYNC;
+    }
+
+    Task stop;
+    stop.request = -1;
+    return m_queue.Push(stop, m_queueTimeout) ? RET_OK : ERR_SYNC;
+}
+
+// Keeps the queue busy until the end of the run, the send time of each item is kept
+// in the ring by the index the item carries
+unsigned SoakRunner::Producer(void*) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    unsigned item = 0;
+    while (syncTimer.State() == ST_WORK) {
+        Task task;
+        task.request = static_cast<int>(item % m_stampRing);
+        m_sentNs[task.request] = m_clock.ElapsedNs(); // published to the consumer by the queue lock
+        if (!m_queue.Push(task, m_queueTimeout))
+            continue; // full for the whole timeout: check the end of the run
+        m_produced = m_produced + 1; // the only writer
+        item++;
+    }
+    if (syncTimer.State() == ST_ERR)
+        return ERR_SYNC;
+
+    Task stop;
+    stop.request = -1;
+    return m_queue.Push(stop, m_stopTimeout) ? RET_OK : ERR_SYNC;
+}
+
+} // namespace MT
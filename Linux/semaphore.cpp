@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::Semaphore g_semaphore;
+
+namespace MT {
+
+unsigned SemaphoreRunner::SemaphoreThreadFunction(void* args) {
+
+    const long semInitCount = *static_cast<const long*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    Stats& stats = Stats::Instance(); // counters are reset by the primary thread for each run
+    const int threadNum   = stats.ThreadNumber(); // short order number to increase readability
+    SyncTimerState tState = ST_WORK;
+    const unsigned semWaitTimeout = 100; // ms, to check the global timer
+
+    while ( (tState = syncTimer.State())==ST_WORK ) {
+
+        // checking the semaphore counter to know if it is allowed to work
+        WaitResult result = g_semaphore.TryWait();
+        if (result == WR_TIMEOUT) { // no permit: waiting for a release
+            stats.Add(SC_WAITS);
+            result = g_semaphore.Wait(semWaitTimeout);
+        }
+
+        if (result == WR_FAILED)
+            return ERR_SYNC;
+
+        if (result == WR_OK) { // semaphore counter was decremented
+            stats.Add(SC_PERMITS_HELD);
+            {
+                stringstream ss; // counter is summed over the threads
+                ss << "Thread " << threadNum << ": starting to work, counter: "
+                   << semInitCount - stats.Sum(SC_PERMITS_HELD);
+                Print(ss.str().c_str());
+            }
+
+            const int  produceFactor = rand()%2000; // up to 2 sec
+            Produce(produceFactor); // produce some work
+            stats.Add(SC_PERMITS_HELD, -1);
+            {
+                stringstream ss;
+                ss << "Thread " << threadNum << ": releasing, counter: "
+                   << semInitCount - stats.Sum(SC_PERMITS_HELD);
+                Print(ss.str().c_str());
+            }
+
+            if (!g_semaphore.Release()) // increase count by one
+                return ERR_SYNC;
+
+        } else { // WR_TIMEOUT - counter stayed 0 during the timed wait
+            stats.Add(SC_TIMEOUTS);
+        }
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    stringstream ss;
+    ss << TIMEOUT    << syncTimer.GetTimeoutInsSec() << ". Thread N "
+       <<  threadNum << ", thread Id: " << CurrentThreadId() << endl;
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+} // namespace MT
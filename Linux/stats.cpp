@@ -0,0 +1,95 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "threads.h"
+#include "stats.h"
+
+namespace MT {
+
+Stats Stats::m_instance;
+
+__thread Stats::Slot* Stats::m_tlsSlot       = NULL;
+__thread long         Stats::m_tlsGeneration = 0;
+
+const char* const statsCounterNames[SC_TOTAL] = {
+    "produced", "consumed", "waits", "timeouts", "contended", "permits held"
+};
+
+const char* StatsCounterName(StatsCounter counter) {
+    return statsCounterNames[counter];
+}
+
+Stats::Stats() : m_slots(m_maxThreads + 1), m_generation(0), m_registered(0), m_queueDepth(-1) {
+    Reset();
+}
+
+void Stats::Reset() {
+    if (!m_slots.isValid())
+        return;
+
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        memset(const_cast<long*>(m_slots[i].values), 0, sizeof(m_slots[i].values));
+        m_slots[i].shared = 0;
+        m_slots[i].number = 0;
+    }
+    Slot& overflow  = m_slots[m_maxThreads];
+    overflow.shared = 1;
+    overflow.number = m_maxThreads + 1;
+
+    m_registered = 0;
+    m_queueDepth = -1;
+    __atomic_add_fetch(&m_generation, 1, __ATOMIC_SEQ_CST); // slots in TLS of all threads are obsolete
+}
+
+Stats::Slot* Stats::Register() {
+    const long generation = m_generation;
+    const long number = __atomic_add_fetch(&m_registered, 1, __ATOMIC_SEQ_CST);
+
+    Slot* slot = &m_slots[m_maxThreads];
+    if (number <= static_cast<long>(m_maxThreads)) {
+        slot = &m_slots[number - 1];
+        slot->number = number;
+    }
+
+    m_tlsSlot       = slot;
+    m_tlsGeneration = generation;
+    return slot;
+}
+
+long Stats::Sum(StatsCounter counter) const {
+    long sum = 0;
+    for (size_t i = 0; i < m_slots.size(); i++)
+        sum += m_slots[i].values[counter];
+    return sum;
+}
+
+void Stats::Snapshot(StatsSnapshot& snapshot) const {
+    memset(snapshot.values, 0, sizeof(snapshot.values));
+    for (size_t i = 0; i < m_slots.size(); i++) { // one pass: slots are read close in time
+        for (int c = 0; c < SC_TOTAL; c++)
+            snapshot.values[c] += m_slots[i].values[c];
+    }
+    const long registered = m_registered;
+    snapshot.threads = static_cast<unsigned>(registered);
+}
+
+unsigned Stats::ThreadSnapshots(ThreadStatsSnapshot* threads, unsigned maxThreads) const {
+    const long registered = m_registered;
+    const unsigned count = std::min(std::min(static_cast<unsigned>(registered), m_maxThreads), maxThreads);
+    for (unsigned i = 0; i < count; i++) {
+        threads[i].number = m_slots[i].number;
+        for (int c = 0; c < SC_TOTAL; c++)
+            threads[i].values[c] = m_slots[i].values[c];
+    }
+    return count;
+}
+
+void Stats::Report(std::ostream& out) const {
+    StatsSnapshot s;
+    Snapshot(s);
+    out << "Statistics of " << s.threads << " threads:";
+    for (int c = 0; c < SC_TOTAL; c++)
+        out << (c == 0 ? " " : ", ") << statsCounterNames[c] << " " << s.values[c];
+    out << endl;
+}
+
+} // namespace MT
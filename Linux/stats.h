@@ -0,0 +1,107 @@
+#pragma once
+
+#include <ostream>
+#include "allocation.h"
+
+namespace MT {
+
+enum StatsCounter {
+    SC_PRODUCED,
+    SC_CONSUMED,
+    SC_WAITS,        // waits for a free slot, an item or a permit
+    SC_TIMEOUTS,     // waits which timed out
+    SC_CONTENDED,    // lock acquisitions which found the lock owned
+    SC_PERMITS_HELD, // incremented on acquire and decremented on release
+    SC_TOTAL
+};
+
+const char* StatsCounterName(StatsCounter counter); // as in the report
+
+struct StatsSnapshot {
+    long     values[SC_TOTAL];
+    unsigned threads;
+};
+
+struct ThreadStatsSnapshot {
+    unsigned number; // as ThreadNumber()
+    long     values[SC_TOTAL];
+};
+
+// Statistics of the runners kept in per-thread counter slots and summed on read.
+//
+// Each thread finds its slot through thread local storage, the slot has the single
+// writer and its own cache line, so counting is a plain store: no lock, no atomic
+// read-modify-write and no false sharing. A slot is taken with one atomic increment
+// when the thread counts for the first time. Threads beyond the number of slots share
+// the overflow slot and count with atomic additions.
+//
+// Counters are read without stopping the writers: every counter is read atomically,
+// but counters of one snapshot may be apart by the updates done while it is taken.
+class Stats {
+public:
+    static const unsigned m_maxThreads = 64;
+
+    static Stats& Instance() {
+        return m_instance;
+    }
+
+    void Reset(); // counting threads must not be running
+
+    void Add(StatsCounter counter, long value = 1) {
+        Slot* slot = GetSlot();
+        if (slot->shared)
+            __atomic_fetch_add(&slot->values[counter], value, __ATOMIC_RELAXED);
+        else
+            slot->values[counter] += value; // the only writer
+    }
+
+    // depth of the queue of the running mode: a gauge, not a counter, stored by its threads
+    // right after they push or pop under the lock of the queue, -1 if the mode does not
+    void SetQueueDepth(long depth) {
+        __atomic_store_n(&m_queueDepth, depth, __ATOMIC_RELAXED);
+    }
+    long QueueDepth() const {
+        return __atomic_load_n(&m_queueDepth, __ATOMIC_RELAXED);
+    }
+
+    // short number of the calling thread (from 1) to increase readability of the output
+    unsigned ThreadNumber() {
+        return GetSlot()->number;
+    }
+
+    long Sum(StatsCounter counter) const;
+    void Snapshot(StatsSnapshot& snapshot) const;
+    // counters of the threads which took their own slot, returns the number copied
+    unsigned ThreadSnapshots(ThreadStatsSnapshot* threads, unsigned maxThreads) const;
+    void Report(std::ostream& out) const;
+
+private:
+    Stats();
+    Stats(const Stats&);
+    Stats& operator=(const Stats&);
+
+    struct MT_CACHE_ALIGN Slot {
+        volatile long values[SC_TOTAL];
+        long          shared;  // overflow slot
+        unsigned      number;
+    };
+
+    static Stats m_instance;
+
+    static __thread Slot* m_tlsSlot;       // of the thread
+    static __thread long  m_tlsGeneration; // Reset() number the slot belongs to
+
+    Slot* GetSlot() { // of the calling thread
+        if (m_tlsGeneration == m_generation)
+            return m_tlsSlot;
+        return Register();
+    }
+    Slot* Register();
+
+    AlignedArray<Slot> m_slots;         // m_maxThreads and the overflow slot
+    volatile long      m_generation;    // from 1: TLS of a new thread is zeroed
+    volatile long      m_registered;    // threads which took a slot
+    volatile long      m_queueDepth;
+};
+
+} // namespace MT
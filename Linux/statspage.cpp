@@ -0,0 +1,164 @@
+#include "stdafx.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "threads.h"
+#include "statspage.h"
+
+namespace MT {
+
+const unsigned STATS_PAGE_MAGIC   = 0x5453544D; // "MTST"
+const unsigned STATS_PAGE_VERSION = 1;
+
+std::string StatsPageName(unsigned processId) {
+    stringstream ss;
+    ss << "/MTStats." << processId;
+    return ss.str();
+}
+
+int StatsPageWriter::Create() {
+    Close();
+    const unsigned processId = static_cast<unsigned>(::getpid());
+    const std::string name = StatsPageName(processId);
+    HandleWrapper fd( ::shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644) );
+    if (!fd.isValid())
+        return ERR_API;
+    m_name = name;
+    if (::ftruncate(fd, sizeof(StatsPage)) != 0) { // zero-filled: no data and an even sequence
+        Close();
+        return ERR_API;
+    }
+    void* page = ::mmap(NULL, sizeof(StatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        Close();
+        return ERR_API;
+    }
+    m_page = static_cast<StatsPage*>(page);
+    m_page->version   = STATS_PAGE_VERSION;
+    m_page->processId = processId;
+    __atomic_store_n(&m_page->magic, STATS_PAGE_MAGIC, __ATOMIC_RELEASE); // last
+    return RET_OK;
+}
+
+void StatsPageWriter::Close() {
+    if (m_page != NULL) {
+        ::munmap(m_page, sizeof(StatsPage));
+        m_page = NULL;
+    }
+    if (!m_name.empty()) { // attached readers keep their mapping
+        ::shm_unlink(m_name.c_str());
+        m_name.clear();
+    }
+}
+
+void StatsPageWriter::Publish(const StatsPageData& data) {
+    if (m_page == NULL)
+        return;
+    const unsigned sequence = m_page->sequence; // the only writer
+    __atomic_store_n(&m_page->sequence, sequence + 1, __ATOMIC_RELAXED); // odd: readers retry
+    __atomic_thread_fence(__ATOMIC_RELEASE); // the odd sequence is seen before the data
+    memcpy(&m_page->data, &data, sizeof(data));
+    __atomic_store_n(&m_page->sequence, sequence + 2, __ATOMIC_RELEASE); // even: consistent
+}
+
+int StatsPageReader::Open(unsigned processId) {
+    Close();
+    HandleWrapper fd( ::shm_open(StatsPageName(processId).c_str(), O_RDONLY | O_CLOEXEC, 0) );
+    if (!fd.isValid())
+        return ERR_API;
+    void* page = ::mmap(NULL, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED)
+        return ERR_API;
+    m_page = static_cast<const StatsPage*>(page);
+    if (__atomic_load_n(&m_page->magic, __ATOMIC_ACQUIRE) != STATS_PAGE_MAGIC ||
+        m_page->version != STATS_PAGE_VERSION) {
+        Close();
+        return ERR_STD;
+    }
+    return RET_OK;
+}
+
+void StatsPageReader::Close() {
+    if (m_page != NULL) {
+        ::munmap(const_cast<StatsPage*>(m_page), sizeof(StatsPage));
+        m_page = NULL;
+    }
+}
+
+bool StatsPageReader::Read(StatsPageData& data) const {
+    if (m_page == NULL)
+        return false;
+    for (unsigned i = 0; i < m_maxRetries; i++) {
+        const unsigned before = __atomic_load_n(&m_page->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) { // being written
+            ::sched_yield();
+            continue;
+        }
+        memcpy(&data, const_cast<const StatsPageData*>(&m_page->data), sizeof(data));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // the data is read before the sequence is checked
+        if (__atomic_load_n(&m_page->sequence, __ATOMIC_RELAXED) == before)
+            return true;
+    }
+    return false;
+}
+
+int StatsPublisher::Start() {
+    if (isRunning())
+        return RET_OK;
+    int ret = m_writer.Create();
+    if (ret != RET_OK)
+        return ret;
+
+    m_stop.Reset();
+    m_clock.Start();
+    Publish(); // the page is valid before the first period
+    if (!StartThread(&PublisherThread, this, 0, m_thread)) {
+        m_writer.Close();
+        return ERR_API;
+    }
+    m_running = true;
+    return RET_OK;
+}
+
+void StatsPublisher::Stop() {
+    if (!isRunning())
+        return;
+    m_stop.Set();
+    unsigned code = RET_OK;
+    JoinThread(m_thread, code);
+    m_running = false;
+    m_writer.Close();
+}
+
+unsigned StatsPublisher::PublisherThread(void* args) {
+    StatsPublisher* publisher = static_cast<StatsPublisher*>(args);
+    WaitResult result = WR_TIMEOUT;
+    while ((result = publisher->m_stop.Wait(m_periodMs)) == WR_TIMEOUT)
+        publisher->Publish();
+    return result == WR_OK ? RET_OK : ERR_SYNC;
+}
+
+// Counters are read from the slots of the threads without stopping them (Stats::Snapshot)
+void StatsPublisher::Publish() {
+    Stats& stats = Stats::Instance();
+    StatsSnapshot snapshot;
+    stats.Snapshot(snapshot);
+    ThreadStatsSnapshot threads[StatsPageData::m_maxThreads];
+    const unsigned count = stats.ThreadSnapshots(threads, StatsPageData::m_maxThreads);
+
+    StatsPageData data;
+    memset(&data, 0, sizeof(data));
+    data.timeUs  = static_cast<unsigned long long>(m_clock.ElapsedNs() / 1000);
+    data.runner  = m_runner;
+    data.threads = snapshot.threads;
+    for (int c = 0; c < SC_TOTAL; c++)
+        data.values[c] = snapshot.values[c];
+    data.queueDepth = stats.QueueDepth(); // sampled by the runner under the lock of its queue
+    for (unsigned i = 0; i < count; i++) {
+        data.thread[i].number = threads[i].number;
+        for (int c = 0; c < SC_TOTAL; c++)
+            data.thread[i].values[c] = threads[i].values[c];
+    }
+    m_writer.Publish(data);
+}
+
+} // namespace MT
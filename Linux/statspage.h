@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include "threads.h"
+
+namespace MT {
+
+// Live statistics of a running process in a small shared memory segment.
+//
+// The publisher thread of the process copies the Stats counters into the page every
+// period, the producer and consumer threads do not touch it: they keep counting in
+// their own slots (stats.h). The page has the single writer and is guarded by a seqlock:
+// the writer makes the sequence odd, writes and makes it even, the readers retry if it
+// was odd or changed while they copied, so the writer never waits for the readers.
+//
+// Segment: /dev/shm/MTStats.<process id>, opened by ./statsreader or any scraper.
+struct StatsPageThread {
+    unsigned  number; // as Stats::ThreadNumber()
+    unsigned  reserved;
+    long long values[SC_TOTAL];
+};
+
+struct StatsPageData {
+    static const unsigned m_maxThreads = 16;
+
+    unsigned long long timeUs;          // of the publication, from the start of the publisher
+    unsigned           runner;          // menu item of the running mode, 0 - none
+    unsigned           threads;         // counting threads, the first m_maxThreads are in thread[]
+    long long          values[SC_TOTAL];
+    long long          queueDepth;      // items in the queue of the running mode, -1 - not sampled
+    StatsPageThread    thread[m_maxThreads];
+};
+
+struct StatsPage {
+    unsigned          magic;
+    unsigned          version;
+    unsigned          processId;
+    volatile unsigned sequence; // odd while the data is written
+    StatsPageData     data;
+};
+
+std::string StatsPageName(unsigned processId); // of shm_open()
+
+class StatsPageWriter {
+public:
+    StatsPageWriter() : m_page(NULL) {
+    }
+    ~StatsPageWriter() {
+        Close();
+    }
+
+    int  Create();
+    void Close();
+    void Publish(const StatsPageData& data);
+
+    bool isValid() const {
+        return m_page != NULL;
+    }
+
+private:
+    StatsPageWriter(const StatsPageWriter&);
+    StatsPageWriter& operator=(const StatsPageWriter&);
+
+    std::string m_name; // unlinked by Close()
+    StatsPage*  m_page;
+};
+
+class StatsPageReader {
+public:
+    static const unsigned m_maxRetries = 1000; // the writer is preempted in the middle
+
+    StatsPageReader() : m_page(NULL) {
+    }
+    ~StatsPageReader() {
+        Close();
+    }
+
+    int  Open(unsigned processId);
+    void Close();
+    bool Read(StatsPageData& data) const; // false if no consistent copy was taken
+
+private:
+    StatsPageReader(const StatsPageReader&);
+    StatsPageReader& operator=(const StatsPageReader&);
+
+    const StatsPage* m_page;
+};
+
+// Thread publishing the Stats of the process to the page every period
+class StatsPublisher {
+public:
+    static const unsigned m_periodMs = 100;
+
+    StatsPublisher() : m_stop(true), m_running(false), m_runner(0) {
+    }
+    ~StatsPublisher() {
+        Stop();
+    }
+
+    int  Start();
+    void Stop();
+
+    bool isRunning() const {
+        return m_running;
+    }
+    void SetRunner(unsigned runner) { // menu item of the running mode
+        m_runner = runner;
+    }
+
+private:
+    StatsPublisher(const StatsPublisher&);
+    StatsPublisher& operator=(const StatsPublisher&);
+
+    static THREAD_FUNCTION PublisherThread;
+    void Publish();
+
+    StatsPageWriter   m_writer;
+    Event             m_stop;    // manual-reset
+    pthread_t         m_thread;
+    bool              m_running;
+    Stopwatch         m_clock;
+    volatile unsigned m_runner;
+};
+
+} // namespace MT
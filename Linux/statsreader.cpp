@@ -0,0 +1,99 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include "threads.h"
+#include "statspage.h"
+
+// Live statistics of a running multithreading started with -statspage.
+//
+// The reader attaches to the stats page of the process (statspage.h) and prints the
+// rates of the counters over each period, the gauges and the state of each thread,
+// until the process exits. It only reads the page: the process is not slowed down.
+//
+// Usage: statsreader <process id> [period ms]
+
+namespace {
+
+const unsigned defPeriodMs = 1000;
+
+void PrintRates(std::ostream& out, const long long* from, const long long* to, double seconds) {
+    for (int c = 0; c < MT::SC_TOTAL; c++) {
+        out << (c == 0 ? " " : ", ") << MT::StatsCounterName(static_cast<MT::StatsCounter>(c)) << " ";
+        if (c == MT::SC_PERMITS_HELD) // gauge
+            out << to[c];
+        else // counters start from 0 with each run
+            out << static_cast<long long>(std::max(0LL, to[c] - from[c]) / seconds) << "/s";
+    }
+}
+
+void Print(const MT::StatsPageData& prev, const MT::StatsPageData& now) {
+    const double seconds = (now.timeUs - prev.timeUs) / 1e6;
+    if (seconds <= 0)
+        return;
+
+    stringstream ss;
+    ss << now.timeUs / 1000000 << " s, ";
+    if (now.runner == 0)
+        ss << "no run";
+    else
+        ss << "mode " << now.runner;
+    ss << ", threads " << now.threads << ", queue ";
+    if (now.queueDepth < 0)
+        ss << "n/a";
+    else
+        ss << now.queueDepth;
+    ss << ":";
+    PrintRates(ss, prev.values, now.values, seconds);
+    ss << endl;
+
+    const unsigned threads = std::min(now.threads, MT::StatsPageData::m_maxThreads);
+    for (unsigned i = 0; i < threads; i++) {
+        const MT::StatsPageThread& to   = now.thread[i];
+        const MT::StatsPageThread& from = prev.thread[i];
+        bool active = false; // counted anything over the period
+        for (int c = 0; c < MT::SC_TOTAL; c++)
+            active = active || to.values[c] != from.values[c];
+        ss << "  thread " << to.number << (active ? " active:" : " idle:  ");
+        PrintRates(ss, from.values, to.values, seconds);
+        ss << endl;
+    }
+    cout << ss.str() << std::flush; // piped to a log
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        cout << "Usage: statsreader <process id> [period ms]" << endl;
+        return ERR_STD;
+    }
+    const pid_t    processId = static_cast<pid_t>(strtoul(argv[1], NULL, 10));
+    const unsigned periodMs  = argc > 2 ? std::max(1, atoi(argv[2])) : defPeriodMs;
+
+    MT::StatsPageReader reader;
+    int ret = reader.Open(processId);
+    if (ret != RET_OK) {
+        cout << "Cannot attach to the stats page of the process " << processId
+             << ", is it started with -statspage?" << endl;
+        return ret;
+    }
+
+    MT::StatsPageData prev, now;
+    if (!reader.Read(prev)) {
+        cout << "The stats page is not consistent" << endl;
+        return ERR_SYNC;
+    }
+    for (;;) {
+        ::usleep(periodMs * 1000);
+        if (::kill(processId, 0) != 0 && errno == ESRCH)
+            break; // exited, the segment is unlinked by it
+        if (!reader.Read(now))
+            continue; // the writer was preempted in the middle of the update, next period
+        Print(prev, now);
+        prev = now;
+    }
+    cout << "The process " << processId << " has exited" << endl;
+    return RET_OK;
+}
@@ -0,0 +1,23 @@
+// stdafx.h : standard system include files and project specific include files
+// that are used frequently, but are changed infrequently (Linux build)
+//
+
+#pragma once
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <memory>
+
+using std::cout;
+using std::cin;
+using std::endl;
+using std::stringstream;
@@ -0,0 +1,118 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "taskqueue.h"
+
+namespace MT {
+
+TaskQueue::TaskQueue(unsigned capacity) : m_syncType(CS), m_tasks(capacity), m_head(0), m_count(0) {
+}
+
+int TaskQueue::Init(SyncType syncType) {
+    m_syncType = syncType;
+    m_head     = 0;
+    m_count    = 0;
+
+    switch (syncType) {
+        case CS:
+            return RET_OK;
+        case CS_EVENT:
+        case MUTEX:
+            m_notEmpty.Reset();
+            m_notFull.Reset();
+            return RET_OK;
+        case SEMAPHORE:
+            if (!m_items.Init(0) || !m_slots.Init(static_cast<unsigned>(m_tasks.size())))
+                return ERR_API;
+            return RET_OK;
+        default:
+            return ERR_SYNC; // the queue is in memory only
+    }
+}
+
+// waits for the state change of the queue, false if the timeout expired
+bool TaskQueue::WaitFor(Event& event, unsigned timeoutMs, const Stopwatch& sw) {
+    unsigned elapsed = static_cast<unsigned>(sw.ElapsedNs() / 1000000);
+    if (timeoutMs != INFINITE && elapsed >= timeoutMs)
+        return false;
+
+    if (m_syncType == CS) { // polling
+        ::sched_yield();
+        return true;
+    }
+    unsigned slice = m_waitSlice;
+    if (timeoutMs != INFINITE && timeoutMs - elapsed < slice)
+        slice = timeoutMs - elapsed;
+    return event.Wait(slice) != WR_FAILED;
+}
+
+bool TaskQueue::Push(const Task& task, unsigned timeoutMs) {
+    const unsigned capacity = static_cast<unsigned>(m_tasks.size());
+
+    if (m_syncType == SEMAPHORE) { // the slot is reserved, queue cannot be full
+        if (m_slots.Wait(timeoutMs) != WR_OK)
+            return false;
+        {
+            Lock lock(m_cs);
+            m_tasks[(m_head + m_count++) % capacity] = task;
+        }
+        return m_items.Release();
+    }
+
+    Stopwatch sw;
+    for (;;) {
+        bool pushed = false;
+        {
+            Lock lock(Guard());
+            if (m_count < capacity) {
+                m_tasks[(m_head + m_count++) % capacity] = task;
+                pushed = true;
+            }
+        }
+        if (pushed) {
+            if (m_syncType != CS)
+                m_notEmpty.Set();
+            return true;
+        }
+        if (!WaitFor(m_notFull, timeoutMs, sw))
+            return false;
+    }
+}
+
+bool TaskQueue::Pop(Task& task, unsigned timeoutMs) {
+    const unsigned capacity = static_cast<unsigned>(m_tasks.size());
+
+    if (m_syncType == SEMAPHORE) {
+        if (m_items.Wait(timeoutMs) != WR_OK)
+            return false;
+        {
+            Lock lock(m_cs);
+            task = m_tasks[m_head];
+            m_head = (m_head + 1) % capacity;
+            m_count--;
+        }
+        return m_slots.Release();
+    }
+
+    Stopwatch sw;
+    for (;;) {
+        bool popped = false;
+        {
+            Lock lock(Guard());
+            if (m_count > 0) {
+                task = m_tasks[m_head];
+                m_head = (m_head + 1) % capacity;
+                m_count--;
+                popped = true;
+            }
+        }
+        if (popped) {
+            if (m_syncType != CS)
+                m_notFull.Set();
+            return true;
+        }
+        if (!WaitFor(m_notEmpty, timeoutMs, sw))
+            return false;
+    }
+}
+
+} // namespace MT
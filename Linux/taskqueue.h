@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include "threads.h"
+
+namespace MT {
+
+// item of the open-loop load: the number of the item, negative asks the consumer to exit
+struct Task {
+    int request;
+};
+
+// Bounded queue of tasks synchronised with the objects of the chosen SyncType, as the
+// task queue of the Windows build (future.h) without the futures:
+//   CS        - critical section, waiting threads poll the queue
+//   CS_EVENT  - critical section, waiting threads are woken up by auto-reset events
+//   MUTEX     - mutex (blocks at once, no spinning) and the same events
+//   SEMAPHORE - critical section, semaphores count free slots and queued tasks
+// Storage is preallocated, so pushing a task allocates nothing.
+class TaskQueue {
+public:
+    TaskQueue(unsigned capacity);
+
+    int Init(SyncType syncType); // (re)creates the synchronisation objects, queue must be empty
+
+    // false on timeout or failure
+    bool Push(const Task& task, unsigned timeoutMs = INFINITE);
+    bool Pop(Task& task, unsigned timeoutMs = INFINITE);
+
+private:
+    TaskQueue(const TaskQueue&);
+    TaskQueue& operator=(const TaskQueue&);
+
+    static const unsigned m_waitSlice = 10; // ms, auto-reset events may miss a waiter
+
+    CriticalSection& Guard() {
+        return m_syncType == MUTEX ? m_mutex : m_cs;
+    }
+    bool WaitFor(Event& event, unsigned timeoutMs, const Stopwatch& sw);
+
+    SyncType m_syncType;
+
+    CriticalSection   m_cs;
+    Mutex             m_mutex;
+    Event             m_notEmpty;  // events
+    Event             m_notFull;
+    Semaphore         m_items;     // or semaphores: queued tasks
+    Semaphore         m_slots;     // free slots
+
+    std::vector<Task> m_tasks;     // ring buffer
+    unsigned          m_head;
+    unsigned          m_count;
+};
+
+} // namespace MT
@@ -0,0 +1,477 @@
+#include "stdafx.h"
+#include <vector>
+#include "threads.h"
+#include "threadrunner.h"
+
+namespace MT {
+
+// Factory Method
+ThreadRunner* ThreadRunnerCreator::Create(SyncType syncType)
+{
+    switch (syncType) {
+        case SEMAPHORE:
+            return new SemaphoreRunner;
+        case OPEN_LOOP:
+            return new OpenLoopRunner;
+        case SOAK:
+            return new SoakRunner;
+        case BATCH:
+            return new ProducerConsumerBatchRunner;
+        case WORK_STACK:
+            return new WorkStackRunner;
+        case CS:
+            return new ProducerConsumerCSRunner;
+        case CS_EVENT:
+            return new ProducerConsumerEventRunner;
+        case MUTEX:
+        default:
+            return new ProducerConsumerMutexRunner;
+    }
+}
+
+int ThreadRunner::InitTimer(unsigned timeoutMs) {
+
+    // synchronise stopping of all threads after specified timeout
+    // using single common global timer object
+
+    SyncTimer& syncTimer = SyncTimer::Instance();
+    if (!syncTimer.isValid())
+        return ERR_API;
+
+    if (!syncTimer.SetTimer(timeoutMs))
+        return ERR_API;
+    return RET_OK;
+}
+
+// Pins the threads to the processors chosen by the placement policy. If the machine has
+// no such placement (one socket, no SMT) the threads are left to the scheduler.
+void ThreadRunner::PlaceThreads(const pthread_t* threads, unsigned count) {
+    if (m_placement == PL_DEFAULT)
+        return;
+
+    std::vector<unsigned> cpus;
+    stringstream ss;
+    ss << "Placement " << PlacementName(m_placement);
+    if (!Topology::Instance().Place(m_placement, count, cpus)) {
+        ss << " is not available on this machine, threads are not pinned";
+    } else {
+        ss << ", processors:";
+        for (unsigned i = 0; i < count; i++) {
+            ss << ' ' << cpus[i];
+            if (!PinThread(threads[i], cpus[i]))
+                ss << " (failed)";
+        }
+    }
+    Print(ss.str().c_str());
+}
+
+void ThreadRunner::PrintWaitStrategy(std::ostream& out) {
+    const WaitBudget& budget = m_wait.Budget();
+    out << "Wait strategy " << WaitPolicyName(m_wait.Policy());
+    if (m_wait.Policy() == WP_YIELD || m_wait.Policy() == WP_BACKOFF || m_wait.Policy() == WP_PARK)
+        out << ", spins " << budget.spins;
+    if (m_wait.Policy() == WP_BACKOFF)
+        out << ", backoff up to " << budget.maxBackoffMs << " ms";
+    out << endl;
+}
+
+int ThreadRunner::Init() const {
+    int ret = InitTimer();
+    if (ret != RET_OK)
+        return ret;
+    m_replay.Restart(); // the trace is played and recorded from the start of the run
+    m_recorder.Restart();
+    return InitSyncObjects(); // derived object virtual function call - type is known at runtime
+                              // runtime polymorphism
+}
+
+int ProducerConsumerRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+    __atomic_store_n(&m_phase, SP_RUN, __ATOMIC_SEQ_CST);
+
+    pthread_t threads[m_totalThreads];
+    unsigned  codes[m_totalThreads] = { RET_OK, RET_OK };
+
+    // in case the consumer is not created - wait while the producer will correctly
+    // exit by timeout and return
+    if (!StartThread(GetProducerThreadFunctionPtr(), NULL, m_stackSize, threads[0]))
+        return ERR_API;
+    if (!StartThread(GetConsumerThreadFunctionPtr(), NULL, m_stackSize, threads[1])) {
+        JoinThread(threads[0], codes[0]);
+        return ERR_API;
+    }
+    PlaceThreads(threads, m_totalThreads); // producer, consumer
+
+    ret = Shutdown(threads[0], threads[1], codes); // wait all threads to exit
+    if (ret != RET_OK)
+        return ret;
+
+    for (unsigned i = 0; i < m_totalThreads; i++)
+        if (codes[i] != RET_OK)
+            return ERR_SYNC;
+
+    return RET_OK;
+}
+
+// Producer exits by the timeout (intake is stopped) or when all tasks are sent. After the
+// timeout the consumer drains the buffer, if it is not empty by the grace deadline the
+// consumer is stopped after the current item and the rest is dropped. The consumer is
+// joined even if the join of the producer failed, then the failure is returned.
+int ProducerConsumerRunner::Shutdown(pthread_t producer, pthread_t consumer,
+                                     unsigned codes[]) const {
+
+    const WaitResult producerResult = JoinThread(producer, codes[0]);
+
+    SyncTimer::Instance().Wait(); // consumer works until the timeout even if all tasks are sent
+
+    const size_t backlog = Backlog();
+    Stopwatch sw;
+    __atomic_store_n(&m_phase, SP_DRAIN, __ATOMIC_SEQ_CST); // nothing is produced any more
+    WakeConsumer();
+
+    WaitResult result = JoinThread(consumer, codes[1], m_drainMs);
+    bool forced = (result == WR_TIMEOUT);
+    if (forced) {
+        __atomic_store_n(&m_phase, SP_STOP, __ATOMIC_SEQ_CST);
+        WakeConsumer();
+        result = JoinThread(consumer, codes[1]);
+    }
+    const double drainMs = sw.ElapsedNs() / 1e6;
+
+    const size_t left    = Backlog();
+    const size_t dropped = DropBacklog();
+    stringstream ss;
+    ss << "Shutdown: " << (forced ? "grace deadline passed, " : "") << "drained "
+       << backlog - left << " of " << backlog << " items in " << drainMs << " ms, dropped "
+       << dropped;
+    if (left != dropped)
+        ss << ", kept " << left - dropped;
+    Print(ss.str().c_str());
+
+    return producerResult == WR_OK && result == WR_OK ? RET_OK : ERR_API;
+}
+
+int SemaphoreRunner::RunThreads() const {
+
+    // semaphore
+    // Maintains a counter which is decreasing whe Wait function succeeds and increasing
+    // when semaphore is released. Wait succeeds when counter > 0.
+
+    // For example, if the counter is set to 2, only two threads can work simultaneously:
+    // both had succeed wait function and decremented the counter so it became 0 and 
+    // the third thread wait function will not succeed.
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    // in case a thread is not created - do not create remaining threads,
+    // wait for created and return
+    std::vector<pthread_t> threads;
+    for (int i=0; i<m_totalThreads; i++) { // try to create > MAX_SEM_COUNT threads
+        pthread_t thread;
+        if (!StartThread(&SemaphoreThreadFunction, (void*)&m_semInitCount, m_stackSize, thread))
+            break;
+        threads.push_back(thread);
+    }
+    if (threads.size() == static_cast<size_t>(m_totalThreads))
+        PlaceThreads(&threads[0], m_totalThreads);
+
+    bool allThreadsOK = true;
+    for (size_t i = 0; i < threads.size(); i++) {
+        unsigned code = RET_OK;
+        if (JoinThread(threads[i], code) != WR_OK)
+            ret = ERR_API;
+        if (code != RET_OK)
+            allThreadsOK = false;
+    }
+
+    if (threads.size() != static_cast<size_t>(m_totalThreads))
+        return ERR_API;
+
+    if (ret != RET_OK)
+        return ret;
+
+    if (!allThreadsOK)
+        return ERR_SYNC;
+
+    return RET_OK;
+}
+
+int OpenLoopRunner::RunStep(double rate, LoadStepResult& result) const {
+
+    const double items = std::min<double>(m_maxStepItems, std::max(1.0, rate * m_stepMs / 1000));
+    StepArgs args;
+    args.rate = rate;
+    args.intendedNs.resize(static_cast<size_t>(items));
+    args.sentNs.resize(args.intendedNs.size());
+    args.doneNs.resize(args.intendedNs.size());
+
+    Stopwatch clock; // the schedule starts now
+    args.clock = &clock;
+    pthread_t threads[2];
+    unsigned codes[2] = { RET_OK, RET_OK };
+    if (!StartThread(&Producer, &args, m_stackSize, threads[0]))
+        return ERR_API;
+    if (!StartThread(&Consumer, &args, m_stackSize, threads[1])) {
+        JoinThread(threads[0], codes[0]); // the producer gives up on the queue timeout
+        return ERR_API;
+    }
+    PlaceThreads(threads, 2);
+    if (JoinThread(threads[0], codes[0]) != WR_OK || JoinThread(threads[1], codes[1]) != WR_OK)
+        return ERR_API;
+    if (codes[0] != RET_OK || codes[1] != RET_OK)
+        return ERR_SYNC;
+
+    result.Compute(rate, args.intendedNs, args.sentNs, args.doneNs, m_maxP99Us);
+    stringstream ss;
+    result.Print(ss);
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+int OpenLoopRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    const SyncType syncTypes[] = { CS, CS_EVENT, MUTEX, SEMAPHORE };
+    const char* syncNames[]    = { "Critical sections", "Critical sections and events",
+                                   "Mutex and events", "Semaphores" };
+
+    for (size_t t = 0; t < sizeof(syncTypes) / sizeof(syncTypes[0]); t++) {
+
+        ret = m_queue.Init(syncTypes[t]);
+        if (ret != RET_OK)
+            return ret;
+
+        stringstream ss;
+        ss << endl << "Open-loop load, " << ArrivalName(m_arrival) << " arrivals: " << syncNames[t];
+        Print(ss.str().c_str());
+
+        // doubling finds the first rate which is not kept, bisection refines it
+        double sustained = 0, saturated = 0, throughput = 0;
+        for (double rate = m_startRate; rate <= m_maxRate && saturated == 0; rate *= 2) {
+            LoadStepResult result;
+            ret = RunStep(rate, result);
+            if (ret != RET_OK)
+                return ret;
+            if (result.sustained) {
+                sustained  = rate;
+                throughput = std::max(throughput, result.achievedRate);
+            } else {
+                saturated  = rate;
+            }
+        }
+        for (unsigned i = 0; i < m_refineSteps && sustained > 0 && saturated > 0; i++) {
+            const double rate = (sustained + saturated) / 2;
+            LoadStepResult result;
+            ret = RunStep(rate, result);
+            if (ret != RET_OK)
+                return ret;
+            if (result.sustained) {
+                sustained  = rate;
+                throughput = std::max(throughput, result.achievedRate);
+            } else {
+                saturated  = rate;
+            }
+        }
+
+        ss.str("");
+        if (saturated == 0)
+            ss << "  saturation throughput is above " << m_maxRate << " items/sec";
+        else if (sustained == 0)
+            ss << "  saturated below " << m_startRate << " items/sec";
+        else
+            ss << "  saturation throughput " << throughput << " items/sec";
+        Print(ss.str().c_str());
+    }
+    return RET_OK;
+}
+
+static unsigned long Difference(unsigned long from, unsigned long to) { // of wrapping counters
+    return to - from;
+}
+
+void SoakRunner::Report(const Sample& from, const Sample& to, const LatencyHistogram& latency,
+                        unsigned long depth, unsigned long maxDepth) {
+    const double seconds = (to.elapsedNs - from.elapsedNs) / 1e9;
+    stringstream ss;
+    ss << "  " << static_cast<unsigned>(to.elapsedNs / 1e9) << " s: "
+       << static_cast<unsigned long>(Difference(from.consumed, to.consumed) / seconds) << " items/s"
+       << ", latency us p50 " << latency.PercentileUs(0.5) << " p99 " << latency.PercentileUs(0.99)
+       << " p99.9 " << latency.PercentileUs(0.999) << " max " << latency.MaxUs()
+       << ", queue " << depth << " (max " << maxDepth << ")"
+       << ", rss " << to.memory.residentBytes / 1024 << " KB"
+       << ", anon " << to.memory.anonymousBytes / 1024 << " KB"
+       << ", allocations " << static_cast<unsigned long>(
+              Difference(from.memory.allocations, to.memory.allocations) / seconds) << "/s"
+       << ", live blocks " << static_cast<long>(Difference(to.memory.frees, to.memory.allocations));
+    Print(ss.str().c_str());
+}
+
+void SoakRunner::Summary(const Sample& first, const Sample& firstEnd, const Sample& last,
+                         const Sample& lastEnd) {
+    const double firstRate = Difference(first.consumed, firstEnd.consumed) * 1e9 /
+                             (firstEnd.elapsedNs - first.elapsedNs);
+    const double lastRate  = Difference(last.consumed, lastEnd.consumed) * 1e9 /
+                             (lastEnd.elapsedNs - last.elapsedNs);
+    stringstream ss;
+    ss << "Soak, the first and the last interval: throughput "
+       << static_cast<unsigned long>(firstRate) << " -> " << static_cast<unsigned long>(lastRate)
+       << " items/s (" << (firstRate > 0 ? (lastRate - firstRate) * 100 / firstRate : 0) << "%)"
+       << ", rss " << firstEnd.memory.residentBytes / 1024 << " -> "
+       << lastEnd.memory.residentBytes / 1024 << " KB"
+       << ", anon " << firstEnd.memory.anonymousBytes / 1024 << " -> "
+       << lastEnd.memory.anonymousBytes / 1024 << " KB"
+       << ", live blocks " << static_cast<long>(Difference(firstEnd.memory.frees, firstEnd.memory.allocations))
+       << " -> " << static_cast<long>(Difference(lastEnd.memory.frees, lastEnd.memory.allocations));
+    Print(ss.str().c_str());
+}
+
+int SoakRunner::RunThreads() const {
+
+    // the run lasts m_durationMin instead of the default interval
+    int ret = InitTimer(m_durationMin * 60 * 1000);
+    if (ret == RET_OK)
+        ret = InitSyncObjects();
+    if (ret != RET_OK)
+        return ret;
+
+    stringstream ss;
+    ss << endl << "Soak: critical sections and events queue for " << m_durationMin
+       << " min, stats every " << m_intervalSec << " s";
+    Print(ss.str().c_str());
+
+    m_produced = m_consumed = 0;
+    {
+        Lock lock(m_latencyCs);
+        m_latency.Reset();
+    }
+    m_clock.Start();
+    Sample prev = { 0, 0 };
+    ReadMemoryCounts(prev.memory);
+
+    pthread_t threads[2];
+    unsigned codes[2] = { RET_OK, RET_OK };
+    if (!StartThread(&Producer, NULL, m_stackSize, threads[0]))
+        return ERR_API;
+    if (!StartThread(&Consumer, NULL, m_stackSize, threads[1])) {
+        InitTimer(1); // stops the producer at once
+        JoinThread(threads[0], codes[0]);
+        return ERR_API;
+    }
+    PlaceThreads(threads, 2);
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const double intervalNs = m_intervalSec * 1e9;
+    double   nextNs    = intervalNs;
+    unsigned intervals = 0;
+    unsigned long maxDepth = 0;
+    Sample first, firstEnd, last, lastEnd;
+    while (syncTimer.State() == ST_WORK) {
+        ::usleep(m_pollMs * 1000);
+        const unsigned long consumed = m_consumed; // the consumer may count an item before the producer
+        const long depth = static_cast<long>(Difference(consumed, m_produced));
+        const unsigned long depthNow = depth > 0 ? depth : 0;
+        maxDepth = std::max(maxDepth, depthNow);
+        if (m_clock.ElapsedNs() < nextNs)
+            continue;
+
+        Sample now;
+        now.elapsedNs = m_clock.ElapsedNs();
+        now.consumed  = m_consumed;
+        ReadMemoryCounts(now.memory);
+        LatencyHistogram latency;
+        {
+            Lock lock(m_latencyCs);
+            latency = m_latency;
+            m_latency.Reset();
+        }
+        Report(prev, now, latency, depthNow, maxDepth);
+
+        if (intervals++ == 0) {
+            first    = prev;
+            firstEnd = now;
+        }
+        last     = prev;
+        lastEnd  = now;
+        prev     = now;
+        maxDepth = 0;
+        nextNs  += intervalNs;
+    }
+
+    if (JoinThread(threads[0], codes[0]) != WR_OK || JoinThread(threads[1], codes[1]) != WR_OK)
+        ret = ERR_API;
+    else if (codes[0] != RET_OK || codes[1] != RET_OK)
+        ret = ERR_SYNC;
+    if (intervals > 1)
+        Summary(first, firstEnd, last, lastEnd);
+    return ret;
+}
+
+int ProducerConsumerBatchRunner::RunThreads() const {
+
+    memset(&m_totals, 0, sizeof(m_totals));
+    stringstream ss;
+    ss << "Batch consumer: up to " << m_maxBatch << " items of " << RECORD_WORDS
+       << " words, kernel " << KernelLevelName(SupportedKernelLevel(m_kernel))
+       << " (best: " << KernelLevelName(BestKernelLevel()) << ")";
+    Print(ss.str().c_str());
+
+    int ret = ProducerConsumerRunner::RunThreads();
+
+    stringstream report; // the consumer has exited
+    report << "Batch consumer: " << m_totals.items << " items in " << m_totals.batches << " batches";
+    if (m_totals.batches > 0)
+        report << ", " << static_cast<double>(m_totals.items) / m_totals.batches << " per batch, kernel "
+               << m_totals.kernelNs / m_totals.items << " ns per item";
+    report << ", selected " << m_totals.selected << " of " << m_totals.items * RECORD_WORDS
+           << " words, sum " << m_totals.sum << ", checksum " << std::hex << m_totals.checksum;
+    Print(report.str().c_str());
+    return ret;
+}
+
+// Not timed by the sync timer: the job ends when all items are processed
+int WorkStackRunner::RunThreads() const {
+
+    stringstream ss;
+    ss << endl << "Bulk job: backlog of " << BulkJob::m_backlog << " items of "
+       << BulkJob::m_payloadBytes << " bytes, then " << BulkJob::m_items
+       << " items made and processed by each worker in bursts of " << BulkJob::m_burst << endl
+       << "thousands of items per second, payload read ns per item" << endl;
+
+    for (unsigned workers = 1; workers <= m_maxWorkers; workers *= 2) {
+        BulkJob job(workers);
+        CSQueue          fifo(BulkJob::Capacity(workers));
+        TreiberStack     lifo(BulkJob::Capacity(workers));
+        WorkStealingPool hybrid(BulkJob::Capacity(workers), workers);
+        SharedQueue* dispatches[] = { &fifo, &lifo, &hybrid };
+        const unsigned variants = sizeof(dispatches) / sizeof(dispatches[0]);
+        if (!job.isValid())
+            return ERR_STD;
+
+        ss << "  " << workers << (workers == 1 ? " worker:" : " workers:");
+        for (unsigned v = 0; v < variants; v++) {
+            if (!dispatches[v]->isValid())
+                return ERR_API;
+
+            BulkJobResult result;
+            int ret = job.Run(*dispatches[v], result);
+            if (ret != RET_OK)
+                return ret;
+            ss << (v == 0 ? " " : ", ") << dispatches[v]->Name() << " " << result.itemsPerSec / 1e3
+               << " (" << result.readNsPerItem << " ns)";
+        }
+        ss << ", " << hybrid.Steals() << " steals" << endl;
+    }
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+} // namespace MT
+
@@ -0,0 +1,392 @@
+#pragma once
+
+#include "threads.h"
+#include "topology.h"
+#include "waitstrategy.h"
+#include "taskqueue.h"
+#include "loadgen.h"
+#include "workload.h"
+#include "memstats.h"
+#include "batchkernel.h"
+#include "workstack.h"
+
+namespace MT { 
+
+class ThreadRunner {
+public:
+    static const unsigned m_defTimeoutMs = 16000; // 16 seconds
+    static int InitTimer(unsigned timeoutMs = m_defTimeoutMs);
+
+    // Stack of the threads started by the runners. The sample threads need little:
+    // a small stack saves address space and the page tables when there are many threads.
+    static const size_t m_defStackSize = 256 * 1024;
+    static size_t m_stackSize; // 0 - default of the process
+
+    // placement of the producer and consumer threads (topology.h), set from the command line
+    static Placement m_placement;
+    static void PlaceThreads(const pthread_t* threads, unsigned count);
+
+    // how the producer and consumer threads wait for the buffer, set from the command line
+    static WaitStrategy m_wait;
+    static void PrintWaitStrategy(std::ostream& out);
+
+    // arrivals of the produced items: replayed from a trace instead of the imitated work,
+    // and recorded to a trace (workload.h), set from the command line
+    static WorkloadReplay   m_replay;
+    static WorkloadRecorder m_recorder;
+
+    int Init() const;
+    virtual int RunThreads() const =0;
+    virtual int InitSyncObjects() const =0;
+    virtual ~ThreadRunner() {
+    }
+
+    // common helpers
+    static void Wait(int ms) {
+        ::usleep(ms * 1000);
+    }
+    static void Produce(int ms = rand()%10 * 50) { // imitates work
+        Wait(ms);
+    }
+    // once per produced item, before it is pushed: waits for the arrival of the next item of
+    // the replayed trace instead of the imitated work, false if the trace is over
+    static bool Arrive(WorkloadRecord& item, int ms = rand()%10 * 50) {
+        const WorkloadRecord imitated = { 0, sizeof(int), 0, 0 };
+        item = imitated;
+        if (m_replay.isEnabled())
+            return m_replay.Produce(item);
+        Produce(ms);
+        return true;
+    }
+    // items a producer sends: its count, or as many as the replayed trace has (it ends the
+    // run by Arrive(), a looped one by the timeout)
+    static int ItemCount(int count) {
+        return m_replay.isEnabled() ? INT_MAX : count;
+    }
+    static void Record(const WorkloadRecord& item) { // once per pushed item
+        if (m_recorder.isEnabled())
+            m_recorder.Append(item.size, item.priority);
+    }
+
+    // console output of the threads goes through the logger service
+    static void Print(const char* msg) {
+        Logger::Instance().Print(msg);
+    }
+    static void Print(const char* msg, int value) {
+        Logger::Instance().Print(msg, value);
+    }
+    static void PutThreadFinishMsg(const char* msg, unsigned int timeout=0) {
+        Logger::Instance().PutThreadFinishMsg(msg, timeout);
+    }
+};
+
+class  ThreadRunnerCreator {  // Factory Method GOF Pattern
+public:
+    static ThreadRunner* Create(SyncType syncType);
+};
+
+// mutlithreaded access to shared read/write memory: producer-consumer problem
+
+class ProducerConsumerRunner : public ThreadRunner {
+public:
+    static void Consume(int msg) { // consume item #msg
+        int ms = rand()%14 * 50;
+        Wait(ms);
+        Stats::Instance().Add(SC_CONSUMED);
+    }
+    static const unsigned m_maxTasks     = 30; // number of tasks to produce (model empty buffer condition)
+
+    // Shutdown phases: the timer stops the intake (producer exits), then the consumer
+    // drains the buffer until it is empty or the grace deadline passes, then it is
+    // stopped after the current item. Items left in the buffer are dropped.
+    enum ShutdownPhase { SP_RUN, SP_DRAIN, SP_STOP };
+    static const unsigned m_drainMs = 3000; // grace deadline
+    static volatile int m_phase;
+
+    // consumer keeps working after the timeout until the primary thread stops it
+    static SyncTimerState ConsumerState(const SyncTimer& syncTimer) {
+        if (syncTimer.State() == ST_ERR)
+            return ST_ERR;
+        return m_phase == SP_STOP ? ST_STOP : ST_WORK;
+    }
+    static bool Draining() { // nothing is produced any more: empty buffer means done
+        return m_phase == SP_DRAIN;
+    }
+
+    // Conditions of the buffer waits (m_wait). They are also true when the waiting
+    // thread is to stop, so a spinning thread does not miss the end of the run.
+    class ItemReady { // the consumer has an item
+    public:
+        ItemReady(const Queue<int>& queue, CriticalSection& cs) : m_queue(queue), m_cs(cs) {
+        }
+        bool operator()() const {
+            if (m_phase != SP_RUN)
+                return true;
+            Lock lock(m_cs);
+            return !m_queue.empty();
+        }
+    private:
+        const Queue<int>& m_queue;
+        CriticalSection&  m_cs;
+    };
+    class SlotReady { // the producer has a free slot
+    public:
+        SlotReady(const Queue<int>& queue, CriticalSection& cs) : m_queue(queue), m_cs(cs) {
+        }
+        bool operator()() const {
+            if (SyncTimer::Instance().State() != ST_WORK)
+                return true;
+            Lock lock(m_cs);
+            return !m_queue.isFull();
+        }
+    private:
+        const Queue<int>& m_queue;
+        CriticalSection&  m_cs;
+    };
+    // the buffer is guarded by the mutex: the other side is seen by the count of its signals,
+    // incremented beside the Set() of its auto-reset event, so the spinning thread reads
+    // memory instead of polling the event with a system call; the event is for blocking (park)
+    class SignalReady {
+    public:
+        SignalReady(const long& signals, long seen, bool consumer) :
+            m_signals(signals), m_seen(seen), m_consumer(consumer) {
+        }
+        bool operator()() const {
+            if (m_consumer ? m_phase != SP_RUN : SyncTimer::Instance().State() != ST_WORK)
+                return true;
+            return __atomic_load_n(&m_signals, __ATOMIC_ACQUIRE) != m_seen;
+        }
+    private:
+        const long& m_signals;
+        const long  m_seen; // read under the mutex when the buffer was checked
+        bool        m_consumer;
+    };
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const = 0;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const = 0;
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const = 0;
+
+    virtual void   WakeConsumer() const { // consumer waiting for items is to see the drain phase
+    }
+    virtual size_t Backlog() const;       // items not consumed yet
+    virtual size_t DropBacklog() const;   // called when all threads have exited, returns dropped items
+
+    // depth of g_msgs for the stats page (Stats::SetQueueDepth), called after each push and
+    // pop under the lock of the buffer
+    static void SampleDepth();
+
+private:
+    static const unsigned m_totalThreads = 2;  // producer and consumer
+
+    int Shutdown(pthread_t producer, pthread_t consumer, unsigned codes[]) const;
+};
+
+// only locking shared memory with Critical Sections
+class ProducerConsumerCSRunner : public ProducerConsumerRunner {
+public:
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+};
+
+// using Events for synchronisation
+class ProducerConsumerEventRunner : public ProducerConsumerRunner {
+public:
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int InitSyncObjects() const ;
+    virtual void WakeConsumer() const;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+};
+
+// using Mutex for synchronisation
+class ProducerConsumerMutexRunner : public ProducerConsumerRunner {
+public:
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    // signals of g_emptyMutEvent and g_fullMutEvent for the spinning threads (SignalReady)
+    static long m_emptySignals; // atomic
+    static long m_fullSignals;  // atomic
+    static void Signal(Event& event, long& signals) {
+        __atomic_add_fetch(&signals, 1, __ATOMIC_RELEASE);
+        event.Set();
+    }
+
+    virtual int InitSyncObjects() const;
+    virtual void WakeConsumer() const;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+};
+
+class SemaphoreRunner : public ThreadRunner { // sample usage of Semaphore
+public:
+    static const int defTotalThreads = 3;
+    static THREAD_FUNCTION SemaphoreThreadFunction;
+
+    SemaphoreRunner(int totalThreads=defTotalThreads) : m_totalThreads(totalThreads),
+        m_semInitCount(m_totalThreads-1) { // initialisation in the order of declaration
+    }
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const;
+
+protected:
+    const int  m_totalThreads;
+    const long m_semInitCount; // initial semaphore object counter
+};
+
+// Open-loop load: the producer sends items on the schedule of the target rate whatever
+// the state of the queue, latency is measured from the intended send time (loadgen.h).
+// The rate is doubled until the queue of the synchronisation type cannot keep it, then
+// the saturation throughput is refined by bisection.
+class OpenLoopRunner : public ThreadRunner {
+public:
+    static const unsigned m_queueSize    = 64;
+    static const unsigned m_stepMs       = 500;     // of the schedule of one rate
+    static const unsigned m_maxStepItems = 500000;
+    static const unsigned m_startRate    = 1000;    // items per second
+    static const unsigned m_maxRate      = 4000000;
+    static const unsigned m_refineSteps  = 3;
+    static const unsigned m_maxP99Us     = 10000;   // the rate is not kept if queueing delay grows beyond
+    static const unsigned m_serviceSpin  = 200;     // consumer work per item
+    static const unsigned m_sleepAheadMs = 2;       // producer sleeps only if the next item is further
+    static const unsigned m_queueTimeout = 5000;    // ms, the other side does not respond
+
+    static ArrivalProcess m_arrival; // set from the command line
+
+    struct StepArgs {
+        double              rate;
+        const Stopwatch*    clock;      // common start of the step
+        std::vector<double> intendedNs; // by item, written by the producer
+        std::vector<double> sentNs;
+        std::vector<double> doneNs;     // written by the consumer
+    };
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+
+private:
+    int RunStep(double rate, LoadStepResult& result) const;
+
+    static TaskQueue m_queue;
+};
+
+// Soak: the producer keeps the queue of critical sections and events busy for hours,
+// every interval the primary thread reports throughput, latency percentiles, queue depth,
+// memory of the process and allocation counts (memstats.h). The summary compares the
+// first and the last interval: slow leaks, drift and throughput degradation show there.
+class SoakRunner : public ThreadRunner {
+public:
+    static const unsigned m_queueSize    = 64;
+    static const unsigned m_stampRing    = 256;  // send times of the items in flight, > m_queueSize + 2
+    static const unsigned m_serviceSpin  = 200;  // consumer work per item
+    static const unsigned m_pollMs       = 100;  // samples of the queue depth and checks of the end
+    static const unsigned m_queueTimeout = 100;  // push and pop are retried while the run lasts
+    static const unsigned m_stopTimeout  = 5000; // for the last item after the end of the run
+    static const unsigned m_defDurationMin = 60;
+    static const unsigned m_defIntervalSec = 10;
+
+    static unsigned m_durationMin; // set from the command line
+    static unsigned m_intervalSec;
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return m_queue.Init(CS_EVENT);
+    }
+
+private:
+    struct Sample { // counters at the end of an interval
+        double        elapsedNs;
+        unsigned long consumed;
+        MemoryCounts  memory;
+    };
+    static void Report(const Sample& from, const Sample& to, const LatencyHistogram& latency,
+                       unsigned long depth, unsigned long maxDepth);
+    static void Summary(const Sample& first, const Sample& firstEnd, const Sample& last,
+                        const Sample& lastEnd);
+
+    static TaskQueue        m_queue;
+    static Stopwatch        m_clock;                // started with the run
+    static double           m_sentNs[m_stampRing];  // by Task::request
+    static volatile unsigned long m_produced;       // single writers, wrap: compared as differences
+    static volatile unsigned long m_consumed;
+    static CriticalSection  m_latencyCs;            // the consumer records, the primary thread takes
+    static LatencyHistogram m_latency;              // of the current interval
+};
+
+// Batch consumer: all items in the buffer (up to m_maxBatch) are popped under one lock,
+// their records are decoded into a contiguous aligned buffer and the vectorised kernel
+// (batchkernel.h) checksums, filters and aggregates them at once. The imitated work is
+// paid once per batch, so the more the producer is ahead, the less each item costs.
+class ProducerConsumerBatchRunner : public ProducerConsumerEventRunner {
+public:
+    static const unsigned m_maxBatch  = 8; // the whole buffer
+    static const int      m_threshold = 0; // the filter selects the words above it
+
+    static KernelLevel m_kernel; // the highest level to use, set from the command line
+
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+
+private:
+    struct Totals { // written by the consumer only, read when it has exited
+        unsigned  batches;
+        unsigned  items;
+        unsigned  checksum; // of the checksums of the batches in order
+        unsigned  selected;
+        long long sum;
+        double    kernelNs;
+    };
+    static void ConsumeBatch(const int* msgs, size_t count, AlignedArray<int>& records);
+
+    static Totals m_totals;
+};
+
+
+// Dispatch order of a bulk job against the cache (BulkJob, workstack.h): the same job
+// runs over the FIFO queue under a critical section, the lock-free LIFO stack and the
+// per-thread deques with stealing (LIFO locally, FIFO stealing). The backlog is bigger
+// than the cache, the LIFO workers read the payloads while they are still in it.
+class WorkStackRunner : public ThreadRunner {
+public:
+    static const unsigned m_maxWorkers = 8;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+};
+
+} // namespace MT
@@ -0,0 +1,264 @@
+#include "stdafx.h"
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include "threads.h"
+#include "threadrunner.h"
+#include "perfcounters.h"
+
+MT::Queue<int> g_msgs(8); // queue with limitied size (8 items here) to model full buffer
+
+// synchronisation objects - must be visible to all threads where they will be used.
+// Futex-based objects need no system resources: nothing to create or to close.
+
+MT::CriticalSection g_cs;                      // buffer lock of the critical section runners
+MT::Event           g_emptyEvent, g_fullEvent; // auto-reset
+MT::Mutex           g_mutex;
+MT::Event           g_emptyMutEvent, g_fullMutEvent;
+MT::Semaphore       g_semaphore;
+
+namespace MT {
+
+size_t          ThreadRunner::m_stackSize       = ThreadRunner::m_defStackSize;
+Placement       ThreadRunner::m_placement       = PL_DEFAULT;
+WaitStrategy    ThreadRunner::m_wait;
+WorkloadReplay  ThreadRunner::m_replay;
+WorkloadRecorder ThreadRunner::m_recorder;
+volatile int    ProducerConsumerRunner::m_phase = ProducerConsumerRunner::SP_RUN;
+long            ProducerConsumerMutexRunner::m_emptySignals = 0;
+long            ProducerConsumerMutexRunner::m_fullSignals  = 0;
+ArrivalProcess  OpenLoopRunner::m_arrival       = AP_CONSTANT;
+TaskQueue       OpenLoopRunner::m_queue(OpenLoopRunner::m_queueSize);
+unsigned        SoakRunner::m_durationMin = SoakRunner::m_defDurationMin;
+unsigned        SoakRunner::m_intervalSec = SoakRunner::m_defIntervalSec;
+TaskQueue       SoakRunner::m_queue(SoakRunner::m_queueSize);
+Stopwatch       SoakRunner::m_clock;
+double          SoakRunner::m_sentNs[SoakRunner::m_stampRing] = { 0 };
+volatile unsigned long SoakRunner::m_produced = 0;
+volatile unsigned long SoakRunner::m_consumed = 0;
+CriticalSection SoakRunner::m_latencyCs;
+LatencyHistogram SoakRunner::m_latency;
+KernelLevel     ProducerConsumerBatchRunner::m_kernel = KL_AVX2;
+ProducerConsumerBatchRunner::Totals ProducerConsumerBatchRunner::m_totals;
+
+void FutexWait(volatile int* addr, int expected, const timespec* timeout) {
+    // returns at once if *addr != expected: the wake-up is not lost between the
+    // check of the caller and the sleep. Spurious returns (EINTR) are checked by the caller.
+    ::syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+void FutexWake(volatile int* addr, int count) {
+    ::syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static timespec ToTimespec(long long ns) {
+    timespec ts;
+    ts.tv_sec  = static_cast<time_t>(ns / 1000000000LL);
+    ts.tv_nsec = static_cast<long>(ns % 1000000000LL);
+    return ts;
+}
+
+struct ThreadStart {
+    THREAD_FUNCTION* function;
+    void*            args;
+};
+
+static void* ThreadEntry(void* p) {
+    ThreadStart start = *static_cast<ThreadStart*>(p);
+    delete static_cast<ThreadStart*>(p);
+    PerfCounters::ThreadScope counters; // if the counters of a run are collected
+    return reinterpret_cast<void*>(static_cast<uintptr_t>(start.function(start.args)));
+}
+
+bool StartThread(THREAD_FUNCTION* function, void* args, size_t stackSize, pthread_t& thread) {
+    pthread_attr_t attr;
+    if (::pthread_attr_init(&attr) != 0)
+        return false;
+    bool ok = stackSize == 0 || ::pthread_attr_setstacksize(&attr, stackSize) == 0;
+
+    ThreadStart* start = NULL;
+    if (ok) {
+        start = new (std::nothrow) ThreadStart;
+        ok = start != NULL;
+    }
+    if (ok) {
+        start->function = function;
+        start->args     = args;
+        ok = ::pthread_create(&thread, &attr, &ThreadEntry, start) == 0;
+        if (!ok)
+            delete start;
+    }
+    ::pthread_attr_destroy(&attr);
+    return ok;
+}
+
+WaitResult JoinThread(pthread_t thread, unsigned& code, unsigned timeoutMs) {
+    void* ret = NULL;
+    int err = 0;
+    if (timeoutMs == INFINITE) {
+        err = ::pthread_join(thread, &ret);
+    } else {
+        timespec now; // pthread_timedjoin_np takes CLOCK_REALTIME
+        ::clock_gettime(CLOCK_REALTIME, &now);
+        const timespec deadline = ToTimespec(now.tv_sec * 1000000000LL + now.tv_nsec +
+                                             timeoutMs * 1000000LL);
+        err = ::pthread_timedjoin_np(thread, &ret, &deadline);
+    }
+    if (err == ETIMEDOUT)
+        return WR_TIMEOUT;
+    if (err != 0)
+        return WR_FAILED;
+    code = static_cast<unsigned>(reinterpret_cast<uintptr_t>(ret));
+    return WR_OK;
+}
+
+void CriticalSection::EnterContended() {
+    for (unsigned spin = 0; spin < m_spinCount; spin++) {
+        CpuRelax();
+        if (m_state == 0 && TryEnter()) // test before the atomic operation: spinning only reads the line
+            return;
+    }
+    // mark the lock contended, the thread which exchanges 0 owns it
+    while (__atomic_exchange_n(&m_state, 2, __ATOMIC_ACQUIRE) != 0)
+        FutexWait(&m_state, 2);
+}
+
+WaitResult Event::Wait(unsigned timeoutMs) {
+    if (TryConsume())
+        return WR_OK;
+    if (timeoutMs == 0)
+        return WR_TIMEOUT;
+
+    const long long deadline = MonotonicNs() + timeoutMs * 1000000LL;
+    __atomic_add_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
+
+    WaitResult result = WR_OK;
+    while (!TryConsume()) {
+        if (timeoutMs == INFINITE) {
+            FutexWait(&m_state, 0);
+            continue;
+        }
+        const long long left = deadline - MonotonicNs();
+        if (left <= 0) {
+            result = WR_TIMEOUT;
+            break;
+        }
+        const timespec timeout = ToTimespec(left);
+        FutexWait(&m_state, 0, &timeout);
+    }
+
+    __atomic_sub_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+bool Semaphore::Init(unsigned initCount) {
+    m_fd.SetHandle( ::eventfd(initCount, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC) );
+    return m_fd.isValid();
+}
+
+WaitResult Semaphore::Wait(unsigned timeoutMs) {
+    const long long deadline = MonotonicNs() + (timeoutMs == INFINITE ? 0 : timeoutMs * 1000000LL);
+    for (;;) {
+        uint64_t value = 0;
+        if (::read(m_fd, &value, sizeof(value)) == sizeof(value))
+            return WR_OK; // counter decremented
+        if (errno != EAGAIN && errno != EINTR)
+            return WR_FAILED;
+
+        // counter is 0: another thread may take the released permit before us, so
+        // the read is repeated after each wake-up
+        int pollMs = -1;
+        if (timeoutMs != INFINITE) {
+            const long long left = deadline - MonotonicNs();
+            if (left <= 0)
+                return WR_TIMEOUT;
+            pollMs = static_cast<int>((left + 999999) / 1000000);
+        }
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, pollMs) < 0 && errno != EINTR)
+            return WR_FAILED;
+    }
+}
+
+bool Semaphore::Release() {
+    const uint64_t one = 1;
+    return ::write(m_fd, &one, sizeof(one)) == sizeof(one);
+}
+
+// until the timer is set the state is ST_WORK, as the timer is not expired
+SyncTimer::SyncTimer() : m_timeoutSec(0), m_deadlineNs( std::numeric_limits<long long>::max() ),
+    m_hTimer( ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC) ) {
+}
+
+bool SyncTimer::SetTimer(unsigned timeoutMs) {
+    Lock lock(m_cs);
+    m_timeoutSec = timeoutMs / 1000;
+
+    // the absolute expiration is the deadline compared by State(): both agree exactly.
+    // Setting the timer clears the expirations of the previous run.
+    const long long deadline = MonotonicNs() + timeoutMs * 1000000LL;
+    itimerspec spec = { { 0, 0 }, ToTimespec(deadline) };
+    if (::timerfd_settime(m_hTimer, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+        return false;
+    m_deadlineNs = deadline; // threads of the run are started after it
+    return true;
+}
+
+bool SyncTimer::Wait(unsigned timeoutMs) const {
+    // readable once expired, the expiration count is not read: the timer stays
+    // signalled for all waiters as the manual-reset waitable timer on Windows
+    pollfd pfd = { m_hTimer, POLLIN, 0 };
+    int ret = 0;
+    do {
+        ret = ::poll(&pfd, 1, timeoutMs == INFINITE ? -1 : static_cast<int>(timeoutMs));
+    } while (ret < 0 && errno == EINTR);
+    return ret == 1;
+}
+
+size_t ProducerConsumerRunner::Backlog() const {
+    return g_msgs.size();
+}
+
+size_t ProducerConsumerRunner::DropBacklog() const {
+    size_t dropped = g_msgs.size();
+    while (!g_msgs.empty())
+        g_msgs.pop();
+    SampleDepth();
+    return dropped;
+}
+
+void ProducerConsumerRunner::SampleDepth() {
+    Stats::Instance().SetQueueDepth(static_cast<long>(g_msgs.size()));
+}
+
+void ProducerConsumerEventRunner::WakeConsumer() const {
+    g_fullEvent.Set();
+}
+
+void ProducerConsumerMutexRunner::WakeConsumer() const {
+    Signal(g_fullMutEvent, m_fullSignals);
+}
+
+int ProducerConsumerEventRunner::InitSyncObjects() const {
+    g_emptyEvent.Reset(); // initial state is nonsignaled
+    g_fullEvent.Reset();
+    return RET_OK;
+}
+
+int ProducerConsumerMutexRunner::InitSyncObjects() const {
+    g_emptyMutEvent.Reset();
+    g_fullMutEvent.Reset();
+    return RET_OK;
+}
+
+int SemaphoreRunner::InitSyncObjects() const {
+
+    // initial count - no more than m_semInitCount of threads work at the same time
+    if (!g_semaphore.isValid() && !g_semaphore.Init(m_semInitCount))
+        return ERR_API;
+
+    return RET_OK;
+}
+
+} // namespace MT
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <limits.h>
+#include <stdint.h>
+#include "allocation.h"
+#include "stats.h"
+
+// chose different synchronisation objects
+enum SyncType {
+    CS    = 1, // only critical sections
+    CS_EVENT,  // critical sections with events
+    MUTEX,     // mutex
+    SEMAPHORE,
+    OPEN_LOOP, // producer sends on the schedule of the target rate, queues of the first types
+    SOAK,      // sustained load for hours, stats of each interval
+    BATCH,     // critical sections and events, consumer pops batches and runs a vectorised kernel
+    WORK_STACK // bulk job dispatched FIFO, LIFO by a lock-free stack and by work stealing
+};
+
+// error return types
+const int RET_OK      = 0;
+const int ERR_SYNC    = 1; // error with thread syncshronisation
+const int ERR_STD     = 2; // std::exception
+const int ERR_API     = 3; // system call failed
+const int ERR_UNKNOWN = 4; // catched by catch (...)
+
+typedef unsigned (THREAD_FUNCTION)(void*); // function to pass to StartThread()
+
+const unsigned INFINITE = UINT_MAX; // wait timeout, ms
+
+const char TIMEOUT[] = "Exiting thread, timeout: ";
+
+namespace MT {
+
+enum WaitResult { WR_OK, WR_TIMEOUT, WR_FAILED };
+
+// CLOCK_MONOTONIC is read in the vDSO: no system call
+inline long long MonotonicNs() {
+    timespec ts;
+    if (::clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return -1;
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+inline long CurrentThreadId() { // as shown by top -H and ps -L
+    return ::syscall(SYS_gettid);
+}
+
+// pause instruction of the spin loops: lets the sibling hyper-thread run and saves
+// the pipeline flush when the loop exits
+inline void CpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// futex(2) wrappers, the kernel is entered only to block or to wake a blocked thread.
+// Futexes are private: the words are not shared with other processes.
+// see: http://man7.org/linux/man-pages/man2/futex.2.html
+// and (Drepper) "Futexes Are Tricky" https://www.akkadia.org/drepper/futex.pdf
+void FutexWait(volatile int* addr, int expected, const timespec* timeout = NULL); // relative
+void FutexWake(volatile int* addr, int count);
+
+// Starts the thread function on a pthread with the given stack size (0 - default of
+// the process, RLIMIT_STACK: 8 MB of address space in most distributions).
+// see: http://man7.org/linux/man-pages/man3/pthread_attr_setstacksize.3.html
+bool StartThread(THREAD_FUNCTION* function, void* args, size_t stackSize, pthread_t& thread);
+// waits for the thread, code is the return value of the thread function
+WaitResult JoinThread(pthread_t thread, unsigned& code, unsigned timeoutMs = INFINITE);
+
+class HandleWrapper { // file descriptor using RAAI idiom
+public:
+    HandleWrapper(int fd = -1) : m_fd(fd) {
+    }
+    ~HandleWrapper() {
+        if (isValid())
+            ::close(m_fd);
+    }
+
+    void SetHandle(int fd) { // needed for global objects
+        if (isValid())
+            ::close(m_fd);
+        m_fd = fd;
+    }
+
+    operator int() const {
+        return m_fd;
+    }
+
+    bool isValid() const {
+        return m_fd >= 0;
+    }
+
+private:
+    // disable copy constructor and assignment operator
+    HandleWrapper(const HandleWrapper&);
+    HandleWrapper& operator=(const HandleWrapper&);
+
+    int m_fd;
+};
+
+// Lock on a futex word (Drepper's mutex 3): 0 - free, 1 - locked, 2 - locked and
+// a thread may be blocked. Uncontended Enter and Leave are one atomic operation each,
+// contended Enter spins first (as the critical section with a spin count on Windows),
+// then blocks in the kernel. Leave enters the kernel only to wake a blocked thread.
+class CriticalSection {
+public:
+    static const unsigned defSpinCount = 0x400;
+
+    CriticalSection(unsigned spinCount = defSpinCount) : m_state(0), m_spinCount(spinCount) {
+    }
+
+    bool isValid() const { // nothing to create
+        return true;
+    }
+
+    bool Enter() {
+        if (!TryEnter())
+            EnterContended();
+        return true;
+    }
+
+    bool Leave() {
+        if (__atomic_exchange_n(&m_state, 0, __ATOMIC_RELEASE) == 2)
+            FutexWake(&m_state, 1);
+        return true;
+    }
+
+    bool TryEnter() { // false if owned by another thread
+        int expected = 0;
+        return __atomic_compare_exchange_n(&m_state, &expected, 1, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+
+private:
+    CriticalSection(const CriticalSection&);
+    CriticalSection& operator=(const CriticalSection&);
+
+    void EnterContended();
+
+    volatile int   m_state;
+    const unsigned m_spinCount;
+};
+
+// The Windows mutex is a kernel object: the owner is blocked at once and woken by the
+// scheduler. The same lock without spinning is the nearest native equivalent, the
+// uncontended path still does not enter the kernel.
+class Mutex : public CriticalSection {
+public:
+    Mutex() : CriticalSection(0) {
+    }
+};
+
+class Lock {
+
+public:
+   Lock(CriticalSection& cs) : m_cs(cs) { // RAAI idiom
+        if (!m_cs.TryEnter()) { // contention is counted on the slow path only
+            Stats::Instance().Add(SC_CONTENDED);
+            m_cs.Enter();
+        }
+    }
+    ~Lock() {
+        m_cs.Leave();
+    }
+private:
+    Lock(const Lock&);
+    Lock& operator=(const Lock&);
+
+    CriticalSection& m_cs;
+};
+
+// Global service created on the first call and read without a lock afterwards.
+//
+// GCC makes the initialisation of local statics thread-safe also in C++03 mode
+// (-fthreadsafe-statics, Itanium C++ ABI guard variables): the first callers are
+// serialised by the guard, and once the object is constructed every call is one
+// acquire load of the guard and the address of the object.
+// see (Meyers, Alexandresku) http://www.aristeia.com/Papers/DDJ_Jul_Aug_2004_revised.pdf
+// and https://itanium-cxx-abi.github.io/cxx-abi/abi.html#guards
+template <class T> class Singleton {
+public:
+    static T& Instance() {
+        static T instance;
+        return instance;
+    }
+};
+
+// Event on a futex word: 1 - signalled, 0 - not. Set() is an atomic store and enters
+// the kernel only if a thread is blocked in Wait(). Auto-reset event lets one waiter
+// through and resets itself, manual-reset event stays signalled until Reset().
+class Event {
+public:
+    Event(bool manualReset = false) : m_state(0), m_waiters(0), m_manualReset(manualReset) {
+    }
+
+    bool isValid() const {
+        return true;
+    }
+
+    void Set() {
+        // the waiter counts itself before it checks the state, the setter stores the
+        // state before it checks the waiters: one of them sees the other
+        __atomic_store_n(&m_state, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_waiters, __ATOMIC_SEQ_CST) != 0)
+            FutexWake(&m_state, m_manualReset ? INT_MAX : 1);
+    }
+
+    void Reset() {
+        __atomic_store_n(&m_state, 0, __ATOMIC_RELAXED);
+    }
+
+    WaitResult Wait(unsigned timeoutMs = INFINITE);
+
+private:
+    Event(const Event&);
+    Event& operator=(const Event&);
+
+    bool TryConsume() { // takes the signal
+        if (m_manualReset)
+            return __atomic_load_n(&m_state, __ATOMIC_ACQUIRE) == 1;
+        int expected = 1;
+        return __atomic_compare_exchange_n(&m_state, &expected, 0, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+
+    volatile int m_state;
+    volatile int m_waiters;
+    const bool   m_manualReset;
+};
+
+// Counting semaphore on eventfd(EFD_SEMAPHORE): each read decrements the counter by one,
+// each write of 1 increments it. Non-blocking descriptor: TryWait() is one read which
+// fails with EAGAIN when the counter is 0, Wait() polls the descriptor.
+// see: http://man7.org/linux/man-pages/man2/eventfd.2.html
+class Semaphore {
+public:
+    Semaphore() {
+    }
+
+    bool Init(unsigned initCount);
+
+    bool isValid() const {
+        return m_fd.isValid();
+    }
+
+    WaitResult TryWait() {
+        return Wait(0);
+    }
+    WaitResult Wait(unsigned timeoutMs = INFINITE);
+    bool Release();
+
+private:
+    Semaphore(const Semaphore&);
+    Semaphore& operator=(const Semaphore&);
+
+    HandleWrapper m_fd;
+};
+
+// C++11 features of the compiler: rvalue references and variadic templates
+#if __cplusplus >= 201103L
+#define MT_RVALUE_REFS
+#define MT_VARIADIC_TEMPLATES
+#endif
+
+// Queue with the upper size limit on preallocated contiguous storage.
+// Storage size is rounded up to the power of two, so the ring index is a mask.
+// Items are constructed in place by push()/emplace() and destroyed by pop(),
+// nothing is allocated after construction. Storage starts on a cache line,
+// large rings are offered to huge pages (allocation.h). With C++11 compiler items can be moved in
+// and out (front() returns non-const reference), so move-only types are supported.
+template <class T> class Queue {
+public:
+    Queue(int _bs) : m_buf_size(_bs), m_mask(Capacity(_bs) - 1), m_head(0), m_size(0),
+        m_items( static_cast<T*>(AllocateBuffer((m_mask + 1) * sizeof(T))) ) {
+        if (m_items == NULL)
+            throw std::bad_alloc();
+    }
+    ~Queue() {
+        while (!empty())
+            pop();
+        FreeBuffer(m_items, (m_mask + 1) * sizeof(T));
+    }
+
+    bool isFull() const {        // exception safe
+        return static_cast<size_t>(m_buf_size) == m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+    size_t size() const {
+        return m_size;
+    }
+
+    // crash-safe version
+    T& front() {
+        if (empty())
+            throw std::underflow_error("Queue buffer is empty");
+        return m_items[m_head];
+    }
+    const T& front() const {
+        if (empty())
+            throw std::underflow_error("Queue buffer is empty");
+        return m_items[m_head];
+    }
+
+    void pop() {
+        if (empty())
+            throw std::underflow_error("Queue buffer is empty");
+        m_items[m_head].~T();
+        m_head = (m_head + 1) & m_mask;
+        m_size--;
+    }
+
+    // for limiting Producer
+    void push(const T& t) {
+        new (Slot()) T(t);
+        m_size++; // only if the constructor did not throw
+    }
+
+#ifdef MT_RVALUE_REFS
+    void push(T&& t) {
+        new (Slot()) T(std::move(t));
+        m_size++;
+    }
+#endif
+
+#ifdef MT_VARIADIC_TEMPLATES
+    template <class... Args> void emplace(Args&&... args) {
+        new (Slot()) T(std::forward<Args>(args)...);
+        m_size++;
+    }
+#else
+    void emplace() {
+        new (Slot()) T();
+        m_size++;
+    }
+    template <class A1> void emplace(const A1& a1) {
+        new (Slot()) T(a1);
+        m_size++;
+    }
+    template <class A1, class A2> void emplace(const A1& a1, const A2& a2) {
+        new (Slot()) T(a1, a2);
+        m_size++;
+    }
+    template <class A1, class A2, class A3> void emplace(const A1& a1, const A2& a2, const A3& a3) {
+        new (Slot()) T(a1, a2, a3);
+        m_size++;
+    }
+#endif
+
+private:
+    Queue(const Queue&);
+    Queue& operator=(const Queue&);
+
+    static size_t Capacity(int bs) { // the power of two
+        size_t capacity = 1;
+        while (capacity < static_cast<size_t>(bs))
+            capacity <<= 1;
+        return capacity;
+    }
+
+    void* Slot() { // memory for the new tail item
+        if (isFull())    // disaster
+            throw std::overflow_error("Queue buffer is full");
+        return m_items + ((m_head + m_size) & m_mask);
+    }
+
+    const int    m_buf_size;
+    const size_t m_mask;
+    size_t       m_head;
+    size_t       m_size;
+    T*           m_items;
+};
+
+// high resolution interval measurement on CLOCK_MONOTONIC
+class Stopwatch {
+public:
+    Stopwatch() {
+        Start();
+    }
+
+    void Start() {
+        m_start = MonotonicNs();
+    }
+
+    double ElapsedNs() const {
+        return static_cast<double>(MonotonicNs() - m_start);
+    }
+
+private:
+    long long m_start;
+};
+
+enum SyncTimerState { ST_WORK, ST_STOP, ST_ERR };
+
+// using Singleton GOF pattern
+class SyncTimer {
+public:
+    // created once by the first call, later calls take no lock (Singleton above)
+    static SyncTimer& Instance() {
+        return Singleton<SyncTimer>::Instance();
+    }
+
+    bool isValid() const {
+        return m_hTimer.isValid();
+    }
+
+    bool SetTimer(unsigned timeoutMs); // relative to the current time
+
+    unsigned int GetTimeoutInsSec() const {
+        return m_timeoutSec;
+    }
+
+    // waits until the timer expires, false on failure or timeout
+    bool Wait(unsigned timeoutMs = INFINITE) const;
+
+    // Polled by the threads in their loops: compares the monotonic clock with the
+    // deadline of the timer without a system call. The timer descriptor is needed
+    // only to block in Wait().
+    SyncTimerState State() const {
+        const long long now = MonotonicNs();
+        if (now < 0)
+            return ST_ERR;
+        return now >= m_deadlineNs ? ST_STOP : ST_WORK;
+    }
+
+protected:
+    friend class Singleton<SyncTimer>;
+
+    SyncTimer(); // timerfd on CLOCK_MONOTONIC: not affected by changes of the system time
+
+private:
+    SyncTimer(const SyncTimer&);
+    SyncTimer& operator=(const SyncTimer&);
+
+    CriticalSection m_cs; // of SetTimer()
+
+    unsigned      m_timeoutSec;
+    long long     m_deadlineNs; // CLOCK_MONOTONIC
+    HandleWrapper m_hTimer;
+};
+
+// Console output shared by the threads: lines are written under the lock,
+// the service itself is found without one (Singleton above).
+class Logger {
+public:
+    static Logger& Instance() {
+        return Singleton<Logger>::Instance();
+    }
+
+    void Print(const char* msg) {
+        Lock lock(m_cs);
+        cout << msg << endl;
+    }
+    void Print(const char* msg, int value) {
+        Lock lock(m_cs);
+        cout << msg << value << endl;
+    }
+    void PutThreadFinishMsg(const char* msg, unsigned int timeout=0) {
+        Lock lock(m_cs);
+        cout << endl << msg;
+        if (timeout != 0)
+            cout << timeout << " sec.";
+        cout << " Thread Id: " << CurrentThreadId() << endl << endl;
+    }
+
+private:
+    friend class Singleton<Logger>;
+
+    Logger() {
+    }
+    Logger(const Logger&);
+    Logger& operator=(const Logger&);
+
+    CriticalSection m_cs;
+};
+
+} // namespace MT
@@ -0,0 +1,210 @@
+#include "stdafx.h"
+#include <sched.h>
+#include <map>
+#include <fstream>
+#include <algorithm>
+#include "threads.h"
+#include "topology.h"
+
+namespace MT {
+
+Topology Topology::m_instance;
+
+const char* const placementNames[PL_TOTAL] = {
+    "default", "smt", "l3", "cross-socket", "spread"
+};
+
+const char* PlacementName(Placement placement) {
+    return placementNames[placement];
+}
+
+bool ParsePlacement(const std::string& name, Placement& placement) {
+    for (int p = 0; p < PL_TOTAL; p++) {
+        if (name == placementNames[p]) {
+            placement = static_cast<Placement>(p);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PinThread(pthread_t thread, unsigned cpu) {
+    if (cpu == anyCpu)
+        return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return ::pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+template <class Key> static unsigned Dense(std::map<Key, unsigned>& ids, const Key& raw) {
+    typename std::map<Key, unsigned>::iterator it = ids.find(raw);
+    if (it == ids.end())
+        it = ids.insert(std::make_pair(raw, static_cast<unsigned>(ids.size()))).first;
+    return it->second;
+}
+
+Topology::Topology() : m_cores(0), m_l3s(0), m_packages(0) {
+    Discover();
+    Number();
+}
+
+const char sysfsCpu[] = "/sys/devices/system/cpu/cpu";
+
+// the first number of the sysfs file: the value, or the lowest processor of a list
+static bool ReadNumber(unsigned cpu, const std::string& file, unsigned& value) {
+    stringstream path;
+    path << sysfsCpu << cpu << '/' << file;
+    std::ifstream in(path.str().c_str());
+    unsigned number = 0;
+    if (!(in >> number))
+        return false; // no such file, or -1 (not reported)
+    value = number;
+    return true;
+}
+
+void Topology::Discover() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (::sched_getaffinity(0, sizeof(set), &set) != 0)
+        return;
+
+    for (unsigned i = 0; i < CPU_SETSIZE; i++) {
+        if (!CPU_ISSET(i, &set))
+            continue;
+        LogicalCpu cpu = { i, i, anyCpu, 0, 0 }; // a core each, one package
+        ReadNumber(i, "topology/core_id", cpu.core);
+        ReadNumber(i, "topology/physical_package_id", cpu.package);
+
+        // the lowest processor sharing the cache identifies the domain
+        for (unsigned index = 0; ; index++) {
+            stringstream cache;
+            cache << "cache/index" << index << '/';
+            unsigned level = 0;
+            if (!ReadNumber(i, cache.str() + "level", level))
+                break;
+            if (level == 3) {
+                ReadNumber(i, cache.str() + "shared_cpu_list", cpu.l3);
+                break;
+            }
+        }
+        m_cpus.push_back(cpu);
+    }
+}
+
+void Topology::Number() {
+    typedef std::pair<unsigned, unsigned> Key;
+    std::map<Key, unsigned> cores, l3s;
+    std::map<unsigned, unsigned> packages;
+    std::vector<unsigned> siblings;
+
+    for (size_t i = 0; i < m_cpus.size(); i++) {
+        LogicalCpu& cpu = m_cpus[i];
+        cpu.core = Dense(cores, Key(cpu.package, cpu.core)); // core numbers may repeat in packages
+        // cache domain is not reported: the package is taken
+        cpu.l3 = cpu.l3 == anyCpu ? Dense(l3s, Key(1, cpu.package)) : Dense(l3s, Key(0, cpu.l3));
+        cpu.package = Dense(packages, cpu.package);
+
+        if (siblings.size() <= cpu.core)
+            siblings.resize(cpu.core + 1, 0);
+        cpu.sibling = siblings[cpu.core]++;
+    }
+    m_cores    = static_cast<unsigned>(cores.size());
+    m_l3s      = static_cast<unsigned>(l3s.size());
+    m_packages = static_cast<unsigned>(packages.size());
+}
+
+void Topology::FirstOfCores(unsigned LogicalCpu::*domain, unsigned id,
+                            std::vector<unsigned>& cpus) const {
+    for (size_t i = 0; i < m_cpus.size(); i++)
+        if (m_cpus[i].*domain == id && m_cpus[i].sibling == 0)
+            cpus.push_back(m_cpus[i].cpu);
+}
+
+struct SpreadOrder { // siblings last, then cores of the packages in turn
+    unsigned sibling;
+    unsigned rank;    // of the core in its package
+    unsigned package;
+    unsigned cpu;
+
+    bool operator<(const SpreadOrder& other) const {
+        if (sibling != other.sibling)
+            return sibling < other.sibling;
+        if (rank != other.rank)
+            return rank < other.rank;
+        return package < other.package;
+    }
+};
+
+bool Topology::Place(Placement placement, unsigned count, std::vector<unsigned>& cpus) const {
+    cpus.clear();
+    if (placement == PL_DEFAULT || m_cpus.empty()) {
+        cpus.assign(count, anyCpu);
+        return placement == PL_DEFAULT;
+    }
+
+    std::vector<unsigned> candidates;
+    switch (placement) {
+        case PL_SMT_SIBLINGS: // one core with enough logical processors
+            for (unsigned c = 0; c < m_cores && candidates.size() < count; c++) {
+                candidates.clear();
+                for (size_t i = 0; i < m_cpus.size(); i++)
+                    if (m_cpus[i].core == c)
+                        candidates.push_back(m_cpus[i].cpu);
+            }
+            break;
+
+        case PL_SAME_L3: // one cache domain with enough cores
+            for (unsigned d = 0; d < m_l3s && candidates.size() < count; d++) {
+                candidates.clear();
+                FirstOfCores(&LogicalCpu::l3, d, candidates);
+            }
+            break;
+
+        case PL_CROSS_SOCKET: { // thread i on package i % packages
+            if (m_packages < 2)
+                return false;
+            std::vector< std::vector<unsigned> > perPackage(m_packages);
+            for (unsigned p = 0; p < m_packages; p++)
+                FirstOfCores(&LogicalCpu::package, p, perPackage[p]);
+            for (unsigned i = 0; i < count; i++) {
+                const std::vector<unsigned>& cores = perPackage[i % m_packages];
+                if (i / m_packages >= cores.size())
+                    return false;
+                candidates.push_back(cores[i / m_packages]);
+            }
+            break;
+        }
+
+        case PL_SPREAD: {
+            std::vector<SpreadOrder> order;
+            std::vector<unsigned> coreRank(m_cores, anyCpu), packageCores(m_packages, 0);
+            for (size_t i = 0; i < m_cpus.size(); i++) {
+                const LogicalCpu& cpu = m_cpus[i];
+                if (coreRank[cpu.core] == anyCpu)
+                    coreRank[cpu.core] = packageCores[cpu.package]++;
+                SpreadOrder item = { cpu.sibling, coreRank[cpu.core], cpu.package, cpu.cpu };
+                order.push_back(item);
+            }
+            std::sort(order.begin(), order.end());
+            for (unsigned i = 0; i < count; i++) // more threads than processors: round robin
+                candidates.push_back(order[i % order.size()].cpu);
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    if (candidates.size() < count)
+        return false;
+    cpus.assign(candidates.begin(), candidates.begin() + count);
+    return true;
+}
+
+void Topology::Report(std::ostream& out) const {
+    out << "Topology: " << m_cpus.size() << " logical processors, " << m_cores << " cores, "
+        << m_l3s << " L3 domains, " << m_packages << " packages" << endl;
+}
+
+} // namespace MT
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+// where the threads of a run are placed
+enum Placement {
+    PL_DEFAULT,      // not pinned: the scheduler decides and may migrate the threads
+    PL_SMT_SIBLINGS, // logical processors of one core: shared L1 and L2
+    PL_SAME_L3,      // different cores sharing the last level cache
+    PL_CROSS_SOCKET, // different packages: every handoff crosses the interconnect
+    PL_SPREAD,       // as far apart as possible: packages, then cores, then siblings
+    PL_TOTAL
+};
+
+const char* PlacementName(Placement placement); // as given on the command line
+bool ParsePlacement(const std::string& name, Placement& placement);
+
+const unsigned anyCpu = ~0u; // thread is not pinned
+
+struct LogicalCpu {
+    unsigned cpu;     // number of the processor in the affinity mask
+    unsigned core;    // physical core
+    unsigned l3;      // last level cache domain (the package if it is not reported)
+    unsigned package; // socket
+    unsigned sibling; // order of the logical processor in its core
+};
+
+// Processor topology of the machine, discovered once at start-up from sysfs
+// (/sys/devices/system/cpu/cpu<N>/topology and cache). Only the processors the
+// process may run on (sched_getaffinity: cpuset, taskset) are used. Without sysfs
+// every logical processor is taken for a core of one package.
+// see: https://www.kernel.org/doc/html/latest/admin-guide/cputopology.html
+class Topology {
+public:
+    static const Topology& Instance() {
+        return m_instance;
+    }
+
+    size_t Cpus() const {
+        return m_cpus.size();
+    }
+    unsigned Cores() const {
+        return m_cores;
+    }
+    unsigned Packages() const {
+        return m_packages;
+    }
+
+    // Processors for count threads by the placement policy, anyCpu for PL_DEFAULT.
+    // False if the machine has no such placement: no SMT, one socket or too few cores.
+    bool Place(Placement placement, unsigned count, std::vector<unsigned>& cpus) const;
+
+    void Report(std::ostream& out) const;
+
+private:
+    Topology();
+    Topology(const Topology&);
+    Topology& operator=(const Topology&);
+
+    void Discover();
+    void Number(); // dense core, cache and package numbers, sibling order
+
+    // the first logical processor of each core of the domain (all if domain is ~0u)
+    void FirstOfCores(unsigned LogicalCpu::*domain, unsigned id, std::vector<unsigned>& cpus) const;
+
+    static Topology m_instance;
+
+    std::vector<LogicalCpu> m_cpus;
+    unsigned m_cores;
+    unsigned m_l3s;
+    unsigned m_packages;
+};
+
+// sets the affinity of the thread to one processor, anyCpu leaves it as it is
+bool PinThread(pthread_t thread, unsigned cpu);
+
+} // namespace MT
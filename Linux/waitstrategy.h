@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include <sched.h>
+#include "threads.h"
+
+namespace MT {
+
+// how an idle thread waits for the other side: for an item in the buffer or a free slot
+enum WaitPolicy {
+    WP_BLOCK,   // block on the event at once (sleep if the other side signals none)
+    WP_SPIN,    // check with the pause instruction until ready: the lowest latency, a whole processor
+    WP_YIELD,   // spin, then give the processor to other threads between the checks
+    WP_BACKOFF, // spin, then sleep between the checks for periods doubled up to the limit
+    WP_PARK,    // spin, then block on the event (futex)
+    WP_TOTAL
+};
+
+const char* WaitPolicyName(WaitPolicy policy); // as given on the command line
+bool ParseWaitPolicy(const std::string& name, WaitPolicy& policy);
+
+struct WaitBudget {
+    static const unsigned defSpins        = 4000; // a few microseconds
+    static const unsigned defMaxBackoffMs = 16;
+
+    unsigned spins;        // checks before yielding, backing off or parking
+    unsigned maxBackoffMs; // longest sleep of the backoff
+
+    WaitBudget() : spins(defSpins), maxBackoffMs(defMaxBackoffMs) {
+    }
+};
+
+// Wait of a thread for a condition made true by another thread, by the policy.
+//
+// The condition is a functor: bool operator()() const, checked at least once before the
+// thread blocks. Spinning threads check it without a system call, so they see the
+// change within the time of one check, but they keep their processor busy all the time;
+// a blocked thread takes no processor time, but is woken up by the scheduler.
+class WaitStrategy {
+public:
+    WaitStrategy(WaitPolicy policy = WP_BLOCK, const WaitBudget& budget = WaitBudget()) :
+        m_policy(policy), m_budget(budget) {
+    }
+
+    WaitPolicy Policy() const {
+        return m_policy;
+    }
+    const WaitBudget& Budget() const {
+        return m_budget;
+    }
+
+    // Waits until ready() is true, the event wake is set or timeoutMs passes. wake is NULL
+    // if the other side signals nothing, then blocking is sleeping for the rest of the timeout.
+    template <class Ready> WaitResult Wait(const Ready& ready, Event* wake, unsigned timeoutMs) const;
+
+private:
+    static const unsigned m_clockPeriod = 1024; // spins between the reads of the clock
+
+    static unsigned Remaining(long long start, unsigned timeoutMs) {
+        if (timeoutMs == INFINITE)
+            return INFINITE;
+        const long long elapsedMs = (MonotonicNs() - start) / 1000000;
+        return elapsedMs >= timeoutMs ? 0 : timeoutMs - static_cast<unsigned>(elapsedMs);
+    }
+
+    template <class Ready> static WaitResult Block(const Ready& ready, Event* wake, unsigned timeoutMs) {
+        if (wake != NULL)
+            return wake->Wait(timeoutMs);
+        ::usleep(timeoutMs * 1000);
+        return ready() ? WR_OK : WR_TIMEOUT;
+    }
+
+    WaitPolicy m_policy;
+    WaitBudget m_budget;
+};
+
+template <class Ready> WaitResult WaitStrategy::Wait(const Ready& ready, Event* wake, unsigned timeoutMs) const {
+    if (m_policy == WP_BLOCK)
+        return Block(ready, wake, timeoutMs);
+
+    const long long start = MonotonicNs();
+    for (unsigned i = 1; m_policy == WP_SPIN || i <= m_budget.spins; i++) {
+        if (ready())
+            return WR_OK;
+        CpuRelax();
+        if (i % m_clockPeriod == 0 && Remaining(start, timeoutMs) == 0)
+            return WR_TIMEOUT;
+    }
+
+    switch (m_policy) {
+        case WP_YIELD:
+            for (;;) {
+                if (ready())
+                    return WR_OK;
+                if (Remaining(start, timeoutMs) == 0)
+                    return WR_TIMEOUT;
+                ::sched_yield(); // returns at once if no other thread is ready to run here
+            }
+        case WP_BACKOFF:
+            for (unsigned sleepMs = 1; ; sleepMs = std::min(2 * sleepMs, m_budget.maxBackoffMs)) {
+                if (ready())
+                    return WR_OK;
+                const unsigned remaining = Remaining(start, timeoutMs);
+                if (remaining == 0)
+                    return WR_TIMEOUT;
+                ::usleep(std::min(sleepMs, remaining) * 1000);
+            }
+        case WP_PARK:
+        default:
+            return Block(ready, wake, Remaining(start, timeoutMs));
+    }
+}
+
+} // namespace MT
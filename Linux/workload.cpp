@@ -0,0 +1,244 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "threads.h"
+#include "workload.h"
+
+namespace MT {
+
+const uint32_t WORKLOAD_MAGIC   = 0x4C574D54; // "MTWL"
+const uint16_t WORKLOAD_VERSION = 1;
+
+int WorkloadWriter::Open(const char* fileName) {
+    Close();
+    m_out.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_out.is_open())
+        return ERR_STD;
+    WorkloadHeader header = { WORKLOAD_MAGIC, WORKLOAD_VERSION, sizeof(WorkloadRecord), 0, 0 };
+    m_out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // the count is written by Close()
+    m_count = 0;
+    return m_out.good() ? RET_OK : ERR_STD;
+}
+
+bool WorkloadWriter::Append(unsigned long long deltaUs, unsigned size, unsigned priority) {
+    if (m_count == 0xFFFFFFFF)
+        return false;
+    WorkloadRecord record;
+    record.deltaUs  = static_cast<uint32_t>(std::min<unsigned long long>(deltaUs, 0xFFFFFFFF));
+    record.size     = static_cast<uint16_t>(std::min(size, 0xFFFFu));
+    record.priority = static_cast<uint8_t>(std::min(priority, 0xFFu));
+    record.reserved = 0;
+    m_out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    m_count++;
+    return m_out.good();
+}
+
+int WorkloadWriter::Close() {
+    if (!m_out.is_open())
+        return RET_OK;
+    WorkloadHeader header = { WORKLOAD_MAGIC, WORKLOAD_VERSION, sizeof(WorkloadRecord), m_count, 0 };
+    m_out.seekp(0);
+    m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const bool ok = m_out.good();
+    m_out.close();
+    return ok ? RET_OK : ERR_STD;
+}
+
+WorkloadReader::WorkloadReader() :
+    m_fileSize(0), m_count(0), m_next(0), m_view(NULL), m_viewOffset(0), m_viewBytes(0)
+{
+}
+
+int WorkloadReader::Open(const char* fileName) {
+    Close();
+    m_hFile.SetHandle( ::open(fileName, O_RDONLY | O_CLOEXEC) );
+    if (!m_hFile.isValid())
+        return ERR_API;
+    struct stat st;
+    if (::fstat(m_hFile, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(WorkloadHeader))) {
+        Close();
+        return ERR_STD;
+    }
+    m_fileSize = st.st_size;
+    if (!Map(0)) {
+        Close();
+        return ERR_API;
+    }
+
+    WorkloadHeader header;
+    memcpy(&header, m_view, sizeof(header));
+    if (header.magic != WORKLOAD_MAGIC || header.version != WORKLOAD_VERSION ||
+        header.recordSize != sizeof(WorkloadRecord) ||
+        m_fileSize < sizeof(header) + static_cast<uint64_t>(header.count) * sizeof(WorkloadRecord)) {
+        Close();
+        return ERR_STD;
+    }
+    m_count = header.count;
+    m_next  = 0;
+    return RET_OK;
+}
+
+void WorkloadReader::Close() {
+    Unmap();
+    m_hFile.SetHandle(-1);
+    m_fileSize = m_viewOffset = 0;
+    m_count = m_next = 0;
+}
+
+void WorkloadReader::Rewind() {
+    m_next = 0;
+}
+
+void WorkloadReader::Unmap() {
+    if (m_view != NULL)
+        ::munmap(const_cast<char*>(m_view), m_viewBytes);
+    m_view = NULL;
+    m_viewBytes = 0;
+}
+
+bool WorkloadReader::Map(uint64_t offset) {
+    Unmap();
+    m_viewOffset = offset - offset % m_viewSize;
+    const size_t bytes = static_cast<size_t>(std::min<uint64_t>(m_viewSize, m_fileSize - m_viewOffset));
+    void* view = ::mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, m_hFile, static_cast<off_t>(m_viewOffset));
+    if (view == MAP_FAILED)
+        return false;
+    ::madvise(view, bytes, MADV_SEQUENTIAL); // read ahead, the pages read are dropped first
+    m_view = static_cast<const char*>(view);
+    m_viewBytes = bytes;
+    return true;
+}
+
+bool WorkloadReader::Next(WorkloadRecord& record) {
+    if (m_next >= m_count)
+        return false;
+    const uint64_t offset = sizeof(WorkloadHeader) + static_cast<uint64_t>(m_next) * sizeof(WorkloadRecord);
+    if (m_view == NULL || offset < m_viewOffset || offset + sizeof(record) > m_viewOffset + m_viewBytes) {
+        if (!Map(offset))
+            return false;
+    }
+    memcpy(&record, m_view + (offset - m_viewOffset), sizeof(record));
+    m_next++;
+    return true;
+}
+
+int WorkloadReplay::Open(const char* fileName, double speed, unsigned loops) {
+    if (speed <= 0)
+        return ERR_STD;
+    Lock lock(m_cs);
+    m_speed = speed;
+    m_loops = loops;
+    return m_reader.Open(fileName);
+}
+
+void WorkloadReplay::Restart() {
+    Lock lock(m_cs);
+    m_reader.Rewind();
+    m_loop  = 0;
+    m_dueUs = 0;
+    m_clock.Start();
+}
+
+bool WorkloadReplay::Take(WorkloadRecord& record, double& dueNs) {
+    Lock lock(m_cs);
+    while (!m_reader.Next(record)) {
+        if (m_reader.Count() == 0 || (m_loops != 0 && m_loop + 1 >= m_loops))
+            return false;
+        m_loop++;
+        m_reader.Rewind();
+    }
+    m_dueUs += record.deltaUs;
+    dueNs = m_dueUs * 1000.0 / m_speed;
+    return true;
+}
+
+bool WorkloadReplay::Produce(WorkloadRecord& record) {
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    double dueNs = 0;
+    if (!Take(record, dueNs)) // the trace is over: no more arrivals in this run
+        return false;
+
+    // sleep in steps to see the end of the run, spin over the last milliseconds
+    for (double remainingMs = (dueNs - m_clock.ElapsedNs()) / 1e6; remainingMs > 0;
+                remainingMs = (dueNs - m_clock.ElapsedNs()) / 1e6) {
+        if (syncTimer.State() != ST_WORK)
+            break; // the producer sees the end of the run
+        if (remainingMs > m_sleepAheadMs)
+            ::usleep(std::min(static_cast<unsigned>(remainingMs) - m_sleepAheadMs, m_idleMs) * 1000);
+        else
+            ::sched_yield();
+    }
+    return true;
+}
+
+int WorkloadRecorder::Open(const char* fileName) {
+    Lock lock(m_cs);
+    return m_writer.Open(fileName);
+}
+
+int WorkloadRecorder::Close() {
+    Lock lock(m_cs);
+    return m_writer.Close();
+}
+
+void WorkloadRecorder::Restart() {
+    Lock lock(m_cs);
+    m_clock.Start();
+    m_lastNs = 0;
+}
+
+void WorkloadRecorder::Append(unsigned size, unsigned priority) {
+    Lock lock(m_cs);
+    if (!m_writer.isOpen())
+        return;
+    const double now = std::max(m_clock.ElapsedNs(), m_lastNs);
+    m_writer.Append(static_cast<unsigned long long>((now - m_lastNs) / 1000), size, priority);
+    m_lastNs = now;
+}
+
+int ConvertWorkloadLog(const char* logName, const char* traceName, unsigned& converted, unsigned& skipped) {
+    converted = skipped = 0;
+    std::ifstream log(logName);
+    if (!log.is_open())
+        return ERR_STD;
+    WorkloadWriter writer;
+    int ret = writer.Open(traceName);
+    if (ret != RET_OK)
+        return ret;
+
+    unsigned long long last = 0;
+    std::string line;
+    while (std::getline(log, line)) {
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+
+        std::istringstream in(line);
+        unsigned long long timestampUs = 0;
+        unsigned size = sizeof(int), priority = 0;
+        if (!(in >> timestampUs)) {
+            skipped++;
+            continue;
+        }
+        unsigned value = 0; // size and priority are optional
+        if (in >> value) {
+            size = value;
+            if (in >> value)
+                priority = value;
+        }
+
+        if (converted == 0)
+            last = timestampUs; // the trace starts with the first item
+        const unsigned long long deltaUs = timestampUs > last ? timestampUs - last : 0;
+        last = std::max(last, timestampUs);
+        if (!writer.Append(deltaUs, size, priority))
+            return ERR_STD;
+        converted++;
+    }
+    return writer.Close();
+}
+
+} // namespace MT
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include "threads.h"
+
+namespace MT {
+
+// Binary workload trace: arrivals of the items of a run, recorded from a run or converted
+// from a log, to be replayed by the producers.
+//
+// File: [header: magic, version, record size, count][records]
+// Records are 8 bytes: a record never crosses a mapped window of the reader.
+struct WorkloadHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct WorkloadRecord {
+    uint32_t deltaUs;  // from the arrival of the previous item (of the start for the first one)
+    uint16_t size;     // bytes of the item
+    uint8_t  priority;
+    uint8_t  reserved;
+};
+
+// Writes a trace file, the count of the header is written by Close()
+class WorkloadWriter {
+public:
+    WorkloadWriter() : m_count(0) {
+    }
+    ~WorkloadWriter() {
+        Close();
+    }
+
+    int  Open(const char* fileName);
+    bool Append(unsigned long long deltaUs, unsigned size, unsigned priority); // saturated to the fields
+    int  Close();
+
+    bool isOpen() const {
+        return m_out.is_open();
+    }
+    uint32_t Count() const {
+        return m_count;
+    }
+
+private:
+    WorkloadWriter(const WorkloadWriter&);
+    WorkloadWriter& operator=(const WorkloadWriter&);
+
+    std::ofstream m_out;
+    uint32_t      m_count;
+};
+
+// Streams the records of a trace file in order through a sliding mapped view: only the
+// window of the current record is in the address space, whatever the size of the trace.
+// The view is advised sequential, so the kernel reads ahead and drops pages behind it.
+class WorkloadReader {
+public:
+    static const unsigned m_viewSize = 1024 * 1024; // multiple of the page size
+
+    WorkloadReader();
+    ~WorkloadReader() {
+        Close();
+    }
+
+    int  Open(const char* fileName);
+    void Close();
+    void Rewind();
+    bool Next(WorkloadRecord& record); // false at the end of the trace
+
+    bool isOpen() const {
+        return m_hFile.isValid();
+    }
+    uint32_t Count() const {
+        return m_count;
+    }
+
+private:
+    WorkloadReader(const WorkloadReader&);
+    WorkloadReader& operator=(const WorkloadReader&);
+
+    bool Map(uint64_t offset); // the window containing the offset
+    void Unmap();
+
+    HandleWrapper m_hFile;
+    uint64_t      m_fileSize;
+    uint32_t      m_count;
+    uint32_t      m_next;       // index of the next record
+    const char*   m_view;
+    uint64_t      m_viewOffset; // of the file
+    size_t        m_viewBytes;
+};
+
+// Replays a trace to the producers of a run: each Produce() takes the next record and
+// waits until its arrival, scaled by the speed, from the start of the run. Producers of a
+// runner share the trace, so its arrivals are spread over them.
+//
+// The trace is played m_loops times (0 - until the end of the run) and it drives the
+// number of items: after the last record the producers stop as if all their items were
+// sent, whatever the item count of the runner.
+class WorkloadReplay {
+public:
+    static const unsigned m_sleepAheadMs = 2;  // sleep only if the arrival is further: usleep() slack
+    static const unsigned m_idleMs       = 50; // longest sleep, to see the end of the run
+
+    WorkloadReplay() : m_speed(1), m_loops(1), m_loop(0), m_dueUs(0) {
+    }
+
+    int  Open(const char* fileName, double speed, unsigned loops);
+    bool isEnabled() const {
+        return m_reader.isOpen();
+    }
+    double Speed() const {
+        return m_speed;
+    }
+    unsigned Loops() const {
+        return m_loops;
+    }
+
+    void Restart(); // before a run, producers must not be running
+    bool Produce(WorkloadRecord& record); // waits for the arrival of the next item, false after the last
+
+private:
+    WorkloadReplay(const WorkloadReplay&);
+    WorkloadReplay& operator=(const WorkloadReplay&);
+
+    bool Take(WorkloadRecord& record, double& dueNs); // the next record, false after the last loop
+
+    CriticalSection    m_cs; // protects all below
+    WorkloadReader     m_reader;
+    double             m_speed;
+    unsigned           m_loops;
+    unsigned           m_loop;
+    unsigned long long m_dueUs;   // arrival of the last taken record at 1x
+    Stopwatch          m_clock;   // started by Restart()
+};
+
+// Records the arrivals of the produced items to a trace file. Each run starts from its
+// Restart(), so the runs follow each other in the trace without the time between them.
+class WorkloadRecorder {
+public:
+    WorkloadRecorder() : m_lastNs(0) {
+    }
+
+    int  Open(const char* fileName);
+    int  Close();
+    bool isEnabled() const {
+        return m_writer.isOpen();
+    }
+
+    void Restart(); // before a run
+    void Append(unsigned size, unsigned priority);
+
+private:
+    WorkloadRecorder(const WorkloadRecorder&);
+    WorkloadRecorder& operator=(const WorkloadRecorder&);
+
+    CriticalSection m_cs; // protects all below
+    WorkloadWriter  m_writer;
+    Stopwatch       m_clock;  // started by Restart()
+    double          m_lastNs; // arrival of the last item
+};
+
+// Converts a text log to a trace. A line is "<timestamp us> [size] [priority]", timestamps
+// are not decreasing (an earlier one is taken as the previous). Empty lines and lines
+// starting with # are skipped, other lines which are not parsed are counted as skipped.
+int ConvertWorkloadLog(const char* logName, const char* traceName, unsigned& converted, unsigned& skipped);
+
+} // namespace MT
@@ -0,0 +1,297 @@
+#include "stdafx.h"
+#include <sched.h>
+#include <vector>
+#include "threads.h"
+#include "workstack.h"
+
+namespace MT {
+
+bool CSQueue::Push(unsigned, int item) {
+    Lock lock(m_cs);
+    if (m_queue.isFull())
+        return false;
+    m_queue.push(item);
+    return true;
+}
+
+bool CSQueue::Pop(unsigned, int& item) {
+    Lock lock(m_cs);
+    if (m_queue.empty())
+        return false;
+    item = m_queue.front();
+    m_queue.pop();
+    return true;
+}
+
+TreiberStack::TreiberStack(size_t capacity) : m_nodes(capacity) {
+    m_top.value  = Tagged(m_nil, 0);
+    m_free.value = Tagged(m_nil, 0);
+    if (!m_nodes.isValid())
+        return;
+    for (size_t i = 0; i < capacity; i++)
+        PushNode(m_free.value, static_cast<uint32_t>(i));
+}
+
+bool TreiberStack::Push(unsigned, int item) {
+    const uint32_t index = PopNode(m_free.value);
+    if (index == m_nil)
+        return false;
+    m_nodes[index].item = item;
+    PushNode(m_top.value, index); // release: the item is seen before the node
+    return true;
+}
+
+bool TreiberStack::Pop(unsigned, int& item) {
+    const uint32_t index = PopNode(m_top.value);
+    if (index == m_nil)
+        return false;
+    item = m_nodes[index].item;
+    PushNode(m_free.value, index);
+    return true;
+}
+
+uint32_t TreiberStack::PopNode(uint64_t& top) {
+    uint64_t old = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+    for (;;) {
+        const uint32_t index = IndexOf(old);
+        if (index == m_nil)
+            return m_nil;
+        // stale if the node is popped meanwhile: the tag differs
+        const uint32_t next = __atomic_load_n(&m_nodes[index].next, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&top, &old, Tagged(next, TagOf(old) + 1), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return index;
+    }
+}
+
+void TreiberStack::PushNode(uint64_t& top, uint32_t index) {
+    uint64_t old = __atomic_load_n(&top, __ATOMIC_RELAXED);
+    for (;;) {
+        __atomic_store_n(&m_nodes[index].next, IndexOf(old), __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&top, &old, Tagged(index, TagOf(old) + 1), false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+static long RingSize(size_t capacity) { // the power of two: the index is masked
+    long size = 1;
+    while (static_cast<size_t>(size) < capacity)
+        size *= 2;
+    return size;
+}
+
+WorkStealingPool::WorkStealingPool(size_t capacity, unsigned threads) : m_threads(threads),
+    m_capacity(static_cast<long>(capacity)), m_mask(RingSize(capacity) - 1),
+    m_deques(threads), m_items(threads * (m_mask + 1)) {
+}
+
+bool WorkStealingPool::Push(unsigned slot, int item) {
+    Deque& d = m_deques[slot];
+    const long b = __atomic_load_n(&d.bottom, __ATOMIC_RELAXED);
+    const long t = __atomic_load_n(&d.top, __ATOMIC_ACQUIRE);
+    if (b - t >= m_capacity) // the top only grows: a stale one errs on the full side
+        return false;
+    __atomic_store_n(&m_items[slot * (m_mask + 1) + (b & m_mask)], item, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // the item is seen before the bottom
+    __atomic_store_n(&d.bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool WorkStealingPool::Pop(unsigned slot, int& item) {
+    if (PopBottom(slot, item))
+        return true;
+    for (unsigned i = 1; i < m_threads; i++) {
+        if (Steal((slot + i) % m_threads, item)) {
+            Deque& d = m_deques[slot];
+            d.steals = d.steals + 1; // the only writer
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned long long WorkStealingPool::Steals() const {
+    unsigned long long steals = 0;
+    for (unsigned i = 0; i < m_threads; i++)
+        steals += m_deques[i].steals;
+    return steals;
+}
+
+// The bottom is lowered before the top is read: a thief reading the top after it sees
+// the lowered bottom, so the owner and a thief cannot take one item both, except the
+// last one which they take by the swap of the top.
+bool WorkStealingPool::PopBottom(unsigned slot, int& item) {
+    Deque& d = m_deques[slot];
+    const long b = __atomic_load_n(&d.bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d.bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d.top, __ATOMIC_RELAXED);
+    if (b - t < 0) { // empty
+        __atomic_store_n(&d.bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    item = __atomic_load_n(&m_items[slot * (m_mask + 1) + (b & m_mask)], __ATOMIC_RELAXED);
+    if (b != t)
+        return true; // more items left: no thief reaches this one
+    const bool taken = __atomic_compare_exchange_n(&d.top, &t, t + 1, false,
+                                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&d.bottom, b + 1, __ATOMIC_RELAXED); // empty either way
+    return taken;
+}
+
+bool WorkStealingPool::Steal(unsigned victim, int& item) {
+    Deque& d = m_deques[victim];
+    long t = __atomic_load_n(&d.top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // the top is read before the bottom
+    const long b = __atomic_load_n(&d.bottom, __ATOMIC_ACQUIRE);
+    if (b - t <= 0)
+        return false;
+    item = __atomic_load_n(&m_items[victim * (m_mask + 1) + (t & m_mask)], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&d.top, &t, t + 1, false, // lost to another thief or the owner
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+BulkJob::BulkJob(unsigned workers) : m_workers(workers),
+    m_bytes(Capacity(workers) * m_payloadBytes), m_payloads( static_cast<char*>(AllocateBuffer(m_bytes)) ),
+    m_claimed(0), m_remaining(0) {
+}
+
+BulkJob::~BulkJob() {
+    FreeBuffer(m_payloads, m_bytes);
+}
+
+bool BulkJob::ClaimBurst(int& first) {
+    const long total = static_cast<long>(m_workers) * m_items; // a multiple of the burst
+    if (__atomic_load_n(&m_claimed, __ATOMIC_RELAXED) >= total)
+        return false;
+    first = static_cast<int>(__atomic_fetch_add(&m_claimed, m_burst, __ATOMIC_RELAXED));
+    return first < total;
+}
+
+// the checksum of the payload is the sum of its words
+long long BulkJob::Write(int item, int seed) {
+    int* words = reinterpret_cast<int*>(m_payloads + static_cast<size_t>(item) * m_payloadBytes);
+    const int count = m_payloadBytes / sizeof(int);
+    for (int i = 0; i < count; i++)
+        words[i] = seed + i;
+    return static_cast<long long>(seed) * count + static_cast<long long>(count) * (count - 1) / 2;
+}
+
+long long BulkJob::Read(int item) const {
+    const int* words = reinterpret_cast<const int*>(m_payloads + static_cast<size_t>(item) * m_payloadBytes);
+    long long sum = 0;
+    for (unsigned i = 0; i < m_payloadBytes / sizeof(int); i++)
+        sum += words[i];
+    return sum;
+}
+
+void BulkJob::Process(WorkerArgs& a, const Stopwatch& sw, int item) {
+    __atomic_sub_fetch(&m_remaining, 1, __ATOMIC_RELAXED);
+    const double start = sw.ElapsedNs();
+    a.read   += Read(item);
+    a.readNs += sw.ElapsedNs() - start;
+}
+
+int BulkJob::Run(SharedQueue& dispatch, BulkJobResult& result) {
+    if (!isValid() || !dispatch.isValid() || m_workers == 0 || m_workers > m_maxWorkers)
+        return ERR_STD;
+
+    long long written = 0;
+    for (unsigned i = 0; i < m_backlog; i++) { // dealt out to the deques of all workers
+        written += Write(static_cast<int>(i), static_cast<int>(i));
+        if (!dispatch.Push(i % m_workers, static_cast<int>(i)))
+            return ERR_SYNC;
+    }
+    __atomic_store_n(&m_claimed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_remaining, static_cast<long>(TotalItems()), __ATOMIC_RELAXED);
+
+    Event start(true);
+    AlignedArray<WorkerArgs> args(m_workers); // zeroed
+    if (!args.isValid())
+        return ERR_STD;
+    for (unsigned i = 0; i < m_workers; i++) {
+        args[i].job      = this;
+        args[i].dispatch = &dispatch;
+        args[i].slot     = i;
+        args[i].start    = &start;
+    }
+
+    std::vector<pthread_t> threads;
+    for (unsigned i = 0; i < m_workers; i++) {
+        pthread_t thread;
+        if (!StartThread(&Worker, &args[i], 0, thread))
+            break;
+        threads.push_back(thread);
+    }
+    if (threads.size() != m_workers)
+        __atomic_store_n(&m_remaining, 0, __ATOMIC_RELAXED); // the created workers exit at once
+
+    Stopwatch sw;
+    start.Set(); // also releases already created threads if some creation failed
+    int ret = RET_OK;
+    for (size_t i = 0; i < threads.size(); i++) {
+        unsigned code = RET_OK;
+        if (JoinThread(threads[i], code) != WR_OK)
+            ret = ERR_SYNC;
+        else if (code != RET_OK && ret == RET_OK)
+            ret = static_cast<int>(code);
+    }
+    const double elapsedNs = sw.ElapsedNs();
+
+    if (threads.size() != m_workers)
+        return ERR_API;
+    if (ret != RET_OK)
+        return ret;
+
+    long long read = 0;
+    double readNs  = 0;
+    for (unsigned i = 0; i < m_workers; i++) {
+        written += args[i].written;
+        read    += args[i].read;
+        readNs  += args[i].readNs;
+    }
+    if (read != written)
+        return ERR_SYNC;
+
+    result.itemsPerSec   = TotalItems() * 1e9 / elapsedNs;
+    result.readNsPerItem = readNs / TotalItems();
+    return RET_OK;
+}
+
+// A worker makes a burst when it has the slots for one and processes an item in between:
+// it pops the items of its bursts, or of the backlog, or of the bursts of the others.
+unsigned BulkJob::Worker(void* args) {
+
+    WorkerArgs& a = *static_cast<WorkerArgs*>(args);
+    BulkJob& job = *a.job;
+    std::vector<int> free; // slots of the next bursts
+    for (unsigned i = 0; i < m_burst; i++)
+        free.push_back(static_cast<int>(m_backlog + a.slot * m_burst + i));
+    Stopwatch sw;
+    if (a.start->Wait() != WR_OK)
+        return ERR_SYNC;
+
+    int first = 0;
+    while (job.Remaining()) {
+        if (free.size() >= m_burst && job.ClaimBurst(first)) {
+            for (unsigned i = 0; i < m_burst; i++) {
+                const int item = free.back();
+                free.pop_back();
+                a.written += job.Write(item, first + static_cast<int>(i));
+                if (!a.dispatch->Push(a.slot, item))
+                    return ERR_SYNC; // sized for all slots
+            }
+        }
+        int item = 0;
+        if (a.dispatch->Pop(a.slot, item)) {
+            job.Process(a, sw, item);
+            free.push_back(item);
+        } else {
+            ::sched_yield(); // the items are being made or lost the race for the last one
+        }
+    }
+    return RET_OK;
+}
+
+} // namespace MT
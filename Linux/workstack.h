@@ -0,0 +1,211 @@
+#pragma once
+
+#include "threads.h"
+
+namespace MT {
+
+// Bounded queue of items shared by many threads, as in combining.h of the Windows build.
+// Each thread passes its own slot number (0 .. threads-1) which the implementations may
+// use for per-thread state.
+class SharedQueue {
+public:
+    virtual ~SharedQueue() {
+    }
+
+    virtual const char* Name() const = 0;
+    virtual bool isValid() const = 0;
+
+    virtual bool Push(unsigned slot, int item) = 0;  // false if full
+    virtual bool Pop(unsigned slot, int& item) = 0;  // false if empty
+};
+
+// MT::Queue locked by a critical section
+class CSQueue : public SharedQueue {
+public:
+    CSQueue(size_t capacity) : m_queue(static_cast<int>(capacity)) {
+    }
+
+    virtual const char* Name() const {
+        return "critical section";
+    }
+    virtual bool isValid() const {
+        return m_cs.isValid();
+    }
+    virtual bool Push(unsigned slot, int item);
+    virtual bool Pop(unsigned slot, int& item);
+
+private:
+    CriticalSection m_cs;
+    Queue<int>      m_queue;
+};
+
+// Lock-free LIFO stack (Treiber, IBM RJ 5118, 1986) of preallocated nodes, free nodes
+// are kept in the second stack of the same kind.
+//
+// Nodes are addressed by 32-bit indices of one array, so the index of the top node and
+// a tag fit in 64 bits and are replaced together by one compare-and-swap (cmpxchg8b on
+// 32-bit x86, without the double-width swap x86-64 pointers would need). Every change
+// of the top increments the tag: if the top node was popped and pushed again while a
+// thread was preempted between reading the top and its swap (ABA), the tag differs and
+// the swap fails. Nodes are never freed while the stack exists, so reading the link of
+// a node another thread has just popped is safe.
+class TreiberStack : public SharedQueue {
+public:
+    TreiberStack(size_t capacity);
+
+    virtual const char* Name() const {
+        return "Treiber stack";
+    }
+    virtual bool isValid() const {
+        return m_nodes.isValid();
+    }
+    virtual bool Push(unsigned slot, int item);
+    virtual bool Pop(unsigned slot, int& item);
+
+private:
+    static const uint32_t m_nil = 0xFFFFFFFF; // index of no node: the stack is empty
+
+    struct Node {
+        uint32_t next; // atomic
+        int      item;
+    };
+
+    // index of the top node in the low half, the tag in the high half
+    static uint64_t Tagged(uint32_t index, uint32_t tag) {
+        return static_cast<uint64_t>(tag) << 32 | index;
+    }
+    static uint32_t IndexOf(uint64_t top) {
+        return static_cast<uint32_t>(top);
+    }
+    static uint32_t TagOf(uint64_t top) {
+        return static_cast<uint32_t>(top >> 32);
+    }
+
+    uint32_t PopNode(uint64_t& top);
+    void     PushNode(uint64_t& top, uint32_t index);
+
+    AlignedArray<Node>     m_nodes;
+    CacheAligned<uint64_t> m_top;  // atomic
+    CacheAligned<uint64_t> m_free; // atomic
+};
+
+// Per-thread deques of work stealing (Chase, Lev, SPAA 2005), bounded; the fences are
+// those of the C11 version (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+//
+// A thread pushes and pops at the bottom of its own deque: it takes its freshest item
+// first (LIFO), whose data is still in its cache. A thread whose deque is empty steals
+// from the top of the others: their oldest items (FIFO), the ones their owners would
+// reach last. The owner synchronises with the thieves only for the last item of its
+// deque, the thieves race for the top with compare-and-swap.
+// https://www.di.ens.fr/~zappa/readings/ppopp13.pdf
+class WorkStealingPool : public SharedQueue {
+public:
+    WorkStealingPool(size_t capacity, unsigned threads); // capacity of each deque
+
+    virtual const char* Name() const {
+        return "work stealing";
+    }
+    virtual bool isValid() const {
+        return m_deques.isValid() && m_items.isValid();
+    }
+    virtual bool Push(unsigned slot, int item); // to the deque of the slot
+    virtual bool Pop(unsigned slot, int& item); // own deque first, then steals
+
+    unsigned long long Steals() const; // read when the threads have exited
+
+private:
+    struct MT_CACHE_ALIGN Deque {
+        long          top;    // atomic, next to steal: the thieves and the owner move it
+        char          pad[CACHE_LINE - sizeof(long)];
+        long          bottom; // atomic, next to push: the owner only
+        unsigned long steals; // from the other deques, the owner is the only writer
+    };
+
+    bool PopBottom(unsigned slot, int& item);
+    bool Steal(unsigned victim, int& item);
+
+    const unsigned      m_threads;
+    const long          m_capacity;
+    const long          m_mask;    // of the ring of a deque
+    AlignedArray<Deque> m_deques;
+    AlignedArray<int>   m_items;   // atomic, the rings of all deques one after another
+};
+
+// Bulk job measuring the dispatch order against the cache.
+//
+// The backlog of items is queued before the workers start. Then each worker repeatedly
+// makes a burst of items, writing their payloads, and processes as many, reading the
+// payloads of the items it pops, until all items are processed. The payloads of the
+// backlog are several times the size of the last level cache: a FIFO worker reads the
+// payloads written a backlog ago, long evicted, a LIFO worker the ones just written.
+// The time of reading the payloads is what the cache misses cost.
+//
+// Items are the numbers of the payload slots: a worker makes its bursts in the slots it
+// has processed, so the slots are never shared by two items. The bursts are claimed from
+// the common count by the worker which has the slots for one: a worker whose items were
+// stolen does not stop the job.
+struct BulkJobResult {
+    double itemsPerSec;
+    double readNsPerItem;
+};
+
+class BulkJob {
+public:
+    static const unsigned m_backlog      = 8192;  // 32 MB of payloads
+    static const unsigned m_items        = 32768; // made and processed after the backlog, per worker
+    static const unsigned m_burst        = 16;
+    static const unsigned m_payloadBytes = 4096;
+    static const unsigned m_maxWorkers   = 64;
+
+    static size_t Capacity(unsigned workers) { // payload slots: all items fit in any structure
+        return m_backlog + workers * m_burst;
+    }
+
+    BulkJob(unsigned workers);
+    ~BulkJob();
+
+    bool isValid() const {
+        return m_payloads != NULL;
+    }
+    unsigned Workers() const {
+        return m_workers;
+    }
+    unsigned long TotalItems() const {
+        return m_backlog + static_cast<unsigned long>(m_workers) * m_items;
+    }
+
+    // ERR_SYNC if the dispatch lost or duplicated an item, ERR_API if threads are not created
+    int Run(SharedQueue& dispatch, BulkJobResult& result);
+
+private:
+    BulkJob(const BulkJob&);
+    BulkJob& operator=(const BulkJob&);
+
+    struct MT_CACHE_ALIGN WorkerArgs {
+        BulkJob*     job;
+        SharedQueue* dispatch;
+        unsigned     slot;
+        Event*       start;   // manual-reset event releasing all threads at once
+        long long    written; // output: checksum of the payloads written
+        long long    read;    // output: checksum of the payloads read
+        double       readNs;  // output
+    };
+
+    static THREAD_FUNCTION Worker;
+
+    bool      ClaimBurst(int& first); // false if all bursts are made
+    long long Write(int item, int seed);
+    long long Read(int item) const;
+    void      Process(WorkerArgs& a, const Stopwatch& sw, int item);
+    bool      Remaining() const {
+        return __atomic_load_n(&m_remaining, __ATOMIC_RELAXED) > 0;
+    }
+
+    const unsigned m_workers;
+    const size_t   m_bytes;
+    char*          m_payloads;
+    long           m_claimed;   // atomic, items of the bursts claimed by the workers
+    long           m_remaining; // atomic, items not popped yet
+};
+
+} // namespace MT
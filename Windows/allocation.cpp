@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include <malloc.h>
+#include "threads.h"
+
+namespace MT {
+
+void* AllocateAligned(size_t size, size_t alignment) {
+    return _aligned_malloc(size, alignment);
+}
+
+void FreeAligned(void* p) {
+    _aligned_free(p); // NULL is ignored
+}
+
+// the privilege is disabled in the process token by default
+static bool EnableLockMemoryPrivilege() {
+    HANDLE hToken = NULL;
+    if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+        return false;
+    HandleWrapper token(hToken);
+
+    TOKEN_PRIVILEGES tp;
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (!::LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid))
+        return false;
+
+    // succeeds also if the privilege is not held, then ERROR_NOT_ALL_ASSIGNED is set
+    if (!::AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL))
+        return false;
+    return ::GetLastError() == ERROR_SUCCESS;
+}
+
+size_t LargePageSize() {
+    // computed once, the same result if threads race here
+    static bool   checked = false;
+    static size_t size    = 0;
+    if (checked)
+        return size;
+
+    // Windows Server 2003 and later, resolved at runtime
+    typedef SIZE_T (WINAPI *GetLargePageMinimumFn)();
+    HMODULE hKernel = ::GetModuleHandle(_T("kernel32.dll"));
+    GetLargePageMinimumFn getLargePageMinimum = (hKernel == NULL) ? NULL :
+        reinterpret_cast<GetLargePageMinimumFn>(::GetProcAddress(hKernel, "GetLargePageMinimum"));
+
+    if (getLargePageMinimum != NULL && EnableLockMemoryPrivilege())
+        size = getLargePageMinimum();
+    checked = true;
+    return size;
+}
+
+void* AllocatePages(size_t size, bool largePages, bool* isLarge) {
+    const size_t largePage = largePages ? LargePageSize() : 0;
+    void* p = NULL;
+    if (largePage != 0) {
+        size_t rounded = (size + largePage - 1) / largePage * largePage;
+        p = ::VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    if (isLarge != NULL)
+        *isLarge = (p != NULL);
+    if (p == NULL) // no contiguous physical memory for large pages is also possible
+        p = ::VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    return p;
+}
+
+void FreePages(void* p) {
+    if (p != NULL)
+        ::VirtualFree(p, 0, MEM_RELEASE);
+}
+
+// the same decision for allocation and release
+static bool OnPages(size_t size) {
+    const size_t minLargePage = 2 * 1024 * 1024; // small buffers do not query the system
+    if (size < minLargePage)
+        return false;
+    const size_t largePage = LargePageSize();
+    return largePage != 0 && size >= largePage;
+}
+
+void* AllocateBuffer(size_t size) {
+    return OnPages(size) ? AllocatePages(size, true) : AllocateAligned(size);
+}
+
+void FreeBuffer(void* p, size_t size) {
+    if (OnPages(size))
+        FreePages(p);
+    else
+        FreeAligned(p);
+}
+
+} // namespace MT
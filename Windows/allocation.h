@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string.h>
+
+namespace MT {
+
+// Cache line is the destructive interference size of x86 and x64 processors: threads
+// writing different variables of one line invalidate each other's cache (false sharing).
+const size_t CACHE_LINE = 64;
+
+// __declspec(align()) takes only a literal
+#define MT_CACHE_ALIGN __declspec(align(64))
+
+// value on its own cache line: aligned and padded to the line size
+template <class T> struct MT_CACHE_ALIGN CacheAligned {
+    T value;
+};
+
+// heap block aligned to the cache line (operator new does not honour __declspec(align))
+void* AllocateAligned(size_t size, size_t alignment = CACHE_LINE);
+void  FreeAligned(void* p);
+
+// Large pages (2 MB on x86/x64) reduce TLB misses of big buffers. They need
+// "Lock pages in memory" privilege of the user, the size of the allocation
+// must be a multiple of the large page size and the memory is never paged out.
+// see: http://msdn.microsoft.com/en-us/library/windows/desktop/aa366720(v=vs.85).aspx
+size_t LargePageSize(); // 0 if large pages cannot be used
+void*  AllocatePages(size_t size, bool largePages, bool* isLarge = NULL); // falls back to small pages
+void   FreePages(void* p);
+
+// Buffers of shared structures: cache-aligned block, or large pages for the blocks
+// of at least the large page size if available
+void* AllocateBuffer(size_t size);
+void  FreeBuffer(void* p, size_t size);
+
+// zero-initialised array of cache-aligned POD items (std::vector cannot hold them in VS2008)
+template <class T> class AlignedArray {
+public:
+    AlignedArray(size_t size) : m_size(size),
+        m_items( static_cast<T*>(AllocateAligned(size * sizeof(T))) ) {
+        if (m_items != NULL)
+            memset(m_items, 0, size * sizeof(T));
+    }
+    ~AlignedArray() {
+        FreeAligned(m_items);
+    }
+
+    bool isValid() const {
+        return m_items != NULL;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    T& operator[](size_t i) {
+        return m_items[i];
+    }
+    const T& operator[](size_t i) const {
+        return m_items[i];
+    }
+
+private:
+    AlignedArray(const AlignedArray&);
+    AlignedArray& operator=(const AlignedArray&);
+
+    size_t m_size;
+    T*     m_items;
+};
+
+} // namespace MT
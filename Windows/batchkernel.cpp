@@ -0,0 +1,243 @@
+#include "stdafx.h"
+#include <intrin.h>    // __cpuid
+#include <emmintrin.h> // SSE2
+#if _MSC_VER >= 1700
+#include <immintrin.h> // AVX2
+#define MT_KERNEL_AVX2
+#endif
+#include "batchkernel.h"
+
+namespace MT {
+
+const char* const kernelLevelNames[KL_TOTAL] = { "scalar", "sse2", "avx2" };
+
+const char* KernelLevelName(KernelLevel level) {
+    return kernelLevelNames[level];
+}
+
+bool ParseKernelLevel(const std::string& name, KernelLevel& level) {
+    for (int l = 0; l < KL_TOTAL; l++) {
+        if (name == kernelLevelNames[l]) {
+            level = static_cast<KernelLevel>(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+// http://msdn.microsoft.com/en-us/library/hskdteyh(v=vs.90).aspx
+static KernelLevel DetectKernelLevel() {
+    int info[4] = { 0 }; // eax, ebx, ecx, edx
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    if (maxLeaf < 1)
+        return KL_SCALAR;
+    __cpuid(info, 1);
+    if ((info[3] & (1 << 26)) == 0) // SSE2
+        return KL_SCALAR;
+#ifdef MT_KERNEL_AVX2
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx     = (info[2] & (1 << 28)) != 0;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) { // XMM and YMM state is saved
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) // AVX2
+            return KL_AVX2;
+    }
+#endif
+    return KL_SSE2;
+}
+
+// before main(): no thread reads it while it is written
+static const KernelLevel g_bestLevel = DetectKernelLevel();
+
+KernelLevel BestKernelLevel() {
+    return g_bestLevel;
+}
+
+// the fields are a xorshift sequence seeded by the item number
+void DecodeRecord(int msg, int* words) {
+    unsigned x = static_cast<unsigned>(msg) * 2654435761U | 1; // never 0
+    for (unsigned k = 0; k < RECORD_WORDS; k++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        words[k] = static_cast<int>(x);
+    }
+}
+
+// primes of xxHash32
+const unsigned PRIME1 = 2654435761U;
+const unsigned PRIME2 = 2246822519U;
+const unsigned PRIME3 = 3266489917U;
+const unsigned PRIME4 = 668265263U;
+const unsigned PRIME5 = 374761393U;
+const unsigned LANES  = 8;
+
+static inline unsigned Rotl(unsigned x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline unsigned Round(unsigned lane, int word) {
+    return Rotl(lane + static_cast<unsigned>(word) * PRIME2, 13) * PRIME1;
+}
+
+static void InitLanes(unsigned* lanes) { // different seeds: equal words in different lanes differ
+    for (unsigned j = 0; j < LANES; j++)
+        lanes[j] = PRIME5 + j * PRIME1;
+}
+
+// common to all kernels: merges the lanes, folds the tail words in and mixes the bits
+static unsigned Finish(const unsigned* lanes, const int* tail, size_t tailCount, size_t count) {
+    unsigned h = static_cast<unsigned>(count) * PRIME5;
+    for (unsigned j = 0; j < LANES; j++)
+        h = Rotl(h + lanes[j] * PRIME2, 13) * PRIME1;
+    for (size_t i = 0; i < tailCount; i++)
+        h = Rotl(h + static_cast<unsigned>(tail[i]) * PRIME3, 17) * PRIME4;
+    h ^= h >> 15;
+    h *= PRIME2;
+    h ^= h >> 13;
+    h *= PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+// without branches: random words would mispredict every other one
+static void Select(const int* words, size_t count, int threshold, BatchSummary& summary) {
+    for (size_t i = 0; i < count; i++) {
+        const int selected = words[i] > threshold ? 1 : 0;
+        summary.selected += selected;
+        summary.sum      += words[i] & -selected;
+    }
+}
+
+static void ScalarKernel(const int* words, size_t count, int threshold, BatchSummary& summary) {
+    unsigned lanes[LANES];
+    InitLanes(lanes);
+    const size_t whole = count - count % LANES;
+    for (size_t i = 0; i < whole; i += LANES) {
+        for (unsigned j = 0; j < LANES; j++)
+            lanes[j] = Round(lanes[j], words[i + j]);
+    }
+    summary.checksum = Finish(lanes, words + whole, count - whole, count);
+    summary.selected = 0;
+    summary.sum      = 0;
+    Select(words, count, threshold, summary);
+}
+
+// SSE2 has no 32-bit multiplication: even and odd lanes are multiplied to 64 bits
+// and the low halves are put back together
+static inline __m128i MulLo32(__m128i a, __m128i b) {
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i RoundSse2(__m128i lanes, __m128i words, __m128i prime1, __m128i prime2) {
+    lanes = _mm_add_epi32(lanes, MulLo32(words, prime2));
+    lanes = _mm_or_si128(_mm_slli_epi32(lanes, 13), _mm_srli_epi32(lanes, 19));
+    return MulLo32(lanes, prime1);
+}
+
+// the mask of the selected words is -1: subtracting it counts them; the selected
+// words are sign-extended to 64 bits for the sum
+static inline void SelectSse2(__m128i words, __m128i threshold, __m128i& selected, __m128i& sum) {
+    const __m128i mask  = _mm_cmpgt_epi32(words, threshold);
+    const __m128i value = _mm_and_si128(words, mask);
+    const __m128i sign  = _mm_cmpgt_epi32(_mm_setzero_si128(), value);
+    selected = _mm_sub_epi32(selected, mask);
+    sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(value, sign));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(value, sign));
+}
+
+static void Sse2Kernel(const int* words, size_t count, int threshold, BatchSummary& summary) {
+    unsigned lanes[LANES];
+    InitLanes(lanes);
+    __m128i lanesLo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+    __m128i lanesHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + 4));
+    const __m128i prime1 = _mm_set1_epi32(static_cast<int>(PRIME1));
+    const __m128i prime2 = _mm_set1_epi32(static_cast<int>(PRIME2));
+    const __m128i limit  = _mm_set1_epi32(threshold);
+    __m128i selected = _mm_setzero_si128();
+    __m128i sum      = _mm_setzero_si128();
+
+    const size_t whole = count - count % LANES;
+    for (size_t i = 0; i < whole; i += LANES) {
+        const __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i*>(words + i));
+        const __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i*>(words + i + 4));
+        lanesLo = RoundSse2(lanesLo, lo, prime1, prime2);
+        lanesHi = RoundSse2(lanesHi, hi, prime1, prime2);
+        SelectSse2(lo, limit, selected, sum);
+        SelectSse2(hi, limit, selected, sum);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lanesLo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4), lanesHi);
+    summary.checksum = Finish(lanes, words + whole, count - whole, count);
+
+    unsigned  counts[4];
+    long long sums[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(counts), selected);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sum);
+    summary.selected = counts[0] + counts[1] + counts[2] + counts[3];
+    summary.sum      = sums[0] + sums[1];
+    Select(words + whole, count - whole, threshold, summary);
+}
+
+#ifdef MT_KERNEL_AVX2
+static void Avx2Kernel(const int* words, size_t count, int threshold, BatchSummary& summary) {
+    unsigned lanes[LANES];
+    InitLanes(lanes);
+    __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+    const __m256i prime1 = _mm256_set1_epi32(static_cast<int>(PRIME1));
+    const __m256i prime2 = _mm256_set1_epi32(static_cast<int>(PRIME2));
+    const __m256i limit  = _mm256_set1_epi32(threshold);
+    __m256i selected = _mm256_setzero_si256();
+    __m256i sum      = _mm256_setzero_si256();
+
+    const size_t whole = count - count % LANES;
+    for (size_t i = 0; i < whole; i += LANES) {
+        const __m256i w = _mm256_load_si256(reinterpret_cast<const __m256i*>(words + i));
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(w, prime2));
+        acc = _mm256_or_si256(_mm256_slli_epi32(acc, 13), _mm256_srli_epi32(acc, 19));
+        acc = _mm256_mullo_epi32(acc, prime1);
+
+        const __m256i mask  = _mm256_cmpgt_epi32(w, limit);
+        const __m256i value = _mm256_and_si256(w, mask);
+        selected = _mm256_sub_epi32(selected, mask);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(value)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(value, 1)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    summary.checksum = Finish(lanes, words + whole, count - whole, count);
+
+    unsigned  counts[8];
+    long long sums[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts), selected);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), sum);
+    summary.selected = 0;
+    for (unsigned j = 0; j < 8; j++)
+        summary.selected += counts[j];
+    summary.sum = sums[0] + sums[1] + sums[2] + sums[3];
+    Select(words + whole, count - whole, threshold, summary);
+}
+#endif
+
+typedef void (BATCH_KERNEL)(const int* words, size_t count, int threshold, BatchSummary& summary);
+
+BATCH_KERNEL* const batchKernels[KL_TOTAL] = {
+    &ScalarKernel,
+    &Sse2Kernel,
+#ifdef MT_KERNEL_AVX2
+    &Avx2Kernel
+#else
+    NULL // never the best level
+#endif
+};
+
+void RunBatchKernel(KernelLevel level, const int* words, size_t count, int threshold,
+                    BatchSummary& summary) {
+    assert((reinterpret_cast<size_t>(words) & 31) == 0);
+    batchKernels[SupportedKernelLevel(level)](words, count, threshold, summary);
+}
+
+} // namespace MT
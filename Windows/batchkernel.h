@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+
+namespace MT {
+
+// Data-parallel work of the batch consumer: checksum, filter and aggregate over the
+// records of the items popped from the buffer at once.
+//
+// The records lie in one contiguous buffer of 32-bit words aligned to 32 bytes
+// (AlignedArray, allocation.h). The SSE2 kernel processes 4 words per instruction,
+// the AVX2 kernel 8, the scalar kernel one. All of them give the same result: the
+// checksum is xxHash32-like over 8 interleaved lanes (word i goes to lane i % 8) and
+// the words after the last whole group of 8 are folded in one by one.
+//
+// The level is chosen at run time by cpuid: SSE2 is not on all processors XP runs on,
+// AVX2 needs the support of the processor and of the system (xgetbv: the system saves
+// the YMM registers). Code of a level is built only if the compiler has its intrinsics,
+// AVX2 needs Visual Studio 2012 or later.
+enum KernelLevel {
+    KL_SCALAR,
+    KL_SSE2,
+    KL_AVX2,
+    KL_TOTAL
+};
+
+const char* KernelLevelName(KernelLevel level); // as given on the command line
+bool ParseKernelLevel(const std::string& name, KernelLevel& level);
+
+KernelLevel BestKernelLevel(); // of this processor and build, detected on start
+
+inline KernelLevel SupportedKernelLevel(KernelLevel wanted) {
+    return std::min(wanted, BestKernelLevel());
+}
+
+struct BatchSummary {
+    unsigned  checksum;
+    unsigned  selected; // words greater than the threshold
+    long long sum;      // of the selected words
+};
+
+// Record of an item as the batch consumer decodes it: one cache line of fields
+const unsigned RECORD_WORDS = 16;
+void DecodeRecord(int msg, int* words);
+
+// words are aligned to 32 bytes, a level above the best one runs as the best one
+void RunBatchKernel(KernelLevel level, const int* words, size_t count, int threshold,
+                    BatchSummary& summary);
+
+} // namespace MT
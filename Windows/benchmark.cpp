@@ -0,0 +1,1189 @@
+#include "stdafx.h"
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include "threads.h"
+#include "filesink.h"
+#include "ratelimiter.h"
+#include "pubsub.h"
+#include "msqueue.h"
+#include "topology.h"
+#include "waitstrategy.h"
+#include "batchkernel.h"
+#include "workstack.h"
+
+// Microbenchmarks of the synchronisation primitives used by the runners (threads.h).
+//
+// For every primitive it measures
+//   - uncontended cost of one acquire/release pair in a single pinned thread,
+//   - contended cost of the same pair when several pinned threads use one object,
+//   - ping-pong round trip between two threads pinned to different processors,
+//   - handoff latency (half of the round trip) of the primitives of each SyncType for
+//     every placement of the two threads on this machine (topology.h), and the best one.
+//
+// Global service accessors (Singleton, threads.h) against the former locked accessor
+// when 64 threads start at once and each calls them, as the thread functions do.
+//
+// Memory layout (allocation.h): per-thread counters packed into common cache lines
+// against cache-aligned ones (false sharing), and random loads over a big buffer on
+// small and on large pages (TLB misses).
+//
+// AsyncFileSink (filesink.h) is measured with several appending threads: cost of
+// Append(), sustained write rate and write latency for each I/O engine.
+//
+// Publish/subscribe (pubsub.h): rate of one publisher fanning a topic out to a growing
+// number of subscriber groups, each group drained by its own thread.
+//
+// Unbounded lock-free queue (msqueue.h): throughput and memory footprint when more
+// producers than consumers run without pause, so the backlog keeps growing.
+//
+// Wait strategies (waitstrategy.h): wake-up latency of a consumer waiting for items
+// published at random intervals, against the processor time the consumer takes.
+//
+// Batch consumer (batchkernel.h): cost per item of popping the items in batches of
+// growing size, decoding their records and running each kernel level the processor has.
+//
+// Dispatch order against the cache (workstack.h): throughput of a bulk job whose backlog
+// is bigger than the cache and the time of reading the payload of an item, over the FIFO
+// queue, the lock-free LIFO stack and the per-thread deques with stealing. The processor
+// counters of cache misses are not readable on Windows, the read time stands for them.
+//
+// Each measurement is repeated (after a warm-up pass) and the median and the minimum
+// are reported. Results are written as CSV to the output file, so the numbers of
+// different builds can be compared to track regressions.
+//
+// Usage: Benchmark.exe [output file] [repetitions]
+
+namespace MT {
+
+const char   defResultFile[] = "bench_results.csv";
+const int    defRepetitions  = 7;
+const unsigned uncontendedIterations = 1000000;
+const unsigned contendedIterations   = 100000; // per thread
+const unsigned pingPongIterations    = 50000;  // round trips
+const unsigned startupThreads        = 64;     // started at once, as many as may be waited for
+const unsigned startupIterations     = 1000;   // per thread, calls of a thread function on its start
+const unsigned sinkRecordSize        = 64;
+const unsigned sinkRecordsPerThread  = 128 * 1024;
+const TCHAR    sinkFile[]            = _T("bench_sink.dat");
+const unsigned maxCounterThreads     = 64;
+const unsigned counterIterations     = 10000000; // per thread
+const size_t   pageWalkBytes         = 256 * 1024 * 1024;
+const size_t   pageWalkStride        = 4096;     // one load per small page
+const unsigned pageWalkLoads         = 4000000;
+const unsigned maxPubSubGroups       = 16;
+const unsigned pubSubMessages        = 100000;
+const unsigned pubSubPayloadSize     = 1024;
+const unsigned pubSubQueueSize       = 64;
+const unsigned msQueueItems          = 500000; // per producer
+const unsigned wakeupItems           = 500;
+const unsigned wakeupMaxGapMs        = 4;      // between the items
+const unsigned batchQueueItems       = 4096;   // popped in batches until the queue is empty
+const unsigned batchRounds           = 16;     // of the queue per repetition
+const unsigned maxBatch              = 512;
+
+// keep the working thread on one processor to avoid migrations between repetitions
+bool PinCurrentThread(unsigned cpu) {
+    return PinThread(::GetCurrentThread(), cpu); // anyCpu: not pinned
+}
+
+unsigned NumberOfProcessors() {
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    unsigned cpus = info.dwNumberOfProcessors;
+    const unsigned maskBits = sizeof(DWORD_PTR) * 8; // affinity mask limit
+    return cpus < maskBits ? cpus : maskBits;
+}
+
+// Measured operations: Run() is one acquire/release pair, Pass() hands the turn
+// to the other ping-pong side if it is ours (lock-like primitives only).
+
+struct CSOp {
+    static const char* Name() { return "CriticalSection"; }
+    bool Init() { return m_cs.isValid(); }
+    void Run() {
+        m_cs.Enter();
+        m_cs.Leave();
+    }
+    bool Pass(volatile LONG& turn, LONG side) {
+        m_cs.Enter();
+        bool passed = (turn == side);
+        if (passed)
+            turn = 1 - side;
+        m_cs.Leave();
+        return passed;
+    }
+
+    CriticalSection m_cs;
+};
+
+struct LockOp {
+    static const char* Name() { return "Lock"; }
+    bool Init() { return m_cs.isValid(); }
+    void Run() {
+        Lock lock(m_cs);
+    }
+    bool Pass(volatile LONG& turn, LONG side) {
+        Lock lock(m_cs);
+        if (turn != side)
+            return false;
+        turn = 1 - side;
+        return true;
+    }
+
+    CriticalSection m_cs;
+};
+
+struct MutexOp {
+    static const char* Name() { return "Mutex"; }
+    bool Init() {
+        m_hMutex.SetHandle( ::CreateMutex(NULL, FALSE, NULL) );
+        return m_hMutex.isValid();
+    }
+    void Run() {
+        ::WaitForSingleObject(m_hMutex, INFINITE);
+        ::ReleaseMutex(m_hMutex);
+    }
+    bool Pass(volatile LONG& turn, LONG side) {
+        ::WaitForSingleObject(m_hMutex, INFINITE);
+        bool passed = (turn == side);
+        if (passed)
+            turn = 1 - side;
+        ::ReleaseMutex(m_hMutex);
+        return passed;
+    }
+
+    HandleWrapper m_hMutex;
+};
+
+struct SemaphoreOp {
+    static const char* Name() { return "Semaphore"; }
+    bool Init() {
+        m_hSemaphore.SetHandle( ::CreateSemaphore(NULL, 1, 1, NULL) ); // binary semaphore
+        return m_hSemaphore.isValid();
+    }
+    void Run() {
+        ::WaitForSingleObject(m_hSemaphore, INFINITE);
+        ::ReleaseSemaphore(m_hSemaphore, 1, NULL);
+    }
+
+    HandleWrapper m_hSemaphore;
+};
+
+struct EventOp { // set and wait of auto-reset event by the same thread
+    static const char* Name() { return "Event"; }
+    bool Init() {
+        m_hEvent.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) );
+        return m_hEvent.isValid();
+    }
+    void Run() {
+        ::SetEvent(m_hEvent);
+        ::WaitForSingleObject(m_hEvent, INFINITE);
+    }
+
+    HandleWrapper m_hEvent;
+};
+
+struct SyncTimerInstanceOp {
+    static const char* Name() { return "SyncTimer::Instance"; }
+    bool Init() { return SyncTimer::Instance().isValid(); }
+    void Run() {
+        m_timer = &SyncTimer::Instance();
+    }
+
+    const SyncTimer* volatile m_timer; // result must be stored, elsewhere call can be optimised
+};
+
+struct SyncTimerStateOp {
+    static const char* Name() { return "SyncTimer::State"; }
+    bool Init() {
+        m_timer = &SyncTimer::Instance();
+        return m_timer->isValid();
+    }
+    void Run() {
+        m_state = m_timer->State();
+    }
+
+    const SyncTimer* m_timer;
+    volatile SyncTimerState m_state;
+};
+
+struct LoggerInstanceOp {
+    static const char* Name() { return "Logger::Instance"; }
+    bool Init() { return true; }
+    void Run() {
+        m_logger = &Logger::Instance();
+    }
+
+    Logger* volatile m_logger;
+};
+
+// former accessor of the global services: every call takes the lock
+// around the local static, as SyncTimer::Instance() did before Singleton
+struct LockedInstanceOp {
+    static const char* Name() { return "locked Instance"; }
+    bool Init() { return m_cs.isValid(); }
+    void Run() {
+        Lock lock(m_cs);
+        static int instance;
+        m_instance = &instance;
+    }
+
+    CriticalSection m_cs;
+    int* volatile   m_instance;
+};
+
+struct QueueOp { // ring storage: no allocation by push/pop
+    static const char* Name() { return "Queue push/pop"; }
+    QueueOp() : m_queue(8) {
+    }
+    bool Init() { return true; }
+    void Run() {
+        m_queue.push(1);
+        m_queue.pop();
+    }
+
+    Queue<int> m_queue;
+};
+
+struct RateLimiterOp { // granting path: compare-and-swap of the shared state
+    static const char* Name() { return "RateLimiter::TryAcquire"; }
+    bool Init() {
+        m_limiter.Reset(1e12, 0xFFFFFFFF); // never exceeded
+        return true;
+    }
+    void Run() {
+        m_granted = m_limiter.TryAcquire();
+    }
+
+    RateLimiter   m_limiter;
+    volatile bool m_granted;
+};
+
+// counters of the threads, each thread increments its own one
+struct PackedCounters { // adjacent: false sharing
+    static const char* Name() { return "Counters packed"; }
+    void Increment(LONG thread) {
+        m_counters[thread]++;
+    }
+
+    volatile LONG m_counters[maxCounterThreads];
+};
+
+struct PaddedCounters {
+    static const char* Name() { return "Counters cache-aligned"; }
+    void Increment(LONG thread) {
+        m_counters[thread].value++;
+    }
+
+    CacheAligned<volatile LONG> m_counters[maxCounterThreads];
+};
+
+struct FileSinkOp {
+    void Run() {
+        m_sink->Append(m_record, sizeof(m_record));
+    }
+
+    AsyncFileSink* m_sink;
+    char m_record[sinkRecordSize];
+};
+
+// ping-pong of kernel objects: each side waits for its own object and signals the other one
+struct EventPingPong {
+    static const char* Name() { return "Event"; }
+    bool Init() {
+        m_hEvents[0].SetHandle( ::CreateEvent(NULL, FALSE, TRUE, NULL) ); // side 0 starts
+        m_hEvents[1].SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) );
+        return m_hEvents[0].isValid() && m_hEvents[1].isValid();
+    }
+    void Step(LONG side) {
+        ::WaitForSingleObject(m_hEvents[side], INFINITE);
+        ::SetEvent(m_hEvents[1 - side]);
+    }
+
+    HandleWrapper m_hEvents[2];
+};
+
+struct SemaphorePingPong {
+    static const char* Name() { return "Semaphore"; }
+    bool Init() {
+        m_hSems[0].SetHandle( ::CreateSemaphore(NULL, 1, 1, NULL) );
+        m_hSems[1].SetHandle( ::CreateSemaphore(NULL, 0, 1, NULL) );
+        return m_hSems[0].isValid() && m_hSems[1].isValid();
+    }
+    void Step(LONG side) {
+        ::WaitForSingleObject(m_hSems[side], INFINITE);
+        ::ReleaseSemaphore(m_hSems[1 - side], 1, NULL);
+    }
+
+    HandleWrapper m_hSems[2];
+};
+
+// ping-pong of locks: the turn variable protected by the lock is polled by both sides
+template <class Op> struct LockPingPong {
+    static const char* Name() { return Op::Name(); }
+    bool Init() {
+        m_turn = 0;
+        return m_op.Init();
+    }
+    void Step(LONG side) {
+        while (!m_op.Pass(m_turn, side))
+            YieldProcessor(); // spin-wait hint
+    }
+
+    Op m_op;
+    volatile LONG m_turn;
+};
+
+struct PubSubOp { // one topic, every group has one subscriber
+    Broker broker;
+    std::vector<SubscriberGroup*> groups;
+
+    bool Init(unsigned groupCount) {
+        for (unsigned g = 0; g < groupCount; g++) {
+            std::string name = std::string("group ") + static_cast<char>('A' + g);
+            SubscriberGroup* group = broker.Subscribe("topic", name, pubSubQueueSize);
+            if (group == NULL)
+                return false;
+            groups.push_back(group);
+        }
+        return true;
+    }
+};
+
+// one item at a time published to the consumer waiting by the strategy
+struct WakeupOp {
+    WakeupOp(WaitPolicy policy) : strategy(policy), hWake( ::CreateEvent(NULL, FALSE, FALSE, NULL) ),
+        published(0), consumed(0), cpuNs(0), wallNs(0) {
+        ::QueryPerformanceFrequency(&freq);
+        stamp.QuadPart = 0;
+    }
+
+    struct Ready {
+        Ready(const WakeupOp& op) : m_op(op) {
+        }
+        bool operator()() const {
+            return m_op.published != m_op.consumed;
+        }
+        const WakeupOp& m_op;
+    };
+
+    WaitStrategy        strategy;
+    HandleWrapper       hWake;     // auto-reset event set after each item
+    LARGE_INTEGER       freq;
+    LARGE_INTEGER       stamp;     // when the last item was published
+    volatile LONG       published;
+    volatile LONG       consumed;
+    std::vector<double> latencies; // ns
+    double              cpuNs;     // of the consumer, user and kernel time
+    double              wallNs;
+};
+
+struct MSQueueOp { // producers are the first threads
+    MSQueue*      queue;
+    unsigned      producers;
+    volatile LONG producersDone;
+};
+
+struct BenchResult {
+    std::string primitive;
+    std::string scenario;
+    unsigned threads;
+    unsigned iterations;
+    double median;
+    double best;      // minimum or maximum, depends on unit
+    std::string unit; // ns per operation (or per round trip), MB/s, us
+};
+
+class Benchmark {
+public:
+    Benchmark(int repetitions) : m_repetitions(repetitions), m_cpus(NumberOfProcessors()) {
+    }
+
+    template <class Op> void Uncontended();
+    template <class Op> void Contended(unsigned threads);
+    template <class Op> void Startup(unsigned threads);
+    template <class PingPong> void RoundTrip();
+    template <class PingPong> void Handoff(const char* syncType);
+    template <class Counters> void FalseSharing(unsigned threads);
+    void PageWalk(bool largePages);
+    void FileSink(FileSinkEngine engine, unsigned threads);
+    void PubSub(unsigned groups);
+    void UnboundedQueue(unsigned producers, unsigned consumers);
+    void Wakeup(WaitPolicy policy);
+    void BatchConsume(KernelLevel level, unsigned batch);
+    void BulkDispatch(unsigned workers);
+
+    unsigned Processors() const {
+        return m_cpus;
+    }
+
+    bool Write(const char* fileName) const;
+
+private:
+    template <class Op> struct ThreadArgs {
+        Op*      op;
+        unsigned cpu;
+        unsigned iterations;
+        LONG     side;      // ping-pong only
+        HANDLE   hStart;    // manual-reset event releasing all threads at once
+        double   elapsedNs; // output
+    };
+
+    template <class Op> static unsigned __stdcall ContendedThread(void* args);
+    template <class PingPong> static unsigned __stdcall PingPongThread(void* args);
+    template <class Counters> static unsigned __stdcall CounterThread(void* args);
+    static THREAD_FUNCTION PubSubThread;
+    static THREAD_FUNCTION MSQueueThread;
+    static THREAD_FUNCTION WakeupThread;
+
+    template <class Op> bool RunThreads(THREAD_FUNCTION* func, std::vector< ThreadArgs<Op> >& args);
+    template <class PingPong> bool RunRoundTrips(unsigned cpu0, unsigned cpu1, std::vector<double>& samples);
+    template <class Op> bool RunContended(Op& op, unsigned threads, unsigned iterations, double& avgNs);
+
+    void Add(const char* primitive, const char* scenario, unsigned threads, unsigned iterations,
+             std::vector<double>& samples, const char* unit = "ns", bool higherIsBetter = false);
+
+    const int      m_repetitions;
+    const unsigned m_cpus;
+    std::vector<BenchResult> m_results;
+};
+
+template <class Op> void Benchmark::Uncontended() {
+    Op op;
+    if (!op.Init())
+        return;
+
+    PinCurrentThread(0);
+    for (unsigned i = 0; i < uncontendedIterations; i++) // warm-up
+        op.Run();
+
+    std::vector<double> samples;
+    for (int rep = 0; rep < m_repetitions; rep++) {
+        Stopwatch sw;
+        for (unsigned i = 0; i < uncontendedIterations; i++)
+            op.Run();
+        samples.push_back(sw.ElapsedNs() / uncontendedIterations);
+    }
+    Add(Op::Name(), "uncontended", 1, uncontendedIterations, samples);
+}
+
+template <class Op> void Benchmark::Contended(unsigned threads) {
+    Op op;
+    if (!op.Init())
+        return;
+
+    std::vector<double> samples;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        double avgNs = 0;
+        if (!RunContended(op, threads, contendedIterations, avgNs))
+            return;
+        if (rep > 0)
+            samples.push_back(avgNs);
+    }
+    Add(Op::Name(), "contended", threads, contendedIterations, samples);
+}
+
+// Cost of the global service accessors when many threads start at once and each calls
+// them a few times, as the thread functions do on their start. There are usually more
+// threads than processors, so a lock taken by a preempted thread stalls the others.
+template <class Op> void Benchmark::Startup(unsigned threads) {
+    Op op;
+    if (!op.Init())
+        return;
+
+    std::vector<double> samples;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        double avgNs = 0;
+        if (!RunContended(op, threads, startupIterations, avgNs))
+            return;
+        if (rep > 0)
+            samples.push_back(avgNs);
+    }
+    Add(Op::Name(), "start burst", threads, startupIterations, samples);
+}
+
+// average cost of Op::Run() seen by a thread when all threads run it simultaneously
+template <class Op> bool Benchmark::RunContended(Op& op, unsigned threads, unsigned iterations,
+                                                 double& avgNs) {
+    std::vector< ThreadArgs<Op> > args(threads);
+    for (unsigned i = 0; i < threads; i++) {
+        args[i].op         = &op;
+        args[i].cpu        = i % m_cpus;
+        args[i].iterations = iterations;
+        args[i].side       = 0;
+        args[i].elapsedNs  = 0;
+    }
+    if (!RunThreads(&ContendedThread<Op>, args))
+        return false;
+
+    double total = 0;
+    for (unsigned i = 0; i < threads; i++)
+        total += args[i].elapsedNs / iterations;
+    avgNs = total / threads;
+    return true;
+}
+
+template <class Counters> void Benchmark::FalseSharing(unsigned threads) {
+    if (threads > maxCounterThreads)
+        return;
+
+    std::vector<double> samples;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        Counters counters; // on the stack: aligned by the compiler
+        memset(&counters, 0, sizeof(counters));
+
+        std::vector< ThreadArgs<Counters> > args(threads);
+        for (unsigned i = 0; i < threads; i++) {
+            args[i].op         = &counters;
+            args[i].cpu        = i % m_cpus;
+            args[i].iterations = counterIterations;
+            args[i].side       = i; // counter of the thread
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&CounterThread<Counters>, args))
+            return;
+
+        double total = 0;
+        for (unsigned i = 0; i < threads; i++)
+            total += args[i].elapsedNs / counterIterations;
+        if (rep > 0)
+            samples.push_back(total / threads);
+    }
+    Add(Counters::Name(), "increment own counter", threads, counterIterations, samples);
+}
+
+// Dependent loads from the pages of a big buffer in random order. With small pages
+// nearly every load misses TLB, large pages cover the buffer with few TLB entries.
+void Benchmark::PageWalk(bool largePages) {
+    bool isLarge = false;
+    char* buffer = static_cast<char*>(AllocatePages(pageWalkBytes, largePages, &isLarge));
+    if (buffer == NULL)
+        return;
+    if (largePages && !isLarge) {
+        FreePages(buffer);
+        cout << "Large pages are not available (\"Lock pages in memory\" privilege is needed)" << endl;
+        return;
+    }
+
+    // random cycle through the pages, each node keeps the pointer to the next one;
+    // offsets in the page differ to spread the nodes over cache sets
+    const size_t nodes = pageWalkBytes / pageWalkStride;
+    std::vector<size_t> order(nodes);
+    for (size_t i = 0; i < nodes; i++)
+        order[i] = i;
+    std::random_shuffle(order.begin(), order.end());
+
+    std::vector<char*> node(nodes);
+    for (size_t i = 0; i < nodes; i++)
+        node[i] = buffer + order[i] * pageWalkStride + (order[i] % (pageWalkStride / CACHE_LINE)) * CACHE_LINE;
+    for (size_t i = 0; i < nodes; i++)
+        *reinterpret_cast<char**>(node[i]) = node[(i + 1) % nodes];
+
+    PinCurrentThread(0);
+    std::vector<double> samples;
+    char* p = node[0];
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        Stopwatch sw;
+        for (unsigned i = 0; i < pageWalkLoads; i++)
+            p = *reinterpret_cast<char**>(p);
+        if (rep > 0)
+            samples.push_back(sw.ElapsedNs() / pageWalkLoads);
+    }
+    char* volatile end = p; // loads must not be optimised away
+    (void)end;
+    FreePages(buffer);
+
+    Add(isLarge ? "Page walk large pages" : "Page walk small pages", "random load", 1, pageWalkLoads,
+        samples);
+}
+
+void Benchmark::FileSink(FileSinkEngine engine, unsigned threads) {
+
+    const char* name = (engine == FSE_OVERLAPPED ? "FileSink overlapped" : "FileSink thread pool");
+    std::vector<double> appendNs, mbPerSec, latencyUs;
+
+    for (int rep = 0; rep < m_repetitions; rep++) {
+        AsyncFileSink sink;
+        if (sink.Open(sinkFile, engine) != RET_OK)
+            return;
+
+        FileSinkOp op;
+        op.m_sink = &sink;
+        memset(op.m_record, 'a' + rep, sizeof(op.m_record));
+
+        double avgNs = 0;
+        bool ok = RunContended(op, threads, sinkRecordsPerThread, avgNs);
+        FileSinkEngine used = sink.Engine();
+        sink.Close();
+        ::DeleteFile(sinkFile);
+        if (!ok || used != engine) // fallback engine is measured separately
+            return;
+
+        FileSinkStats stats;
+        sink.GetStats(stats);
+        appendNs.push_back(avgNs);
+        mbPerSec.push_back(stats.bytes / (1024.0 * 1024.0) / stats.elapsedSec);
+        latencyUs.push_back(stats.latencyP99Us);
+    }
+    Add(name, "append", threads, sinkRecordsPerThread, appendNs);
+    Add(name, "throughput", threads, sinkRecordsPerThread, mbPerSec, "MB/s", true);
+    Add(name, "write latency p99", threads, sinkRecordsPerThread, latencyUs, "us");
+}
+
+// Publisher (side 0) sends the messages and one stop message, other threads drain the groups
+void Benchmark::PubSub(unsigned groups) {
+    std::vector<double> samples;
+    for (int rep = 0; rep <= m_repetitions; rep++) {
+        PubSubOp op;
+        if (!op.Init(groups))
+            return;
+
+        std::vector< ThreadArgs<PubSubOp> > args(groups + 1);
+        for (unsigned i = 0; i <= groups; i++) {
+            args[i].op         = &op;
+            args[i].cpu        = i % m_cpus;
+            args[i].iterations = pubSubMessages;
+            args[i].side       = i;
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&PubSubThread, args))
+            return;
+        if (rep > 0)
+            samples.push_back(pubSubMessages * 1e9 / args[0].elapsedNs);
+    }
+    Add("PubSub fan-out", "publish to all groups", groups, pubSubMessages, samples, "msg/s", true);
+}
+
+// Rate of the items passed from producers to consumers and the memory taken by the queue
+// at the end (the peak: nodes are recycled, not freed)
+void Benchmark::UnboundedQueue(unsigned producers, unsigned consumers) {
+    std::vector<double> itemsPerSec, footprintKB;
+    for (int rep = 0; rep <= m_repetitions; rep++) {
+        MSQueue queue(producers + consumers);
+        if (!queue.isValid())
+            return;
+        MSQueueOp op = { &queue, producers, 0 };
+
+        std::vector< ThreadArgs<MSQueueOp> > args(producers + consumers);
+        for (unsigned i = 0; i < args.size(); i++) {
+            args[i].op         = &op;
+            args[i].cpu        = i % m_cpus;
+            args[i].iterations = msQueueItems;
+            args[i].side       = i; // slot of the queue
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&MSQueueThread, args))
+            return;
+        if (rep == 0)
+            continue;
+
+        double elapsedNs = 0; // until the last consumer has found the queue empty
+        for (unsigned i = producers; i < args.size(); i++)
+            elapsedNs = std::max(elapsedNs, args[i].elapsedNs);
+        MSQueueFootprint footprint;
+        queue.GetFootprint(footprint);
+        itemsPerSec.push_back(producers * static_cast<double>(msQueueItems) * 1e9 / elapsedNs);
+        footprintKB.push_back(footprint.bytes / 1024.0);
+    }
+    const char* scenario = (producers > consumers ? "producers ahead" : "balanced");
+    std::string footprint = std::string(scenario) + " footprint";
+    Add("MSQueue push/pop", scenario, producers + consumers, msQueueItems, itemsPerSec, "items/s", true);
+    Add("MSQueue push/pop", footprint.c_str(), producers + consumers, msQueueItems, footprintKB, "KB");
+}
+
+// Wake-up latency (from the publication of an item until the consumer sees it) against
+// the processor time of the consumer in per cent of the run time: the spinning strategies
+// buy latency with the processor.
+void Benchmark::Wakeup(WaitPolicy policy) {
+    std::vector<double> latency, cpu;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        WakeupOp op(policy);
+        if (!op.hWake.isValid())
+            return;
+        op.latencies.reserve(wakeupItems);
+
+        std::vector< ThreadArgs<WakeupOp> > args(2);
+        for (unsigned i = 0; i < 2; i++) {
+            args[i].op         = &op;
+            args[i].cpu        = i % m_cpus;
+            args[i].iterations = wakeupItems;
+            args[i].side       = i; // 0 - producer, 1 - consumer
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&WakeupThread, args) || op.latencies.size() != wakeupItems)
+            return;
+        if (rep == 0)
+            continue;
+        std::sort(op.latencies.begin(), op.latencies.end());
+        latency.push_back(op.latencies[op.latencies.size() / 2] / 1000);
+        cpu.push_back(100 * op.cpuNs / op.wallNs);
+    }
+    const std::string name = std::string("Wait ") + WaitPolicyName(policy);
+    Add(name.c_str(), "wake-up latency", 2, wakeupItems, latency, "us");
+    Add(name.c_str(), "consumer cpu", 2, wakeupItems, cpu, "%");
+}
+
+// Consumer side of the batch consumer (ProducerConsumerBatchRunner): the items are popped
+// under one lock per batch, their records decoded and processed by the kernel. The lock
+// and the call of the kernel are paid once per batch, the wider kernels process more
+// words per instruction.
+void Benchmark::BatchConsume(KernelLevel level, unsigned batch) {
+    Queue<int> queue(batchQueueItems);
+    CriticalSection cs;
+    AlignedArray<int> records(batch * RECORD_WORDS);
+    if (!records.isValid())
+        return;
+    std::vector<int> msgs(batch);
+
+    // the kernel must give the result of the scalar one, with a tail and without
+    for (unsigned i = 0; i < batch; i++)
+        DecodeRecord(static_cast<int>(i), &records[i * RECORD_WORDS]);
+    const size_t sizes[] = { batch * RECORD_WORDS, batch * RECORD_WORDS - 3 };
+    for (int i = 0; i < 2; i++) {
+        BatchSummary expected, summary;
+        RunBatchKernel(KL_SCALAR, &records[0], sizes[i], 0, expected);
+        RunBatchKernel(level, &records[0], sizes[i], 0, summary);
+        if (summary.checksum != expected.checksum || summary.selected != expected.selected ||
+            summary.sum != expected.sum) {
+            cout << "Kernel " << KernelLevelName(level) << " differs from the scalar one" << endl;
+            return;
+        }
+    }
+
+    PinCurrentThread(0);
+    std::vector<double> samples;
+    unsigned checksum = 0;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        double elapsedNs = 0;
+        for (unsigned round = 0; round < batchRounds; round++) {
+            for (unsigned i = 0; i < batchQueueItems; i++)
+                queue.push(static_cast<int>(i));
+
+            Stopwatch sw;
+            while (!queue.empty()) {
+                size_t count = 0;
+                {
+                    Lock lock(cs);
+                    while (count < batch && !queue.empty()) {
+                        msgs[count++] = queue.front();
+                        queue.pop();
+                    }
+                }
+                for (size_t i = 0; i < count; i++)
+                    DecodeRecord(msgs[i], &records[i * RECORD_WORDS]);
+                BatchSummary summary;
+                RunBatchKernel(level, &records[0], count * RECORD_WORDS, 0, summary);
+                checksum ^= summary.checksum;
+            }
+            elapsedNs += sw.ElapsedNs();
+        }
+        if (rep > 0)
+            samples.push_back(elapsedNs / (batchRounds * batchQueueItems));
+    }
+    volatile unsigned result = checksum; // the kernel must not be optimised away
+    (void)result;
+
+    stringstream scenario;
+    scenario << "batch of " << batch;
+    const std::string name = std::string("Batch consume ") + KernelLevelName(level);
+    Add(name.c_str(), scenario.str().c_str(), 1, batchRounds * batchQueueItems, samples);
+}
+
+// Each repetition runs the job over every dispatch structure in turn, so slow drifts of
+// the machine affect all of them alike
+void Benchmark::BulkDispatch(unsigned workers) {
+    const unsigned variants = 3;
+    std::vector<double> itemsPerSec[variants], readNs[variants];
+    const char* names[variants] = { 0 };
+
+    BulkJob job(workers);
+    if (!job.isValid())
+        return;
+    for (int rep = 0; rep <= m_repetitions; rep++) { // first pass is warm-up
+        CSQueue          fifo(BulkJob::Capacity(workers));
+        TreiberStack     lifo(BulkJob::Capacity(workers));
+        WorkStealingPool hybrid(BulkJob::Capacity(workers), workers);
+        SharedQueue* dispatches[variants] = { &fifo, &lifo, &hybrid };
+
+        for (unsigned v = 0; v < variants; v++) {
+            BulkJobResult result;
+            if (job.Run(*dispatches[v], result) != RET_OK) {
+                cout << "Bulk job over " << dispatches[v]->Name() << " failed" << endl;
+                return;
+            }
+            names[v] = dispatches[v]->Name();
+            if (rep == 0)
+                continue;
+            itemsPerSec[v].push_back(result.itemsPerSec);
+            readNs[v].push_back(result.readNsPerItem);
+        }
+    }
+    for (unsigned v = 0; v < variants; v++) {
+        const std::string name = std::string("Dispatch ") + names[v];
+        const unsigned items = static_cast<unsigned>(job.TotalItems());
+        Add(name.c_str(), "bulk job", workers, items, itemsPerSec[v], "items/s", true);
+        Add(name.c_str(), "payload read", workers, items, readNs[v]);
+    }
+}
+
+template <class PingPong> void Benchmark::RoundTrip() {
+    std::vector<double> samples;
+    if (RunRoundTrips<PingPong>(0, m_cpus > 1 ? 1 : 0, samples)) // different processors if possible
+        Add(PingPong::Name(), "ping-pong", 2, pingPongIterations, samples);
+}
+
+// Handoff latency for each placement the machine has: one side wakes the other and the
+// time until the other side runs is half of the round trip.
+template <class PingPong> void Benchmark::Handoff(const char* syncType) {
+    const Topology& topology = Topology::Instance();
+    Placement best = PL_TOTAL;
+    double bestNs  = 0;
+
+    for (int p = 0; p < PL_TOTAL; p++) {
+        const Placement placement = static_cast<Placement>(p);
+        std::vector<unsigned> cpus;
+        if (!topology.Place(placement, 2, cpus))
+            continue; // e.g. one socket
+
+        std::vector<double> samples;
+        if (!RunRoundTrips<PingPong>(cpus[0], cpus[1], samples))
+            return;
+        for (size_t i = 0; i < samples.size(); i++)
+            samples[i] /= 2;
+
+        const std::string scenario = std::string("handoff, ") + PlacementName(placement);
+        Add(syncType, scenario.c_str(), 2, pingPongIterations, samples);
+        const double median = m_results.back().median;
+        if (best == PL_TOTAL || median < bestNs) {
+            best   = placement;
+            bestNs = median;
+        }
+    }
+    if (best != PL_TOTAL)
+        cout << syncType << ": best placement " << PlacementName(best) << ", handoff "
+             << bestNs << " ns" << endl;
+}
+
+// round trip time of each repetition, the first pass is warm-up
+template <class PingPong> bool Benchmark::RunRoundTrips(unsigned cpu0, unsigned cpu1,
+                                                        std::vector<double>& samples) {
+    for (int rep = 0; rep <= m_repetitions; rep++) {
+        PingPong pp;
+        if (!pp.Init())
+            return false;
+
+        std::vector< ThreadArgs<PingPong> > args(2);
+        for (unsigned i = 0; i < 2; i++) {
+            args[i].op         = &pp;
+            args[i].cpu        = (i == 0 ? cpu0 : cpu1);
+            args[i].iterations = pingPongIterations;
+            args[i].side       = i;
+            args[i].elapsedNs  = 0;
+        }
+        if (!RunThreads(&PingPongThread<PingPong>, args))
+            return false;
+        if (rep > 0)
+            samples.push_back(args[0].elapsedNs / pingPongIterations);
+    }
+    return true;
+}
+
+template <class Op> unsigned __stdcall Benchmark::ContendedThread(void* args) {
+    ThreadArgs<Op>* a = static_cast<ThreadArgs<Op>*>(args);
+    PinCurrentThread(a->cpu);
+    ::WaitForSingleObject(a->hStart, INFINITE);
+
+    Stopwatch sw;
+    for (unsigned i = 0; i < a->iterations; i++)
+        a->op->Run();
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+template <class PingPong> unsigned __stdcall Benchmark::PingPongThread(void* args) {
+    ThreadArgs<PingPong>* a = static_cast<ThreadArgs<PingPong>*>(args);
+    PinCurrentThread(a->cpu);
+    ::WaitForSingleObject(a->hStart, INFINITE);
+
+    Stopwatch sw;
+    for (unsigned i = 0; i < a->iterations; i++)
+        a->op->Step(a->side);
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+template <class Counters> unsigned __stdcall Benchmark::CounterThread(void* args) {
+    ThreadArgs<Counters>* a = static_cast<ThreadArgs<Counters>*>(args);
+    PinCurrentThread(a->cpu);
+    ::WaitForSingleObject(a->hStart, INFINITE);
+
+    Stopwatch sw;
+    for (unsigned i = 0; i < a->iterations; i++)
+        a->op->Increment(a->side);
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+unsigned __stdcall Benchmark::PubSubThread(void* args) {
+    ThreadArgs<PubSubOp>* a = static_cast<ThreadArgs<PubSubOp>*>(args);
+    PinCurrentThread(a->cpu);
+    ::WaitForSingleObject(a->hStart, INFINITE);
+
+    if (a->side > 0) {
+        SubscriberGroup* group = a->op->groups[a->side - 1];
+        MessageRef msg;
+        while (group->Pop(msg) && msg.isValid())
+            ;
+        return RET_OK;
+    }
+
+    const size_t groups = a->op->broker.GroupCount("topic");
+    Stopwatch sw;
+    for (unsigned i = 0; i < a->iterations; i++) {
+        if (a->op->broker.Publish("topic", MessageRef(new Message(i, pubSubPayloadSize))) != groups)
+            return ERR_SYNC;
+    }
+    a->op->broker.Publish("topic", MessageRef()); // stop
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+unsigned __stdcall Benchmark::MSQueueThread(void* args) {
+    ThreadArgs<MSQueueOp>* a = static_cast<ThreadArgs<MSQueueOp>*>(args);
+    MSQueueOp& op = *a->op;
+    const unsigned slot = static_cast<unsigned>(a->side);
+    PinCurrentThread(a->cpu);
+    ::WaitForSingleObject(a->hStart, INFINITE);
+
+    Stopwatch sw;
+    if (slot < op.producers) {
+        for (unsigned i = 0; i < a->iterations; i++) {
+            if (!op.queue->Push(slot, i))
+                return ERR_STD;
+        }
+        ::InterlockedIncrement(&op.producersDone);
+    } else {
+        for (;;) {
+            const bool last = (op.producersDone == static_cast<LONG>(op.producers));
+            int item = 0;
+            if (!op.queue->Pop(slot, item) && last)
+                break; // producers had finished before the queue was found empty
+        }
+    }
+    a->elapsedNs = sw.ElapsedNs();
+    return RET_OK;
+}
+
+static double ThreadCpuNs() { // user and kernel time of the calling thread
+    FILETIME creation, exit, kernel, user;
+    if (!::GetThreadTimes(::GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return static_cast<double>(k.QuadPart + u.QuadPart) * 100; // 100 ns intervals
+}
+
+unsigned __stdcall Benchmark::WakeupThread(void* args) {
+    ThreadArgs<WakeupOp>* a = static_cast<ThreadArgs<WakeupOp>*>(args);
+    WakeupOp& op = *a->op;
+    PinCurrentThread(a->cpu);
+    ::WaitForSingleObject(a->hStart, INFINITE);
+
+    if (a->side == 0) { // producer: the next item after the previous one is taken
+        for (unsigned i = 0; i < a->iterations; i++) {
+            ::Sleep(rand() % (wakeupMaxGapMs + 1));
+            while (op.consumed != op.published)
+                ::SwitchToThread();
+            ::QueryPerformanceCounter(&op.stamp);
+            ::InterlockedIncrement(&op.published);
+            ::SetEvent(op.hWake);
+        }
+        return RET_OK;
+    }
+
+    const double cpuStart = ThreadCpuNs();
+    Stopwatch sw;
+    while (static_cast<unsigned>(op.consumed) < a->iterations) {
+        const DWORD dwResult = op.strategy.Wait(WakeupOp::Ready(op), op.hWake, INFINITE);
+        if (dwResult == WAIT_FAILED)
+            return ERR_SYNC;
+        if (op.published == op.consumed)
+            continue; // woken up by the signal of an item seen by spinning
+        LARGE_INTEGER now;
+        ::QueryPerformanceCounter(&now);
+        op.latencies.push_back(static_cast<double>(now.QuadPart - op.stamp.QuadPart) * 1e9 /
+                               op.freq.QuadPart);
+        ::InterlockedIncrement(&op.consumed);
+    }
+    op.wallNs = sw.ElapsedNs();
+    op.cpuNs  = ThreadCpuNs() - cpuStart;
+    return RET_OK;
+}
+
+template <class Op> bool Benchmark::RunThreads(THREAD_FUNCTION* func, std::vector< ThreadArgs<Op> >& args) {
+
+    HandleWrapper hStart( ::CreateEvent(NULL, TRUE, FALSE, NULL) ); // manual reset
+    if (!hStart.isValid())
+        return false;
+
+    std::vector<HANDLE> threadHandles;
+    for (size_t i = 0; i < args.size(); i++) {
+        args[i].hStart = hStart;
+        HANDLE h = (HANDLE) _beginthreadex(NULL, 0, func, &args[i], 0, NULL);
+        if (h == 0)
+            break;
+        threadHandles.push_back(h);
+    }
+
+    ::SetEvent(hStart); // also releases already created threads if some creation failed
+    if (!threadHandles.empty())
+        ::WaitForMultipleObjects(static_cast<DWORD>(threadHandles.size()), &threadHandles[0],
+            TRUE, INFINITE);
+    for (size_t i = 0; i < threadHandles.size(); i++)
+        ::CloseHandle(threadHandles[i]);
+
+    return threadHandles.size() == args.size();
+}
+
+void Benchmark::Add(const char* primitive, const char* scenario, unsigned threads, unsigned iterations,
+                    std::vector<double>& samples, const char* unit, bool higherIsBetter) {
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult r;
+    r.primitive  = primitive;
+    r.scenario   = scenario;
+    r.threads    = threads;
+    r.iterations = iterations;
+    r.median     = samples[samples.size() / 2];
+    r.best       = (higherIsBetter ? samples.back() : samples[0]);
+    r.unit       = unit;
+    m_results.push_back(r);
+
+    cout << primitive << ", " << scenario << ", threads: " << threads
+         << ", median: " << r.median << ' ' << unit << ", best: " << r.best << ' ' << unit << endl;
+}
+
+bool Benchmark::Write(const char* fileName) const {
+    std::ofstream out(fileName);
+    if (!out)
+        return false;
+
+    LARGE_INTEGER freq;
+    ::QueryPerformanceFrequency(&freq);
+#ifdef _DEBUG
+    const char build[] = "Debug";
+#else
+    const char build[] = "Release";
+#endif
+    out << "# processors: " << m_cpus << ", QPC frequency: " << freq.QuadPart
+        << ", repetitions: " << m_repetitions << ", build: " << build << endl;
+    out << "primitive,scenario,threads,iterations,median,best,unit" << endl;
+    for (size_t i = 0; i < m_results.size(); i++) {
+        const BenchResult& r = m_results[i];
+        out << r.primitive << ',' << r.scenario << ',' << r.threads << ',' << r.iterations << ','
+            << r.median << ',' << r.best << ',' << r.unit << endl;
+    }
+    return out.good();
+}
+
+} // namespace MT
+
+int main(int argc, char* argv[])
+{
+    const char* fileName = (argc > 1 ? argv[1] : MT::defResultFile);
+    int repetitions      = (argc > 2 ? atoi(argv[2]) : MT::defRepetitions);
+    if (repetitions < 1)
+        repetitions = MT::defRepetitions;
+
+    // less interference from other processes
+    ::SetPriorityClass(::GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+
+    // the timer must be valid and not signalled to measure the working state
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = -36000000000LL; // 1 hour
+    if (!MT::SyncTimer::Instance().SetTimer(timeout)) {
+        cout << "WinApi error, exiting." << endl;
+        return ERR_API;
+    }
+
+    MT::Benchmark bench(repetitions);
+
+    bench.Uncontended<MT::CSOp>();
+    bench.Uncontended<MT::LockOp>();
+    bench.Uncontended<MT::MutexOp>();
+    bench.Uncontended<MT::SemaphoreOp>();
+    bench.Uncontended<MT::EventOp>();
+    bench.Uncontended<MT::SyncTimerInstanceOp>();
+    bench.Uncontended<MT::SyncTimerStateOp>();
+    bench.Uncontended<MT::RateLimiterOp>();
+    bench.Uncontended<MT::QueueOp>();
+
+    for (unsigned threads = 2; threads <= bench.Processors(); threads *= 2) {
+        bench.Contended<MT::CSOp>(threads);
+        bench.Contended<MT::LockOp>(threads);
+        bench.Contended<MT::MutexOp>(threads);
+        bench.Contended<MT::SemaphoreOp>(threads);
+        bench.Contended<MT::SyncTimerInstanceOp>(threads);
+        bench.Contended<MT::SyncTimerStateOp>(threads);
+        bench.Contended<MT::RateLimiterOp>(threads);
+    }
+
+    bench.Startup<MT::LockedInstanceOp>(MT::startupThreads);
+    bench.Startup<MT::SyncTimerInstanceOp>(MT::startupThreads);
+    bench.Startup<MT::LoggerInstanceOp>(MT::startupThreads);
+    bench.Startup<MT::SyncTimerStateOp>(MT::startupThreads);
+
+    for (unsigned threads = 2; threads <= bench.Processors(); threads *= 2) {
+        bench.FalseSharing<MT::PackedCounters>(threads);
+        bench.FalseSharing<MT::PaddedCounters>(threads);
+    }
+    bench.PageWalk(false);
+    bench.PageWalk(true);
+
+    bench.RoundTrip< MT::LockPingPong<MT::CSOp> >();
+    bench.RoundTrip< MT::LockPingPong<MT::LockOp> >();
+    bench.RoundTrip< MT::LockPingPong<MT::MutexOp> >();
+    bench.RoundTrip<MT::EventPingPong>();
+    bench.RoundTrip<MT::SemaphorePingPong>();
+
+    MT::Topology::Instance().Report(cout); // handoff by SyncType, names as in the menu
+    bench.Handoff< MT::LockPingPong<MT::CSOp> >("Critical sections");
+    bench.Handoff<MT::EventPingPong>("Critical sections and events");
+    bench.Handoff< MT::LockPingPong<MT::MutexOp> >("Mutex");
+    bench.Handoff<MT::SemaphorePingPong>("Semaphore");
+
+    const unsigned sinkThreads = (bench.Processors() < 4 ? bench.Processors() : 4);
+    bench.FileSink(MT::FSE_OVERLAPPED, sinkThreads);
+    bench.FileSink(MT::FSE_THREADPOOL, sinkThreads);
+
+    for (unsigned groups = 1; groups <= MT::maxPubSubGroups; groups *= 2)
+        bench.PubSub(groups);
+
+    const unsigned queueThreads = (bench.Processors() < 4 ? 4 : bench.Processors());
+    bench.UnboundedQueue(queueThreads / 2, queueThreads / 2);
+    bench.UnboundedQueue(queueThreads * 3 / 4, queueThreads / 4);
+
+    for (int policy = 0; policy < MT::WP_TOTAL; policy++)
+        bench.Wakeup(static_cast<MT::WaitPolicy>(policy));
+
+    for (int level = 0; level <= MT::BestKernelLevel(); level++) {
+        for (unsigned batch = 1; batch <= MT::maxBatch; batch *= 8)
+            bench.BatchConsume(static_cast<MT::KernelLevel>(level), batch);
+    }
+
+    for (unsigned workers = 1; workers <= bench.Processors() && workers <= MT::BulkJob::m_maxWorkers; workers *= 2)
+        bench.BulkDispatch(workers);
+
+    if (!bench.Write(fileName)) {
+        cout << "Cannot write results to " << fileName << endl;
+        return ERR_STD;
+    }
+    cout << endl << "Results are written to " << fileName << endl;
+    return RET_OK;
+}
@@ -0,0 +1,113 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "combining.h"
+
+namespace MT {
+
+bool CSQueue::Push(unsigned, int item) {
+    Lock lock(m_cs);
+    if (m_queue.isFull())
+        return false;
+    m_queue.push(item);
+    return true;
+}
+
+bool CSQueue::Pop(unsigned, int& item) {
+    Lock lock(m_cs);
+    if (m_queue.empty())
+        return false;
+    item = m_queue.front();
+    m_queue.pop();
+    return true;
+}
+
+bool MutexQueue::Push(unsigned, int item) {
+    if (::WaitForSingleObject(m_hMutex, INFINITE) != WAIT_OBJECT_0)
+        return false;
+    bool pushed = !m_queue.isFull();
+    if (pushed)
+        m_queue.push(item);
+    ::ReleaseMutex(m_hMutex);
+    return pushed;
+}
+
+bool MutexQueue::Pop(unsigned, int& item) {
+    if (::WaitForSingleObject(m_hMutex, INFINITE) != WAIT_OBJECT_0)
+        return false;
+    bool popped = !m_queue.empty();
+    if (popped) {
+        item = m_queue.front();
+        m_queue.pop();
+    }
+    ::ReleaseMutex(m_hMutex);
+    return popped;
+}
+
+FlatCombiningQueue::FlatCombiningQueue(size_t capacity, unsigned threads) :
+    m_requests(threads), // zeroed: OP_NONE
+    m_queue(capacity),
+    m_passes(0),
+    m_combined(0)
+{
+    m_lock.value = 0;
+}
+
+bool FlatCombiningQueue::Push(unsigned slot, int item) {
+    return Apply(slot, OP_PUSH, item);
+}
+
+bool FlatCombiningQueue::Pop(unsigned slot, int& item) {
+    return Apply(slot, OP_POP, item);
+}
+
+bool FlatCombiningQueue::Apply(unsigned slot, Operation op, int& item) {
+    Request& request = m_requests[slot];
+    request.item = item;
+    ::InterlockedExchange(&request.op, op); // publish: the item is visible before the request
+
+    for (unsigned spin = 1; ; spin++) {
+        // test before the interlocked operation: waiting threads only read the lock line
+        if (m_lock.value == 0 && ::InterlockedCompareExchange(&m_lock.value, 1, 0) == 0) {
+            Combine(); // applies our request too
+            ::InterlockedExchange(&m_lock.value, 0);
+        }
+        if (request.op == OP_NONE) // served by us or by another combiner
+            break;
+
+        if (spin % m_spinCount == 0)
+            ::SwitchToThread(); // the combiner may be preempted
+        else
+            YieldProcessor();
+    }
+
+    item = request.item;
+    return request.done;
+}
+
+void FlatCombiningQueue::Combine() {
+    unsigned combined = 0;
+    for (size_t i = 0; i < m_requests.size(); i++) {
+        Request& r = m_requests[i];
+        const LONG op = r.op;
+        if (op == OP_NONE)
+            continue;
+
+        if (op == OP_PUSH) {
+            r.done = !m_queue.isFull();
+            if (r.done)
+                m_queue.push(r.item);
+        } else {
+            r.done = !m_queue.empty();
+            if (r.done) {
+                r.item = m_queue.front();
+                m_queue.pop();
+            }
+        }
+        ::InterlockedExchange(&r.op, OP_NONE); // result is visible before the request is cleared
+        combined++;
+    }
+    m_passes++;
+    m_combined += combined;
+}
+
+} // namespace MT
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "threads.h"
+
+namespace MT {
+
+// Bounded queue of items shared by many threads. Each thread passes its own slot
+// number (0 .. threads-1) which the implementations may use for per-thread state.
+class SharedQueue {
+public:
+    virtual ~SharedQueue() {
+    }
+
+    virtual const char* Name() const = 0;
+    virtual bool isValid() const = 0;
+
+    virtual bool Push(unsigned slot, int item) = 0;  // false if full
+    virtual bool Pop(unsigned slot, int& item) = 0;  // false if empty
+};
+
+// MT::Queue locked by a critical section
+class CSQueue : public SharedQueue {
+public:
+    CSQueue(size_t capacity) : m_queue(capacity) {
+    }
+
+    virtual const char* Name() const {
+        return "critical section";
+    }
+    virtual bool isValid() const {
+        return m_cs.isValid();
+    }
+    virtual bool Push(unsigned slot, int item);
+    virtual bool Pop(unsigned slot, int& item);
+
+private:
+    CriticalSection m_cs;
+    Queue<int>      m_queue;
+};
+
+// MT::Queue locked by a mutex (kernel object: every acquire is a system call)
+class MutexQueue : public SharedQueue {
+public:
+    MutexQueue(size_t capacity) : m_queue(capacity),
+        m_hMutex( ::CreateMutex(NULL, FALSE, NULL) ) {
+    }
+
+    virtual const char* Name() const {
+        return "mutex";
+    }
+    virtual bool isValid() const {
+        return m_hMutex.isValid();
+    }
+    virtual bool Push(unsigned slot, int item);
+    virtual bool Pop(unsigned slot, int& item);
+
+private:
+    Queue<int>    m_queue;
+    HandleWrapper m_hMutex;
+};
+
+// Flat combining (Hendler, Incze, Shavit, Tzafrir, SPAA 2010).
+//
+// A thread publishes its push or pop request in its own slot and tries to take the
+// combiner lock. The thread which gets it applies pending requests of all slots to the
+// sequential queue in one pass and clears them; others spin on their slot until it is
+// served or the lock is free again. The queue and the lock are touched by one thread
+// per pass instead of passing their cache lines from one thread to another on every
+// operation.
+// http://mcg.cs.tau.ac.il/papers/spaa2010-fc.pdf
+class FlatCombiningQueue : public SharedQueue {
+public:
+    FlatCombiningQueue(size_t capacity, unsigned threads);
+
+    virtual const char* Name() const {
+        return "flat combining";
+    }
+    virtual bool isValid() const {
+        return m_requests.isValid();
+    }
+    virtual bool Push(unsigned slot, int item);
+    virtual bool Pop(unsigned slot, int& item);
+
+    double RequestsPerPass() const { // average number of requests applied by a combiner
+        return m_passes == 0 ? 0 : static_cast<double>(m_combined) / m_passes;
+    }
+
+private:
+    enum Operation { OP_NONE, OP_PUSH, OP_POP };
+
+    struct MT_CACHE_ALIGN Request {
+        volatile LONG op;   // set by the owner, cleared by the combiner
+        int           item; // pushed or popped
+        bool          done; // false if the queue was full or empty
+    };
+
+    bool Apply(unsigned slot, Operation op, int& item);
+    void Combine(); // the combiner lock must be taken
+
+    static const unsigned m_spinCount = 64; // before yielding the processor
+
+    AlignedArray<Request>     m_requests;
+    CacheAligned<volatile LONG> m_lock; // combiner lock: 1 if taken
+    Queue<int>                m_queue;  // accessed by the combiner only
+    ULONGLONG                 m_passes;
+    ULONGLONG                 m_combined;
+};
+
+} // namespace MT
@@ -1,202 +1,624 @@
-#include "stdafx.h"
-#include <queue>
-#include "threads.h"
-#include "threadrunner.h"
-
-extern MT::Queue<int> g_msgs;
-extern MT::HandleWrapper g_hEmptyEvent, g_hFullEvent, g_hEmptyMutEvent, g_hFullMutEvent, g_hMutex;
-
-bool isSignalled(const MT::HandleWrapper& h, const std::string& hName, const std::string& who,
-                 bool diagnostics = false);
-
-const char EMPTY_BUFFER[]     = "Consumer: empty buffer, waiting";
-const char CONSUMER_WAKE_UP[] = "Consumer: waking up";
-
-namespace MT {
-
-// Just locking shared data structure with Critical Sections.
-// Using RAAI idiom for aquiring locks
-unsigned __stdcall ProducerConsumerCSRunner::Consumer(void* args) {
-
-    const SyncTimer& syncTimer = SyncTimer::Instance();
-    CriticalSection cons_cs;
-    const int emptyBufferWait = 1000; // 1 sec
-    SyncTimerState tState = ST_WORK;
-
-    while ( (tState = syncTimer.State()) == ST_WORK ) {
-        bool isEmpty = false;
-        {
-            Lock lock(cons_cs);      // acquire lock
-            if (g_msgs.empty()) { // nothing to produce, need synchronisation
-                isEmpty = true;
-                Print(EMPTY_BUFFER);
-            }
-        } // release lock
-        if (isEmpty) {
-            Wait(emptyBufferWait);
-            continue; // wait until there will be some input in the buffer or timeout occurs
-        }
-
-        int cur_msg=0;
-        {
-            Lock lock(cons_cs);
-            try {
-                cur_msg = g_msgs.front();
-                g_msgs.pop();
-            } catch(std::exception& ex) {
-                Print(ex.what());
-                return ERR_STD;
-            } catch(...) {
-                Print("Unknown error ");
-                return ERR_UNKNOWN;
-            }
-            stringstream ss;
-            ss << "received:" <<  cur_msg;
-            Print(ss.str().c_str());
-        }
-        Consume(cur_msg);
-
-    } // while
-
-    if (tState == ST_ERR)
-        return ERR_SYNC;
-
-    PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
-    return RET_OK;
-}
-
-// Using Critical Sections and Events for synchronisation
-unsigned __stdcall ProducerConsumerEventRunner::Consumer(void* args) {
-
-    const SyncTimer& syncTimer = SyncTimer::Instance();
-    CriticalSection cons_cs;
-    const int emptyBufferTimeout = 3000; // 3 sec
-    SyncTimerState tState = ST_WORK;
-    bool diagnostic=false; // debug messages
-
-    while ( (tState = syncTimer.State())==ST_WORK ) {
-        
-        isSignalled(g_hEmptyEvent, "Consumer: ", "g_hEmptyEvent", diagnostic);
-        isSignalled(g_hFullEvent,  "Consumer: ", "g_hFullEvent", diagnostic);
-
-        bool isEmpty = false;
-        {
-            Lock lock(cons_cs); // any access to writable shared memory should be protected by lock
-            isEmpty = g_msgs.empty();
-            if (isEmpty)
-                Print(EMPTY_BUFFER);
-        }
-
-        if (isEmpty) {
-            ::ResetEvent(g_hFullEvent); // nothing to consume, need synchronisation
-            DWORD dwResult = ::WaitForSingleObject(g_hFullEvent, emptyBufferTimeout);
-            if (dwResult == WAIT_FAILED)
-                return ERR_SYNC; // error, exiting
-
-            if (dwResult == WAIT_TIMEOUT)
-                continue; // check global timer
-
-            // WAIT_OBJECT_0 - event signalled
-            Print(CONSUMER_WAKE_UP);
-        }
-
-        int cur_msg = 0;
-        {
-            Lock lock(cons_cs);
-            try {
-                cur_msg = g_msgs.front();
-                g_msgs.pop();
-
-            } catch(std::exception& ex) {
-                Print(ex.what());
-                return ERR_STD;
-            } catch(...) {
-                Print("Unknown error ");
-                return ERR_UNKNOWN;
-            }
-
-            stringstream ss;
-            ss << "received:" <<  cur_msg;
-            Print(ss.str().c_str());
-
-            ::SetEvent(g_hEmptyEvent);
-        }
-
-        Consume(cur_msg);
-
-    } // while
-
-    if (tState == ST_ERR)
-        return ERR_SYNC;
-
-    PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
-    return RET_OK;
-}
-
-// Using mutex for synchronisation
-unsigned __stdcall ProducerConsumerMutexRunner::Consumer(void* args) {
-
-    // not using Instance() each time to increase performance (no locks)
-    const SyncTimer& syncTimer = SyncTimer::Instance();
-
-    const int emptyBufferTimeout = 3000; // 3 sec
-    SyncTimerState tState = ST_WORK;
-    bool diagnostic = false; // debug messages
-
-    while ( (tState = syncTimer.State())==ST_WORK ) {
-
-        isSignalled(g_hEmptyMutEvent, "Consumer: ", "g_hEmptyEvent", diagnostic);
-        isSignalled(g_hFullMutEvent,  "Consumer: ", "g_hFullEvent", diagnostic);
-
-        DWORD dwResult = ::WaitForSingleObject(g_hMutex, INFINITE);
-        if (dwResult != WAIT_OBJECT_0)
-            return ERR_SYNC; // error
-            
-        if (g_msgs.empty()) {    // nothing to consume, need synchronisation
-            Print(EMPTY_BUFFER); // protected by lock to synchonise output
-            ::ReleaseMutex(g_hMutex);
-
-            ::ResetEvent(g_hFullMutEvent);
-            DWORD dwResult = ::WaitForSingleObject(g_hFullMutEvent, emptyBufferTimeout);
-            if (dwResult == WAIT_FAILED)
-                return ERR_SYNC;          // error, exiting
-            if (dwResult == WAIT_TIMEOUT) // check global timer
-                continue;
-
-            Print(CONSUMER_WAKE_UP);
-
-            dwResult = ::WaitForSingleObject(g_hMutex, INFINITE);
-            if (dwResult != WAIT_OBJECT_0)
-                return ERR_SYNC; // error
-        }
-
-        int cur_msg = 0;
-        try {
-            cur_msg = g_msgs.front();
-            g_msgs.pop();
-
-        } catch(std::exception& ex) {
-            Print(ex.what());
-            ::ReleaseMutex(g_hMutex);
-            return ERR_STD;
-        } catch(...) {  
-            Print("Unknown error");
-            ::ReleaseMutex(g_hMutex);
-            return ERR_UNKNOWN;
-        }
-
-        Print("received:", cur_msg);
-        ::ReleaseMutex(g_hMutex);
-        ::SetEvent(g_hEmptyMutEvent);
-        Consume(cur_msg);
-
-    } // while
-
-    if (tState == ST_ERR)
-        return ERR_SYNC;
-
-    PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
-    return RET_OK;
-}
-
-} // namespace MT
+#include "stdafx.h"
+#include <queue>
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::Queue<int> g_msgs;
+extern MT::CriticalSection g_cs;
+extern MT::HandleWrapper g_hEmptyEvent, g_hFullEvent, g_hEmptyMutEvent, g_hFullMutEvent, g_hMutex;
+
+bool isSignalled(const MT::HandleWrapper& h, const std::string& hName, const std::string& who,
+                 bool diagnostics = false);
+
+const char EMPTY_BUFFER[]     = "Consumer: empty buffer, waiting";
+const char CONSUMER_WAKE_UP[] = "Consumer: waking up";
+const char SINK_FAILED[]      = "Consumer: cannot write to the file sink";
+const char JOURNAL_FAILED[]   = "Consumer: the journal has failed";
+const char SERVER_IDLE[]      = "Server: no requests";
+const char SUBSCRIBER_IDLE[]  = "Subscriber: no messages";
+const char BUFFER_DRAINED[]   = "Consumer: buffer drained, exiting.";
+const char FORCE_STOPPED[]    = "Consumer: grace deadline passed, exiting.";
+
+struct SinkRecord { // item as it is written by ProducerConsumerFileSinkRunner
+    int      msg;
+    DWORD    threadId;
+    LONGLONG received; // QueryPerformanceCounter
+};
+
+namespace MT {
+
+// Just locking shared data structure with Critical Sections.
+// Using RAAI idiom for aquiring locks
+unsigned __stdcall ProducerConsumerCSRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferWait = 1000; // 1 sec
+    SyncTimerState tState = ST_WORK;
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Consumer");
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+        bool isEmpty = false;
+        {
+            Lock lock(g_cs);      // acquire lock
+            if (g_msgs.empty()) { // nothing to produce, need synchronisation
+                isEmpty = true;
+                Print(EMPTY_BUFFER);
+            }
+        } // release lock
+        if (isEmpty) {
+            if (Draining())
+                break;
+            stats.Add(SC_WAITS);
+            tracer.Begin(TE_EMPTY_WAIT);
+            m_wait.Wait(ItemReady(g_msgs, g_cs), NULL, emptyBufferWait);
+            tracer.End(TE_EMPTY_WAIT);
+            continue; // wait until there will be some input in the buffer or timeout occurs
+        }
+
+        int cur_msg=0;
+        {
+            Lock lock(g_cs);
+            try {
+                cur_msg = g_msgs.front();
+                g_msgs.pop();
+                SampleDepth();
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error ");
+                return ERR_UNKNOWN;
+            }
+            stringstream ss;
+            ss << "received:" <<  cur_msg;
+            Print(ss.str().c_str());
+        }
+        Consume(cur_msg);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Using Critical Sections and Events for synchronisation
+unsigned __stdcall ProducerConsumerEventRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    bool diagnostic=false; // debug messages
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Consumer");
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+        
+        isSignalled(g_hEmptyEvent, "Consumer: ", "g_hEmptyEvent", diagnostic);
+        isSignalled(g_hFullEvent,  "Consumer: ", "g_hFullEvent", diagnostic);
+
+        bool isEmpty = false;
+        {
+            Lock lock(g_cs); // any access to writable shared memory should be protected by lock
+            isEmpty = g_msgs.empty();
+            if (isEmpty)
+                Print(EMPTY_BUFFER);
+        }
+
+        if (isEmpty) {
+            if (Draining())
+                break;
+            ::ResetEvent(g_hFullEvent); // nothing to consume, need synchronisation
+            stats.Add(SC_WAITS);
+            tracer.Begin(TE_EMPTY_WAIT);
+            DWORD dwResult = m_wait.Wait(ItemReady(g_msgs, g_cs), g_hFullEvent, emptyBufferTimeout);
+            tracer.End(TE_EMPTY_WAIT);
+            if (dwResult == WAIT_FAILED)
+                return ERR_SYNC; // error, exiting
+
+            if (dwResult == WAIT_TIMEOUT) {
+                stats.Add(SC_TIMEOUTS);
+                continue; // check global timer
+            }
+
+            // WAIT_OBJECT_0 - event signalled
+            if (m_phase != SP_RUN)
+                continue; // woken up by the shutdown
+            tracer.Instant(TE_WAKEUP);
+            Print(CONSUMER_WAKE_UP);
+        }
+
+        int cur_msg = 0;
+        {
+            Lock lock(g_cs);
+            try {
+                cur_msg = g_msgs.front();
+                g_msgs.pop();
+                SampleDepth();
+
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error ");
+                return ERR_UNKNOWN;
+            }
+
+            stringstream ss;
+            ss << "received:" <<  cur_msg;
+            Print(ss.str().c_str());
+
+            ::SetEvent(g_hEmptyEvent);
+        }
+
+        Consume(cur_msg);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Using mutex for synchronisation
+unsigned __stdcall ProducerConsumerMutexRunner::Consumer(void* args) {
+
+    // not using Instance() each time to increase performance (no locks)
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    bool diagnostic = false; // debug messages
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Consumer");
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        isSignalled(g_hEmptyMutEvent, "Consumer: ", "g_hEmptyEvent", diagnostic);
+        isSignalled(g_hFullMutEvent,  "Consumer: ", "g_hFullEvent", diagnostic);
+
+        tracer.Begin(TE_LOCK_WAIT);
+        DWORD dwResult = ::WaitForSingleObject(g_hMutex, INFINITE);
+        tracer.End(TE_LOCK_WAIT);
+        if (dwResult != WAIT_OBJECT_0)
+            return ERR_SYNC; // error
+            
+        if (g_msgs.empty()) {    // nothing to consume, need synchronisation
+            const LONG seen = m_fullSignals; // under the mutex: a push after the check is counted
+            Print(EMPTY_BUFFER); // protected by lock to synchonise output
+            ::ReleaseMutex(g_hMutex);
+            if (Draining())
+                break;
+
+            ::ResetEvent(g_hFullMutEvent);
+            stats.Add(SC_WAITS);
+            tracer.Begin(TE_EMPTY_WAIT);
+            DWORD dwResult = m_wait.Wait(SignalReady(m_fullSignals, seen, true), g_hFullMutEvent,
+                                         emptyBufferTimeout);
+            tracer.End(TE_EMPTY_WAIT);
+            if (dwResult == WAIT_FAILED)
+                return ERR_SYNC;          // error, exiting
+            if (dwResult == WAIT_TIMEOUT) { // check global timer
+                stats.Add(SC_TIMEOUTS);
+                continue;
+            }
+            if (m_phase != SP_RUN)
+                continue; // woken up by the shutdown
+
+            tracer.Instant(TE_WAKEUP);
+            Print(CONSUMER_WAKE_UP);
+
+            tracer.Begin(TE_LOCK_WAIT);
+            dwResult = ::WaitForSingleObject(g_hMutex, INFINITE);
+            tracer.End(TE_LOCK_WAIT);
+            if (dwResult != WAIT_OBJECT_0)
+                return ERR_SYNC; // error
+        }
+
+        int cur_msg = 0;
+        try {
+            cur_msg = g_msgs.front();
+            g_msgs.pop();
+            SampleDepth();
+
+        } catch(std::exception& ex) {
+            Print(ex.what());
+            ::ReleaseMutex(g_hMutex);
+            return ERR_STD;
+        } catch(...) {  
+            Print("Unknown error");
+            ::ReleaseMutex(g_hMutex);
+            return ERR_UNKNOWN;
+        }
+
+        Print("received:", cur_msg);
+        ::ReleaseMutex(g_hMutex);
+        Signal(g_hEmptyMutEvent, m_emptySignals);
+        Consume(cur_msg);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Using Critical Sections and Events for synchronisation, received items are written
+// to the file. The consumer only copies the record to the sink buffer, file writes
+// are done by the sink I/O threads.
+unsigned __stdcall ProducerConsumerFileSinkRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    Stats& stats = Stats::Instance();
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        bool isEmpty = false;
+        {
+            Lock lock(g_cs);
+            isEmpty = g_msgs.empty();
+            if (isEmpty)
+                Print(EMPTY_BUFFER);
+        }
+
+        if (isEmpty) {
+            if (Draining())
+                break;
+            ::ResetEvent(g_hFullEvent);
+            stats.Add(SC_WAITS);
+            DWORD dwResult = m_wait.Wait(ItemReady(g_msgs, g_cs), g_hFullEvent, emptyBufferTimeout);
+            if (dwResult == WAIT_FAILED)
+                return ERR_SYNC;
+
+            if (dwResult == WAIT_TIMEOUT)
+                stats.Add(SC_TIMEOUTS);
+            if (dwResult == WAIT_TIMEOUT || m_phase != SP_RUN)
+                continue; // check the shutdown
+
+            Print(CONSUMER_WAKE_UP);
+        }
+
+        SinkRecord rec;
+        {
+            Lock lock(g_cs);
+            try {
+                rec.msg = g_msgs.front();
+                g_msgs.pop();
+                SampleDepth();
+
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error ");
+                return ERR_UNKNOWN;
+            }
+
+            Print("received:", rec.msg);
+            ::SetEvent(g_hEmptyEvent);
+        }
+        stats.Add(SC_CONSUMED);
+
+        LARGE_INTEGER now;
+        ::QueryPerformanceCounter(&now);
+        rec.threadId = ::GetCurrentThreadId();
+        rec.received = now.QuadPart;
+        if (!m_sink.Append(&rec, sizeof(rec))) {
+            Print(SINK_FAILED);
+            return ERR_API;
+        }
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Persistent queue: items are read from the journal, read position is committed after
+// the item is consumed, so after restart unconsumed items are received again
+unsigned __stdcall ProducerConsumerJournalRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        int cur_msg = 0;
+        unsigned size = 0;
+        if (!m_journal.Read(&cur_msg, sizeof(cur_msg), size)) {
+            const int error = m_journal.Error(); // corrupt record or failed group commit
+            if (error != RET_OK) {
+                Print(JOURNAL_FAILED);
+                return error;
+            }
+            if (Draining())
+                break;
+            Print(EMPTY_BUFFER);
+            if (m_journal.WaitData(emptyBufferTimeout)) // woken up by the group commit
+                Print(CONSUMER_WAKE_UP);
+            continue; // check global timer
+        }
+
+        Print("received:", cur_msg);
+        Consume(cur_msg);
+        m_journal.Commit(); // saved by the next group commit
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Fulfils the tasks until the stop request (task without promise)
+unsigned __stdcall RequestResponseRunner::Server(void* args) {
+
+    Task task;
+    for (;;) {
+        if (!m_queue.Pop(task, m_replyTimeout)) {
+            Print(SERVER_IDLE);
+            return ERR_SYNC;
+        }
+        if (!task.promise.isValid())
+            break;
+
+        task.promise.SetValue(task.request * 2); // wakes up the client or calls its continuation
+        task = Task(); // the state returns to the pool when the client releases the future
+    }
+    return RET_OK;
+}
+
+// One of the pool: consumes until retired by the controller
+unsigned __stdcall ElasticConsumerRunner::Consumer(void* args) {
+
+    ConsumerSlot& slot = *static_cast<ConsumerSlot*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const DWORD emptyBufferWait = 50; // ms, to check retirement and the global timer
+    SyncTimerState tState = ST_WORK;
+
+    while (slot.retire == 0 && (tState = ConsumerState(syncTimer)) == ST_WORK) {
+
+        int  cur_msg = 0;
+        bool isEmpty = true;
+        {
+            Lock lock(m_cs);
+            if (!g_msgs.empty()) {
+                cur_msg = g_msgs.front();
+                g_msgs.pop();
+                SampleDepth();
+                isEmpty = false;
+            }
+        }
+
+        if (isEmpty) {
+            if (Draining())
+                break;
+            if (::WaitForSingleObject(m_hItems, emptyBufferWait) == WAIT_FAILED)
+                return ERR_SYNC;
+            continue;
+        }
+        ::SetEvent(m_hSpace);
+
+        Stopwatch sw;
+        Consume(cur_msg);
+        ::InterlockedExchangeAdd(&slot.busyUs, static_cast<LONG>(sw.ElapsedNs() / 1000));
+        ::InterlockedIncrement(&slot.consumed);
+    }
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+    if (slot.retire == 0) // not retired by the controller
+        PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+// Takes messages of its group until the stop message (invalid reference)
+unsigned __stdcall PubSubRunner::Subscriber(void* args) {
+
+    SubscriberArgs& subArgs = *static_cast<SubscriberArgs*>(args);
+    LARGE_INTEGER freq, now;
+    ::QueryPerformanceFrequency(&freq);
+
+    for (;;) {
+        MessageRef msg;
+        if (!subArgs.group->Pop(msg, m_queueTimeout)) {
+            Print(SUBSCRIBER_IDLE);
+            return ERR_SYNC;
+        }
+        if (!msg.isValid())
+            break;
+
+        ::QueryPerformanceCounter(&now);
+        subArgs.latencyUs += static_cast<double>(now.QuadPart - msg->Published()) * 1e6 / freq.QuadPart;
+        subArgs.received++;
+        Wait(subArgs.workMs); // all groups read the same payload
+    }
+    return RET_OK;
+}
+
+// Pops items until the queue is empty after the producers have stopped
+unsigned __stdcall UnboundedQueueRunner::Consumer(void* args) {
+
+    WorkerArgs& a = *static_cast<WorkerArgs*>(args);
+    for (;;) {
+        // read before Pop(): if set, all producers had exited and empty queue is final
+        const bool stopping = (m_stopConsumers != 0);
+        int item = 0;
+        if (a.queue->Pop(a.slot, item)) {
+            Work(m_consumeSpin);
+            a.items = a.items + 1;
+            continue;
+        }
+        if (stopping)
+            break;
+        ::SwitchToThread();
+    }
+    return RET_OK;
+}
+
+// Serves the items in the order they were sent and stamps their completion
+unsigned __stdcall OpenLoopRunner::Consumer(void* args) {
+
+    StepArgs& a = *static_cast<StepArgs*>(args);
+    for (;;) {
+        Task task;
+        if (!m_queue.Pop(task, m_queueTimeout))
+            return ERR_SYNC;
+        if (task.request < 0)
+            break; // the producer has sent all items
+
+        for (volatile unsigned i = 0; i < m_serviceSpin; i++) // imitate work
+            ;
+        a.doneNs[task.request] = a.clock->ElapsedNs();
+    }
+    return RET_OK;
+}
+
+// Serves the items until the producer stops, latency is from the send to the end of the work
+unsigned __stdcall SoakRunner::Consumer(void*) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    for (;;) {
+        Task task;
+        if (!m_queue.Pop(task, syncTimer.State() == ST_WORK ? m_queueTimeout : m_stopTimeout)) {
+            if (syncTimer.State() == ST_WORK)
+                continue; // empty for the whole timeout
+            return ERR_SYNC; // the producer has not sent the last item
+        }
+        if (task.request < 0)
+            break;
+
+        for (volatile unsigned i = 0; i < m_serviceSpin; i++) // imitate work
+            ;
+        const double latencyNs = m_clock.ElapsedNs() - m_sentNs[task.request];
+        {
+            Lock lock(m_latencyCs);
+            m_latency.Record(latencyNs);
+        }
+        m_consumed = m_consumed + 1; // the only writer
+    }
+    return RET_OK;
+}
+
+// Critical sections and events as ProducerConsumerEventRunner, but all items in the buffer
+// are taken at once and the kernel processes their records together
+unsigned __stdcall ProducerConsumerBatchRunner::Consumer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const int emptyBufferTimeout = 3000; // 3 sec
+    SyncTimerState tState = ST_WORK;
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Consumer");
+
+    AlignedArray<int> records(m_maxBatch * RECORD_WORDS);
+    if (!records.isValid())
+        return ERR_STD;
+    int msgs[m_maxBatch];
+
+    while ( (tState = ConsumerState(syncTimer)) == ST_WORK ) {
+
+        bool isEmpty = false;
+        {
+            Lock lock(g_cs);
+            isEmpty = g_msgs.empty();
+            if (isEmpty)
+                Print(EMPTY_BUFFER);
+        }
+
+        if (isEmpty) {
+            if (Draining())
+                break;
+            ::ResetEvent(g_hFullEvent); // nothing to consume, need synchronisation
+            stats.Add(SC_WAITS);
+            tracer.Begin(TE_EMPTY_WAIT);
+            DWORD dwResult = m_wait.Wait(ItemReady(g_msgs, g_cs), g_hFullEvent, emptyBufferTimeout);
+            tracer.End(TE_EMPTY_WAIT);
+            if (dwResult == WAIT_FAILED)
+                return ERR_SYNC; // error, exiting
+
+            if (dwResult == WAIT_TIMEOUT)
+                stats.Add(SC_TIMEOUTS);
+            if (dwResult == WAIT_TIMEOUT || m_phase != SP_RUN)
+                continue; // check the shutdown
+
+            tracer.Instant(TE_WAKEUP);
+            Print(CONSUMER_WAKE_UP);
+        }
+
+        size_t count = 0;
+        {
+            Lock lock(g_cs); // one acquisition for the whole batch
+            try {
+                while (count < m_maxBatch && !g_msgs.empty()) {
+                    msgs[count++] = g_msgs.front();
+                    g_msgs.pop();
+                }
+                SampleDepth();
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error ");
+                return ERR_UNKNOWN;
+            }
+            if (count == 0)
+                continue; // taken by the check after the wake-up
+
+            stringstream ss;
+            ss << "received batch: " << msgs[0] << "-" << msgs[count - 1];
+            Print(ss.str().c_str());
+            ::SetEvent(g_hEmptyEvent);
+        }
+
+        ConsumeBatch(msgs, count, records);
+
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    PutThreadFinishMsg( tState == ST_WORK ? BUFFER_DRAINED : FORCE_STOPPED );
+    return RET_OK;
+}
+
+void ProducerConsumerBatchRunner::ConsumeBatch(const int* msgs, size_t count, AlignedArray<int>& records) {
+    TraceScope scope(TE_CONSUME);
+    Wait(rand()%14 * 50); // imitated work of the whole batch
+
+    for (size_t i = 0; i < count; i++)
+        DecodeRecord(msgs[i], &records[i * RECORD_WORDS]);
+
+    Stopwatch sw;
+    BatchSummary summary;
+    RunBatchKernel(m_kernel, &records[0], count * RECORD_WORDS, m_threshold, summary);
+    const double kernelNs = sw.ElapsedNs();
+
+    m_totals.batches  = m_totals.batches + 1; // the only writer
+    m_totals.items    = m_totals.items + static_cast<unsigned>(count);
+    m_totals.checksum = ((m_totals.checksum << 5) | (m_totals.checksum >> 27)) ^ summary.checksum;
+    m_totals.selected = m_totals.selected + summary.selected;
+    m_totals.sum      = m_totals.sum + summary.sum;
+    m_totals.kernelNs = m_totals.kernelNs + kernelNs;
+    Stats::Instance().Add(SC_CONSUMED, static_cast<LONG>(count));
+}
+
+} // namespace MT
@@ -0,0 +1,348 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "filesink.h"
+
+namespace MT {
+
+AsyncFileSink::AsyncFileSink() : m_current(NULL), m_offset(0), m_memory(NULL),
+    m_engine(FSE_OVERLAPPED), m_bufferSize(0), m_maxInFlight(0), m_flushMs(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    ::QueryPerformanceFrequency(&m_freq);
+}
+
+AsyncFileSink::~AsyncFileSink() {
+    Close();
+}
+
+int AsyncFileSink::Open(const TCHAR* fileName, FileSinkEngine engine, unsigned bufferSize,
+                        unsigned buffers, unsigned maxInFlight, unsigned flushMs) {
+
+    if (isOpen() || !m_cs.isValid() || !m_statsCs.isValid())
+        return ERR_SYNC;
+    if (bufferSize == 0 || buffers == 0 || maxInFlight == 0)
+        return ERR_STD;
+
+    m_bufferSize  = bufferSize;
+    m_maxInFlight = maxInFlight < MAXIMUM_WAIT_OBJECTS ? maxInFlight : MAXIMUM_WAIT_OBJECTS;
+    m_flushMs     = flushMs;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_latencies.clear();
+
+    // all buffers in one page aligned region, allocated once and locked in physical memory
+    // if the working set quota allows it (not required for correctness)
+    SIZE_T total = static_cast<SIZE_T>(bufferSize) * buffers;
+    m_memory = static_cast<char*>( ::VirtualAlloc(NULL, total, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE) );
+    if (m_memory == NULL)
+        return ERR_API;
+    ::VirtualLock(m_memory, total);
+
+    m_buffers.resize(buffers);
+    m_free.clear();
+    for (unsigned i = 0; i < buffers; i++) {
+        memset(&m_buffers[i], 0, sizeof(Buffer));
+        m_buffers[i].data = m_memory + static_cast<SIZE_T>(i) * bufferSize;
+        m_free.push_back(&m_buffers[i]);
+    }
+    m_current = GetFreeBuffer();
+    m_offset  = 0;
+
+    m_hBufferFree.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) ); // auto-reset
+    if (!m_hBufferFree.isValid()) {
+        Release();
+        return ERR_API;
+    }
+
+    m_engine = engine;
+    if (m_engine == FSE_OVERLAPPED) {
+        m_hFile.SetHandle( ::CreateFile(fileName, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL) );
+        if (m_hFile.isValid()) // completions of the file writes are queued to the port
+            m_hPort.SetHandle( ::CreateIoCompletionPort(m_hFile, NULL, KEY_WRITE, 1) );
+        if (!m_hPort.isValid()) {
+            m_hFile.SetHandle(INVALID_HANDLE_VALUE); // shares reading only: closed before reopening
+            m_engine = FSE_THREADPOOL;
+        }
+    }
+    if (m_engine == FSE_THREADPOOL) {
+        m_hFile.SetHandle( ::CreateFile(fileName, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, NULL) );
+        if (m_hFile.isValid()) // port is used only as a queue of ready buffers
+            m_hPort.SetHandle( ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, m_maxInFlight) );
+        if (!m_hPort.isValid()) {
+            Release();
+            return ERR_API;
+        }
+    }
+
+    unsigned threads = (m_engine == FSE_OVERLAPPED ? 1 : m_maxInFlight);
+    THREAD_FUNCTION* func = (m_engine == FSE_OVERLAPPED ? &IoThread : &WorkerThread);
+    for (unsigned i = 0; i < threads; i++) {
+        HANDLE h = (HANDLE) _beginthreadex(NULL, 0, func, this, 0, NULL);
+        if (h == 0) {
+            Release();
+            return ERR_API;
+        }
+        m_threads.push_back(h);
+    }
+
+    m_elapsed.Start();
+    return RET_OK;
+}
+
+bool AsyncFileSink::Append(const void* data, unsigned size) {
+
+    if (!isOpen() || size > m_bufferSize)
+        return false;
+
+    bool stalled = false;
+    for (;;) {
+        {
+            Lock lock(m_cs);
+            if (m_current != NULL && m_current->used + size > m_bufferSize) {
+                Submit(m_current);
+                m_current = NULL;
+            }
+            if (m_current == NULL)
+                m_current = GetFreeBuffer();
+
+            if (m_current != NULL) {
+                if (m_current->used == 0) {
+                    LARGE_INTEGER now;
+                    ::QueryPerformanceCounter(&now);
+                    m_current->firstAppend = now.QuadPart;
+                }
+                memcpy(m_current->data + m_current->used, data, size);
+                m_current->used += size;
+                m_current->items++;
+                break;
+            }
+        } // release lock
+
+        // all buffers are being written: wait for a completion, recheck at least each flush interval
+        stalled = true;
+        ::WaitForSingleObject(m_hBufferFree, m_flushMs > 0 ? m_flushMs : 1);
+    }
+
+    if (stalled) {
+        Lock lock(m_statsCs);
+        m_stats.stalls++;
+    }
+    return true;
+}
+
+int AsyncFileSink::Close() {
+
+    if (!isOpen())
+        return RET_OK;
+
+    {
+        Lock lock(m_cs);
+        if (m_current != NULL && m_current->used > 0) {
+            Submit(m_current);
+            m_current = NULL;
+        }
+    }
+    int ret = Release(); // waits for all submitted writes
+
+    Lock lock(m_statsCs);
+    m_stats.elapsedSec = m_elapsed.ElapsedNs() / 1e9;
+    if (!m_latencies.empty()) {
+        std::vector<double> sorted(m_latencies);
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (size_t i = 0; i < sorted.size(); i++)
+            sum += sorted[i];
+        m_stats.latencyAvgUs = sum / sorted.size();
+        m_stats.latencyP50Us = sorted[sorted.size() / 2];
+        m_stats.latencyP99Us = sorted[sorted.size() * 99 / 100];
+        m_stats.latencyMaxUs = sorted.back();
+    }
+    return ret;
+}
+
+void AsyncFileSink::GetStats(FileSinkStats& stats) const {
+    Lock lock(m_statsCs);
+    stats = m_stats;
+}
+
+void AsyncFileSink::Report(std::ostream& out) const {
+    FileSinkStats s;
+    GetStats(s);
+
+    const double mb = s.bytes / (1024.0 * 1024.0);
+    out << "File sink (" << (m_engine == FSE_OVERLAPPED ? "overlapped I/O" : "thread pool") << "): "
+        << s.items << " items in " << s.batches << " writes ("
+        << (s.batches > 0 ? static_cast<double>(s.items) / s.batches : 0.0) << " items per write), "
+        << mb << " MB, " << (s.elapsedSec > 0 ? mb / s.elapsedSec : 0.0) << " MB/s" << endl
+        << "  write latency, us: avg " << s.latencyAvgUs << ", p50 " << s.latencyP50Us
+        << ", p99 " << s.latencyP99Us << ", max " << s.latencyMaxUs << endl
+        << "  stalls (no free buffer): " << s.stalls << ", failed writes: " << s.errors;
+}
+
+AsyncFileSink::Buffer* AsyncFileSink::GetFreeBuffer() {
+    if (m_free.empty())
+        return NULL;
+    Buffer* buf = m_free.back();
+    m_free.pop_back();
+    return buf;
+}
+
+void AsyncFileSink::Submit(Buffer* buf) {
+    // file offsets are assigned in the order of submission, so writes may complete in any order
+    ULARGE_INTEGER offset;
+    offset.QuadPart = m_offset;
+    memset(&buf->ov, 0, sizeof(OVERLAPPED));
+    buf->ov.Offset     = offset.LowPart;
+    buf->ov.OffsetHigh = offset.HighPart;
+    m_offset += buf->used;
+
+    ::PostQueuedCompletionStatus(m_hPort, buf->used, KEY_SUBMIT, &buf->ov);
+}
+
+// writes partially filled buffer which is waiting longer than flush interval
+void AsyncFileSink::FlushIdle() {
+    Lock lock(m_cs);
+    if (m_current == NULL || m_current->used == 0)
+        return;
+
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    if ((now.QuadPart - m_current->firstAppend) * 1000 < static_cast<LONGLONG>(m_flushMs) * m_freq.QuadPart)
+        return;
+
+    Submit(m_current);
+    m_current = GetFreeBuffer(); // if NULL, the next Append will take a returned one
+}
+
+void AsyncFileSink::Complete(Buffer* buf, bool ok) {
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    {
+        Lock lock(m_statsCs);
+        if (ok) {
+            m_stats.bytes   += buf->used;
+            m_stats.items   += buf->items;
+            m_stats.batches++;
+            m_latencies.push_back( (now.QuadPart - buf->firstAppend) * 1e6 / m_freq.QuadPart );
+        } else {
+            m_stats.errors++;
+        }
+    }
+
+    buf->used  = 0;
+    buf->items = 0;
+    {
+        Lock lock(m_cs);
+        m_free.push_back(buf);
+    }
+    ::SetEvent(m_hBufferFree); // wake up stalled Append
+}
+
+// stops I/O threads after all queued buffers are written, frees resources
+int AsyncFileSink::Release() {
+
+    int ret = RET_OK;
+    if (!m_threads.empty()) {
+        for (size_t i = 0; i < m_threads.size(); i++) // queued after all submitted buffers
+            ::PostQueuedCompletionStatus(m_hPort, 0, KEY_STOP, NULL);
+
+        ::WaitForMultipleObjects(static_cast<DWORD>(m_threads.size()), &m_threads[0], TRUE, INFINITE);
+        for (size_t i = 0; i < m_threads.size(); i++) {
+            DWORD code = 0;
+            ::GetExitCodeThread(m_threads[i], &code);
+            if (code != RET_OK && ret == RET_OK)
+                ret = static_cast<int>(code);
+            ::CloseHandle(m_threads[i]);
+        }
+        m_threads.clear();
+    }
+
+    m_hPort.SetHandle(INVALID_HANDLE_VALUE);
+    m_hFile.SetHandle(INVALID_HANDLE_VALUE);
+    m_hBufferFree.SetHandle(INVALID_HANDLE_VALUE);
+
+    if (m_memory != NULL) {
+        ::VirtualFree(m_memory, 0, MEM_RELEASE); // also unlocks the pages
+        m_memory = NULL;
+    }
+    m_buffers.clear();
+    m_free.clear();
+    m_current = NULL;
+    return ret;
+}
+
+// FSE_OVERLAPPED: single thread submits ready buffers and handles write completions
+unsigned __stdcall AsyncFileSink::IoThread(void* args) {
+
+    AsyncFileSink* sink = static_cast<AsyncFileSink*>(args);
+    std::deque<Buffer*> pending; // ready buffers exceeding in-flight limit
+    unsigned inFlight = 0;
+    bool stopping = false;
+
+    while (!stopping || inFlight > 0 || !pending.empty()) {
+
+        DWORD      bytes = 0;
+        ULONG_PTR  key   = 0;
+        OVERLAPPED* ov   = NULL;
+        BOOL ok = ::GetQueuedCompletionStatus(sink->m_hPort, &bytes, &key, &ov, sink->m_flushMs);
+
+        if (ov == NULL) {         // timeout or stop request
+            if (!ok && ::GetLastError() != WAIT_TIMEOUT)
+                return ERR_API;
+            if (ok && key == KEY_STOP)
+                stopping = true;
+        } else if (key == KEY_SUBMIT) {
+            pending.push_back( CONTAINING_RECORD(ov, Buffer, ov) );
+        } else {                  // KEY_WRITE: overlapped write completed
+            inFlight--;
+            sink->Complete( CONTAINING_RECORD(ov, Buffer, ov), ok != FALSE );
+        }
+
+        while (inFlight < sink->m_maxInFlight && !pending.empty()) {
+            Buffer* buf = pending.front();
+            pending.pop_front();
+
+            // completion packet is queued even if the write completes synchronously
+            if (::WriteFile(sink->m_hFile, buf->data, buf->used, NULL, &buf->ov) ||
+                ::GetLastError() == ERROR_IO_PENDING)
+                inFlight++;
+            else
+                sink->Complete(buf, false);
+        }
+
+        if (!stopping)
+            sink->FlushIdle();
+    }
+    return RET_OK;
+}
+
+// FSE_THREADPOOL: each worker writes one buffer at a time at the offset set in OVERLAPPED
+unsigned __stdcall AsyncFileSink::WorkerThread(void* args) {
+
+    AsyncFileSink* sink = static_cast<AsyncFileSink*>(args);
+    for (;;) {
+        DWORD      bytes = 0;
+        ULONG_PTR  key   = 0;
+        OVERLAPPED* ov   = NULL;
+        BOOL ok = ::GetQueuedCompletionStatus(sink->m_hPort, &bytes, &key, &ov, sink->m_flushMs);
+
+        if (ov == NULL) {
+            if (!ok && ::GetLastError() != WAIT_TIMEOUT)
+                return ERR_API;
+            if (ok && key == KEY_STOP)
+                break;
+            sink->FlushIdle();
+            continue;
+        }
+
+        Buffer* buf = CONTAINING_RECORD(ov, Buffer, ov);
+        DWORD written = 0; // synchronous handle: positional write, as pwrite()
+        BOOL ret = ::WriteFile(sink->m_hFile, buf->data, buf->used, &written, &buf->ov);
+        sink->Complete(buf, ret != FALSE && written == buf->used);
+        sink->FlushIdle();
+    }
+    return RET_OK;
+}
+
+} // namespace MT
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+// Engines of AsyncFileSink
+enum FileSinkEngine {
+    FSE_OVERLAPPED, // one I/O thread keeps overlapped writes pending on the completion port
+    FSE_THREADPOOL  // worker threads do synchronous positional writes (fallback)
+};
+
+struct FileSinkStats {
+    ULONGLONG bytes;
+    ULONGLONG items;   // appended records
+    ULONGLONG batches; // write requests
+    ULONGLONG stalls;  // appends which had to wait for a free buffer
+    ULONGLONG errors;  // failed write requests
+    double    elapsedSec;      // from Open() to the end of Close()
+    double    latencyAvgUs;    // from the first record of a batch to the write completion
+    double    latencyP50Us;
+    double    latencyP99Us;
+    double    latencyMaxUs;
+};
+
+// Batched asynchronous file writer for consumer threads.
+//
+// Records are copied into one of preallocated page-aligned buffers which are locked
+// in memory once at Open() (as registered buffers of asynchronous I/O engines).
+// A full buffer, or partially filled one after flush interval, is written to the file
+// as a single request, so many records are coalesced per submission and at most
+// maxInFlight writes are pending at any time.
+//
+// Consumer threads never call file API: Append() only copies the record and posts a
+// full buffer to the I/O completion port. It waits only if all buffers are being
+// written (backpressure), such appends are counted as stalls.
+//
+// see: http://msdn.microsoft.com/en-us/library/windows/desktop/aa365198(v=vs.85).aspx
+class AsyncFileSink {
+public:
+    static const unsigned defBufferSize  = 64 * 1024;
+    static const unsigned defBuffers     = 16;
+    static const unsigned defMaxInFlight = 4;
+    static const unsigned defFlushMs     = 50; // maximal delay of partially filled buffer
+
+    AsyncFileSink();
+    ~AsyncFileSink();
+
+    // if overlapped I/O cannot be used the sink falls back to FSE_THREADPOOL
+    int Open(const TCHAR* fileName, FileSinkEngine engine = FSE_OVERLAPPED,
+             unsigned bufferSize  = defBufferSize,
+             unsigned buffers     = defBuffers,
+             unsigned maxInFlight = defMaxInFlight,
+             unsigned flushMs     = defFlushMs);
+
+    // thread-safe, record must not be larger than buffer size
+    bool Append(const void* data, unsigned size);
+
+    // all appending threads must be finished. Writes remaining data and waits for
+    // all pending requests
+    int Close();
+
+    bool isOpen() const {
+        return m_hPort.isValid();
+    }
+
+    FileSinkEngine Engine() const {
+        return m_engine;
+    }
+
+    void GetStats(FileSinkStats& stats) const;
+    void Report(std::ostream& out) const;
+
+private:
+    AsyncFileSink(const AsyncFileSink&);
+    AsyncFileSink& operator=(const AsyncFileSink&);
+
+    struct Buffer {
+        OVERLAPPED ov;          // completion packet returns pointer to it
+        char*      data;
+        unsigned   used;
+        unsigned   items;
+        LONGLONG   firstAppend; // QueryPerformanceCounter of the first record
+    };
+
+    // completion keys
+    static const ULONG_PTR KEY_WRITE  = 0; // completed overlapped write
+    static const ULONG_PTR KEY_SUBMIT = 1; // buffer is ready to be written
+    static const ULONG_PTR KEY_STOP   = 2;
+
+    static THREAD_FUNCTION IoThread;     // FSE_OVERLAPPED
+    static THREAD_FUNCTION WorkerThread; // FSE_THREADPOOL
+
+    Buffer* GetFreeBuffer();       // m_cs must be acquired
+    void    Submit(Buffer* buf);   // m_cs must be acquired
+    void    FlushIdle();
+    void    Complete(Buffer* buf, bool ok);
+    int     Release();
+
+    CriticalSection      m_cs;      // protects m_current, m_free and m_offset
+    std::vector<Buffer>  m_buffers;
+    std::vector<Buffer*> m_free;
+    Buffer*              m_current; // buffer being filled
+    LONGLONG             m_offset;  // file offset of the next submitted buffer
+    char*                m_memory;
+
+    HandleWrapper        m_hFile;
+    HandleWrapper        m_hPort;
+    HandleWrapper        m_hBufferFree; // signalled when a write completes
+    std::vector<HANDLE>  m_threads;
+
+    FileSinkEngine m_engine;
+    unsigned       m_bufferSize;
+    unsigned       m_maxInFlight;
+    unsigned       m_flushMs;
+
+    mutable CriticalSection m_statsCs;
+    FileSinkStats       m_stats;
+    std::vector<double> m_latencies; // microseconds, per batch
+    LARGE_INTEGER       m_freq;
+    Stopwatch           m_elapsed;
+};
+
+} // namespace MT
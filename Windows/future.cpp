@@ -0,0 +1,307 @@
+#include "stdafx.h"
+#include "future.h"
+
+namespace MT {
+
+TaskPool::TaskPool(unsigned capacity) : m_states(NULL), m_capacity(capacity) {
+
+    ::InitializeSListHead(&m_free);
+
+    // list entries must be aligned on MEMORY_ALLOCATION_ALIGNMENT boundary, the cache line is wider
+    TaskState* states = static_cast<TaskState*>( AllocateAligned(capacity * sizeof(TaskState)) );
+    if (states == NULL)
+        return;
+
+    unsigned created = 0;
+    for (; created < capacity; created++) {
+        TaskState& s = states[created];
+        memset(&s, 0, sizeof(TaskState));
+        s.pool   = this;
+        s.hReady = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (s.hReady == NULL)
+            break;
+        ::InterlockedPushEntrySList(&m_free, &s.entry);
+    }
+
+    if (created != capacity) { // all or nothing
+        for (unsigned i = 0; i < created; i++)
+            ::CloseHandle(states[i].hReady);
+        FreeAligned(states);
+        ::InitializeSListHead(&m_free);
+        return;
+    }
+    m_states = states;
+}
+
+// all Promise and Future objects must be released
+TaskPool::~TaskPool() {
+    if (m_states == NULL)
+        return;
+    for (unsigned i = 0; i < m_capacity; i++)
+        ::CloseHandle(m_states[i].hReady);
+    FreeAligned(m_states);
+}
+
+TaskState* TaskPool::Acquire() {
+    if (m_states == NULL)
+        return NULL;
+
+    PSLIST_ENTRY entry = ::InterlockedPopEntrySList(&m_free);
+    if (entry == NULL)
+        return NULL;
+
+    TaskState* state = CONTAINING_RECORD(entry, TaskState, entry);
+    state->refs = 1;
+    return state;
+}
+
+void TaskPool::Release(TaskState* state) {
+    if (::InterlockedDecrement(&state->refs) != 0)
+        return;
+
+    // the last reference: nobody can access the state, prepare it for the next task
+    if (state->flags & TS_WAITER)
+        ::ResetEvent(state->hReady);
+    state->flags        = 0;
+    state->continuation = NULL;
+    state->context      = NULL;
+    ::InterlockedPushEntrySList(&m_free, &state->entry);
+}
+
+Promise::Promise(const Promise& other) : m_state(other.m_state) {
+    if (m_state != NULL)
+        ::InterlockedIncrement(&m_state->refs);
+}
+
+Promise& Promise::operator=(const Promise& other) {
+    if (other.m_state != NULL)
+        ::InterlockedIncrement(&other.m_state->refs);
+    if (m_state != NULL)
+        m_state->pool->Release(m_state);
+    m_state = other.m_state;
+    return *this;
+}
+
+Promise::~Promise() {
+    if (m_state != NULL)
+        m_state->pool->Release(m_state);
+}
+
+Future Promise::GetFuture() const {
+    if (m_state == NULL)
+        return Future();
+    ::InterlockedIncrement(&m_state->refs);
+    return Future(m_state);
+}
+
+void Promise::SetValue(int result) {
+    TaskState* s = m_state;
+    s->result = result;
+
+    // interlocked operation is a full barrier: the result is visible before TS_READY
+    LONG flags = s->flags;
+    for (;;) {
+        LONG prev = ::InterlockedCompareExchange(&s->flags, flags | TS_READY, flags);
+        if (prev == flags)
+            break;
+        flags = prev;
+    }
+
+    if (flags & TS_WAITER) // kernel call only if somebody is waiting
+        ::SetEvent(s->hReady);
+    if (flags & TS_CONTINUATION)
+        s->continuation(result, s->context);
+}
+
+Future::Future(TaskState* state) : m_state(state) {
+}
+
+Future::Future(const Future& other) : m_state(other.m_state) {
+    if (m_state != NULL)
+        ::InterlockedIncrement(&m_state->refs);
+}
+
+Future& Future::operator=(const Future& other) {
+    if (other.m_state != NULL)
+        ::InterlockedIncrement(&other.m_state->refs);
+    if (m_state != NULL)
+        m_state->pool->Release(m_state);
+    m_state = other.m_state;
+    return *this;
+}
+
+Future::~Future() {
+    if (m_state != NULL)
+        m_state->pool->Release(m_state);
+}
+
+bool Future::Wait(DWORD timeout) const {
+    for (int i = 0; i < m_spinCount; i++) { // result usually comes soon
+        if (IsReady())
+            return true;
+        YieldProcessor();
+    }
+
+    // register as waiter unless the result came meanwhile
+    LONG flags = m_state->flags;
+    for (;;) {
+        if (flags & TS_READY)
+            return true;
+        LONG prev = ::InterlockedCompareExchange(&m_state->flags, flags | TS_WAITER, flags);
+        if (prev == flags)
+            break;
+        flags = prev;
+    }
+    return ::WaitForSingleObject(m_state->hReady, timeout) == WAIT_OBJECT_0;
+}
+
+void Future::Then(Continuation continuation, void* context) {
+    m_state->continuation = continuation;
+    m_state->context      = context;
+
+    LONG flags = m_state->flags;
+    for (;;) {
+        if (flags & TS_READY) {
+            continuation(m_state->result, context);
+            return;
+        }
+        LONG prev = ::InterlockedCompareExchange(&m_state->flags, flags | TS_CONTINUATION, flags);
+        if (prev == flags)
+            return; // SetValue() will call it
+        flags = prev;
+    }
+}
+
+TaskQueue::TaskQueue(unsigned capacity) : m_syncType(CS), m_tasks(capacity), m_head(0), m_count(0) {
+}
+
+int TaskQueue::Init(SyncType syncType) {
+    if (!m_cs.isValid())
+        return ERR_API;
+    m_syncType = syncType;
+    m_head     = 0;
+    m_count    = 0;
+
+    const LONG capacity = static_cast<LONG>(m_tasks.size());
+    switch (syncType) {
+        case CS:
+            return RET_OK;
+        case MUTEX:
+            m_hMutex.SetHandle( ::CreateMutex(NULL, FALSE, NULL) );
+            if (!m_hMutex.isValid())
+                return ERR_API;
+            // fall through: the same events
+        case CS_EVENT:
+            m_hNotEmpty.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) );
+            m_hNotFull.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) );
+            break;
+        case SEMAPHORE:
+            m_hNotEmpty.SetHandle( ::CreateSemaphore(NULL, 0, capacity, NULL) );
+            m_hNotFull.SetHandle( ::CreateSemaphore(NULL, capacity, capacity, NULL) );
+            break;
+        default:
+            return ERR_SYNC; // the queue is in memory only
+    }
+    if (!m_hNotEmpty.isValid() || !m_hNotFull.isValid())
+        return ERR_API;
+    return RET_OK;
+}
+
+bool TaskQueue::Enter() {
+    if (m_syncType == MUTEX)
+        return ::WaitForSingleObject(m_hMutex, INFINITE) == WAIT_OBJECT_0;
+    return m_cs.Enter();
+}
+
+void TaskQueue::Leave() {
+    if (m_syncType == MUTEX)
+        ::ReleaseMutex(m_hMutex);
+    else
+        m_cs.Leave();
+}
+
+// waits for the state change of the queue, false if the timeout expired
+bool TaskQueue::WaitFor(HANDLE hEvent, DWORD timeout, const Stopwatch& sw) {
+    DWORD elapsed = static_cast<DWORD>(sw.ElapsedNs() / 1000000);
+    if (timeout != INFINITE && elapsed >= timeout)
+        return false;
+
+    if (m_syncType == CS) { // polling
+        ::SwitchToThread();
+        return true;
+    }
+    DWORD slice = m_waitSlice;
+    if (timeout != INFINITE && timeout - elapsed < slice)
+        slice = timeout - elapsed;
+    return ::WaitForSingleObject(hEvent, slice) != WAIT_FAILED;
+}
+
+bool TaskQueue::Push(const Task& task, DWORD timeout) {
+    const unsigned capacity = static_cast<unsigned>(m_tasks.size());
+
+    if (m_syncType == SEMAPHORE) { // the slot is reserved, queue cannot be full
+        if (::WaitForSingleObject(m_hNotFull, timeout) != WAIT_OBJECT_0)
+            return false;
+        if (!Enter())
+            return false;
+        m_tasks[(m_head + m_count++) % capacity] = task;
+        Leave();
+        ::ReleaseSemaphore(m_hNotEmpty, 1, NULL);
+        return true;
+    }
+
+    Stopwatch sw;
+    for (;;) {
+        if (!Enter())
+            return false;
+        if (m_count < capacity) {
+            m_tasks[(m_head + m_count++) % capacity] = task;
+            Leave();
+            if (m_syncType != CS)
+                ::SetEvent(m_hNotEmpty);
+            return true;
+        }
+        Leave();
+        if (!WaitFor(m_hNotFull, timeout, sw))
+            return false;
+    }
+}
+
+bool TaskQueue::Pop(Task& task, DWORD timeout) {
+    const unsigned capacity = static_cast<unsigned>(m_tasks.size());
+
+    if (m_syncType == SEMAPHORE) {
+        if (::WaitForSingleObject(m_hNotEmpty, timeout) != WAIT_OBJECT_0)
+            return false;
+        if (!Enter())
+            return false;
+        task = m_tasks[m_head];
+        m_tasks[m_head] = Task(); // releases the reference to the task state
+        m_head = (m_head + 1) % capacity;
+        m_count--;
+        Leave();
+        ::ReleaseSemaphore(m_hNotFull, 1, NULL);
+        return true;
+    }
+
+    Stopwatch sw;
+    for (;;) {
+        if (!Enter())
+            return false;
+        if (m_count > 0) {
+            task = m_tasks[m_head];
+            m_tasks[m_head] = Task();
+            m_head = (m_head + 1) % capacity;
+            m_count--;
+            Leave();
+            if (m_syncType != CS)
+                ::SetEvent(m_hNotFull);
+            return true;
+        }
+        Leave();
+        if (!WaitFor(m_hNotEmpty, timeout, sw))
+            return false;
+    }
+}
+
+} // namespace MT
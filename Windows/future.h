@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include "threads.h"
+
+namespace MT {
+
+typedef void (*Continuation)(int result, void* context);
+
+// task state flags
+const LONG TS_READY        = 1;
+const LONG TS_WAITER       = 2; // hReady must be set
+const LONG TS_CONTINUATION = 4;
+
+class TaskPool;
+
+// Shared state of a Promise/Future pair. States are preallocated by TaskPool and
+// recycled, so completing a task needs no memory allocation.
+struct MT_CACHE_ALIGN TaskState { // tasks of different threads do not share cache lines
+    SLIST_ENTRY   entry;        // free list link, must be the first member
+    volatile LONG refs;         // Promise and Future copies
+    volatile LONG flags;        // TS_xxx
+    int           result;
+    Continuation  continuation;
+    void*         context;
+    HANDLE        hReady;       // manual-reset, created once with the pool
+    TaskPool*     pool;
+};
+
+// Lock-free pool of task states (interlocked singly linked list as the free list)
+// http://msdn.microsoft.com/en-us/library/windows/desktop/ms684121(v=vs.85).aspx
+class TaskPool {
+public:
+    TaskPool(unsigned capacity);
+    ~TaskPool();
+
+    bool isValid() const {
+        return m_states != NULL;
+    }
+
+    TaskState* Acquire(); // NULL if all states are in use
+    void Release(TaskState* state);
+
+private:
+    TaskPool(const TaskPool&);
+    TaskPool& operator=(const TaskPool&);
+
+    SLIST_HEADER m_free;
+    TaskState*   m_states;
+    unsigned     m_capacity;
+};
+
+class Future;
+
+// Consumer side of the task: fulfils it once with SetValue()
+class Promise {
+public:
+    Promise() : m_state(NULL) {
+    }
+    explicit Promise(TaskPool& pool) : m_state(pool.Acquire()) {
+    }
+    Promise(const Promise& other);
+    Promise& operator=(const Promise& other);
+    ~Promise();
+
+    bool isValid() const { // false if the pool is exhausted
+        return m_state != NULL;
+    }
+
+    Future GetFuture() const;
+
+    // wakes up the waiting thread and calls the continuation in this thread
+    void SetValue(int result);
+
+private:
+    TaskState* m_state;
+};
+
+// Producer side of the task: result can be waited for, polled or passed to a continuation
+class Future {
+public:
+    Future() : m_state(NULL) {
+    }
+    Future(const Future& other);
+    Future& operator=(const Future& other);
+    ~Future();
+
+    bool isValid() const {
+        return m_state != NULL;
+    }
+
+    bool IsReady() const { // polling
+        return (m_state->flags & TS_READY) != 0;
+    }
+
+    // spins shortly before falling to the kernel wait
+    bool Wait(DWORD timeout = INFINITE) const;
+
+    int Get() const { // waits if not ready
+        Wait();
+        return m_state->result;
+    }
+
+    // called at once if the result is ready, otherwise by the thread calling SetValue()
+    // (only one continuation per task)
+    void Then(Continuation continuation, void* context);
+
+private:
+    friend class Promise;
+    explicit Future(TaskState* state); // takes the reference
+
+    static const int m_spinCount = 1000;
+
+    TaskState* m_state;
+};
+
+// request with the completion token
+struct Task {
+    int     request;
+    Promise promise; // invalid promise asks the consumer to exit
+};
+
+// Bounded queue of tasks synchronised with the objects of the chosen SyncType:
+//   CS        - critical section, waiting threads poll the queue
+//   CS_EVENT  - critical section, waiting threads are woken up by auto-reset events
+//   MUTEX     - mutex and the same events
+//   SEMAPHORE - critical section, semaphores count free slots and queued tasks
+// Storage is preallocated, so pushing a task allocates nothing.
+class TaskQueue {
+public:
+    TaskQueue(unsigned capacity);
+
+    int Init(SyncType syncType); // (re)creates the synchronisation objects, queue must be empty
+
+    // false on timeout or failure
+    bool Push(const Task& task, DWORD timeout = INFINITE);
+    bool Pop(Task& task, DWORD timeout = INFINITE);
+
+private:
+    TaskQueue(const TaskQueue&);
+    TaskQueue& operator=(const TaskQueue&);
+
+    static const DWORD m_waitSlice = 10; // ms, auto-reset events may miss a waiter
+
+    bool Enter();
+    void Leave();
+    bool WaitFor(HANDLE hEvent, DWORD timeout, const Stopwatch& sw);
+
+    SyncType m_syncType;
+
+    CriticalSection    m_cs;
+    HandleWrapper      m_hMutex;
+    HandleWrapper      m_hNotEmpty; // events or semaphores (queued tasks)
+    HandleWrapper      m_hNotFull;  // (free slots)
+
+    std::vector<Task>  m_tasks;     // ring buffer
+    unsigned           m_head;
+    unsigned           m_count;
+};
+
+} // namespace MT
@@ -0,0 +1,534 @@
+#include "stdafx.h"
+#include <climits>
+#include <algorithm>
+#include "journal.h"
+
+namespace MT {
+
+Journal::Journal() : m_segmentSize(defSegmentSize), m_durabilityMs(defDurabilityMs),
+    m_write(NULL), m_writeOffset(0), m_flushedOffset(0), m_writtenSeq(0), m_durableSeq(0),
+    m_read(NULL), m_readSeq(0), m_commitSeq(0), m_checkpointSeq(0), m_firstSegment(1),
+    m_waiters(0), m_error(RET_OK), m_hFlusher(NULL)
+{
+    m_readPos.segment = m_commitPos.segment = 1;
+    m_readPos.offset  = m_commitPos.offset  = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+Journal::~Journal() {
+    Close();
+}
+
+int Journal::Open(const TCHAR* name, unsigned durabilityMs, unsigned segmentSize) {
+
+    if (isOpen() || !m_cs.isValid())
+        return ERR_SYNC;
+    if (segmentSize < 2 * sizeof(RecordHeader))
+        return ERR_STD;
+
+    m_name          = name;
+    m_segmentSize   = segmentSize;
+    m_durabilityMs  = durabilityMs > 0 ? durabilityMs : 1;
+    m_error         = RET_OK;
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_hData.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) );
+    m_hStop.SetHandle( ::CreateEvent(NULL, TRUE, FALSE, NULL) );
+    m_hDurable.SetHandle( ::CreateSemaphore(NULL, 0, LONG_MAX, NULL) );
+    if (!m_hData.isValid() || !m_hStop.isValid() || !m_hDurable.isValid()) {
+        Release();
+        return ERR_API;
+    }
+
+    int ret = Recover();
+    if (ret != RET_OK) {
+        Release();
+        return ret;
+    }
+
+    m_hFlusher = (HANDLE) _beginthreadex(NULL, 0, &FlusherThread, this, 0, NULL);
+    if (m_hFlusher == 0) {
+        Release();
+        return ERR_API;
+    }
+    return RET_OK;
+}
+
+int Journal::Close() {
+
+    if (!isOpen())
+        return RET_OK;
+
+    DWORD code = RET_OK;
+    if (m_hFlusher != NULL) {
+        ::SetEvent(m_hStop); // flusher makes the final group commit before exit
+        ::WaitForSingleObject(m_hFlusher, INFINITE);
+        ::GetExitCodeThread(m_hFlusher, &code);
+        ::CloseHandle(m_hFlusher);
+        m_hFlusher = NULL;
+    }
+    Release();
+    return static_cast<int>(code);
+}
+
+ULONGLONG Journal::Append(const void* data, unsigned size) {
+
+    const DWORD recSize = RecordSize(size);
+    if (recSize + sizeof(RecordHeader) > m_segmentSize) // segment end marker must fit too
+        return 0;
+
+    Lock lock(m_cs);
+    if (m_write == NULL || m_error != RET_OK)
+        return 0;
+    if (m_writeOffset + recSize + sizeof(RecordHeader) > m_segmentSize && !Rotate())
+        return 0;
+
+    RecordHeader h;
+    h.magic    = RECORD_MAGIC;
+    h.size     = size;
+    h.seq      = m_writtenSeq + 1;
+    h.checksum = Checksum(data, size, h.seq);
+    h.reserved = 0;
+
+    char* p = m_write->View() + m_writeOffset;
+    memcpy(p + sizeof(RecordHeader), data, size);
+    memcpy(p, &h, sizeof(RecordHeader)); // torn records are rejected by the checksum on recovery
+
+    m_writeOffset += recSize;
+    m_writtenSeq   = h.seq;
+    m_stats.appended++;
+    return h.seq;
+}
+
+bool Journal::WaitDurable(ULONGLONG seq, DWORD timeout) {
+
+    Stopwatch sw;
+    bool ret = true;
+    for (;;) {
+        {
+            Lock lock(m_cs);
+            if (m_durableSeq >= seq || m_write == NULL || m_error != RET_OK)
+                break;
+            m_waiters++;
+        }
+        // a permit left by a timed out waiter only causes one more check
+        if (::WaitForSingleObject(m_hDurable, timeout) != WAIT_OBJECT_0) {
+            ret = false;
+            break;
+        }
+    }
+
+    Lock lock(m_cs);
+    m_stats.commitWaits++;
+    m_stats.commitWaitUs += sw.ElapsedNs() / 1000;
+    return ret && m_durableSeq >= seq;
+}
+
+bool Journal::Read(void* data, unsigned maxSize, unsigned& size) {
+
+    Lock lock(m_cs);
+    while (m_readSeq < m_durableSeq && m_error == RET_OK) {
+        char* view = ReadView();
+        if (view == NULL)
+            return false;
+
+        const RecordHeader* h = reinterpret_cast<const RecordHeader*>(view + m_readPos.offset);
+        if (h->magic == SEGMENT_END) {
+            m_readPos.segment++;
+            m_readPos.offset = 0;
+            continue;
+        }
+        // the read position would not move past it: the consumer is stopped, not spinning
+        if (h->magic != RECORD_MAGIC || h->size > maxSize ||
+            h->size > m_segmentSize - m_readPos.offset - sizeof(RecordHeader)) {
+            m_error = ERR_STD;
+            return false;
+        }
+
+        memcpy(data, view + m_readPos.offset + sizeof(RecordHeader), h->size);
+        size = h->size;
+        m_readPos.offset += RecordSize(h->size);
+        m_readSeq = h->seq;
+        m_stats.consumed++;
+        return true;
+    }
+    return false;
+}
+
+bool Journal::WaitData(DWORD timeout) {
+    {
+        Lock lock(m_cs);
+        if (m_error != RET_OK)
+            return false;
+        if (m_readSeq < m_durableSeq)
+            return true;
+    }
+    return ::WaitForSingleObject(m_hData, timeout) == WAIT_OBJECT_0;
+}
+
+int Journal::Error() const {
+    Lock lock(m_cs);
+    return m_error;
+}
+
+void Journal::Commit() {
+    Lock lock(m_cs);
+    m_commitPos = m_readPos;
+    m_commitSeq = m_readSeq;
+}
+
+ULONGLONG Journal::Unconsumed() const {
+    Lock lock(m_cs);
+    return m_writtenSeq - m_readSeq;
+}
+
+void Journal::GetStats(JournalStats& stats) const {
+    Lock lock(m_cs);
+    stats = m_stats;
+}
+
+void Journal::Report(std::ostream& out) const {
+    JournalStats s;
+    GetStats(s);
+
+    out << "Journal: appended " << s.appended << ", consumed " << s.consumed
+        << ", recovered at open " << s.recovered << ", unconsumed " << Unconsumed() << endl
+        << "  group commits: " << s.flushes << ", records per commit "
+        << (s.flushes > 0 ? static_cast<double>(s.flushedRecords) / s.flushes : 0.0)
+        << ", commit time avg " << (s.flushes > 0 ? s.flushUs / s.flushes : 0.0) << " us" << endl
+        << "  producer durability wait avg "
+        << (s.commitWaits > 0 ? s.commitWaitUs / s.commitWaits : 0.0) << " us";
+}
+
+// record with header, aligned to 8 bytes
+DWORD Journal::RecordSize(unsigned size) {
+    return (sizeof(RecordHeader) + size + 7) & ~7u;
+}
+
+// FNV-1a of the sequence number and the payload
+DWORD Journal::Checksum(const void* data, unsigned size, ULONGLONG seq) {
+    DWORD hash = 2166136261u;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(&seq);
+    for (unsigned i = 0; i < sizeof(seq); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    p = static_cast<const unsigned char*>(data);
+    for (unsigned i = 0; i < size; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+std::basic_string<TCHAR> Journal::SegmentName(DWORD number) const {
+    TCHAR suffix[32];
+    _stprintf_s(suffix, 32, _T(".%08lu.seg"), number);
+    return m_name + suffix;
+}
+
+// the oldest segment file, 1 if there are none
+DWORD Journal::FindFirstSegment() const {
+    std::basic_string<TCHAR> pattern = m_name + _T(".*.seg");
+    WIN32_FIND_DATA data;
+    HANDLE hFind = ::FindFirstFile(pattern.c_str(), &data);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return 1;
+
+    DWORD first = 0;
+    do {
+        const TCHAR* dot = _tcsrchr(data.cFileName, _T('.')); // ".seg"
+        const TCHAR* num = dot;
+        while (num > data.cFileName && *(num - 1) != _T('.'))
+            num--;
+        DWORD n = _tcstoul(num, NULL, 10);
+        if (n > 0 && (first == 0 || n < first))
+            first = n;
+    } while (::FindNextFile(hFind, &data));
+    ::FindClose(hFind);
+
+    return first > 0 ? first : 1;
+}
+
+bool Journal::ReadCheckpoint(Checkpoint& cp) {
+    std::basic_string<TCHAR> fileName = m_name + _T(".checkpoint");
+    m_hCheckpoint.SetHandle( ::CreateFile(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL) );
+    if (!m_hCheckpoint.isValid())
+        return false;
+
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov)); // offset 0
+    DWORD read = 0;
+    if (!::ReadFile(m_hCheckpoint, &cp, sizeof(cp), &read, &ov) || read != sizeof(cp))
+        return false;
+
+    return cp.magic == CHECKPOINT_MAGIC && cp.checksum == Checksum(&cp.pos, sizeof(cp.pos), cp.seq);
+}
+
+// the checkpoint is smaller than a disk sector, so it is written at once
+bool Journal::WriteCheckpoint(const Position& pos, ULONGLONG seq) {
+    Checkpoint cp;
+    cp.magic    = CHECKPOINT_MAGIC;
+    cp.pos      = pos;
+    cp.seq      = seq;
+    cp.checksum = Checksum(&cp.pos, sizeof(cp.pos), cp.seq);
+
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    DWORD written = 0;
+    return ::WriteFile(m_hCheckpoint, &cp, sizeof(cp), &written, &ov) && written == sizeof(cp) &&
+           ::FlushFileBuffers(m_hCheckpoint);
+}
+
+// Finds the end of the log scanning only from the checkpoint. Valid record must have
+// correct checksum and the next sequence number, the scan stops at the first one which
+// is not (free space or torn write). Everything after it is erased before producers
+// continue there: stale records of an earlier run beyond the end could carry the
+// expected numbers and checksums and be taken as valid by the next recovery.
+int Journal::Recover() {
+
+    Checkpoint cp;
+    bool hasCheckpoint = ReadCheckpoint(cp);
+    if (!m_hCheckpoint.isValid())
+        return ERR_API;
+
+    if (hasCheckpoint) {
+        m_commitPos = cp.pos;
+        m_commitSeq = cp.seq;
+    } else {
+        m_commitPos.segment = FindFirstSegment();
+        m_commitPos.offset  = 0;
+        m_commitSeq = 0;
+    }
+    m_readPos  = m_commitPos;
+    m_readSeq  = m_commitSeq;
+    m_checkpointSeq = m_commitSeq;
+    m_firstSegment  = hasCheckpoint ? FindFirstSegment() : m_commitPos.segment;
+
+    Segment* seg = new Segment;
+    if (!seg->Open(SegmentName(m_commitPos.segment).c_str(), m_commitPos.segment, m_segmentSize, true)) {
+        delete seg;
+        return ERR_API;
+    }
+
+    DWORD     offset  = m_commitPos.offset;
+    ULONGLONG lastSeq = m_commitSeq;
+    ULONGLONG found   = 0;
+    while (offset + sizeof(RecordHeader) <= m_segmentSize) {
+        const RecordHeader* h = reinterpret_cast<const RecordHeader*>(seg->View() + offset);
+
+        if (h->magic == SEGMENT_END) { // continue in the next segment
+            Segment* next = new Segment;
+            if (!next->Open(SegmentName(seg->Number() + 1).c_str(), seg->Number() + 1, m_segmentSize, true)) {
+                delete next;
+                delete seg;
+                return ERR_API;
+            }
+            delete seg;
+            seg    = next;
+            offset = 0;
+            continue;
+        }
+
+        // the size is checked before RecordSize() and Checksum() use it: a garbage one wraps
+        if (h->magic != RECORD_MAGIC || (lastSeq > 0 && h->seq != lastSeq + 1) ||
+            h->size > m_segmentSize - offset - sizeof(RecordHeader) ||
+            offset + RecordSize(h->size) + sizeof(RecordHeader) > m_segmentSize ||
+            h->checksum != Checksum(seg->View() + offset + sizeof(RecordHeader), h->size, h->seq))
+            break;
+
+        lastSeq = h->seq;
+        offset += RecordSize(h->size);
+        found++;
+    }
+
+    char* tail = seg->View() + offset;
+    const DWORD tailSize = m_segmentSize - offset;
+    if (static_cast<DWORD>(std::count(tail, tail + tailSize, 0)) != tailSize) { // new space is zero
+        memset(tail, 0, tailSize);
+        if (!seg->Flush(offset, m_segmentSize)) {
+            delete seg;
+            return ERR_API;
+        }
+    }
+    for (DWORD n = seg->Number() + 1; ; n++) { // segments of the earlier run after the end
+        if (!::DeleteFile(SegmentName(n).c_str())) {
+            if (::GetLastError() == ERROR_FILE_NOT_FOUND)
+                break; // segments are created in order: none after a missing one
+            delete seg;
+            return ERR_API;
+        }
+    }
+
+    // producers continue after the last valid record
+    m_write         = seg;
+    m_writeOffset   = offset;
+    m_flushedOffset = offset;
+    m_writtenSeq    = lastSeq;
+    m_durableSeq    = lastSeq;
+    if (m_readSeq == 0 && found > 0) // empty checkpoint: first record sets the numbering
+        m_readSeq = m_commitSeq = m_checkpointSeq = lastSeq - found;
+    m_stats.recovered = found;
+    return RET_OK;
+}
+
+bool Journal::Rotate() {
+    Segment* next = new Segment;
+    if (!next->Open(SegmentName(m_write->Number() + 1).c_str(), m_write->Number() + 1, m_segmentSize, true)) {
+        delete next;
+        return false;
+    }
+
+    RecordHeader end;
+    memset(&end, 0, sizeof(end));
+    end.magic = SEGMENT_END;
+    memcpy(m_write->View() + m_writeOffset, &end, sizeof(end));
+
+    m_retired.push_back(m_write);
+    m_write         = next;
+    m_writeOffset   = 0;
+    m_flushedOffset = 0;
+    return true;
+}
+
+char* Journal::ReadView() {
+    if (m_write != NULL && m_readPos.segment == m_write->Number()) {
+        delete m_read; // consumed segment can be deleted now
+        m_read = NULL;
+        return m_write->View();
+    }
+
+    if (m_read == NULL || m_read->Number() != m_readPos.segment) {
+        delete m_read;
+        m_read = new Segment;
+        if (!m_read->Open(SegmentName(m_readPos.segment).c_str(), m_readPos.segment, m_segmentSize, false)) {
+            delete m_read;
+            m_read = NULL;
+            return NULL;
+        }
+    }
+    return m_read->View();
+}
+
+// group commit: makes all appended records durable, saves committed read position
+bool Journal::Flush() {
+
+    std::vector<Segment*> retired;
+    Segment*  seg;
+    DWORD     from, to;
+    ULONGLONG written, durable, commitSeq;
+    Position  commitPos;
+    {
+        Lock lock(m_cs);
+        retired.swap(m_retired);
+        seg       = m_write;
+        from      = m_flushedOffset;
+        to        = m_writeOffset;
+        written   = m_writtenSeq;
+        durable   = m_durableSeq;
+        commitPos = m_commitPos;
+        commitSeq = m_commitSeq;
+    }
+
+    // only the flusher deletes retired segments, so seg stays mapped even if rotated meanwhile
+    Stopwatch sw;
+    bool ok = true;
+    for (size_t i = 0; i < retired.size(); i++) {
+        ok = retired[i]->Flush(0, m_segmentSize) && ok;
+        delete retired[i];
+    }
+    if (to > from)
+        ok = seg->Flush(from, to) && ok;
+    double flushUs = sw.ElapsedNs() / 1000;
+
+    if (ok && commitSeq != m_checkpointSeq && WriteCheckpoint(commitPos, commitSeq)) {
+        m_checkpointSeq = commitSeq;
+        for (; m_firstSegment < commitPos.segment; m_firstSegment++) { // fully consumed
+            if (!::DeleteFile(SegmentName(m_firstSegment).c_str()) && ::GetLastError() != ERROR_FILE_NOT_FOUND)
+                break; // try again with the next checkpoint
+        }
+    }
+
+    if (ok && written == durable)
+        return true;
+
+    LONG waiters = 0;
+    {
+        Lock lock(m_cs);
+        if (ok) {
+            if (m_write == seg)
+                m_flushedOffset = to;
+            m_durableSeq = written;
+            m_stats.flushes++;
+            m_stats.flushedRecords += written - durable;
+            m_stats.flushUs        += flushUs;
+        } else { // the waiters are released to see the error
+            m_error = ERR_API;
+        }
+        waiters   = m_waiters;
+        m_waiters = 0;
+    }
+    if (waiters > 0)
+        ::ReleaseSemaphore(m_hDurable, waiters, NULL);
+    ::SetEvent(m_hData);
+    return ok;
+}
+
+void Journal::Release() {
+    for (size_t i = 0; i < m_retired.size(); i++)
+        delete m_retired[i];
+    m_retired.clear();
+    delete m_write;
+    m_write = NULL;
+    delete m_read;
+    m_read = NULL;
+
+    m_hCheckpoint.SetHandle(INVALID_HANDLE_VALUE);
+    m_hData.SetHandle(INVALID_HANDLE_VALUE);
+    m_hDurable.SetHandle(INVALID_HANDLE_VALUE);
+    m_hStop.SetHandle(INVALID_HANDLE_VALUE);
+}
+
+unsigned __stdcall Journal::FlusherThread(void* args) {
+    Journal* journal = static_cast<Journal*>(args);
+
+    bool stopping = false;
+    while (!stopping) {
+        DWORD dwResult = ::WaitForSingleObject(journal->m_hStop, journal->m_durabilityMs);
+        if (dwResult == WAIT_FAILED)
+            return ERR_SYNC;
+        stopping = (dwResult == WAIT_OBJECT_0);
+        if (!journal->Flush())
+            return ERR_API; // appends fail from now on
+    }
+    return RET_OK;
+}
+
+bool Journal::Segment::Open(const TCHAR* fileName, DWORD number, unsigned size, bool create) {
+    m_hFile.SetHandle( ::CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL) );
+    if (!m_hFile.isValid())
+        return false;
+
+    // the file is extended to the segment size, new space is zero-filled
+    m_hMapping.SetHandle( ::CreateFileMapping(m_hFile, NULL, PAGE_READWRITE, 0, size, NULL) );
+    if (!m_hMapping.isValid())
+        return false;
+
+    m_view = static_cast<char*>( ::MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, size) );
+    m_number = number;
+    return m_view != NULL;
+}
+
+void Journal::Segment::Close() {
+    if (m_view != NULL) {
+        ::UnmapViewOfFile(m_view);
+        m_view = NULL;
+    }
+    m_hMapping.SetHandle(INVALID_HANDLE_VALUE);
+    m_hFile.SetHandle(INVALID_HANDLE_VALUE);
+}
+
+// writes dirty pages of the range and file metadata to the disk
+bool Journal::Segment::Flush(DWORD from, DWORD to) {
+    return ::FlushViewOfFile(m_view + from, to - from) && ::FlushFileBuffers(m_hFile);
+}
+
+} // namespace MT
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+struct JournalStats {
+    ULONGLONG appended;
+    ULONGLONG consumed;
+    ULONGLONG recovered;      // unconsumed records found by Open()
+    ULONGLONG flushes;        // group commits
+    ULONGLONG flushedRecords; // records made durable by all group commits
+    double    flushUs;        // total time of FlushViewOfFile and FlushFileBuffers
+    ULONGLONG commitWaits;    // WaitDurable() calls
+    double    commitWaitUs;   // total time spent in WaitDurable()
+};
+
+// Persistent queue: memory-mapped append-only log split into fixed size segment files.
+//
+// Producers Append() records to the mapped view of the current segment, when it is
+// full the next segment file is created. Records become durable by group commit:
+// flusher thread writes everything appended since the previous flush with a single
+// FlushViewOfFile/FlushFileBuffers pair each durability interval, and all producers
+// waiting in WaitDurable() are released together.
+//
+// Consumers Read() durable records in order and Commit() the read position. The flusher
+// saves committed position to the checkpoint file and deletes fully consumed segments.
+// Open() recovers unconsumed records scanning the log from the checkpoint only.
+//
+// A corrupt record met by Read() or a failed group commit fails the journal: Error()
+// tells why, Append(), Read() and the waits return false at once from then on.
+//
+// Files: <name>.<segment number>.seg - records
+//            [header: magic, size, sequence number, checksum][payload][padding to 8 bytes]
+//        <name>.checkpoint - committed read position
+class Journal {
+public:
+    static const unsigned defSegmentSize  = 4 * 1024 * 1024;
+    static const unsigned defDurabilityMs = 10; // group commit interval
+
+    Journal();
+    ~Journal();
+
+    int Open(const TCHAR* name, unsigned durabilityMs = defDurabilityMs,
+             unsigned segmentSize = defSegmentSize);
+    int Close(); // flushes appended records and the checkpoint
+
+    bool isOpen() const {
+        return m_write != NULL;
+    }
+
+    // returns sequence number of the record (starting from 1) or 0 if failed
+    ULONGLONG Append(const void* data, unsigned size);
+
+    // waits for the group commit which makes the record durable
+    bool WaitDurable(ULONGLONG seq, DWORD timeout = INFINITE);
+
+    // reads the next durable record, false if there is none or the journal has failed
+    bool Read(void* data, unsigned maxSize, unsigned& size);
+    bool WaitData(DWORD timeout); // signalled after a group commit
+    void Commit();                // all read records are consumed
+
+    // RET_OK, ERR_STD if a record cannot be read (corrupt or larger than maxSize of Read()),
+    // ERR_API if a group commit failed
+    int Error() const;
+
+    ULONGLONG Unconsumed() const;
+    void GetStats(JournalStats& stats) const;
+    void Report(std::ostream& out) const;
+
+private:
+    Journal(const Journal&);
+    Journal& operator=(const Journal&);
+
+    struct RecordHeader {
+        DWORD     magic;
+        DWORD     size;
+        ULONGLONG seq;
+        DWORD     checksum;
+        DWORD     reserved;
+    };
+
+    struct Position {
+        DWORD segment;
+        DWORD offset;
+    };
+
+    struct Checkpoint {
+        DWORD     magic;
+        DWORD     checksum;
+        Position  pos;
+        ULONGLONG seq; // last consumed record
+    };
+
+    class Segment { // mapped segment file
+    public:
+        Segment() : m_number(0), m_view(NULL) {
+        }
+        ~Segment() {
+            Close();
+        }
+
+        bool Open(const TCHAR* fileName, DWORD number, unsigned size, bool create);
+        void Close();
+        bool Flush(DWORD from, DWORD to);
+
+        DWORD Number() const {
+            return m_number;
+        }
+        char* View() const {
+            return m_view;
+        }
+
+    private:
+        Segment(const Segment&);
+        Segment& operator=(const Segment&);
+
+        HandleWrapper m_hFile;
+        HandleWrapper m_hMapping;
+        DWORD         m_number;
+        char*         m_view;
+    };
+
+    static const DWORD RECORD_MAGIC     = 0x4A524543; // "JREC"
+    static const DWORD SEGMENT_END      = 0x4A454E44; // "JEND", rest of the segment is unused
+    static const DWORD CHECKPOINT_MAGIC = 0x4A43504B; // "JCPK"
+
+    static THREAD_FUNCTION FlusherThread;
+
+    static DWORD RecordSize(unsigned size);
+    static DWORD Checksum(const void* data, unsigned size, ULONGLONG seq);
+
+    std::basic_string<TCHAR> SegmentName(DWORD number) const;
+    DWORD FindFirstSegment() const;
+    bool  ReadCheckpoint(Checkpoint& cp);
+    bool  WriteCheckpoint(const Position& pos, ULONGLONG seq);
+    int   Recover();
+    bool  Rotate();     // m_cs must be acquired
+    char* ReadView();   // m_cs must be acquired
+    bool  Flush();      // false if the group commit failed
+    void  Release();
+
+    std::basic_string<TCHAR> m_name;
+    unsigned m_segmentSize;
+    unsigned m_durabilityMs;
+
+    mutable CriticalSection m_cs; // protects all below
+
+    Segment*              m_write;         // current segment of producers
+    DWORD                 m_writeOffset;
+    DWORD                 m_flushedOffset; // durable part of m_write
+    std::vector<Segment*> m_retired;       // rotated, to be flushed and closed by the flusher
+    ULONGLONG             m_writtenSeq;    // last appended record
+    ULONGLONG             m_durableSeq;    // last durable record
+
+    Segment*  m_read;     // segment of the reader if it is behind the producers
+    Position  m_readPos;
+    ULONGLONG m_readSeq;  // last read record
+    Position  m_commitPos;
+    ULONGLONG m_commitSeq;
+    ULONGLONG m_checkpointSeq; // saved in the checkpoint file
+    DWORD     m_firstSegment;  // the oldest existing segment file
+    LONG      m_waiters;       // threads in WaitDurable()
+    int       m_error;
+
+    HandleWrapper m_hCheckpoint;
+    HandleWrapper m_hData;     // auto-reset: new durable records
+    HandleWrapper m_hDurable;  // semaphore releasing WaitDurable() waiters
+    HandleWrapper m_hStop;     // manual-reset: stop the flusher
+    HANDLE        m_hFlusher;
+
+    JournalStats m_stats;
+};
+
+} // namespace MT
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+// when the items of an open-loop load are sent
+enum ArrivalProcess {
+    AP_CONSTANT, // at equal intervals
+    AP_POISSON,  // at exponentially distributed intervals of the same mean: bursts and gaps
+    AP_TOTAL
+};
+
+const char* ArrivalName(ArrivalProcess process); // as given on the command line
+bool ParseArrival(const std::string& name, ArrivalProcess& process);
+
+// Intended send times of the items of an open-loop load at the target rate.
+//
+// The schedule does not depend on the system under test: an item is due at its time
+// even if the previous one could not be sent yet, so a stalled sender falls behind
+// the schedule and sends the overdue items at once instead of stretching it.
+class ArrivalSchedule {
+public:
+    ArrivalSchedule(ArrivalProcess process, double ratePerSec, unsigned seed = 1);
+
+    double NextNs(); // intended time of the next item from the start of the load
+
+private:
+    double Uniform(); // (0, 1]
+
+    ArrivalProcess m_process;
+    double         m_meanGapNs;
+    double         m_nextNs;
+    unsigned       m_random; // xorshift state, never 0
+};
+
+// Latency of the items of one load step.
+//
+// Latency measured from the actual send time misses the time the items were waiting to
+// be sent while the sender was blocked by the full queue: exactly the queueing delay of
+// the overloaded system (coordinated omission). Measured from the intended send time it
+// includes that delay.
+struct LoadStepResult {
+    double   targetRate;       // items per second
+    double   achievedRate;     // completed items per second of the step
+    unsigned items;
+    double   p50Us;            // from the intended send time
+    double   p99Us;
+    double   p999Us;
+    double   maxUs;
+    double   uncorrectedP99Us; // from the actual send time
+    bool     sustained;        // the rate is kept without growing queueing delay
+
+    // intendedNs, sentNs and doneNs are the times of the items from the start of the step
+    void Compute(double rate, const std::vector<double>& intendedNs, const std::vector<double>& sentNs,
+                 const std::vector<double>& doneNs, double maxP99Us);
+    void Print(std::ostream& out) const;
+};
+
+// Latency distribution of a long run in log-linear buckets: 16 buckets per power of two,
+// so a percentile is known within 1/16 of its value in fixed memory, whatever the count.
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        Reset();
+    }
+
+    void Reset();
+    void Record(double ns);
+
+    unsigned long long Count() const {
+        return m_total;
+    }
+    double PercentileUs(double fraction) const; // upper bound of the bucket
+    double MaxUs() const {
+        return m_maxNs / 1000;
+    }
+
+private:
+    static const unsigned m_subBits = 4;
+    static const unsigned m_sub     = 1 << m_subBits;
+    static const unsigned m_maxBits = 40; // about 18 minutes, longer latency is counted there
+    static const unsigned m_buckets = (m_maxBits - m_subBits + 2) * m_sub;
+
+    static unsigned Bucket(unsigned long long ns);
+    static unsigned long long Upper(unsigned bucket); // the largest value of the bucket
+
+    unsigned long long m_counts[m_buckets];
+    unsigned long long m_total;
+    double             m_maxNs;
+};
+
+} // namespace MT
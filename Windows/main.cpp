@@ -1,69 +1,250 @@
-#include "stdafx.h"
-#include "threads.h"
-#include "threadrunner.h"
-
-// A sample program demonstrating usage of basic Windows synchronisation objects
-// by example of solving producer-consumer problem.
-// ( http://en.wikipedia.org/wiki/Producer-consumer_problem )
-//
-// At start user chooses the type of synchronisation objects (main.cpp).
-// Appropriate object of ThreadRunner class hierarchy (threadrunner.h)
-// provides thread management (threadrunner.cpp) and thread function
-// (consumer.cpp, producer.cpp).
-
-// Threads are running until they all will finish or timeout occurs.
-// Common SyncTimer object (threads.h) signals all threads to stop.
-//
-// Alexey Voytenko, alexvgml@gmail.com
-
-int main(int argc, char* argv[])
-{
-    // enable memory leaks detection
-    _CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF ); 
-
-    srand(static_cast<unsigned int>(time(0))); // init RND generator
-    
-    int ret    = RET_OK;
-    int choice = 0;
-
-    // primary thread of the application
-    while (true) {
-
-        cout << "Choose type of synchronisation objects (enter 1-5):" << endl << endl
-             << "1. Critical sections (Producer-Consumer)" << endl
-             << "2. Critical sections and events (Producer-Consumer)" << endl
-             << "3. Mutex (Producer-Consumer)" << endl
-             << "4. Semaphore" << endl
-             << "5. Exit" << endl;
-        
-        while ( !(cin >> choice) || !(1 <= choice && choice <= 5) ) {
-            if (cin.fail()) { // not an integer
-                cin.clear();  // clear failbit
-
-                // ignore all input before <Enter>
-                cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            }
-            cout << "Please input an integer from 1 to 5:" << endl;
-        }
-        if (choice == 5)
-            break;
-
-        // although auto_ptr is deprecated it can be used  here as scoped ptr (not using C++11 yet)
-        std::auto_ptr <MT::ThreadRunner> spTR( 
-                    MT::ThreadRunnerCreator::Create(static_cast<SyncType>(choice)) );
-
-        ret = spTR->RunThreads();
-
-        if (ret!=RET_OK) {
-            if (ret==ERR_SYNC) {
-                cout << endl << "Not all threads finished correctly, exiting." << endl;
-            } else if (ret == ERR_API) {
-                cout << endl << "WinApi error, exiting." << endl;
-            } else {
-                cout << endl << "Error ocurred with the code " << ret << ", exiting." << endl;
-            }
-            break;
-        }
-    }
-    return ret;
-}
+#include "stdafx.h"
+#include <algorithm>
+#include "threads.h"
+#include "threadrunner.h"
+#include "statspage.h"
+
+// A sample program demonstrating usage of basic Windows synchronisation objects
+// by example of solving producer-consumer problem.
+// ( http://en.wikipedia.org/wiki/Producer-consumer_problem )
+//
+// At start user chooses the type of synchronisation objects (main.cpp).
+// Appropriate object of ThreadRunner class hierarchy (threadrunner.h)
+// provides thread management (threadrunner.cpp) and thread function
+// (consumer.cpp, producer.cpp).
+
+// Threads are running until they all will finish or timeout occurs.
+// Common SyncTimer object (threads.h) signals all threads to stop.
+//
+// Usage: Multithreading.exe [-trace] [-counters] [-place default|smt|l3|cross-socket|spread]
+//                           [-wait block|spin|yield|backoff|park] [-spins <count>] [-backoff <ms>]
+//                           [-arrival constant|poisson] [-kernel scalar|sse2|avx2]
+//                           [-record <trace>] [-replay <trace> [-speed <x>] [-loop <count>]]
+//                           [-soak <minutes>] [-interval <seconds>] [-statspage]
+//        Multithreading.exe -convert <log> <trace>
+// With -trace the timeline of each run is written to trace_<menu item>.json
+// (Chrome trace-event format, open in chrome://tracing or https://ui.perfetto.dev).
+// With -counters CPU counters of each run are reported (perfcounters.h).
+// With -place producer and consumer threads are pinned by the placement policy (topology.h).
+// With -wait producer and consumer wait for the buffer by the policy (waitstrategy.h):
+// -spins is the number of checks before yielding, backing off or parking, -backoff is
+// the longest sleep of the backoff.
+// With -arrival the open-loop producer sends at equal or at exponential intervals (loadgen.h).
+// With -kernel the batch consumer uses at most the given level (batchkernel.h), by default
+// the best one the processor has.
+// With -record the arrivals of the produced items are written to the workload trace,
+// with -replay the producers take the arrivals from the trace (workload.h), -speed
+// scales its time (10 - ten times faster), -loop plays it again (0 - until the timeout).
+// -convert makes a trace of the log with lines "<timestamp us> [size] [priority]".
+// -soak sets the duration of the soak run, -interval the period of its stats (memstats.h).
+// With -statspage the statistics are published to shared memory for StatsReader.exe
+// and other scrapers while the runs go (statspage.h).
+//
+// Alexey Voytenko, alexvgml@gmail.com
+
+// value of the option argv[i], i is moved to it; NULL if it is missing
+static const char* OptionValue(int argc, char* argv[], int& i) {
+    if (i + 1 >= argc) {
+        cout << "Missing value of " << argv[i] << endl;
+        return NULL;
+    }
+    return argv[++i];
+}
+
+int main(int argc, char* argv[])
+{
+    // enable memory leaks detection
+    _CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF ); 
+
+    srand(static_cast<unsigned int>(time(0))); // init RND generator
+    
+    int ret    = RET_OK;
+    int choice = 0;
+    bool trace = false, counters = false, statsPage = false;
+    MT::WaitPolicy waitPolicy = MT::WP_BLOCK;
+    MT::WaitBudget waitBudget;
+    const char* replayFile = NULL;
+    double   replaySpeed = 1;
+    unsigned replayLoops = 1;
+    for (int i = 1; i < argc; i++) {
+        const std::string flag(argv[i]);
+        if (flag == "-trace") {
+            trace = true;
+        } else if (flag == "-counters") {
+            counters = true;
+        } else if (flag == "-statspage") {
+            statsPage = true;
+        } else if (flag == "-place") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && !MT::ParsePlacement(value, MT::ThreadRunner::m_placement))
+                cout << "Unknown placement " << value << ", threads are not pinned" << endl;
+        } else if (flag == "-wait") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && !MT::ParseWaitPolicy(value, waitPolicy))
+                cout << "Unknown wait policy " << value << ", threads block" << endl;
+        } else if (flag == "-arrival") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && !MT::ParseArrival(value, MT::OpenLoopRunner::m_arrival))
+                cout << "Unknown arrival process " << value << ", arrivals are constant" << endl;
+        } else if (flag == "-kernel") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL &&
+                !MT::ParseKernelLevel(value, MT::ProducerConsumerBatchRunner::m_kernel))
+                cout << "Unknown kernel level " << value << ", the best one is used" << endl;
+        } else if (flag == "-spins") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                waitBudget.spins = static_cast<unsigned>(atoi(value));
+        } else if (flag == "-backoff") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                waitBudget.maxBackoffMs = static_cast<unsigned>(atoi(value));
+        } else if (flag == "-replay") {
+            replayFile = OptionValue(argc, argv, i);
+        } else if (flag == "-speed") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                replaySpeed = atof(value);
+        } else if (flag == "-loop") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                replayLoops = static_cast<unsigned>(atoi(value));
+        } else if (flag == "-soak") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                MT::SoakRunner::m_durationMin = std::max(1, atoi(value));
+        } else if (flag == "-interval") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL)
+                MT::SoakRunner::m_intervalSec = std::max(1, atoi(value));
+        } else if (flag == "-record") {
+            const char* value = OptionValue(argc, argv, i);
+            if (value != NULL && MT::ThreadRunner::m_recorder.Open(value) != RET_OK)
+                cout << "Cannot create trace " << value << ", arrivals are not recorded" << endl;
+        } else if (flag == "-convert") {
+            if (i + 2 >= argc) {
+                cout << "Missing log or trace of -convert" << endl;
+                return ERR_STD;
+            }
+            const char* logFile   = argv[++i];
+            const char* traceFile = argv[++i];
+            unsigned converted = 0, skipped = 0;
+            ret = MT::ConvertWorkloadLog(logFile, traceFile, converted, skipped);
+            if (ret == RET_OK)
+                cout << "Trace " << traceFile << ": " << converted << " items, "
+                     << skipped << " lines skipped" << endl;
+            else
+                cout << "Cannot convert " << logFile << " to " << traceFile << endl;
+            return ret;
+        } else {
+            cout << "Unknown option " << flag << endl;
+        }
+    }
+    if (replayFile != NULL) {
+        if (MT::ThreadRunner::m_replay.Open(replayFile, replaySpeed, replayLoops) == RET_OK)
+            cout << "Replaying " << replayFile << " at " << replaySpeed << "x, loops: "
+                 << replayLoops << " (0 - until the timeout)" << endl;
+        else
+            cout << "Cannot open trace " << replayFile << ", producers imitate work" << endl;
+    }
+    MT::ThreadRunner::m_wait = MT::WaitStrategy(waitPolicy, waitBudget);
+    if (waitPolicy != MT::WP_BLOCK)
+        MT::ThreadRunner::PrintWaitStrategy(cout);
+    if (MT::ThreadRunner::m_placement != MT::PL_DEFAULT)
+        MT::Topology::Instance().Report(cout);
+    MT::StatsPublisher publisher;
+    if (statsPage) {
+        if (publisher.Start() == RET_OK)
+            cout << "Statistics are published to " << MT::StatsPageName(::GetCurrentProcessId())
+                 << ", StatsReader.exe " << ::GetCurrentProcessId() << endl;
+        else
+            cout << "Cannot create the stats page" << endl;
+    }
+    const int exitChoice = WORK_STACK + 1; // the last menu item
+
+    // primary thread of the application
+    while (true) {
+
+        cout << "Choose type of synchronisation objects (enter 1-" << exitChoice << "):" << endl << endl
+             << "1. Critical sections (Producer-Consumer)" << endl
+             << "2. Critical sections and events (Producer-Consumer)" << endl
+             << "3. Mutex (Producer-Consumer)" << endl
+             << "4. Semaphore" << endl
+             << "5. Critical sections and events, asynchronous file sink (Producer-Consumer)" << endl
+             << "6. Persistent queue in memory-mapped journal (Producer-Consumer)" << endl
+             << "7. Request/response with futures over all queue types (Client-Server)" << endl
+             << "8. Rate limiter (many threads)" << endl
+             << "9. Critical section and events, elastic consumer pool (Producer-Consumer)" << endl
+             << "10. Publish/subscribe, topics fan out to subscriber groups" << endl
+             << "11. Shared queue under contention, flat combining against locks" << endl
+             << "12. Unbounded lock-free queue, producers faster than consumers" << endl
+             << "13. Open-loop load at the target rate, rate sweep over all queue types" << endl
+             << "14. Soak: sustained load for -soak minutes, stats every -interval seconds" << endl
+             << "15. Critical sections and events, batch consumer with a vectorised kernel" << endl
+             << "16. Bulk job against the cache: FIFO queue, lock-free LIFO stack, work stealing" << endl
+             << exitChoice << ". Exit" << endl;
+        
+        while ( !(cin >> choice) || !(1 <= choice && choice <= exitChoice) ) {
+            if (cin.fail()) { // not an integer
+                cin.clear();  // clear failbit
+
+                // ignore all input before <Enter>
+                cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            }
+            cout << "Please input an integer from 1 to " << exitChoice << ":" << endl;
+        }
+        if (choice == exitChoice)
+            break;
+
+        // although auto_ptr is deprecated it can be used  here as scoped ptr (not using C++11 yet)
+        std::auto_ptr <MT::ThreadRunner> spTR( 
+                    MT::ThreadRunnerCreator::Create(static_cast<SyncType>(choice)) );
+
+        MT::Tracer& tracer = MT::Tracer::Instance();
+        if (trace && !tracer.Start())
+            cout << "Cannot start tracing" << endl;
+
+        MT::Stats& stats = MT::Stats::Instance();
+        stats.Reset();
+
+        MT::PerfCounters perf;
+        if (counters)
+            perf.Start();
+
+        publisher.SetRunner(choice);
+        ret = spTR->RunThreads();
+        publisher.SetRunner(0);
+
+        stringstream ss; // all threads are finished
+        stats.Report(ss);
+        if (counters) {
+            perf.Stop();
+            perf.Report(ss, stats.Sum(MT::SC_CONSUMED));
+        }
+        cout << endl << ss.str();
+
+        if (tracer.isEnabled()) { // all threads are finished
+            tracer.Stop();
+            stringstream fileName;
+            fileName << "trace_" << choice << ".json";
+            if (tracer.Write(fileName.str().c_str()) == RET_OK)
+                cout << endl << "Timeline is written to " << fileName.str() << endl;
+            else
+                cout << endl << "Cannot write " << fileName.str() << endl;
+        }
+
+        if (ret!=RET_OK) {
+            if (ret==ERR_SYNC) {
+                cout << endl << "Not all threads finished correctly, exiting." << endl;
+            } else if (ret == ERR_API) {
+                cout << endl << "WinApi error, exiting." << endl;
+            } else {
+                cout << endl << "Error ocurred with the code " << ret << ", exiting." << endl;
+            }
+            break;
+        }
+    }
+    if (MT::ThreadRunner::m_recorder.isEnabled() && MT::ThreadRunner::m_recorder.Close() != RET_OK)
+        cout << "Cannot write the recorded trace" << endl;
+    return ret;
+}
@@ -0,0 +1,138 @@
+#include "stdafx.h"
+#include <new>
+#include <psapi.h> // types only, the function is resolved at run time
+#include "threads.h"
+#include "memstats.h"
+
+#ifdef new
+#undef new // debug "new" of stdafx.h, the operators are defined here
+#endif
+
+namespace {
+
+volatile LONG g_allocations    = 0;
+volatile LONG g_frees          = 0;
+volatile LONG g_allocatedBytes = 0;
+
+void CountAllocation(size_t size) {
+    ::InterlockedIncrement(&g_allocations);
+    ::InterlockedExchangeAdd(&g_allocatedBytes, static_cast<LONG>(size));
+}
+
+#ifdef _DEBUG
+// "new" of the sources is the debug heap operator of the CRT in debug builds (stdafx.h) and
+// does not come to the operators below: all blocks of the debug heap, malloc() of the
+// operators included, are counted by the allocation hook instead.
+// http://msdn.microsoft.com/en-us/library/820k4tb8(v=vs.90).aspx
+int __cdecl CountingAllocHook(int allocType, void* userData, size_t size, int blockUse,
+                              long request, const unsigned char* fileName, int line) {
+    if (blockUse == _CRT_BLOCK) // internal blocks of the runtime
+        return TRUE;
+    if (allocType == _HOOK_ALLOC)
+        CountAllocation(size);
+    else if (allocType == _HOOK_REALLOC) // the block is replaced: live blocks do not change
+        ::InterlockedExchangeAdd(&g_allocatedBytes, static_cast<LONG>(size));
+    else if (allocType == _HOOK_FREE)
+        ::InterlockedIncrement(&g_frees);
+    return TRUE; // the allocation goes on
+}
+
+const _CRT_ALLOC_HOOK g_previousHook = _CrtSetAllocHook(&CountingAllocHook);
+#endif
+
+void* Allocate(size_t size) {
+    void* p = malloc(size == 0 ? 1 : size);
+#ifndef _DEBUG // counted by the allocation hook
+    if (p != NULL)
+        CountAllocation(size);
+#endif
+    return p;
+}
+
+void Free(void* p) {
+    if (p == NULL)
+        return;
+#ifndef _DEBUG
+    ::InterlockedIncrement(&g_frees);
+#endif
+    free(p);
+}
+
+void* AllocateOrThrow(size_t size) {
+    for (;;) {
+        void* p = Allocate(size);
+        if (p != NULL)
+            return p;
+        std::new_handler handler = std::set_new_handler(NULL); // no getter before C++11
+        std::set_new_handler(handler);
+        if (handler == NULL)
+            throw std::bad_alloc();
+        handler(); // frees memory or throws
+    }
+}
+
+} // namespace
+
+// the throwing forms are defined without throw(std::bad_alloc): Visual C++ ignores dynamic
+// exception specifications other than throw() and warns about them (C4290)
+void* operator new(size_t size) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+    return Allocate(size);
+}
+
+void operator delete(void* p) throw() {
+    Free(p);
+}
+
+void operator delete[](void* p) throw() {
+    Free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() {
+    Free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw() {
+    Free(p);
+}
+
+namespace MT {
+
+// psapi.dll is loaded once, GetProcessMemoryInfo is in it on all versions
+// http://msdn.microsoft.com/en-us/library/windows/desktop/ms683219(v=vs.85).aspx
+typedef BOOL (WINAPI *GetProcessMemoryInfoFn)(HANDLE, PPROCESS_MEMORY_COUNTERS, DWORD);
+
+static GetProcessMemoryInfoFn ProcessMemoryInfo() {
+    static HMODULE hPsapi = ::LoadLibrary(_T("psapi.dll"));
+    static GetProcessMemoryInfoFn getInfo = hPsapi == NULL ? NULL :
+        reinterpret_cast<GetProcessMemoryInfoFn>( ::GetProcAddress(hPsapi, "GetProcessMemoryInfo") );
+    return getInfo;
+}
+
+bool ReadMemoryCounts(MemoryCounts& counts) {
+    counts.allocations    = static_cast<unsigned long>(g_allocations);
+    counts.frees          = static_cast<unsigned long>(g_frees);
+    counts.allocatedBytes = static_cast<unsigned long>(g_allocatedBytes);
+    counts.workingSetBytes = counts.privateBytes = 0;
+
+    GetProcessMemoryInfoFn getInfo = ProcessMemoryInfo();
+    PROCESS_MEMORY_COUNTERS pmc = { sizeof(pmc) };
+    if (getInfo == NULL || !getInfo(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return false;
+    counts.workingSetBytes = pmc.WorkingSetSize;
+    counts.privateBytes    = pmc.PagefileUsage; // commit charge of the process
+    return true;
+}
+
+} // namespace MT
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+// Memory of the process for the long runs: resident memory read from the system and the
+// counts of the interposed counting allocator.
+//
+// Global operator new and delete are replaced (memstats.cpp) to count the allocations,
+// frees and allocated bytes with one interlocked operation each. The counters wrap, so
+// they are compared as differences: allocations - frees are the live blocks, a number
+// growing under steady load is a leak. In debug builds "new" of the sources is the CRT
+// debug heap operator (stdafx.h): there the blocks are counted by the allocation hook of
+// the debug heap, malloc() and the STL containers included.
+struct MemoryCounts {
+    size_t        workingSetBytes; // resident
+    size_t        privateBytes;    // committed, not shared with other processes
+    unsigned long allocations;
+    unsigned long frees;
+    unsigned long allocatedBytes;
+};
+
+bool ReadMemoryCounts(MemoryCounts& counts); // false if the process memory is not known
+
+} // namespace MT
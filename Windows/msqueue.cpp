@@ -0,0 +1,190 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "threads.h"
+#include "msqueue.h"
+
+namespace MT {
+
+MSQueue::MSQueue(unsigned threads, unsigned chunkNodes) :
+    m_head(NULL),
+    m_tail(NULL),
+    m_chunks(NULL),
+    m_chunkCount(0),
+    m_chunkNodes(chunkNodes),
+    m_threads(threads),
+    m_retireLimit(2 * m_hazards * threads), // at least half of the retired nodes are freed by a scan
+    m_records(threads),                     // zeroed
+    m_retiredStore(threads * m_retireLimit),
+    m_scanStore(threads * m_hazards * threads)
+{
+    ::InitializeSListHead(&m_free);
+    if (!m_records.isValid())
+        return;
+
+    for (unsigned i = 0; i < threads; i++) {
+        m_records[i].retired = &m_retiredStore[i * m_retireLimit];
+        m_records[i].scan    = &m_scanStore[i * m_hazards * threads];
+    }
+
+    Node* dummy = NewNode(); // head always points to the dummy node
+    if (dummy == NULL)
+        return;
+    dummy->next = NULL;
+    m_head = m_tail = dummy;
+}
+
+MSQueue::~MSQueue() {
+    // all nodes (queued, retired and free) belong to the blocks
+    Chunk* chunk = m_chunks;
+    while (chunk != NULL) {
+        Chunk* next = chunk->next;
+        FreeAligned(chunk);
+        chunk = next;
+    }
+}
+
+MSQueue::Node* MSQueue::NewNode() {
+    PSLIST_ENTRY entry = ::InterlockedPopEntrySList(&m_free);
+    while (entry == NULL) {
+        if (!Grow())
+            return NULL;
+        entry = ::InterlockedPopEntrySList(&m_free);
+    }
+    return reinterpret_cast<Node*>(entry);
+}
+
+// allocates a block of nodes and puts them to the free list; threads growing at
+// the same time add a block each
+bool MSQueue::Grow() {
+    Node* block = static_cast<Node*>(AllocateAligned((m_chunkNodes + 1) * sizeof(Node)));
+    if (block == NULL)
+        return false;
+
+    Chunk* chunk = reinterpret_cast<Chunk*>(block);
+    Chunk* head = m_chunks;
+    do {
+        chunk->next = head;
+        head = static_cast<Chunk*>( ::InterlockedCompareExchangePointer(
+            reinterpret_cast<PVOID volatile*>(&m_chunks), chunk, head) );
+    } while (head != chunk->next);
+    ::InterlockedIncrement(&m_chunkCount);
+
+    for (unsigned i = 1; i <= m_chunkNodes; i++)
+        ::InterlockedPushEntrySList(&m_free, &block[i].entry);
+    return true;
+}
+
+// publishes the hazard pointer: interlocked exchange is a full barrier, so the
+// pointer is visible to scanning threads before the node is validated again
+void MSQueue::Protect(HazardRecord& rec, unsigned i, Node* node) {
+    ::InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&rec.hazard[i]), node);
+}
+
+bool MSQueue::Push(unsigned slot, int item) {
+    Node* node = NewNode();
+    if (node == NULL)
+        return false;
+    node->item = item;
+    node->next = NULL;
+
+    HazardRecord& rec = m_records[slot];
+    Node* tail = NULL;
+    for (;;) {
+        tail = m_tail;
+        Protect(rec, 0, tail);
+        if (m_tail != tail) // tail could be retired before it was protected
+            continue;
+
+        Node* next = tail->next;
+        if (m_tail != tail)
+            continue;
+        if (next != NULL) { // tail is behind: help to advance it
+            ::InterlockedCompareExchangePointer(
+                reinterpret_cast<PVOID volatile*>(&m_tail), next, tail);
+            continue;
+        }
+        if (::InterlockedCompareExchangePointer(
+                reinterpret_cast<PVOID volatile*>(&tail->next), node, NULL) == NULL)
+            break; // linked
+    }
+    // may fail if another thread has already advanced it
+    ::InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&m_tail), node, tail);
+    rec.hazard[0] = NULL;
+    return true;
+}
+
+bool MSQueue::Pop(unsigned slot, int& item) {
+    HazardRecord& rec = m_records[slot];
+    Node* head = NULL;
+    for (;;) {
+        head = m_head;
+        Protect(rec, 0, head);
+        if (m_head != head)
+            continue;
+
+        Node* tail = m_tail;
+        Node* next = head->next;
+        Protect(rec, 1, next);
+        if (m_head != head) // next could be retired and reused
+            continue;
+
+        if (next == NULL) { // empty
+            rec.hazard[0] = NULL;
+            return false;
+        }
+        if (head == tail) { // tail is behind: help to advance it
+            ::InterlockedCompareExchangePointer(
+                reinterpret_cast<PVOID volatile*>(&m_tail), next, tail);
+            continue;
+        }
+
+        item = next->item; // read before the node can become the dummy of another pop
+        if (::InterlockedCompareExchangePointer(
+                reinterpret_cast<PVOID volatile*>(&m_head), next, head) == head)
+            break;
+    }
+    rec.hazard[0] = NULL;
+    rec.hazard[1] = NULL;
+    Retire(rec, head); // the old dummy
+    return true;
+}
+
+void MSQueue::Retire(HazardRecord& rec, Node* node) {
+    rec.retired[rec.retiredCount++] = node;
+    if (rec.retiredCount == m_retireLimit)
+        Scan(rec);
+}
+
+// recycles retired nodes which are not protected by any thread
+void MSQueue::Scan(HazardRecord& rec) {
+    unsigned protectedCount = 0;
+    for (unsigned t = 0; t < m_threads; t++) {
+        for (unsigned i = 0; i < m_hazards; i++) {
+            Node* p = m_records[t].hazard[i];
+            if (p != NULL)
+                rec.scan[protectedCount++] = p;
+        }
+    }
+    std::sort(rec.scan, rec.scan + protectedCount);
+
+    unsigned kept = 0;
+    for (unsigned i = 0; i < rec.retiredCount; i++) {
+        Node* node = rec.retired[i];
+        if (std::binary_search(rec.scan, rec.scan + protectedCount, node))
+            rec.retired[kept++] = node; // still read by another thread
+        else
+            ::InterlockedPushEntrySList(&m_free, &node->entry);
+    }
+    rec.retiredCount = kept;
+}
+
+void MSQueue::GetFootprint(MSQueueFootprint& footprint) const {
+    footprint.chunks  = static_cast<ULONGLONG>(m_chunkCount);
+    footprint.nodes   = footprint.chunks * m_chunkNodes;
+    footprint.bytes   = footprint.chunks * (m_chunkNodes + 1) * sizeof(Node);
+    footprint.retired = 0;
+    for (unsigned t = 0; t < m_threads; t++)
+        footprint.retired += m_records[t].retiredCount;
+}
+
+} // namespace MT
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include "threads.h"
+#include "combining.h"
+
+namespace MT {
+
+struct MSQueueFootprint {
+    ULONGLONG chunks;       // node blocks taken from the heap
+    ULONGLONG nodes;        // nodes in the blocks
+    ULONGLONG bytes;
+    ULONGLONG retired;      // nodes waiting for the hazard pointers to be released
+};
+
+// Unbounded lock-free queue (Michael, Scott, PODC 1996) with hazard pointers
+// (Michael, IEEE TPDS 2004) for safe memory reclamation.
+//
+// Push never waits for other threads and never fails while memory is available.
+// A dequeued node is retired by the thread which dequeued it: when the thread has
+// retired enough nodes it scans hazard pointers of all threads and recycles the nodes
+// nobody is reading through the lock-free free list. New nodes are taken from the free
+// list, the heap is used only when the list is empty and then a whole block of nodes
+// is allocated, so in a steady state the queue does not call the allocator at all.
+// Memory goes back to the heap when the queue is destroyed.
+//
+// Each thread uses its own slot number (0 .. threads-1) for its hazard pointers.
+// http://www.cs.rochester.edu/u/scott/papers/1996_PODC_queues.pdf
+// http://www.research.ibm.com/people/m/michael/ieeetpds-2004.pdf
+class MSQueue : public SharedQueue {
+public:
+    static const unsigned defChunkNodes = 1024;
+
+    MSQueue(unsigned threads, unsigned chunkNodes = defChunkNodes);
+    ~MSQueue();
+
+    virtual const char* Name() const {
+        return "Michael-Scott";
+    }
+    virtual bool isValid() const {
+        return m_head != NULL && m_records.isValid();
+    }
+    virtual bool Push(unsigned slot, int item); // false only if memory is exhausted
+    virtual bool Pop(unsigned slot, int& item); // false if empty
+
+    void GetFootprint(MSQueueFootprint& footprint) const; // approximate while in use
+
+private:
+    MSQueue(const MSQueue&);
+    MSQueue& operator=(const MSQueue&);
+
+    // interlocked list entries must be aligned on MEMORY_ALLOCATION_ALIGNMENT
+    struct __declspec(align(16)) Node {
+        SLIST_ENTRY  entry; // free list link, must be the first member
+        Node* volatile next;
+        int          item;
+    };
+
+    struct Chunk {          // header of the block in place of its first node
+        Chunk* next;
+    };
+
+    static const unsigned m_hazards = 2; // per thread
+
+    struct MT_CACHE_ALIGN HazardRecord {
+        Node* volatile hazard[m_hazards];
+        Node**         retired;      // m_retireLimit entries
+        Node**         scan;         // hazard pointers of all threads collected by Scan()
+        unsigned       retiredCount;
+    };
+
+    Node* NewNode();
+    bool  Grow();
+    void  Protect(HazardRecord& rec, unsigned i, Node* node);
+    void  Retire(HazardRecord& rec, Node* node);
+    void  Scan(HazardRecord& rec);
+
+    Node* volatile m_head;
+    char           m_pad1[CACHE_LINE - sizeof(Node*)]; // producers and consumers work on
+    Node* volatile m_tail;                             // different lines
+    char           m_pad2[CACHE_LINE - sizeof(Node*)];
+
+    SLIST_HEADER        m_free;
+    Chunk* volatile     m_chunks;     // lock-free list of the allocated blocks
+    volatile LONG       m_chunkCount;
+    const unsigned      m_chunkNodes;
+    const unsigned      m_threads;
+    const unsigned      m_retireLimit;   // scan after retiring so many nodes
+    AlignedArray<HazardRecord> m_records;
+    std::vector<Node*>  m_retiredStore;  // preallocated lists of all records
+    std::vector<Node*>  m_scanStore;
+};
+
+} // namespace MT
@@ -0,0 +1,88 @@
+#include "stdafx.h"
+#include "perfcounters.h"
+
+namespace MT {
+
+const char* const perfCounterNames[PC_TOTAL] = {
+    "cycles", "instructions", "LLC misses", "context switches", "CPU migrations",
+    "user ms", "kernel ms"
+};
+
+// FILETIME is in 100 ns intervals
+static ULONGLONG FileTimeToMs(const FILETIME& ft) {
+    ULARGE_INTEGER t;
+    t.LowPart  = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return t.QuadPart / 10000;
+}
+
+PerfCounters::PerfCounters() : m_queryCycles(NULL) {
+    for (int i = 0; i < PC_TOTAL; i++) {
+        m_available[i] = false;
+        m_start[i]     = 0;
+        m_delta[i]     = 0;
+    }
+
+    HMODULE hKernel = ::GetModuleHandle(_T("kernel32.dll"));
+    if (hKernel != NULL)
+        m_queryCycles = reinterpret_cast<QueryProcessCycleTimeFn>(
+            ::GetProcAddress(hKernel, "QueryProcessCycleTime") );
+
+    m_available[PC_CYCLES]    = (m_queryCycles != NULL);
+    m_available[PC_USER_MS]   = true;
+    m_available[PC_KERNEL_MS] = true;
+}
+
+const char* PerfCounters::Name(PerfCounterId id) {
+    return perfCounterNames[id];
+}
+
+void PerfCounters::Sample(ULONGLONG values[PC_TOTAL]) const {
+    HANDLE hProcess = ::GetCurrentProcess();
+
+    ULONG64 cycles = 0;
+    if (m_queryCycles != NULL)
+        m_queryCycles(hProcess, &cycles);
+    values[PC_CYCLES] = cycles;
+
+    // includes the threads which have exited
+    FILETIME creation, exit, kernel, user;
+    if (::GetProcessTimes(hProcess, &creation, &exit, &kernel, &user)) {
+        values[PC_USER_MS]   = FileTimeToMs(user);
+        values[PC_KERNEL_MS] = FileTimeToMs(kernel);
+    }
+}
+
+void PerfCounters::Start() {
+    for (int i = 0; i < PC_TOTAL; i++)
+        m_start[i] = 0;
+    Sample(m_start);
+}
+
+void PerfCounters::Stop() {
+    ULONGLONG now[PC_TOTAL] = { 0 };
+    Sample(now);
+    for (int i = 0; i < PC_TOTAL; i++)
+        m_delta[i] = now[i] - m_start[i];
+}
+
+void PerfCounters::Report(std::ostream& out, ULONGLONG items) const {
+    out << "Performance counters of the run";
+    if (items > 0)
+        out << ", " << items << " items consumed";
+    out << ":" << endl;
+
+    for (int i = 0; i < PC_TOTAL; i++) {
+        out << "  " << perfCounterNames[i] << ": ";
+        if (!m_available[i]) {
+            out << "n/a" << endl;
+            continue;
+        }
+        out << m_delta[i];
+        if (items > 0)
+            out << " (" << static_cast<double>(m_delta[i]) / items << " per item)";
+        out << endl;
+    }
+}
+
+} // namespace MT
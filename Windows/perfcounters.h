@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ostream>
+#include "threads.h"
+
+namespace MT {
+
+enum PerfCounterId {
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_CONTEXT_SWITCHES,
+    PC_MIGRATIONS,
+    PC_USER_MS,
+    PC_KERNEL_MS,
+    PC_TOTAL
+};
+
+// Counters of all threads of the process captured around a run of the runner.
+//
+// Windows gives no user mode access to the performance monitoring unit, so only
+// the counters the system keeps per thread are available: CPU cycles charged to
+// the threads (QueryProcessCycleTime, Windows Vista and later, resolved at runtime)
+// and user and kernel times. Counters which cannot be captured are reported as n/a
+// instead of failing the run.
+// see: http://msdn.microsoft.com/en-us/library/windows/desktop/ms684929(v=vs.85).aspx
+class PerfCounters {
+public:
+    PerfCounters();
+
+    bool isAvailable(PerfCounterId id) const {
+        return m_available[id];
+    }
+    static const char* Name(PerfCounterId id);
+
+    void Start();
+    void Stop();
+
+    // totals and counts per item (if items were counted)
+    void Report(std::ostream& out, ULONGLONG items) const;
+
+private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    typedef BOOL (WINAPI *QueryProcessCycleTimeFn)(HANDLE, PULONG64);
+
+    void Sample(ULONGLONG values[PC_TOTAL]) const;
+
+    QueryProcessCycleTimeFn m_queryCycles;
+    bool      m_available[PC_TOTAL];
+    ULONGLONG m_start[PC_TOTAL];
+    ULONGLONG m_delta[PC_TOTAL];
+};
+
+} // namespace MT
@@ -1,231 +1,588 @@
-#include "stdafx.h"
-#include <queue>
-#include "threads.h"
-#include "threadrunner.h"
-
-extern MT::Queue<int> g_msgs;
-extern MT::HandleWrapper g_hEmptyEvent, g_hFullEvent, g_hEmptyMutEvent, g_hFullMutEvent, g_hMutex;
-
-const char FULL_BUFFER[]      = "Producer: full buffer, waiting";
-const char PRODUCER_WAKE_UP[] = "Producer: waking up";
-const char TASKS_FINISHED[]   = "Producer: tasks finished, exiting.";
-
-// diagnostics
-bool isSignalled(const MT::HandleWrapper& h, const std::string& hName, const std::string& who, 
-                 bool diagnostics = false) {
-
-    DWORD dwResult = ::WaitForSingleObject(h, 0);
-    bool res = (dwResult != WAIT_TIMEOUT);
-    if (diagnostics) {
-        stringstream ss;
-        ss << who << " " << hName <<  " is " << ( res ? "" : "NOT" ) << " signalled";
-        MT::ThreadRunner::Print(ss.str().c_str());
-    }
-
-    return res;
-}
-
-namespace MT {
-
-// Just locking shared data structure with Critical Sections
-unsigned __stdcall ProducerConsumerCSRunner::Producer(void* args) {
-
-    const SyncTimer& syncTimer = SyncTimer::Instance();
-    CriticalSection prod_cs;
-    SyncTimerState tState = ST_WORK;
-
-    // we will finish either when produce m_maxTasks or global timeout occurs
-    for (int nTask = 1; nTask <= m_maxTasks; nTask++) {
-
-        Produce(); // imitate work, exception safe
-        const int fullBufferWait = 300; // 0.3 sec
-
-        bool isFull = false;
-        do {
-            {   // all access to shared writable memory should be protected by exclusive lock
-                Lock lock(prod_cs);    // acquire lock
-                isFull = g_msgs.isFull();
-            } // release lock
-            if (isFull) {
-                Print(FULL_BUFFER);   // buffer is full -
-                Wait(fullBufferWait); // wait some period for consumer
-            }
-        } while ( (tState = syncTimer.State())==ST_WORK && isFull ) ; // check timeout waiting for free buffer
-
-        if (tState != ST_WORK) { // check timeout
-            if (tState == ST_ERR)
-                return ERR_SYNC;
-            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
-            return RET_OK;
-        }
-
-        {
-            Lock lock(prod_cs);
-            try {
-                g_msgs.push(nTask);
-
-            } catch(std::exception& ex) { // in case of uncaught exception Lock desctructor
-                Print(ex.what());         // will release the lock
-                return ERR_STD;
-            } catch(...) {
-                Print("Unknown error");
-                return ERR_UNKNOWN;
-            }
-        }
-        Print("sent: ", nTask);
-    } // for
-
-    PutThreadFinishMsg( TASKS_FINISHED );
-    return RET_OK;
-}
-
-// Using Events for synchronisation
-unsigned __stdcall ProducerConsumerEventRunner::Producer(void* args) {
-
-    const SyncTimer& syncTimer = SyncTimer::Instance();
-    CriticalSection prod_cs;
-    SyncTimerState tState = ST_WORK;
-    bool diagnostic = false; // debug messages
-
-    // we will finish either when produce m_maxTasks or global timeout occurs
-    for (int nTask = 1; nTask <= m_maxTasks; nTask++) {
-
-        Produce(); // imitate work, exception safe
-
-        isSignalled(g_hEmptyEvent, "Producer: ", "g_hEmptyEvent", diagnostic);
-        isSignalled(g_hFullEvent,  "Producer: ", "g_hFullEvent",  diagnostic);
-
-        const int fullBufferTimeout = 5000; // 5 sec
-        bool isFull = true;
-        while ( (tState = syncTimer.State())==ST_WORK && isFull) { // check timeout waiting for free buffer
-            {
-                Lock lock(prod_cs);
-                isFull = g_msgs.isFull();
-                if (isFull)
-                    Print(FULL_BUFFER);
-            } // release lock
-
-            if (isFull) { // buffer is full, wait event from consumer
-                ::ResetEvent(g_hEmptyEvent);
-                DWORD dwResult = ::WaitForSingleObject(g_hEmptyEvent, fullBufferTimeout);
-                if (dwResult == WAIT_FAILED)
-                    return ERR_SYNC; // error, exiting
-
-                if (dwResult == WAIT_TIMEOUT)
-                    continue; // buffer is still full, check global timer
-
-                // WAIT_OBJECT_0 - event signalled, buffer is free
-                Print(PRODUCER_WAKE_UP);
-                isFull = false;
-            }
-        } // while
-
-        if (tState != ST_WORK) {
-            if (tState == ST_ERR)
-                return ERR_SYNC;
-            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
-            return RET_OK;
-        }
-
-        {
-            Lock lock(prod_cs);
-            try {
-                g_msgs.push(nTask);
-
-            } catch(std::exception& ex) {
-                Print(ex.what());
-                return ERR_STD;
-            } catch(...) {
-                Print("Unknown error");
-                return ERR_UNKNOWN;
-            }
-            Print("sent: ", nTask);
-            ::SetEvent(g_hFullEvent);
-        }
-
-    } // for
-
-    PutThreadFinishMsg( TASKS_FINISHED );
-    return RET_OK;
-}
-
-// Using mutex for synchronisation
-unsigned __stdcall  ProducerConsumerMutexRunner::Producer(void* args) {
-
-    const SyncTimer& syncTimer  = SyncTimer::Instance();
-    SyncTimerState tState = ST_WORK;
-    bool diagnostic = false; // debug messages
-
-    // we will finish either when produce m_maxTasks or global timeout occurs
-    for (int nTask = 1; nTask <= m_maxTasks; nTask++) {
-
-        Produce(); // imitate work, exception safe
-        const int fullBufferTimeout = 5000; // 5 sec
-
-        bool isFull = true;
-        while ( (tState = syncTimer.State())==ST_WORK && isFull) { // check timeout waiting for free buffer
-
-            isSignalled(g_hEmptyMutEvent, "Producer: ", "g_hEmptyEvent", diagnostic);
-            isSignalled(g_hFullMutEvent,  "Producer: ", "g_hFullEvent",  diagnostic);
-
-            Produce(); // imitate work, exception safe
-
-            DWORD dwResult = ::WaitForSingleObject(g_hMutex, INFINITE);
-            if (dwResult != WAIT_OBJECT_0)
-                return ERR_SYNC; // error, exiting
-
-            // now we own the mutex
-            isFull = g_msgs.isFull();
-            if (isFull) {  // buffer is full, wait event from consumer
-
-                Print(FULL_BUFFER);
-                ::ReleaseMutex(g_hMutex);
-
-                ::ResetEvent(g_hEmptyMutEvent);
-                DWORD dwResult = ::WaitForSingleObject(g_hEmptyMutEvent, fullBufferTimeout);
-                if (dwResult == WAIT_FAILED)
-                    return ERR_SYNC; // error, exiting
-
-                if (dwResult == WAIT_TIMEOUT)
-                    continue; // buffer is still full, check global timer
-
-                // WAIT_OBJECT_0 - event signalled,  buffer is free
-                Print(PRODUCER_WAKE_UP);
-                isFull = false;
-            }
-        } // while
-
-        // now we own the mutex
-
-        if (tState != ST_WORK) {
-            ::ReleaseMutex(g_hMutex);
-            if (tState == ST_ERR)
-                return ERR_SYNC;
-            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
-            return RET_OK;
-        }
-
-        try {
-            g_msgs.push(nTask);
-        
-        } catch(std::exception& ex) { // should catch all exception in the thread to avoid indefinite locks
-            Print( ex.what());        // by not releasing mutex
-            ::ReleaseMutex(g_hMutex);
-            return ERR_STD;
-        } catch(...) {  
-            Print("Unknown error");
-            ::ReleaseMutex(g_hMutex);
-            return ERR_UNKNOWN;
-        }
-
-        Print("sent: ", nTask);
-        ::ReleaseMutex(g_hMutex);
-        ::SetEvent(g_hFullMutEvent);
-
-    } // for
-
-    PutThreadFinishMsg( TASKS_FINISHED );
-    return RET_OK;
-}
-
-} // namespace MT
+#include "stdafx.h"
+#include <queue>
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::Queue<int> g_msgs;
+extern MT::CriticalSection g_cs;
+extern MT::HandleWrapper g_hEmptyEvent, g_hFullEvent, g_hEmptyMutEvent, g_hFullMutEvent, g_hMutex;
+
+const char FULL_BUFFER[]      = "Producer: full buffer, waiting";
+const char PRODUCER_WAKE_UP[] = "Producer: waking up";
+const char TASKS_FINISHED[]   = "Producer: tasks finished, exiting.";
+const char JOURNAL_FAILED[]   = "Producer: cannot append to the journal";
+const char POOL_EXHAUSTED[]   = "Client: no free task states";
+const char SUBMIT_FAILED[]    = "Client: cannot submit the task";
+const char REPLY_TIMEOUT[]    = "Client: no reply";
+const char WRONG_REPLY[]      = "Client: wrong reply";
+const char PUBLISH_FAILED[]   = "Publisher: subscriber group stays full, groups delivered: ";
+
+// completion of CM_CONTINUATION requests, called in the server thread
+struct Reply {
+    volatile LONG    done;
+    int              result;
+    double           latencyUs;
+    const MT::Stopwatch* sw;
+};
+
+static void OnReply(int result, void* context) {
+    Reply* reply = static_cast<Reply*>(context);
+    reply->result    = result;
+    reply->latencyUs = reply->sw->ElapsedNs() / 1000;
+    ::InterlockedExchange(&reply->done, 1);
+}
+
+// diagnostics
+bool isSignalled(const MT::HandleWrapper& h, const std::string& hName, const std::string& who, 
+                 bool diagnostics = false) {
+
+    DWORD dwResult = ::WaitForSingleObject(h, 0);
+    bool res = (dwResult != WAIT_TIMEOUT);
+    if (diagnostics) {
+        stringstream ss;
+        ss << who << " " << hName <<  " is " << ( res ? "" : "NOT" ) << " signalled";
+        MT::ThreadRunner::Print(ss.str().c_str());
+    }
+
+    return res;
+}
+
+namespace MT {
+
+// Just locking shared data structure with Critical Sections
+unsigned __stdcall ProducerConsumerCSRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Producer");
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+        const int fullBufferWait = 300; // 0.3 sec
+
+        bool isFull = false;
+        do {
+            {   // all access to shared writable memory should be protected by exclusive lock
+                Lock lock(g_cs);    // acquire lock
+                isFull = g_msgs.isFull();
+            } // release lock
+            if (isFull) {
+                Print(FULL_BUFFER);   // buffer is full -
+                stats.Add(SC_WAITS);
+                tracer.Begin(TE_FULL_WAIT);
+                m_wait.Wait(SlotReady(g_msgs, g_cs), NULL, fullBufferWait); // wait for consumer
+                tracer.End(TE_FULL_WAIT);
+            }
+        } while ( (tState = syncTimer.State())==ST_WORK && isFull ) ; // check timeout waiting for free buffer
+
+        if (tState != ST_WORK) { // check timeout
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        {
+            Lock lock(g_cs);
+            try {
+                g_msgs.push(nTask);
+                SampleDepth();
+
+            } catch(std::exception& ex) { // in case of uncaught exception Lock desctructor
+                Print(ex.what());         // will release the lock
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error");
+                return ERR_UNKNOWN;
+            }
+        }
+        stats.Add(SC_PRODUCED);
+        Record(item);
+        Print("sent: ", nTask);
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Using Events for synchronisation
+unsigned __stdcall ProducerConsumerEventRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    bool diagnostic = false; // debug messages
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Producer");
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+
+        isSignalled(g_hEmptyEvent, "Producer: ", "g_hEmptyEvent", diagnostic);
+        isSignalled(g_hFullEvent,  "Producer: ", "g_hFullEvent",  diagnostic);
+
+        const int fullBufferTimeout = 5000; // 5 sec
+        bool isFull = true;
+        while ( (tState = syncTimer.State())==ST_WORK && isFull) { // check timeout waiting for free buffer
+            {
+                Lock lock(g_cs);
+                isFull = g_msgs.isFull();
+                if (isFull)
+                    Print(FULL_BUFFER);
+            } // release lock
+
+            if (isFull) { // buffer is full, wait event from consumer
+                ::ResetEvent(g_hEmptyEvent);
+                stats.Add(SC_WAITS);
+                tracer.Begin(TE_FULL_WAIT);
+                DWORD dwResult = m_wait.Wait(SlotReady(g_msgs, g_cs), g_hEmptyEvent, fullBufferTimeout);
+                tracer.End(TE_FULL_WAIT);
+                if (dwResult == WAIT_FAILED)
+                    return ERR_SYNC; // error, exiting
+
+                if (dwResult == WAIT_TIMEOUT) {
+                    stats.Add(SC_TIMEOUTS);
+                    continue; // buffer is still full, check global timer
+                }
+
+                // WAIT_OBJECT_0 - event signalled, buffer is free
+                tracer.Instant(TE_WAKEUP);
+                Print(PRODUCER_WAKE_UP);
+                isFull = false;
+            }
+        } // while
+
+        if (tState != ST_WORK) {
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        {
+            Lock lock(g_cs);
+            try {
+                g_msgs.push(nTask);
+                SampleDepth();
+
+            } catch(std::exception& ex) {
+                Print(ex.what());
+                return ERR_STD;
+            } catch(...) {
+                Print("Unknown error");
+                return ERR_UNKNOWN;
+            }
+            stats.Add(SC_PRODUCED);
+            Record(item);
+            Print("sent: ", nTask);
+            ::SetEvent(g_hFullEvent);
+        }
+
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Using mutex for synchronisation
+unsigned __stdcall  ProducerConsumerMutexRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer  = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    bool diagnostic = false; // debug messages
+    Tracer& tracer = Tracer::Instance();
+    Stats& stats = Stats::Instance();
+    tracer.SetThreadName("Producer");
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+        const int fullBufferTimeout = 5000; // 5 sec
+
+        bool isFull = true;
+        while ( (tState = syncTimer.State())==ST_WORK && isFull) { // check timeout waiting for free buffer
+
+            isSignalled(g_hEmptyMutEvent, "Producer: ", "g_hEmptyEvent", diagnostic);
+            isSignalled(g_hFullMutEvent,  "Producer: ", "g_hFullEvent",  diagnostic);
+
+            Produce(); // imitate work, exception safe
+
+            tracer.Begin(TE_LOCK_WAIT);
+            DWORD dwResult = ::WaitForSingleObject(g_hMutex, INFINITE);
+            tracer.End(TE_LOCK_WAIT);
+            if (dwResult != WAIT_OBJECT_0)
+                return ERR_SYNC; // error, exiting
+
+            // now we own the mutex
+            isFull = g_msgs.isFull();
+            if (isFull) {  // buffer is full, wait event from consumer
+
+                const LONG seen = m_emptySignals; // under the mutex: a pop after the check is counted
+                Print(FULL_BUFFER);
+                ::ReleaseMutex(g_hMutex);
+
+                ::ResetEvent(g_hEmptyMutEvent);
+                stats.Add(SC_WAITS);
+                tracer.Begin(TE_FULL_WAIT);
+                DWORD dwResult = m_wait.Wait(SignalReady(m_emptySignals, seen, false), g_hEmptyMutEvent,
+                                             fullBufferTimeout);
+                tracer.End(TE_FULL_WAIT);
+                if (dwResult == WAIT_FAILED)
+                    return ERR_SYNC; // error, exiting
+
+                if (dwResult == WAIT_TIMEOUT) {
+                    stats.Add(SC_TIMEOUTS);
+                    continue; // buffer is still full, check global timer
+                }
+
+                // WAIT_OBJECT_0 - event signalled,  buffer is free
+                tracer.Instant(TE_WAKEUP);
+                Print(PRODUCER_WAKE_UP);
+                isFull = false;
+            }
+        } // while
+
+        // now we own the mutex
+
+        if (tState != ST_WORK) {
+            ::ReleaseMutex(g_hMutex);
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        try {
+            g_msgs.push(nTask);
+            SampleDepth();
+        
+        } catch(std::exception& ex) { // should catch all exception in the thread to avoid indefinite locks
+            Print( ex.what());        // by not releasing mutex
+            ::ReleaseMutex(g_hMutex);
+            return ERR_STD;
+        } catch(...) {  
+            Print("Unknown error");
+            ::ReleaseMutex(g_hMutex);
+            return ERR_UNKNOWN;
+        }
+
+        stats.Add(SC_PRODUCED);
+        Record(item);
+        Print("sent: ", nTask);
+        ::ReleaseMutex(g_hMutex);
+        Signal(g_hFullMutEvent, m_fullSignals);
+
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Persistent queue: each item is appended to the journal and the producer waits for
+// the group commit which makes it durable
+unsigned __stdcall ProducerConsumerJournalRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+
+    // we will finish either when produce m_maxTasks (or the replayed trace) or global timeout occurs
+    for (int nTask = 1; nTask <= ItemCount(m_maxTasks); nTask++) {
+
+        WorkloadRecord item;
+        if (!Arrive(item)) // imitate work or replay the arrival, exception safe
+            break;         // the replayed trace is over
+
+        if ( (tState = syncTimer.State()) != ST_WORK ) {
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        ULONGLONG seq = m_journal.Append(&nTask, sizeof(nTask));
+        if (seq == 0 || !m_journal.WaitDurable(seq)) {
+            Print(JOURNAL_FAILED);
+            return ERR_API;
+        }
+        Stats::Instance().Add(SC_PRODUCED);
+        Record(item);
+        Print("sent (durable): ", nTask);
+    } // for
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Submits requests one by one and gets the results completing the task in turn
+// by waiting, polling and continuation.
+unsigned __stdcall RequestResponseRunner::Client(void* args) {
+
+    ClientArgs& clientArgs = *static_cast<ClientArgs*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    SyncTimerState tState = ST_WORK;
+    Stopwatch sw;
+
+    for (unsigned i = 0; i < m_requests; i++) {
+        if ( (tState = syncTimer.State()) != ST_WORK )
+            break;
+
+        const int request = rand();
+        const CompletionMode mode = static_cast<CompletionMode>(i % CM_TOTAL);
+
+        Task task;
+        task.request = request;
+        task.promise = Promise(m_pool);
+        if (!task.promise.isValid()) {
+            Print(POOL_EXHAUSTED);
+            return ERR_SYNC;
+        }
+        Future future = task.promise.GetFuture();
+
+        Reply reply = { 0, 0, 0, &sw };
+        if (mode == CM_CONTINUATION)
+            future.Then(&OnReply, &reply);
+
+        sw.Start();
+        if (!m_queue.Push(task, m_replyTimeout)) {
+            Print(SUBMIT_FAILED);
+            return ERR_SYNC;
+        }
+
+        int    result    = 0;
+        double latencyUs = 0;
+        switch (mode) {
+            case CM_WAIT:
+                if (!future.Wait(m_replyTimeout)) {
+                    Print(REPLY_TIMEOUT);
+                    return ERR_SYNC;
+                }
+                latencyUs = sw.ElapsedNs() / 1000;
+                result    = future.Get();
+                break;
+            case CM_POLL:
+                while (!future.IsReady()) {
+                    if (sw.ElapsedNs() > m_replyTimeout * 1e6) {
+                        Print(REPLY_TIMEOUT);
+                        return ERR_SYNC;
+                    }
+                    ::SwitchToThread(); // do some other work
+                }
+                latencyUs = sw.ElapsedNs() / 1000;
+                result    = future.Get();
+                break;
+            case CM_CONTINUATION:
+            default:
+                // queued task is always fulfilled: servers stop after all clients
+                while (reply.done == 0)
+                    ::SwitchToThread();
+                latencyUs = reply.latencyUs;
+                result    = reply.result;
+                break;
+        }
+
+        if (result != request * 2) {
+            Print(WRONG_REPLY);
+            return ERR_SYNC;
+        }
+        clientArgs.latencyUs[mode].push_back(latencyUs);
+    }
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+    if (tState == ST_STOP)
+        PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+    return RET_OK;
+}
+
+// Sends items in bursts which back up the queue unless the consumer pool grows. A replayed
+// trace brings its own bursts: the items are sent at its arrivals until it is over.
+unsigned __stdcall ElasticConsumerRunner::Producer(void* args) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const DWORD fullBufferWait = 50; // ms, to check the global timer
+    const int   items = ItemCount(m_bursts * m_burstSize);
+    SyncTimerState tState = ST_WORK;
+
+    for (int nTask = 1; nTask <= items; nTask++) {
+        WorkloadRecord item;
+        if (!Arrive(item, rand()%3 * 10))
+            break; // the replayed trace is over
+
+        bool sent = false;
+        while (!sent) {
+            if ( (tState = syncTimer.State()) != ST_WORK ) {
+                if (tState == ST_ERR)
+                    return ERR_SYNC;
+                PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+                return RET_OK;
+            }
+            {
+                Lock lock(m_cs);
+                if (!g_msgs.isFull()) {
+                    g_msgs.push(nTask);
+                    SampleDepth();
+                    sent = true;
+                }
+            }
+            if (sent) {
+                Stats::Instance().Add(SC_PRODUCED);
+                Record(item);
+                ::SetEvent(m_hItems);
+            } else { // full buffer: stall
+                Stopwatch sw;
+                if (::WaitForSingleObject(m_hSpace, fullBufferWait) == WAIT_FAILED)
+                    return ERR_SYNC;
+                ::InterlockedExchangeAdd(&m_stallUs, static_cast<LONG>(sw.ElapsedNs() / 1000));
+            }
+        }
+        if (!m_replay.isEnabled() && nTask % m_burstSize == 0) {
+            Print("Producer: burst sent, items: ", nTask);
+            if (nTask < items)
+                Wait(m_burstPauseMs);
+        }
+    }
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Publishes messages to the topic, waits while a subscriber group is full. With a replayed
+// trace the messages are published at its arrivals until it is over.
+unsigned __stdcall PubSubRunner::Publisher(void* args) {
+
+    PublisherArgs& pubArgs = *static_cast<PublisherArgs*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const size_t groups = pubArgs.broker->GroupCount(pubArgs.topic);
+    SyncTimerState tState = ST_WORK;
+    if (groups == 0)
+        return ERR_STD; // nobody subscribed to the topic
+
+    const int messages = ItemCount(m_messages);
+    for (int i = 0; i < messages; i++) {
+        WorkloadRecord item = { 0, m_payloadSize, 0, 0 };
+        if (m_replay.isEnabled() && !Arrive(item)) // no imitated work between the messages
+            break; // the replayed trace is over
+        if ( (tState = syncTimer.State()) != ST_WORK ) {
+            if (tState == ST_ERR)
+                return ERR_SYNC;
+            PutThreadFinishMsg( TIMEOUT, syncTimer.GetTimeoutInsSec() );
+            return RET_OK;
+        }
+
+        MessageRef msg( new Message(pubArgs.firstId + i, m_payloadSize) );
+        const size_t delivered = pubArgs.broker->Publish(pubArgs.topic, msg, m_queueTimeout);
+        if (delivered != groups) { // the first groups got the message, the lagging one did not
+            Print(PUBLISH_FAILED, static_cast<int>(delivered));
+            return ERR_SYNC;
+        }
+        pubArgs.published++;
+        Record(item);
+    } // the last reference of msg is released by a subscriber
+
+    PutThreadFinishMsg( TASKS_FINISHED );
+    return RET_OK;
+}
+
+// Pushes an item and pops one (not necessarily the same) in a loop: the thread which
+// pushed never finds the queue empty and all threads contend all the time
+unsigned __stdcall FlatCombiningRunner::Worker(void* args) {
+
+    WorkerArgs& a = *static_cast<WorkerArgs*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const unsigned timerCheck = 1024; // pairs between checks of the timer
+    ::WaitForSingleObject(a.hStart, INFINITE);
+
+    for (unsigned i = 0; i < m_pairs; i++) {
+        if (i % timerCheck == 0 && syncTimer.State() != ST_WORK)
+            break; // timeout: the rate is counted from the pairs done
+        int item = static_cast<int>(a.slot * m_pairs + i);
+        if (!a.queue->Push(a.slot, item) || !a.queue->Pop(a.slot, item))
+            return ERR_SYNC;
+        a.pairs++;
+    }
+    return RET_OK;
+}
+
+// Pushes items without waiting until stopped, the queue grows with the backlog
+unsigned __stdcall UnboundedQueueRunner::Producer(void* args) {
+
+    WorkerArgs& a = *static_cast<WorkerArgs*>(args);
+    while (m_stopProducers == 0) {
+        Work(m_produceSpin);
+        if (!a.queue->Push(a.slot, static_cast<int>(a.items)))
+            return ERR_STD; // out of memory
+        a.items = a.items + 1; // the only writer
+    }
+    return RET_OK;
+}
+
+// Sends the items on the schedule: an item is due at its intended time even if the
+// queue was full when the previous one was sent, so a blocked producer sends the overdue
+// items at once and the queueing delay shows in the latency of the consumer
+unsigned __stdcall OpenLoopRunner::Producer(void* args) {
+
+    StepArgs& a = *static_cast<StepArgs*>(args);
+    ArrivalSchedule schedule(m_arrival, a.rate);
+    const unsigned items = static_cast<unsigned>(a.intendedNs.size());
+
+    for (unsigned i = 0; i < items; i++) {
+        const double due = schedule.NextNs();
+        double now = a.clock->ElapsedNs();
+        while (now < due) { // the timer resolution is too coarse for the short gaps: spin
+            if (due - now > m_sleepAheadMs * 1e6)
+                ::Sleep(1);
+            else
+                YieldProcessor();
+            now = a.clock->ElapsedNs();
+        }
+        a.intendedNs[i] = due;
+        a.sentNs[i]     = now;
+
+        Task task;
+        task.request = static_cast<int>(i);
+        if (!m_queue.Push(task, m_queueTimeout))
+            return ERR_SYNC;
+    }
+
+    Task stop;
+    stop.request = -1;
+    return m_queue.Push(stop, m_queueTimeout) ? RET_OK : ERR_SYNC;
+}
+
+// Keeps the queue busy until the end of the run, the send time of each item is kept
+// in the ring by the index the item carries
+unsigned __stdcall SoakRunner::Producer(void*) {
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    unsigned item = 0;
+    while (syncTimer.State() == ST_WORK) {
+        Task task;
+        task.request = static_cast<int>(item % m_stampRing);
+        m_sentNs[task.request] = m_clock.ElapsedNs(); // published to the consumer by the queue lock
+        if (!m_queue.Push(task, m_queueTimeout))
+            continue; // full for the whole timeout: check the end of the run
+        m_produced = m_produced + 1; // the only writer
+        item++;
+    }
+    if (syncTimer.State() == ST_ERR)
+        return ERR_SYNC;
+
+    Task stop;
+    stop.request = -1;
+    return m_queue.Push(stop, m_stopTimeout) ? RET_OK : ERR_SYNC;
+}
+
+} // namespace MT
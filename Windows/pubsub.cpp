@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "pubsub.h"
+
+namespace MT {
+
+Message::Message(int id, unsigned payloadSize) : m_refs(1), m_id(id), m_payload(payloadSize) {
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    m_published = now.QuadPart;
+}
+
+SubscriberGroup::SubscriberGroup(const std::string& name, unsigned capacity) : m_name(name),
+    m_queue(capacity),
+    m_hItems( ::CreateSemaphore(NULL, 0, capacity, NULL) ),
+    m_hSlots( ::CreateSemaphore(NULL, capacity, capacity, NULL) ),
+    m_stalls(0)
+{
+}
+
+bool SubscriberGroup::Push(const MessageRef& msg, DWORD timeout) {
+    DWORD dwResult = ::WaitForSingleObject(m_hSlots, 0);
+    if (dwResult == WAIT_TIMEOUT) { // group is full: backpressure
+        ::InterlockedIncrement(&m_stalls);
+        dwResult = ::WaitForSingleObject(m_hSlots, timeout);
+    }
+    if (dwResult != WAIT_OBJECT_0)
+        return false;
+
+    {
+        Lock lock(m_cs);
+        m_queue.push(msg); // the slot is reserved, cannot overflow
+    }
+    ::ReleaseSemaphore(m_hItems, 1, NULL);
+    return true;
+}
+
+bool SubscriberGroup::Pop(MessageRef& msg, DWORD timeout) {
+    if (::WaitForSingleObject(m_hItems, timeout) != WAIT_OBJECT_0)
+        return false;
+
+    {
+        Lock lock(m_cs);
+        msg = m_queue.front();
+        m_queue.pop();
+    }
+    ::ReleaseSemaphore(m_hSlots, 1, NULL);
+    return true;
+}
+
+Broker::~Broker() {
+    for (size_t i = 0; i < m_all.size(); i++)
+        delete m_all[i];
+}
+
+SubscriberGroup* Broker::Subscribe(const std::string& topic, const std::string& group, unsigned capacity) {
+    SubscriberGroup* sg = NULL;
+    for (size_t i = 0; i < m_all.size(); i++)
+        if (m_all[i]->Name() == group)
+            sg = m_all[i];
+
+    if (sg == NULL) {
+        sg = new SubscriberGroup(group, capacity);
+        if (!sg->isValid()) {
+            delete sg;
+            return NULL;
+        }
+        m_all.push_back(sg);
+    }
+
+    Groups& groups = m_topics[topic];
+    if (std::find(groups.begin(), groups.end(), sg) == groups.end())
+        groups.push_back(sg);
+    return sg;
+}
+
+size_t Broker::GroupCount(const std::string& topic) const {
+    Topics::const_iterator it = m_topics.find(topic);
+    return it == m_topics.end() ? 0 : it->second.size();
+}
+
+size_t Broker::Publish(const std::string& topic, const MessageRef& msg, DWORD timeout) {
+    Topics::const_iterator it = m_topics.find(topic);
+    if (it == m_topics.end())
+        return 0;
+
+    const Groups& groups = it->second;
+    for (size_t i = 0; i < groups.size(); i++)
+        if (!groups[i]->Push(msg, timeout)) // one more reference, not a copy
+            return i;
+    return groups.size();
+}
+
+} // namespace MT
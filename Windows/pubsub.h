@@ -0,0 +1,140 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "threads.h"
+
+namespace MT {
+
+// Message published once and shared by all subscribers: the last reader frees it
+class Message {
+public:
+    Message(int id, unsigned payloadSize);
+
+    int Id() const {
+        return m_id;
+    }
+    LONGLONG Published() const { // QueryPerformanceCounter
+        return m_published;
+    }
+    const std::vector<char>& Payload() const {
+        return m_payload;
+    }
+
+    void AddRef() {
+        ::InterlockedIncrement(&m_refs);
+    }
+    void Release() {
+        if (::InterlockedDecrement(&m_refs) == 0)
+            delete this;
+    }
+
+private:
+    ~Message() {
+    }
+    Message(const Message&);
+    Message& operator=(const Message&);
+
+    volatile LONG     m_refs;
+    int               m_id;
+    LONGLONG          m_published;
+    std::vector<char> m_payload;
+};
+
+// counted reference to the message: copying it does not copy the message
+class MessageRef {
+public:
+    MessageRef(Message* msg = NULL) : m_msg(msg) { // takes the initial reference
+    }
+    MessageRef(const MessageRef& other) : m_msg(other.m_msg) {
+        if (m_msg != NULL)
+            m_msg->AddRef();
+    }
+    MessageRef& operator=(const MessageRef& other) {
+        if (other.m_msg != NULL)
+            other.m_msg->AddRef();
+        if (m_msg != NULL)
+            m_msg->Release();
+        m_msg = other.m_msg;
+        return *this;
+    }
+    ~MessageRef() {
+        if (m_msg != NULL)
+            m_msg->Release();
+    }
+
+    bool isValid() const { // invalid reference asks the subscriber to exit
+        return m_msg != NULL;
+    }
+    const Message* operator->() const {
+        return m_msg;
+    }
+
+private:
+    Message* m_msg;
+};
+
+// Subscribers sharing the load of a topic: each message is delivered to one of them.
+// Bounded queue of the group applies backpressure to publishers: semaphores count
+// free slots and queued messages.
+class SubscriberGroup {
+public:
+    SubscriberGroup(const std::string& name, unsigned capacity);
+
+    bool isValid() const {
+        return m_cs.isValid() && m_hItems.isValid() && m_hSlots.isValid();
+    }
+    const std::string& Name() const {
+        return m_name;
+    }
+    LONG Stalls() const { // publishes which waited for a free slot
+        return m_stalls;
+    }
+
+    bool Push(const MessageRef& msg, DWORD timeout = INFINITE);
+    bool Pop(MessageRef& msg, DWORD timeout = INFINITE);
+
+private:
+    SubscriberGroup(const SubscriberGroup&);
+    SubscriberGroup& operator=(const SubscriberGroup&);
+
+    std::string       m_name;
+    CriticalSection   m_cs;     // protects m_queue
+    Queue<MessageRef> m_queue;
+    HandleWrapper     m_hItems; // semaphore: queued messages
+    HandleWrapper     m_hSlots; // semaphore: free slots
+    volatile LONG     m_stalls;
+};
+
+// Named topics fanning out to subscriber groups. Topology is built by Subscribe()
+// before publishers and subscribers start, Publish() only reads it.
+class Broker {
+public:
+    Broker() {
+    }
+    ~Broker();
+
+    // NULL if the group could not be created
+    SubscriberGroup* Subscribe(const std::string& topic, const std::string& group, unsigned capacity);
+
+    size_t GroupCount(const std::string& topic) const; // groups subscribed to the topic
+
+    // Delivers the reference to the groups of the topic in the order of subscription, waits
+    // while a group is full. Delivery is not atomic: if a group stays full for the timeout,
+    // the groups before it keep the message and the groups from it on do not get it.
+    // Returns the number of groups delivered: GroupCount() if all of them.
+    size_t Publish(const std::string& topic, const MessageRef& msg, DWORD timeout = INFINITE);
+
+private:
+    Broker(const Broker&);
+    Broker& operator=(const Broker&);
+
+    typedef std::vector<SubscriberGroup*>      Groups;
+    typedef std::map<std::string, Groups>      Topics;
+
+    Topics m_topics;
+    std::vector<SubscriberGroup*> m_all; // owned, a group may subscribe to several topics
+};
+
+} // namespace MT
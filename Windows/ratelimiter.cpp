@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#include <climits>
+#include <intrin.h>
+#include "ratelimiter.h"
+
+namespace MT {
+
+RateLimiter::RateLimiter(double ratePerSec, unsigned burst) {
+    LARGE_INTEGER freq;
+    ::QueryPerformanceFrequency(&freq);
+    m_freq = freq.QuadPart;
+    Reset(ratePerSec, burst);
+}
+
+void RateLimiter::Reset(double ratePerSec, unsigned burst) {
+    m_rate      = ratePerSec;
+    m_burst     = burst > 0 ? burst : 1;
+    m_interval  = static_cast<LONGLONG>(m_freq / ratePerSec);
+    if (m_interval < 1)
+        m_interval = 1;
+    m_tolerance = (m_burst - 1) * m_interval;
+    m_tat       = Now() - m_tolerance; // full bucket
+}
+
+LONGLONG RateLimiter::Reserve(LONGLONG now, LONGLONG maxWait) {
+    for (;;) {
+        // on 32-bit system the read may be torn, then compare-and-swap fails and retries
+        LONGLONG tat   = m_tat;
+        LONGLONG start = tat > now ? tat : now;
+        LONGLONG wait  = start - now - m_tolerance; // until the request conforms
+        if (wait < 0)
+            wait = 0;
+        if (wait > maxWait)
+            return -1;
+        // compiler intrinsic: InterlockedCompareExchange64 API is not available on Windows XP
+        if (_InterlockedCompareExchange64(&m_tat, start + m_interval, tat) == tat)
+            return wait;
+    }
+}
+
+bool RateLimiter::TryAcquire() {
+    return Reserve(Now(), 0) == 0;
+}
+
+bool RateLimiter::Acquire(DWORD timeout) {
+    LONGLONG now     = Now();
+    LONGLONG maxWait = timeout == INFINITE ? LLONG_MAX : timeout * m_freq / 1000;
+    LONGLONG wait    = Reserve(now, maxWait);
+    if (wait < 0)
+        return false;
+
+    // the slot is ours: sleep most of the wait, then yield for precision
+    const LONGLONG until = now + wait;
+    LONGLONG remaining = 0;
+    while ( (remaining = until - Now()) > 0 ) {
+        DWORD ms = static_cast<DWORD>(remaining * 1000 / m_freq);
+        if (ms > 1)
+            ::Sleep(ms - 1); // system timer resolution
+        else
+            ::SwitchToThread();
+    }
+    return true;
+}
+
+} // namespace MT
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "threads.h"
+
+namespace MT {
+
+// Lock-free rate limiter: Generic Cell Rate Algorithm, the equivalent of token bucket.
+//
+// The whole state is a single "theoretical arrival time" (TAT) of the next request in
+// QueryPerformanceCounter ticks. Each granted request moves TAT forward by the emission
+// interval (1/rate); a request is allowed if TAT would not run ahead of the current time
+// by more than the burst tolerance. TAT is updated by compare-and-swap, so tokens are
+// "refilled" by the passing time itself - no timer thread, no lock.
+// see: http://en.wikipedia.org/wiki/Generic_cell_rate_algorithm
+class RateLimiter {
+public:
+    RateLimiter(double ratePerSec = 1000, unsigned burst = 1);
+
+    // not thread-safe: no threads may acquire meanwhile
+    void Reset(double ratePerSec, unsigned burst);
+
+    // non-blocking, false if the rate is exceeded
+    bool TryAcquire();
+
+    // reserves the next free slot and sleeps until it comes,
+    // false (nothing reserved) if it is later than the timeout
+    bool Acquire(DWORD timeout = INFINITE);
+
+    double Rate() const {
+        return m_rate;
+    }
+    unsigned Burst() const {
+        return m_burst;
+    }
+
+private:
+    RateLimiter(const RateLimiter&);
+    RateLimiter& operator=(const RateLimiter&);
+
+    static LONGLONG Now() {
+        LARGE_INTEGER now;
+        ::QueryPerformanceCounter(&now);
+        return now.QuadPart;
+    }
+
+    // moves TAT for one request unless it has to wait longer than maxWait ticks,
+    // returns the wait or -1 if nothing was changed
+    LONGLONG Reserve(LONGLONG now, LONGLONG maxWait);
+
+    double   m_rate;
+    unsigned m_burst;
+    LONGLONG m_freq;
+    LONGLONG m_interval;  // emission interval, ticks
+    LONGLONG m_tolerance; // (burst - 1) * interval
+
+    MT_CACHE_ALIGN volatile LONGLONG m_tat; // the only written member
+};
+
+} // namespace MT
@@ -1,71 +1,100 @@
-#include "stdafx.h"
-#include "threads.h"
-#include "threadrunner.h"
-
-extern MT::HandleWrapper g_hSemaphore;
-extern long g_semCounter;
-extern volatile LONG g_semThreadNum;
-
-LONG getNextNumber() { // assign short order number to threads to increase readability
-    // need to reset the counter in each new wait function, so use global which is reset
-    // in primary thread (static would not play).
-    ::InterlockedIncrement(&g_semThreadNum);
-    return g_semThreadNum;
-}
-
-namespace MT {
-
-unsigned __stdcall SemaphoreRunner::SemaphoreThreadFunction(void* args) {
-
-    const SyncTimer& syncTimer = SyncTimer::Instance();
-    const int threadNum   = getNextNumber();
-    SyncTimerState tState = ST_WORK;
-    CriticalSection sem_cs;
-
-    while ( (tState = syncTimer.State())==ST_WORK ) {
-
-        // checking the semaphore state to know if it is allowed to work 
-        DWORD dwResult = ::WaitForSingleObject(g_hSemaphore, 
-            0); // 0-timeout
-
-        if (dwResult == WAIT_FAILED)
-            return ERR_SYNC;
-
-        if (dwResult == WAIT_OBJECT_0) { // semaphore is signalled
-            {
-                Lock lock(sem_cs);
-                g_semCounter--; // semaphore counter was decremented
-                stringstream ss;
-                ss << "Thread " << threadNum << ": starting to work, counter: " << g_semCounter;
-                Print(ss.str().c_str());
-            }
-            
-            const int  produceFactor = rand()/10;
-            Produce(produceFactor); // produce some work
-            {
-                Lock lock(sem_cs);
-                g_semCounter++;
-                stringstream ss;
-                ss << "Thread " << threadNum << ": releasing, counter: " << g_semCounter;
-                Print(ss.str().c_str());
-            }
-
-            ::ReleaseSemaphore( 
-                    g_hSemaphore, // handle to semaphore
-                    1,            // increase count by one
-                    NULL);        // not interested in previous count
-
-        } // else: WAIT_TIMEOUT -  semaphore was not signalled
-    } // while
-
-    if (tState == ST_ERR)
-        return ERR_SYNC;
-
-    stringstream ss;
-    ss << TIMEOUT    << syncTimer.GetTimeoutInsSec() << ". Thread N "
-       <<  threadNum << ", thread Id: " << ::GetCurrentThreadId() << endl;
-    Print(ss.str().c_str());
-    return RET_OK;
-}
-
-} // namespace MT
\ No newline at end of file
+#include "stdafx.h"
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::HandleWrapper g_hSemaphore;
+
+namespace MT {
+
+unsigned __stdcall SemaphoreRunner::SemaphoreThreadFunction(void* args) {
+
+    const long semInitCount = *static_cast<const long*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    Stats& stats = Stats::Instance(); // counters are reset by the primary thread for each run
+    const int threadNum   = stats.ThreadNumber(); // short order number to increase readability
+    SyncTimerState tState = ST_WORK;
+    const DWORD semWaitTimeout = 100; // ms, to check the global timer
+
+    while ( (tState = syncTimer.State())==ST_WORK ) {
+
+        // checking the semaphore state to know if it is allowed to work 
+        DWORD dwResult = ::WaitForSingleObject(g_hSemaphore, 
+            0); // 0-timeout
+        if (dwResult == WAIT_TIMEOUT) { // no permit: waiting for a release
+            stats.Add(SC_WAITS);
+            dwResult = ::WaitForSingleObject(g_hSemaphore, semWaitTimeout);
+        }
+
+        if (dwResult == WAIT_FAILED)
+            return ERR_SYNC;
+
+        if (dwResult == WAIT_OBJECT_0) { // semaphore is signalled
+            stats.Add(SC_PERMITS_HELD); // semaphore counter was decremented
+            {
+                stringstream ss; // counter is summed over the threads
+                ss << "Thread " << threadNum << ": starting to work, counter: "
+                   << semInitCount - stats.Sum(SC_PERMITS_HELD);
+                Print(ss.str().c_str());
+            }
+            
+            const int  produceFactor = rand()/10;
+            Produce(produceFactor); // produce some work
+            stats.Add(SC_PERMITS_HELD, -1);
+            {
+                stringstream ss;
+                ss << "Thread " << threadNum << ": releasing, counter: "
+                   << semInitCount - stats.Sum(SC_PERMITS_HELD);
+                Print(ss.str().c_str());
+            }
+
+            ::ReleaseSemaphore( 
+                    g_hSemaphore, // handle to semaphore
+                    1,            // increase count by one
+                    NULL);        // not interested in previous count
+
+        } else { // WAIT_TIMEOUT - semaphore was not signalled during the timed wait
+            stats.Add(SC_TIMEOUTS);
+        }
+    } // while
+
+    if (tState == ST_ERR)
+        return ERR_SYNC;
+
+    stringstream ss;
+    ss << TIMEOUT    << syncTimer.GetTimeoutInsSec() << ". Thread N "
+       <<  threadNum << ", thread Id: " << ::GetCurrentThreadId() << endl;
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+// Works as often as the rate limiter allows until the phase is stopped
+unsigned __stdcall RateLimiterRunner::RateLimitedThreadFunction(void* args) {
+
+    WorkerStats& stats = *static_cast<WorkerStats*>(args);
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const bool blocking = m_blocking != 0;
+    const DWORD acquireTimeout = 100; // ms, to check the stop flag
+    Stopwatch sw;
+
+    while (m_stop == 0) {
+        if (syncTimer.State() == ST_ERR)
+            return ERR_SYNC;
+
+        bool granted = false;
+        if (blocking) {
+            granted = m_limiter.Acquire(acquireTimeout);
+        } else {
+            sw.Start();
+            granted = m_limiter.TryAcquire();
+            stats.acquireNs += sw.ElapsedNs();
+            if (!granted)
+                ::SwitchToThread();
+        }
+        stats.attempts++;
+        if (granted)
+            stats.granted++; // the work itself is empty: only the rate is measured
+    }
+    return RET_OK;
+}
+
+} // namespace MT
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <ostream>
+#include "allocation.h"
+
+namespace MT {
+
+enum StatsCounter {
+    SC_PRODUCED,
+    SC_CONSUMED,
+    SC_WAITS,        // waits for a free slot, an item or a permit
+    SC_TIMEOUTS,     // waits which timed out
+    SC_CONTENDED,    // lock acquisitions which found the lock owned
+    SC_PERMITS_HELD, // incremented on acquire and decremented on release
+    SC_TOTAL
+};
+
+const char* StatsCounterName(StatsCounter counter); // as in the report
+
+struct StatsSnapshot {
+    LONG     values[SC_TOTAL];
+    unsigned threads;
+};
+
+struct ThreadStatsSnapshot {
+    unsigned number; // as ThreadNumber()
+    LONG     values[SC_TOTAL];
+};
+
+// Statistics of the runners kept in per-thread counter slots and summed on read.
+//
+// Each thread finds its slot through thread local storage, the slot has the single
+// writer and its own cache line, so counting is a plain store: no lock, no interlocked
+// operation and no false sharing. A slot is taken with one interlocked increment when
+// the thread counts for the first time. Threads beyond the number of slots share the
+// overflow slot and count with interlocked operations.
+//
+// Counters are read without stopping the writers: every counter is read atomically,
+// but counters of one snapshot may be apart by the updates done while it is taken.
+class Stats {
+public:
+    static const unsigned m_maxThreads = MAXIMUM_WAIT_OBJECTS;
+
+    static Stats& Instance() {
+        return m_instance;
+    }
+
+    void Reset(); // counting threads must not be running
+
+    void Add(StatsCounter counter, LONG value = 1) {
+        Slot* slot = GetSlot();
+        if (slot->shared)
+            ::InterlockedExchangeAdd(&slot->values[counter], value);
+        else
+            slot->values[counter] += value; // the only writer
+    }
+
+    // depth of the queue of the running mode: a gauge, not a counter, stored by its threads
+    // right after they push or pop under the lock of the queue, -1 if the mode does not
+    void SetQueueDepth(LONG depth) {
+        m_queueDepth = depth; // aligned: the store is atomic
+    }
+    LONG QueueDepth() const {
+        return m_queueDepth;
+    }
+
+    // short number of the calling thread (from 1) to increase readability of the output
+    unsigned ThreadNumber() {
+        return GetSlot()->number;
+    }
+
+    LONG Sum(StatsCounter counter) const;
+    void Snapshot(StatsSnapshot& snapshot) const;
+    // counters of the threads which took their own slot, returns the number copied
+    unsigned ThreadSnapshots(ThreadStatsSnapshot* threads, unsigned maxThreads) const;
+    void Report(std::ostream& out) const;
+
+    ~Stats();
+
+private:
+    Stats();
+    Stats(const Stats&);
+    Stats& operator=(const Stats&);
+
+    struct MT_CACHE_ALIGN Slot {
+        volatile LONG values[SC_TOTAL];
+        LONG          shared;  // overflow slot
+        unsigned      number;
+    };
+
+    static Stats m_instance;
+
+    Slot* GetSlot() { // of the calling thread
+        if (reinterpret_cast<LONG_PTR>(::TlsGetValue(m_tlsGeneration)) == m_generation)
+            return static_cast<Slot*>(::TlsGetValue(m_tlsSlot));
+        return Register();
+    }
+    Slot* Register();
+
+    AlignedArray<Slot> m_slots;         // m_maxThreads and the overflow slot
+    DWORD              m_tlsSlot;       // Slot* of the thread
+    DWORD              m_tlsGeneration; // Reset() number the slot belongs to
+    volatile LONG      m_generation;
+    volatile LONG      m_registered;    // threads which took a slot
+    volatile LONG      m_queueDepth;
+};
+
+} // namespace MT
@@ -0,0 +1,157 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "statspage.h"
+
+namespace MT {
+
+const DWORD STATS_PAGE_MAGIC   = 0x5453544D; // "MTST"
+const DWORD STATS_PAGE_VERSION = 1;
+
+std::string StatsPageName(DWORD processId) {
+    stringstream ss; // session namespace: no privilege is needed to create it
+    ss << "Local\\MTStats." << processId;
+    return ss.str();
+}
+
+int StatsPageWriter::Create() {
+    Close();
+    const DWORD processId = ::GetCurrentProcessId();
+    m_hMapping.SetHandle( ::CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                               sizeof(StatsPage), StatsPageName(processId).c_str()) );
+    if (!m_hMapping.isValid())
+        return ERR_API;
+    m_page = static_cast<StatsPage*>( ::MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, sizeof(StatsPage)) );
+    if (m_page == NULL) {
+        m_hMapping.SetHandle(INVALID_HANDLE_VALUE);
+        return ERR_API;
+    }
+    // pages of the paging file are zero-filled: no data and an even sequence
+    m_page->version   = STATS_PAGE_VERSION;
+    m_page->processId = processId;
+    ::InterlockedExchange(reinterpret_cast<volatile LONG*>(&m_page->magic), STATS_PAGE_MAGIC); // last
+    return RET_OK;
+}
+
+void StatsPageWriter::Close() {
+    if (m_page != NULL) {
+        ::UnmapViewOfFile(m_page);
+        m_page = NULL;
+    }
+    m_hMapping.SetHandle(INVALID_HANDLE_VALUE);
+}
+
+void StatsPageWriter::Publish(const StatsPageData& data) {
+    if (m_page == NULL)
+        return;
+    ::InterlockedIncrement(&m_page->sequence); // odd: readers retry, full barrier
+    memcpy(&m_page->data, &data, sizeof(data));
+    ::InterlockedIncrement(&m_page->sequence); // even: the data is consistent
+}
+
+int StatsPageReader::Open(DWORD processId) {
+    Close();
+    m_hMapping.SetHandle( ::OpenFileMappingA(FILE_MAP_READ, FALSE, StatsPageName(processId).c_str()) );
+    if (!m_hMapping.isValid())
+        return ERR_API;
+    m_page = static_cast<const StatsPage*>( ::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, sizeof(StatsPage)) );
+    if (m_page == NULL) {
+        m_hMapping.SetHandle(INVALID_HANDLE_VALUE);
+        return ERR_API;
+    }
+    if (m_page->magic != STATS_PAGE_MAGIC || m_page->version != STATS_PAGE_VERSION) {
+        Close();
+        return ERR_STD;
+    }
+    return RET_OK;
+}
+
+void StatsPageReader::Close() {
+    if (m_page != NULL) {
+        ::UnmapViewOfFile(m_page);
+        m_page = NULL;
+    }
+    m_hMapping.SetHandle(INVALID_HANDLE_VALUE);
+}
+
+bool StatsPageReader::Read(StatsPageData& data) const {
+    if (m_page == NULL)
+        return false;
+    for (unsigned i = 0; i < m_maxRetries; i++) {
+        const LONG before = m_page->sequence;
+        if (before & 1) { // being written
+            ::SwitchToThread();
+            continue;
+        }
+        MemoryBarrier(); // the data is read after the sequence
+        memcpy(&data, const_cast<const StatsPageData*>(&m_page->data), sizeof(data));
+        MemoryBarrier(); // and before it is checked again
+        if (m_page->sequence == before)
+            return true;
+    }
+    return false;
+}
+
+int StatsPublisher::Start() {
+    if (isRunning())
+        return RET_OK;
+    m_hStop.SetHandle( ::CreateEvent(NULL, TRUE, FALSE, NULL) );
+    if (!m_hStop.isValid())
+        return ERR_API;
+    int ret = m_writer.Create();
+    if (ret != RET_OK)
+        return ret;
+
+    m_clock.Start();
+    Publish(); // the page is valid before the first period
+    m_hThread = (HANDLE) _beginthreadex(NULL, 0, &PublisherThread, this, 0, NULL);
+    if (m_hThread == 0) {
+        m_hThread = NULL;
+        m_writer.Close();
+        return ERR_API;
+    }
+    return RET_OK;
+}
+
+void StatsPublisher::Stop() {
+    if (!isRunning())
+        return;
+    ::SetEvent(m_hStop);
+    ::WaitForSingleObject(m_hThread, INFINITE);
+    ::CloseHandle(m_hThread);
+    m_hThread = NULL;
+    m_writer.Close();
+}
+
+unsigned __stdcall StatsPublisher::PublisherThread(void* args) {
+    StatsPublisher* publisher = static_cast<StatsPublisher*>(args);
+    DWORD dwResult = WAIT_TIMEOUT;
+    while ((dwResult = ::WaitForSingleObject(publisher->m_hStop, m_periodMs)) == WAIT_TIMEOUT)
+        publisher->Publish();
+    return dwResult == WAIT_OBJECT_0 ? RET_OK : ERR_SYNC;
+}
+
+// Counters are read from the slots of the threads without stopping them (Stats::Snapshot)
+void StatsPublisher::Publish() {
+    Stats& stats = Stats::Instance();
+    StatsSnapshot snapshot;
+    stats.Snapshot(snapshot);
+    ThreadStatsSnapshot threads[StatsPageData::m_maxThreads];
+    const unsigned count = stats.ThreadSnapshots(threads, StatsPageData::m_maxThreads);
+
+    StatsPageData data;
+    memset(&data, 0, sizeof(data));
+    data.timeUs  = static_cast<unsigned long long>(m_clock.ElapsedNs() / 1000);
+    data.runner  = m_runner;
+    data.threads = snapshot.threads;
+    for (int c = 0; c < SC_TOTAL; c++)
+        data.values[c] = snapshot.values[c];
+    data.queueDepth = stats.QueueDepth(); // sampled by the runner under the lock of its queue
+    for (unsigned i = 0; i < count; i++) {
+        data.thread[i].number = threads[i].number;
+        for (int c = 0; c < SC_TOTAL; c++)
+            data.thread[i].values[c] = threads[i].values[c];
+    }
+    m_writer.Publish(data);
+}
+
+} // namespace MT
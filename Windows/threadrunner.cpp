@@ -1,210 +1,1206 @@
-#include "stdafx.h"
-#include "threads.h"
-#include "threadrunner.h"
-
-volatile LONG g_semThreadNum = 0; // short number of semaphore threads to increase readability
-long g_semCounter = 0;
-
-namespace MT {
-
-// Factory Method
-ThreadRunner* ThreadRunnerCreator::Create(SyncType syncType)
-{
-    switch (syncType) {
-        case SEMAPHORE:
-            return new SemaphoreRunner;
-        case CS:
-            return new ProducerConsumerCSRunner;
-        case CS_EVENT:
-            return new ProducerConsumerEventRunner;
-        case MUTEX:
-        default:
-            return new ProducerConsumerMutexRunner;
-    }
-}
-
-int ThreadRunner::InitTimer(long long interval) {
-
-    // synchronise stopping of all threads after specified timeout 
-    // using single common global WaitableTimer object
-
-    SyncTimer& syncTimer = SyncTimer::Instance();
-    if (!syncTimer.isValid())
-        return ERR_API;
-
-    LARGE_INTEGER timeout; // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686289(v=vs.85).aspx
-    timeout.QuadPart = interval; // if negative, the absolute value is interpreted as relative
-                                 // to the current time on the clock, in 100ns interval
-    if (!syncTimer.SetTimer(timeout))
-        return ERR_API;
-    return RET_OK;
-}
-
-int ThreadRunner::Init() const {
-    int ret = InitTimer();
-    if (ret != RET_OK)
-        return ret;
-    return InitSyncObjects(); // derived object virtual function call - type is known at runtime
-                              // runtime polymorphism
-}
-
-int ProducerConsumerRunner::RunThreads() const {
-
-    int ret = Init();
-    if (ret != RET_OK)
-        return ret;
-
-    HANDLE   threadHandles[m_totalThreads] = { 0 };
-    unsigned threadIDs[m_totalThreads]     = { 0 };
-
-   // get thread functions of current object (virtual functions calls)
-    THREAD_FUNCTION *Producer = GetProducerThreadFunctionPtr();
-    THREAD_FUNCTION *Consumer = GetConsumerThreadFunctionPtr();
-
-    // in case a thread is not created - do not create remaining threads,
-    // wait for created and return
-
-    int createdThreads = 0;
-    threadHandles[0] = (HANDLE) _beginthreadex(
-        NULL,     // securtiy
-        0,        // thread stack size, 0 - default size (1 Mb)
-        Producer, // start address of the thread function: unsigned ( __stdcall *start_address )( void * )
-        0,        // arguments for the thread function (void*)
-        0,        // Initflag - Initial state of a new thread 
-                  // (0 for running or CREATE_SUSPENDED for suspended);
-        &threadIDs[0] // output: receive thread id
-        );        // see: http://msdn.microsoft.com/en-us/library/kdzttdcb(v=vs.90).aspx
-
-    if (threadHandles[0] != 0) {
-        createdThreads++;
-        threadHandles[1] = (HANDLE) _beginthreadex( NULL, 0, Consumer, 0, 0, &threadIDs[1] );
-        if (threadHandles[1] != 0)
-            createdThreads++;
-    }
-
-    // It may happen that only one of the threads was created.
-    // In such case we will wait while this thread will correctly exit by timeout 
-
-    DWORD dwRet = 0;
-    bool allThreadsOK = false;
-    if (createdThreads > 0) {
-        dwRet = ::WaitForMultipleObjects( // wait all created threads to exit
-
-            createdThreads, // number of handles of created threads in threadHandles
-            threadHandles,  // const HANDLE* - an array of handles to thread, process, mutex, event, semaphore
-                    // waitable timer, change notification, console input, memory resource notification.
-                    // see also: http://msdn.microsoft.com/en-us/library/windows/desktop/ms687025(v=vs.85).aspx
-            TRUE ,  // bWaitALl
-            INFINITE  // DWORD dwMilliseconds. INFINITE - wait all threads to finish.
-            );
-
-        // check status and close created thread handles
-        allThreadsOK = true;
-        for (int i=0; i<m_totalThreads; i++) {
-            if (threadHandles[i] == 0) { // some threads were not created - nothning was done
-                allThreadsOK = false;
-                continue;
-            }
-            if (allThreadsOK) {
-                DWORD code = 0;
-                ::GetExitCodeThread(threadHandles[i], &code);
-                if (code != 0)
-                    allThreadsOK = false;
-            }
-            ::CloseHandle(threadHandles[i]);
-        }
-    } 
-
-    // resourses will be auto cleaned up
-    if (createdThreads != m_totalThreads)
-        return ERR_API;
-
-    if (dwRet == WAIT_FAILED) // WaitForMultipleObject return code
-        return ERR_API;
-
-    if (dynamic_cast<const ProducerConsumerMutexRunner*>(this) != 0)
-        if (dwRet == WAIT_ABANDONED)
-            return ERR_SYNC;
-
-    if (!allThreadsOK)
-         ERR_SYNC;
-
-    return RET_OK;
-}
-
-int SemaphoreRunner::RunThreads() const {
-
-    // semaphore
-    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms685129(v=vs.85).aspx
-    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686946(v=vs.85).aspx
-
-    // Maintains a counter which is decreasing whe Wait function succeeds and increasing
-    // when semaphore is released. The state is signaled when counter > 0.
-
-    // For example, if the counter is set to 2, only two threads can work simultaneously:
-    // both had succeed wait function and decremented the counter so it became 0 and 
-    // the third thread wait function will not succeed - semaphore state is NOT signalled.
-
-    int ret = Init();
-    if (ret != RET_OK)
-        return ret;
-
-    g_semCounter   = m_semInitCount;
-    g_semThreadNum = 0;  // reset thread number counter (for next calls of SemaphoreThreadFunction)
-
-    std::vector<HANDLE> threadHandles(m_totalThreads);
-    std::vector<unsigned> threadIDs(m_totalThreads);
-
-    // in case a thread is not created - do not create remaining threads, 
-    // wait for created, cleen up and return
-    int createdThreads = 0;
-    for (int i=0; i<m_totalThreads; i++, createdThreads++) { // try to create > MAX_SEM_COUNT threads
-        threadHandles[i] = (HANDLE)  _beginthreadex( NULL, 0, &SemaphoreThreadFunction, 
-            (void*)&m_semInitCount, 0, &threadIDs[i] );
-
-        if (threadHandles[i] == 0)
-            break;
-    }
-
-    DWORD dwRet = 0;
-    bool allThreadsOK = false;
-
-    if (createdThreads > 0) {
-        dwRet = ::WaitForMultipleObjects(
-            createdThreads,
-            &threadHandles[0],
-            TRUE, // wait all threads
-            INFINITE
-            );
-
-        // check status and close thread handles
-        allThreadsOK = true;
-        for (int i=0; i<m_totalThreads; i++) {
-            if (threadHandles[i] == 0) { // some threads were not created - nothning was done
-                allThreadsOK = false;
-                continue;
-            }
-            if (allThreadsOK) {
-                DWORD code = 0;
-                ::GetExitCodeThread(threadHandles[i], &code);
-                if (code != 0)
-                    allThreadsOK = false;
-            }
-            ::CloseHandle(threadHandles[i]);
-        }
-    }
-
-    // resourses will be auto cleaned up
-    if (createdThreads != m_totalThreads)
-        return ERR_API;
-
-    if (dwRet == WAIT_FAILED)
-        return ERR_API;
-
-    if (!allThreadsOK)
-        ERR_SYNC;
-
-    return RET_OK;
-}
-
-} // namespace MT
\ No newline at end of file
+#include "stdafx.h"
+#include <algorithm>
+#include "threads.h"
+#include "threadrunner.h"
+
+extern MT::Queue<int> g_msgs;
+
+const TCHAR SINK_FILE[] = _T("received.dat"); // output of ProducerConsumerFileSinkRunner
+const TCHAR JOURNAL_NAME[] = _T("msgs");      // msgs.<segment>.seg, msgs.checkpoint
+
+namespace MT {
+
+// Factory Method
+ThreadRunner* ThreadRunnerCreator::Create(SyncType syncType)
+{
+    switch (syncType) {
+        case SEMAPHORE:
+            return new SemaphoreRunner;
+        case CS:
+            return new ProducerConsumerCSRunner;
+        case CS_EVENT:
+            return new ProducerConsumerEventRunner;
+        case FILE_SINK:
+            return new ProducerConsumerFileSinkRunner;
+        case JOURNAL:
+            return new ProducerConsumerJournalRunner;
+        case REQUEST_RESPONSE:
+            return new RequestResponseRunner;
+        case RATE_LIMITER:
+            return new RateLimiterRunner;
+        case ELASTIC:
+            return new ElasticConsumerRunner;
+        case PUB_SUB:
+            return new PubSubRunner;
+        case FLAT_COMBINING:
+            return new FlatCombiningRunner;
+        case UNBOUNDED:
+            return new UnboundedQueueRunner;
+        case OPEN_LOOP:
+            return new OpenLoopRunner;
+        case SOAK:
+            return new SoakRunner;
+        case BATCH:
+            return new ProducerConsumerBatchRunner;
+        case WORK_STACK:
+            return new WorkStackRunner;
+        case MUTEX:
+        default:
+            return new ProducerConsumerMutexRunner;
+    }
+}
+
+int ThreadRunner::InitTimer(long long interval) {
+
+    // synchronise stopping of all threads after specified timeout 
+    // using single common global WaitableTimer object
+
+    SyncTimer& syncTimer = SyncTimer::Instance();
+    if (!syncTimer.isValid())
+        return ERR_API;
+
+    LARGE_INTEGER timeout; // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686289(v=vs.85).aspx
+    timeout.QuadPart = interval; // if negative, the absolute value is interpreted as relative
+                                 // to the current time on the clock, in 100ns interval
+    if (!syncTimer.SetTimer(timeout))
+        return ERR_API;
+    return RET_OK;
+}
+
+// Pins the threads to the processors chosen by the placement policy. If the machine has
+// no such placement (one socket, no SMT) the threads are left to the scheduler.
+void ThreadRunner::PlaceThreads(const HANDLE* threadHandles, unsigned count) {
+    if (m_placement == PL_DEFAULT)
+        return;
+
+    std::vector<unsigned> cpus;
+    stringstream ss;
+    ss << "Placement " << PlacementName(m_placement);
+    if (!Topology::Instance().Place(m_placement, count, cpus)) {
+        ss << " is not available on this machine, threads are not pinned";
+    } else {
+        ss << ", processors:";
+        for (unsigned i = 0; i < count; i++) {
+            ss << ' ' << cpus[i];
+            if (!PinThread(threadHandles[i], cpus[i]))
+                ss << " (failed)";
+        }
+    }
+    Print(ss.str().c_str());
+}
+
+void ThreadRunner::PrintWaitStrategy(std::ostream& out) {
+    const WaitBudget& budget = m_wait.Budget();
+    out << "Wait strategy " << WaitPolicyName(m_wait.Policy());
+    if (m_wait.Policy() == WP_YIELD || m_wait.Policy() == WP_BACKOFF || m_wait.Policy() == WP_PARK)
+        out << ", spins " << budget.spins;
+    if (m_wait.Policy() == WP_BACKOFF)
+        out << ", backoff up to " << budget.maxBackoffMs << " ms";
+    out << endl;
+}
+
+int ThreadRunner::Init() const {
+    int ret = InitTimer();
+    if (ret != RET_OK)
+        return ret;
+    m_replay.Restart(); // the trace is played and recorded from the start of the run
+    m_recorder.Restart();
+    return InitSyncObjects(); // derived object virtual function call - type is known at runtime
+                              // runtime polymorphism
+}
+
+int ProducerConsumerRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+    ::InterlockedExchange(&m_phase, SP_RUN);
+
+    HANDLE   threadHandles[m_totalThreads] = { 0 };
+    unsigned threadIDs[m_totalThreads]     = { 0 };
+
+   // get thread functions of current object (virtual functions calls)
+    THREAD_FUNCTION *Producer = GetProducerThreadFunctionPtr();
+    THREAD_FUNCTION *Consumer = GetConsumerThreadFunctionPtr();
+
+    // in case a thread is not created - do not create remaining threads,
+    // wait for created and return
+
+    int createdThreads = 0;
+    threadHandles[0] = (HANDLE) _beginthreadex(
+        NULL,     // securtiy
+        0,        // thread stack size, 0 - default size (1 Mb)
+        Producer, // start address of the thread function: unsigned ( __stdcall *start_address )( void * )
+        0,        // arguments for the thread function (void*)
+        0,        // Initflag - Initial state of a new thread 
+                  // (0 for running or CREATE_SUSPENDED for suspended);
+        &threadIDs[0] // output: receive thread id
+        );        // see: http://msdn.microsoft.com/en-us/library/kdzttdcb(v=vs.90).aspx
+
+    if (threadHandles[0] != 0) {
+        createdThreads++;
+        threadHandles[1] = (HANDLE) _beginthreadex( NULL, 0, Consumer, 0, 0, &threadIDs[1] );
+        if (threadHandles[1] != 0)
+            createdThreads++;
+    }
+    if (createdThreads == m_totalThreads)
+        PlaceThreads(threadHandles, m_totalThreads); // producer, consumer
+
+    // It may happen that only one of the threads was created.
+    // In such case we will wait while this thread will correctly exit by timeout 
+
+    DWORD dwRet = 0;
+    bool allThreadsOK = false;
+    if (createdThreads > 0) {
+        dwRet = Shutdown(threadHandles[0], threadHandles[1]); // wait all created threads to exit
+
+        // check status and close created thread handles
+        allThreadsOK = true;
+        for (int i=0; i<m_totalThreads; i++) {
+            if (threadHandles[i] == 0) { // some threads were not created - nothning was done
+                allThreadsOK = false;
+                continue;
+            }
+            if (allThreadsOK) {
+                DWORD code = 0;
+                ::GetExitCodeThread(threadHandles[i], &code);
+                if (code != 0)
+                    allThreadsOK = false;
+            }
+            ::CloseHandle(threadHandles[i]);
+        }
+    } 
+
+    // resourses will be auto cleaned up
+    if (createdThreads != m_totalThreads)
+        return ERR_API;
+
+    if (dwRet == WAIT_FAILED) // of a wait for the threads
+        return ERR_API;
+
+    if (!allThreadsOK)
+        return ERR_SYNC;
+
+    return RET_OK;
+}
+
+// Producer exits by the timeout (intake is stopped) or when all tasks are sent. After the
+// timeout the consumer drains the buffer, if it is not empty by the grace deadline the
+// consumer is stopped after the current item and the rest is dropped. The consumer is
+// waited for even if the wait for the producer failed, WAIT_FAILED of either is returned.
+DWORD ProducerConsumerRunner::Shutdown(HANDLE hProducer, HANDLE hConsumer) const {
+
+    const DWORD producerRet = ::WaitForSingleObject(hProducer, INFINITE);
+    if (hConsumer == 0)
+        return producerRet;
+
+    SyncTimer::Instance().Wait(); // consumer works until the timeout even if all tasks are sent
+
+    const size_t backlog = Backlog();
+    Stopwatch sw;
+    ::InterlockedExchange(&m_phase, SP_DRAIN); // nothing is produced any more
+    WakeConsumer();
+
+    DWORD dwRet = ::WaitForSingleObject(hConsumer, m_drainMs);
+    bool forced = (dwRet == WAIT_TIMEOUT);
+    if (forced) {
+        ::InterlockedExchange(&m_phase, SP_STOP);
+        WakeConsumer();
+        dwRet = ::WaitForSingleObject(hConsumer, INFINITE);
+    }
+    ReportDrain(backlog, sw.ElapsedNs() / 1e6, forced);
+
+    return producerRet == WAIT_FAILED ? producerRet : dwRet;
+}
+
+void ProducerConsumerRunner::ReportDrain(size_t backlog, double drainMs, bool forced) const {
+
+    const size_t left    = Backlog();
+    const size_t dropped = DropBacklog();
+    stringstream ss;
+    ss << "Shutdown: " << (forced ? "grace deadline passed, " : "") << "drained "
+       << backlog - left << " of " << backlog << " items in " << drainMs << " ms, dropped "
+       << dropped;
+    if (left != dropped)
+        ss << ", kept " << left - dropped;
+    Print(ss.str().c_str());
+}
+
+int ProducerConsumerFileSinkRunner::RunThreads() const {
+
+    int ret = m_sink.Open(SINK_FILE);
+    if (ret != RET_OK)
+        return ret;
+
+    ret = ProducerConsumerRunner::RunThreads();
+
+    int closeRet = m_sink.Close(); // writes all received items
+    stringstream ss;
+    m_sink.Report(ss);
+    Print(ss.str().c_str());
+
+    return ret != RET_OK ? ret : closeRet;
+}
+
+int ProducerConsumerJournalRunner::RunThreads() const {
+
+    int ret = m_journal.Open(JOURNAL_NAME, m_durabilityMs); // recovers unconsumed items
+    if (ret != RET_OK)
+        return ret;
+
+    JournalStats stats;
+    m_journal.GetStats(stats);
+    Print("Journal: unconsumed items after restart: ", static_cast<int>(stats.recovered));
+
+    ret = ProducerConsumerRunner::RunThreads();
+
+    int closeRet = m_journal.Close(); // final group commit and checkpoint
+    stringstream ss;
+    m_journal.Report(ss);
+    Print(ss.str().c_str());
+
+    return ret != RET_OK ? ret : closeRet;
+}
+
+// starts count threads, false if not all were created
+static bool StartThreads(THREAD_FUNCTION* function, void* args, size_t argSize, unsigned count,
+                         std::vector<HANDLE>& threadHandles) {
+    for (unsigned i = 0; i < count; i++) {
+        void* threadArgs = args == NULL ? NULL : static_cast<char*>(args) + i * argSize;
+        HANDLE h = (HANDLE) _beginthreadex(NULL, 0, function, threadArgs, 0, NULL);
+        if (h == 0)
+            return false;
+        threadHandles.push_back(h);
+    }
+    return true;
+}
+
+// waits for the threads, closes their handles and checks the exit codes
+static int JoinThreads(std::vector<HANDLE>& threadHandles) {
+    if (threadHandles.empty())
+        return RET_OK;
+
+    int ret = RET_OK;
+    DWORD dwRet = ::WaitForMultipleObjects(static_cast<DWORD>(threadHandles.size()),
+                                           &threadHandles[0], TRUE, INFINITE);
+    if (dwRet == WAIT_FAILED)
+        ret = ERR_API;
+
+    for (size_t i = 0; i < threadHandles.size(); i++) {
+        DWORD code = 0;
+        ::GetExitCodeThread(threadHandles[i], &code);
+        if (code != RET_OK && ret == RET_OK)
+            ret = ERR_SYNC;
+        ::CloseHandle(threadHandles[i]);
+    }
+    threadHandles.clear();
+    return ret;
+}
+
+int RequestResponseRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+    if (!m_pool.isValid())
+        return ERR_API;
+
+    const SyncType syncTypes[] = { CS, CS_EVENT, MUTEX, SEMAPHORE };
+    const char* syncNames[]    = { "Critical sections", "Critical sections and events",
+                                   "Mutex and events", "Semaphores" };
+    const char* modeNames[CM_TOTAL] = { "wait", "poll", "continuation" };
+
+    for (size_t t = 0; t < sizeof(syncTypes) / sizeof(syncTypes[0]); t++) {
+
+        ret = m_queue.Init(syncTypes[t]);
+        if (ret != RET_OK)
+            return ret;
+
+        ClientArgs args[m_clients];
+        std::vector<HANDLE> servers, clients;
+
+        // servers first: clients are timed from the first request
+        bool created = StartThreads(&Server, NULL, 0, m_servers, servers) &&
+                       StartThreads(&Client, args, sizeof(ClientArgs), m_clients, clients);
+
+        ret = JoinThreads(clients);
+
+        for (size_t i = 0; i < servers.size(); i++) // stop requests
+            if (!m_queue.Push(Task(), m_replyTimeout))
+                ret = ERR_SYNC;
+
+        int serversRet = JoinThreads(servers);
+        if (!created)
+            return ERR_API;
+        if (ret != RET_OK)
+            return ret;
+        if (serversRet != RET_OK)
+            return serversRet;
+
+        // round trip latency of all clients
+        stringstream ss;
+        ss << endl << "Request/response: " << syncNames[t] << endl;
+        for (int mode = 0; mode < CM_TOTAL; mode++) {
+            std::vector<double> latency;
+            for (unsigned c = 0; c < m_clients; c++)
+                latency.insert(latency.end(), args[c].latencyUs[mode].begin(),
+                               args[c].latencyUs[mode].end());
+            if (latency.empty())
+                continue;
+
+            std::sort(latency.begin(), latency.end());
+            double sum = 0;
+            for (size_t i = 0; i < latency.size(); i++)
+                sum += latency[i];
+
+            ss << "  " << modeNames[mode] << ": " << latency.size() << " requests, us"
+               << " avg " << sum / latency.size()
+               << " p50 " << latency[latency.size() / 2]
+               << " p99 " << latency[latency.size() * 99 / 100]
+               << " max " << latency.back() << endl;
+        }
+        Print(ss.str().c_str());
+    }
+    return RET_OK;
+}
+
+int SemaphoreRunner::RunThreads() const {
+
+    // semaphore
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms685129(v=vs.85).aspx
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686946(v=vs.85).aspx
+
+    // Maintains a counter which is decreasing whe Wait function succeeds and increasing
+    // when semaphore is released. The state is signaled when counter > 0.
+
+    // For example, if the counter is set to 2, only two threads can work simultaneously:
+    // both had succeed wait function and decremented the counter so it became 0 and 
+    // the third thread wait function will not succeed - semaphore state is NOT signalled.
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    std::vector<HANDLE> threadHandles(m_totalThreads);
+    std::vector<unsigned> threadIDs(m_totalThreads);
+
+    // in case a thread is not created - do not create remaining threads, 
+    // wait for created, cleen up and return
+    int createdThreads = 0;
+    for (int i=0; i<m_totalThreads; i++, createdThreads++) { // try to create > MAX_SEM_COUNT threads
+        threadHandles[i] = (HANDLE)  _beginthreadex( NULL, 0, &SemaphoreThreadFunction, 
+            (void*)&m_semInitCount, 0, &threadIDs[i] );
+
+        if (threadHandles[i] == 0)
+            break;
+    }
+    if (createdThreads == m_totalThreads)
+        PlaceThreads(&threadHandles[0], m_totalThreads);
+
+    DWORD dwRet = 0;
+    bool allThreadsOK = false;
+
+    if (createdThreads > 0) {
+        dwRet = ::WaitForMultipleObjects(
+            createdThreads,
+            &threadHandles[0],
+            TRUE, // wait all threads
+            INFINITE
+            );
+
+        // check status and close thread handles
+        allThreadsOK = true;
+        for (int i=0; i<m_totalThreads; i++) {
+            if (threadHandles[i] == 0) { // some threads were not created - nothning was done
+                allThreadsOK = false;
+                continue;
+            }
+            if (allThreadsOK) {
+                DWORD code = 0;
+                ::GetExitCodeThread(threadHandles[i], &code);
+                if (code != 0)
+                    allThreadsOK = false;
+            }
+            ::CloseHandle(threadHandles[i]);
+        }
+    }
+
+    // resourses will be auto cleaned up
+    if (createdThreads != m_totalThreads)
+        return ERR_API;
+
+    if (dwRet == WAIT_FAILED)
+        return ERR_API;
+
+    if (!allThreadsOK)
+        return ERR_SYNC;
+
+    return RET_OK;
+}
+
+int RateLimiterRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    const char* phaseNames[] = { "non-blocking", "blocking" };
+    for (LONG blocking = 0; blocking <= 1; blocking++) {
+
+        m_limiter.Reset(m_rate, m_burst);
+        m_blocking = blocking;
+        m_stop     = 0;
+
+        AlignedArray<WorkerStats> stats(m_totalThreads); // zeroed
+        if (!stats.isValid())
+            return ERR_STD;
+        std::vector<HANDLE> workers;
+
+        Stopwatch sw;
+        bool created = StartThreads(&RateLimitedThreadFunction, &stats[0], sizeof(WorkerStats),
+                                    m_totalThreads, workers);
+        Wait(m_phaseMs);
+        ::InterlockedExchange(&m_stop, 1);
+        ret = JoinThreads(workers);
+        const double elapsedSec = sw.ElapsedNs() / 1e9;
+
+        if (!created)
+            return ERR_API;
+        if (ret != RET_OK)
+            return ret;
+
+        WorkerStats total = { 0, 0, 0 };
+        ULONGLONG minGranted = stats[0].granted, maxGranted = stats[0].granted;
+        for (size_t i = 0; i < stats.size(); i++) {
+            total.granted   += stats[i].granted;
+            total.attempts  += stats[i].attempts;
+            total.acquireNs += stats[i].acquireNs;
+            minGranted = std::min(minGranted, stats[i].granted);
+            maxGranted = std::max(maxGranted, stats[i].granted);
+        }
+
+        // the initial burst is allowed above the rate
+        const double expected = m_rate * elapsedSec + m_burst;
+        stringstream ss;
+        ss << endl << "Rate limiter, " << phaseNames[blocking] << " acquire, "
+           << m_totalThreads << " threads, " << m_rate << " ops/sec, burst " << m_burst << endl
+           << "  achieved rate: " << total.granted / elapsedSec << " ops/sec, "
+           << 100.0 * total.granted / expected << "% of expected" << endl
+           << "  granted per thread: min " << minGranted << " max " << maxGranted << endl
+           << "  acquire calls: " << total.attempts;
+        if (!blocking) // the cost of the call itself under contention
+            ss << ", avg " << total.acquireNs / std::max<ULONGLONG>(total.attempts, 1) << " ns";
+        Print(ss.str().c_str());
+    }
+    return RET_OK;
+}
+
+bool ElasticConsumerRunner::AddConsumer(ConsumerSlot& slot) {
+    memset(&slot, 0, sizeof(ConsumerSlot));
+    slot.hThread = (HANDLE) _beginthreadex(NULL, 0, &Consumer, &slot, 0, NULL);
+    return slot.hThread != 0;
+}
+
+int ElasticConsumerRunner::RetireConsumer(ConsumerSlot& slot) {
+    ::InterlockedExchange(&slot.retire, 1);
+    ::SetEvent(m_hItems); // do not wait for the empty buffer timeout
+
+    DWORD code = ERR_SYNC;
+    if (::WaitForSingleObject(slot.hThread, INFINITE) != WAIT_OBJECT_0)
+        code = ERR_API;
+    else
+        ::GetExitCodeThread(slot.hThread, &code);
+    ::CloseHandle(slot.hThread);
+    slot.hThread = 0;
+    return static_cast<int>(code);
+}
+
+// the primary thread is the controller of the consumer pool
+int ElasticConsumerRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    {
+        Lock lock(m_cs);
+        while (!g_msgs.empty()) // left by the previous runs
+            g_msgs.pop();
+        SampleDepth();
+    }
+    m_stallUs = 0;
+    ::InterlockedExchange(&m_phase, SP_RUN);
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    ConsumerSlot slots[m_maxConsumers];
+    LONG         lastBusyUs[m_maxConsumers] = { 0 };
+    unsigned     active = 0;
+
+    HANDLE hProducer = (HANDLE) _beginthreadex(NULL, 0, &Producer, NULL, 0, NULL);
+    if (hProducer == 0)
+        return ERR_API;
+    if (AddConsumer(slots[0]))
+        active++;
+
+    std::vector<ScalingEvent> events;
+    LONG     consumed    = 0;   // by retired consumers
+    unsigned peak        = active;
+    unsigned highSamples = 0;
+    double   consumerSec = 0;   // integral of the pool size
+    double   prevMs      = 0;
+    double   lastScaleMs = -1.0 * m_cooldownMs;
+    double   idleSinceMs = -1;  // no idle period
+    Stopwatch sw;
+
+    while (active > 0) {
+        Wait(m_controlMs);
+        const double nowMs = sw.ElapsedNs() / 1e6;
+
+        unsigned depth = 0;
+        {
+            Lock lock(m_cs);
+            depth = static_cast<unsigned>(g_msgs.size());
+        }
+
+        LONG busyUs = 0;
+        bool failed = false;
+        for (unsigned i = 0; i < active; i++) {
+            LONG cur = slots[i].busyUs;
+            busyUs += cur - lastBusyUs[i];
+            lastBusyUs[i] = cur;
+            if (::WaitForSingleObject(slots[i].hThread, 0) != WAIT_TIMEOUT)
+                failed = true; // consumer exited by itself: error
+        }
+        const double   intervalUs = (nowMs - prevMs) * 1000 * active;
+        const unsigned utilPct    = intervalUs > 0 ? static_cast<unsigned>(100 * busyUs / intervalUs) : 0;
+        consumerSec += active * (nowMs - prevMs) / 1000;
+        prevMs = nowMs;
+
+        const bool producerDone = ::WaitForSingleObject(hProducer, 0) == WAIT_OBJECT_0;
+        if (failed || syncTimer.State() != ST_WORK || (producerDone && depth == 0))
+            break;
+
+        highSamples = (depth >= m_highWater) ? highSamples + 1 : 0;
+        if (depth == 0 && utilPct < m_lowUtilPct) {
+            if (idleSinceMs < 0)
+                idleSinceMs = nowMs;
+        } else {
+            idleSinceMs = -1;
+        }
+
+        if (nowMs - lastScaleMs < m_cooldownMs)
+            continue;
+
+        bool up = false;
+        if (highSamples >= m_upSamples && active < m_maxConsumers) {
+            up = true;
+            if (!AddConsumer(slots[active])) {
+                ret = ERR_API;
+                break;
+            }
+            lastBusyUs[active] = 0;
+            active++;
+        } else if (idleSinceMs >= 0 && nowMs - idleSinceMs >= m_idleMs && active > m_minConsumers) {
+            active--;
+            consumed += slots[active].consumed;
+            int code = RetireConsumer(slots[active]);
+            if (code != RET_OK) {
+                ret = code;
+                break;
+            }
+            idleSinceMs = nowMs; // the next one needs its own idle period
+        } else {
+            continue;
+        }
+
+        ScalingEvent e = { nowMs / 1000, up, depth, utilPct, active };
+        events.push_back(e);
+        peak = std::max(peak, active);
+        lastScaleMs = nowMs;
+        highSamples = 0;
+        Print(e.up ? "Elastic: consumer added, consumers: " : "Elastic: consumer retired, consumers: ",
+              active);
+    }
+
+    // timeout: the producer stops the intake, the pool drains the buffer until it is empty
+    // or the grace deadline passes, then the consumers are stopped after the current item
+    size_t backlog = 0;
+    double drainMs = 0;
+    bool   forced  = false;
+    if (ret == RET_OK && active > 0 && syncTimer.State() == ST_STOP) {
+        ::WaitForSingleObject(hProducer, INFINITE);
+        {
+            Lock lock(m_cs);
+            backlog = g_msgs.size();
+        }
+        Stopwatch drainSw;
+        ::InterlockedExchange(&m_phase, SP_DRAIN);
+        ::SetEvent(m_hItems); // the others see the phase by their empty buffer timeout
+
+        HANDLE hConsumers[m_maxConsumers];
+        for (unsigned i = 0; i < active; i++)
+            hConsumers[i] = slots[i].hThread;
+        DWORD dwRet = ::WaitForMultipleObjects(active, hConsumers, TRUE, m_drainMs);
+        forced = (dwRet == WAIT_TIMEOUT);
+        if (forced)
+            ::InterlockedExchange(&m_phase, SP_STOP);
+        else if (dwRet == WAIT_FAILED)
+            ret = ERR_API;
+        drainMs = drainSw.ElapsedNs() / 1e6;
+    }
+
+    // all produced items are consumed, the buffer is drained or an error occurred
+    while (active > 0) {
+        active--;
+        consumed += slots[active].consumed;
+        int code = RetireConsumer(slots[active]);
+        if (ret == RET_OK)
+            ret = code;
+    }
+    ::WaitForSingleObject(hProducer, INFINITE);
+    DWORD code = 0;
+    ::GetExitCodeThread(hProducer, &code);
+    ::CloseHandle(hProducer);
+    if (ret == RET_OK && code != RET_OK)
+        ret = ERR_SYNC;
+    if (syncTimer.State() == ST_STOP)
+        ReportDrain(backlog, drainMs, forced);
+
+    unsigned ups = 0;
+    stringstream ss;
+    ss << endl << "Elastic consumer pool scaling events:" << endl;
+    for (size_t i = 0; i < events.size(); i++) {
+        const ScalingEvent& e = events[i];
+        ups += e.up ? 1 : 0;
+        ss << "  " << e.timeSec << " s: " << (e.up ? "up  " : "down") << " to " << e.consumers
+           << " consumers, depth " << e.depth << ", utilisation " << e.utilPct << "%" << endl;
+    }
+    ss << "Scaled up " << ups << " times, down " << events.size() - ups << " times, peak "
+       << peak << " consumers, average " << (prevMs > 0 ? consumerSec * 1000 / prevMs : 0) << endl
+       << "Consumed " << consumed << " items, producer stalled on full buffer "
+       << m_stallUs / 1000 << " ms";
+    Print(ss.str().c_str());
+
+    return ret;
+}
+
+int PubSubRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    struct GroupConfig {
+        const char* topic;
+        const char* group;
+        unsigned    subscribers;
+        DWORD       workMs;
+    };
+    const GroupConfig config[] = {
+        { "quotes", "display",    1, 1 },
+        { "quotes", "analytics",  2, 2 },
+        { "trades", "settlement", 2, 2 },
+        { "trades", "audit",      1, 5 }  // slow: backpressure to the trades publisher
+    };
+    const unsigned groups = sizeof(config) / sizeof(config[0]);
+
+    Broker broker;
+    unsigned totalSubscribers = 0;
+    for (unsigned g = 0; g < groups; g++)
+        totalSubscribers += config[g].subscribers;
+
+    AlignedArray<SubscriberArgs> subArgs(totalSubscribers);
+    if (!subArgs.isValid())
+        return ERR_STD;
+    for (unsigned g = 0, k = 0; g < groups; g++) {
+        SubscriberGroup* group = broker.Subscribe(config[g].topic, config[g].group, m_queueSize);
+        if (group == NULL)
+            return ERR_API;
+        for (unsigned c = 0; c < config[g].subscribers; c++, k++) {
+            subArgs[k].group  = group;
+            subArgs[k].workMs = config[g].workMs;
+        }
+    }
+
+    PublisherArgs pubArgs[] = {
+        { &broker, "quotes", 1, 0 },
+        { &broker, "trades", 1000001, 0 }
+    };
+    const unsigned publishers = sizeof(pubArgs) / sizeof(pubArgs[0]);
+
+    std::vector<HANDLE> subThreads, pubThreads;
+    bool created = StartThreads(&Subscriber, &subArgs[0], sizeof(SubscriberArgs), totalSubscribers,
+                                subThreads) &&
+                   StartThreads(&Publisher, pubArgs, sizeof(PublisherArgs), publishers, pubThreads);
+
+    ret = JoinThreads(pubThreads);
+
+    // invalid reference stops one subscriber of the group
+    for (unsigned k = 0; k < subThreads.size(); k++)
+        if (!subArgs[k].group->Push(MessageRef(), m_queueTimeout))
+            ret = ERR_SYNC;
+
+    int subRet = JoinThreads(subThreads);
+    if (!created)
+        return ERR_API;
+    if (ret != RET_OK)
+        return ret;
+    if (subRet != RET_OK)
+        return subRet;
+
+    ULONG deliveries = 0;
+    stringstream ss;
+    ss << endl << "Publish/subscribe: " << publishers << " topics, " << groups << " groups, "
+       << totalSubscribers << " subscribers, payload " << m_payloadSize << " bytes" << endl;
+    for (unsigned g = 0, k = 0; g < groups; g++) {
+        ULONG  received  = 0;
+        double latencyUs = 0;
+        for (unsigned c = 0; c < config[g].subscribers; c++, k++) {
+            received  += subArgs[k].received;
+            latencyUs += subArgs[k].latencyUs;
+        }
+        deliveries += received;
+        ss << "  " << config[g].topic << " -> " << config[g].group << ": "
+           << config[g].subscribers << " subscribers, " << received << " received, latency avg "
+           << (received > 0 ? latencyUs / received : 0) << " us, publisher stalls "
+           << subArgs[k - 1].group->Stalls() << endl;
+    }
+
+    // every delivery of a message beyond the first one shares its payload
+    ULONG published = 0;
+    for (unsigned p = 0; p < publishers; p++)
+        published += pubArgs[p].published;
+    ss << "Deliveries: " << deliveries << ", payload copies avoided: "
+       << (deliveries > published ? deliveries - published : 0);
+    Print(ss.str().c_str());
+
+    return RET_OK;
+}
+
+int FlatCombiningRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    stringstream ss;
+    ss << endl << "Shared queue, millions of push/pop pairs per second, " << m_pairs
+       << " pairs per thread" << endl;
+
+    for (unsigned threads = m_minThreads; threads <= m_maxThreads; threads *= 2) {
+
+        CSQueue            csQueue(m_queueSize);
+        MutexQueue         mutexQueue(m_queueSize);
+        MSQueue            msQueue(threads); // lock-free FIFO as the others
+        FlatCombiningQueue fcQueue(m_queueSize, threads);
+        SharedQueue* queues[] = { &csQueue, &mutexQueue, &msQueue, &fcQueue };
+        const unsigned variants = sizeof(queues) / sizeof(queues[0]);
+
+        ss << "  " << threads << " threads:";
+        for (unsigned v = 0; v < variants; v++) {
+            if (!queues[v]->isValid())
+                return ERR_API;
+
+            double pairsPerSec = 0;
+            ret = Measure(*queues[v], threads, pairsPerSec);
+            if (ret != RET_OK)
+                return ret;
+            ss << (v == 0 ? " " : ", ") << queues[v]->Name() << " " << pairsPerSec / 1e6;
+        }
+        ss << " (" << fcQueue.RequestsPerPass() << " requests per combining pass)" << endl;
+    }
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+// all threads start together, each variant has its own timeout
+int FlatCombiningRunner::Measure(SharedQueue& queue, unsigned threads, double& pairsPerSec) const {
+
+    int ret = InitTimer();
+    if (ret != RET_OK)
+        return ret;
+
+    HandleWrapper hStart( ::CreateEvent(NULL, TRUE, FALSE, NULL) );
+    if (!hStart.isValid())
+        return ERR_API;
+
+    AlignedArray<WorkerArgs> args(threads); // zeroed
+    if (!args.isValid())
+        return ERR_STD;
+    for (unsigned i = 0; i < threads; i++) {
+        args[i].queue  = &queue;
+        args[i].slot   = i;
+        args[i].hStart = hStart;
+    }
+
+    std::vector<HANDLE> workers;
+    bool created = StartThreads(&Worker, &args[0], sizeof(WorkerArgs), threads, workers);
+    Stopwatch sw;
+    ::SetEvent(hStart); // also releases created threads if some creation failed
+    ret = JoinThreads(workers);
+    const double elapsedSec = sw.ElapsedNs() / 1e9;
+
+    if (!created)
+        return ERR_API;
+    if (ret != RET_OK)
+        return ret;
+
+    ULONGLONG pairs = 0;
+    for (unsigned i = 0; i < threads; i++)
+        pairs += args[i].pairs;
+    pairsPerSec = pairs / elapsedSec;
+    return RET_OK;
+}
+
+int UnboundedQueueRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    MSQueue queue(m_producers + m_consumers);
+    if (!queue.isValid())
+        return ERR_STD;
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    stringstream ss;
+    ss << endl << "Unbounded lock-free queue, " << m_producers << " producers, " << m_consumers
+       << " slower consumers" << endl;
+
+    for (unsigned cycle = 1; cycle <= m_cycles; cycle++) {
+
+        AlignedArray<WorkerArgs> args(m_producers + m_consumers); // zeroed
+        if (!args.isValid())
+            return ERR_STD;
+        for (unsigned i = 0; i < args.size(); i++) {
+            args[i].queue = &queue;
+            args[i].slot  = i;
+        }
+        WorkerArgs* prodArgs = &args[0];
+        WorkerArgs* consArgs = &args[m_producers];
+
+        MSQueueFootprint before;
+        queue.GetFootprint(before);
+        m_stopProducers = 0;
+        m_stopConsumers = 0;
+
+        std::vector<HANDLE> producers, consumers;
+        bool created = StartThreads(&Consumer, consArgs, sizeof(WorkerArgs), m_consumers, consumers) &&
+                       StartThreads(&Producer, prodArgs, sizeof(WorkerArgs), m_producers, producers);
+
+        // backlog is the difference of the counters of the threads, no shared counter
+        ULONGLONG pushed = 0, popped = 0, peakBacklog = 0;
+        Stopwatch sw;
+        while (created && sw.ElapsedNs() < m_imbalanceMs * 1e6) {
+            Wait(m_sampleMs);
+            pushed = popped = 0;
+            for (unsigned i = 0; i < m_producers; i++)
+                pushed += prodArgs[i].items;
+            for (unsigned i = 0; i < m_consumers; i++)
+                popped += consArgs[i].items;
+            peakBacklog = std::max(peakBacklog, pushed - std::min(pushed, popped));
+        }
+        const double produceSec = sw.ElapsedNs() / 1e9;
+
+        ::InterlockedExchange(&m_stopProducers, 1);
+        ret = JoinThreads(producers);
+        pushed = 0;
+        for (unsigned i = 0; i < m_producers; i++)
+            pushed += prodArgs[i].items;
+
+        // drain: consumers exit when the queue is empty after the producers have stopped
+        ::InterlockedExchange(&m_stopConsumers, 1);
+        int consRet = JoinThreads(consumers);
+        const double totalSec = sw.ElapsedNs() / 1e9;
+        popped = 0;
+        for (unsigned i = 0; i < m_consumers; i++)
+            popped += consArgs[i].items;
+
+        if (!created)
+            return ERR_API;
+        if (ret != RET_OK || consRet != RET_OK)
+            return ret != RET_OK ? ret : consRet;
+
+        MSQueueFootprint after;
+        queue.GetFootprint(after);
+        ss << "  cycle " << cycle << ": pushed " << pushed << " (" << pushed / produceSec
+           << " items/sec), popped " << popped << " (" << popped / totalSec << " items/sec)" << endl
+           << "    peak backlog " << peakBacklog << " items, drained in "
+           << (totalSec - produceSec) * 1000 << " ms" << endl
+           << "    node blocks allocated " << after.chunks - before.chunks << ", footprint "
+           << after.bytes / 1024 << " KB (" << after.nodes << " nodes, "
+           << after.retired << " retired)" << endl;
+
+        if (syncTimer.State() != ST_WORK)
+            break;
+    }
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+int OpenLoopRunner::RunStep(double rate, LoadStepResult& result) const {
+
+    const double items = std::min<double>(m_maxStepItems, std::max(1.0, rate * m_stepMs / 1000));
+    StepArgs args;
+    args.rate = rate;
+    args.intendedNs.resize(static_cast<size_t>(items));
+    args.sentNs.resize(args.intendedNs.size());
+    args.doneNs.resize(args.intendedNs.size());
+
+    Stopwatch clock; // the schedule starts now
+    args.clock = &clock;
+    std::vector<HANDLE> threads;
+    bool created = StartThreads(&Producer, &args, 0, 1, threads) &&
+                   StartThreads(&Consumer, &args, 0, 1, threads);
+    if (created)
+        PlaceThreads(&threads[0], 2);
+    int ret = JoinThreads(threads);
+    if (!created)
+        return ERR_API;
+    if (ret != RET_OK)
+        return ret;
+
+    result.Compute(rate, args.intendedNs, args.sentNs, args.doneNs, m_maxP99Us);
+    stringstream ss;
+    result.Print(ss);
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+int OpenLoopRunner::RunThreads() const {
+
+    int ret = Init();
+    if (ret != RET_OK)
+        return ret;
+
+    const SyncType syncTypes[] = { CS, CS_EVENT, MUTEX, SEMAPHORE };
+    const char* syncNames[]    = { "Critical sections", "Critical sections and events",
+                                   "Mutex and events", "Semaphores" };
+
+    for (size_t t = 0; t < sizeof(syncTypes) / sizeof(syncTypes[0]); t++) {
+
+        ret = m_queue.Init(syncTypes[t]);
+        if (ret != RET_OK)
+            return ret;
+
+        stringstream ss;
+        ss << endl << "Open-loop load, " << ArrivalName(m_arrival) << " arrivals: " << syncNames[t];
+        Print(ss.str().c_str());
+
+        // doubling finds the first rate which is not kept, bisection refines it
+        double sustained = 0, saturated = 0, throughput = 0;
+        for (double rate = m_startRate; rate <= m_maxRate && saturated == 0; rate *= 2) {
+            LoadStepResult result;
+            ret = RunStep(rate, result);
+            if (ret != RET_OK)
+                return ret;
+            if (result.sustained) {
+                sustained  = rate;
+                throughput = std::max(throughput, result.achievedRate);
+            } else {
+                saturated  = rate;
+            }
+        }
+        for (unsigned i = 0; i < m_refineSteps && sustained > 0 && saturated > 0; i++) {
+            const double rate = (sustained + saturated) / 2;
+            LoadStepResult result;
+            ret = RunStep(rate, result);
+            if (ret != RET_OK)
+                return ret;
+            if (result.sustained) {
+                sustained  = rate;
+                throughput = std::max(throughput, result.achievedRate);
+            } else {
+                saturated  = rate;
+            }
+        }
+
+        ss.str("");
+        if (saturated == 0)
+            ss << "  saturation throughput is above " << m_maxRate << " items/sec";
+        else if (sustained == 0)
+            ss << "  saturated below " << m_startRate << " items/sec";
+        else
+            ss << "  saturation throughput " << throughput << " items/sec";
+        Print(ss.str().c_str());
+    }
+    return RET_OK;
+}
+
+static unsigned long Difference(unsigned long from, unsigned long to) { // of wrapping counters
+    return to - from;
+}
+
+void SoakRunner::Report(const Sample& from, const Sample& to, const LatencyHistogram& latency,
+                        unsigned long depth, unsigned long maxDepth) {
+    const double seconds = (to.elapsedNs - from.elapsedNs) / 1e9;
+    stringstream ss;
+    ss << "  " << static_cast<unsigned>(to.elapsedNs / 1e9) << " s: "
+       << static_cast<unsigned long>(Difference(from.consumed, to.consumed) / seconds) << " items/s"
+       << ", latency us p50 " << latency.PercentileUs(0.5) << " p99 " << latency.PercentileUs(0.99)
+       << " p99.9 " << latency.PercentileUs(0.999) << " max " << latency.MaxUs()
+       << ", queue " << depth << " (max " << maxDepth << ")"
+       << ", working set " << to.memory.workingSetBytes / 1024 << " KB"
+       << ", private " << to.memory.privateBytes / 1024 << " KB"
+       << ", allocations " << static_cast<unsigned long>(
+              Difference(from.memory.allocations, to.memory.allocations) / seconds) << "/s"
+       << ", live blocks " << static_cast<LONG>(Difference(to.memory.frees, to.memory.allocations));
+    Print(ss.str().c_str());
+}
+
+void SoakRunner::Summary(const Sample& first, const Sample& firstEnd, const Sample& last,
+                         const Sample& lastEnd) {
+    const double firstRate = Difference(first.consumed, firstEnd.consumed) * 1e9 /
+                             (firstEnd.elapsedNs - first.elapsedNs);
+    const double lastRate  = Difference(last.consumed, lastEnd.consumed) * 1e9 /
+                             (lastEnd.elapsedNs - last.elapsedNs);
+    stringstream ss;
+    ss << "Soak, the first and the last interval: throughput "
+       << static_cast<unsigned long>(firstRate) << " -> " << static_cast<unsigned long>(lastRate)
+       << " items/s (" << (firstRate > 0 ? (lastRate - firstRate) * 100 / firstRate : 0) << "%)"
+       << ", working set " << firstEnd.memory.workingSetBytes / 1024 << " -> "
+       << lastEnd.memory.workingSetBytes / 1024 << " KB"
+       << ", private " << firstEnd.memory.privateBytes / 1024 << " -> "
+       << lastEnd.memory.privateBytes / 1024 << " KB"
+       << ", live blocks " << static_cast<LONG>(Difference(firstEnd.memory.frees, firstEnd.memory.allocations))
+       << " -> " << static_cast<LONG>(Difference(lastEnd.memory.frees, lastEnd.memory.allocations));
+    Print(ss.str().c_str());
+}
+
+int SoakRunner::RunThreads() const {
+
+    // the run lasts m_durationMin instead of the default interval
+    int ret = InitTimer(-static_cast<long long>(m_durationMin) * 60 * 10000000);
+    if (ret == RET_OK)
+        ret = InitSyncObjects();
+    if (ret != RET_OK)
+        return ret;
+
+    stringstream ss;
+    ss << endl << "Soak: critical sections and events queue for " << m_durationMin
+       << " min, stats every " << m_intervalSec << " s";
+    Print(ss.str().c_str());
+
+    m_produced = m_consumed = 0;
+    {
+        Lock lock(m_latencyCs);
+        m_latency.Reset();
+    }
+    m_clock.Start();
+    Sample prev = { 0, 0 };
+    ReadMemoryCounts(prev.memory);
+
+    std::vector<HANDLE> threads;
+    bool created = StartThreads(&Producer, NULL, 0, 1, threads) &&
+                   StartThreads(&Consumer, NULL, 0, 1, threads);
+    if (!created) {
+        InitTimer(-1); // stops the started thread at once
+        JoinThreads(threads);
+        return ERR_API;
+    }
+    PlaceThreads(&threads[0], 2);
+
+    const SyncTimer& syncTimer = SyncTimer::Instance();
+    const double intervalNs = m_intervalSec * 1e9;
+    double   nextNs    = intervalNs;
+    unsigned intervals = 0;
+    unsigned long maxDepth = 0;
+    Sample first, firstEnd, last, lastEnd;
+    while (syncTimer.State() == ST_WORK) {
+        ::Sleep(m_pollMs);
+        const LONG consumed = m_consumed; // the consumer may count an item before the producer
+        const LONG depth = static_cast<LONG>(Difference(consumed, m_produced));
+        const unsigned long depthNow = depth > 0 ? depth : 0;
+        maxDepth = std::max(maxDepth, depthNow);
+        if (m_clock.ElapsedNs() < nextNs)
+            continue;
+
+        Sample now;
+        now.elapsedNs = m_clock.ElapsedNs();
+        now.consumed  = m_consumed;
+        ReadMemoryCounts(now.memory);
+        LatencyHistogram latency;
+        {
+            Lock lock(m_latencyCs);
+            latency = m_latency;
+            m_latency.Reset();
+        }
+        Report(prev, now, latency, depthNow, maxDepth);
+
+        if (intervals++ == 0) {
+            first    = prev;
+            firstEnd = now;
+        }
+        last     = prev;
+        lastEnd  = now;
+        prev     = now;
+        maxDepth = 0;
+        nextNs  += intervalNs;
+    }
+
+    ret = JoinThreads(threads);
+    if (intervals > 1)
+        Summary(first, firstEnd, last, lastEnd);
+    return ret;
+}
+
+int ProducerConsumerBatchRunner::RunThreads() const {
+
+    memset(&m_totals, 0, sizeof(m_totals));
+    stringstream ss;
+    ss << "Batch consumer: up to " << m_maxBatch << " items of " << RECORD_WORDS
+       << " words, kernel " << KernelLevelName(SupportedKernelLevel(m_kernel))
+       << " (best: " << KernelLevelName(BestKernelLevel()) << ")";
+    Print(ss.str().c_str());
+
+    int ret = ProducerConsumerRunner::RunThreads();
+
+    stringstream report; // the consumer has exited
+    report << "Batch consumer: " << m_totals.items << " items in " << m_totals.batches << " batches";
+    if (m_totals.batches > 0)
+        report << ", " << static_cast<double>(m_totals.items) / m_totals.batches << " per batch, kernel "
+               << m_totals.kernelNs / m_totals.items << " ns per item";
+    report << ", selected " << m_totals.selected << " of " << m_totals.items * RECORD_WORDS
+           << " words, sum " << m_totals.sum << ", checksum " << std::hex << m_totals.checksum;
+    Print(report.str().c_str());
+    return ret;
+}
+
+// Not timed by the sync timer: the job ends when all items are processed
+int WorkStackRunner::RunThreads() const {
+
+    stringstream ss;
+    ss << endl << "Bulk job: backlog of " << BulkJob::m_backlog << " items of "
+       << BulkJob::m_payloadBytes << " bytes, then " << BulkJob::m_items
+       << " items made and processed by each worker in bursts of " << BulkJob::m_burst << endl
+       << "thousands of items per second, payload read ns per item" << endl;
+
+    for (unsigned workers = 1; workers <= m_maxWorkers; workers *= 2) {
+        BulkJob job(workers);
+        CSQueue          fifo(BulkJob::Capacity(workers));
+        TreiberStack     lifo(BulkJob::Capacity(workers));
+        WorkStealingPool hybrid(BulkJob::Capacity(workers), workers);
+        SharedQueue* dispatches[] = { &fifo, &lifo, &hybrid };
+        const unsigned variants = sizeof(dispatches) / sizeof(dispatches[0]);
+        if (!job.isValid())
+            return ERR_STD;
+
+        ss << "  " << workers << (workers == 1 ? " worker:" : " workers:");
+        for (unsigned v = 0; v < variants; v++) {
+            if (!dispatches[v]->isValid())
+                return ERR_API;
+
+            BulkJobResult result;
+            int ret = job.Run(*dispatches[v], result);
+            if (ret != RET_OK)
+                return ret;
+            ss << (v == 0 ? " " : ", ") << dispatches[v]->Name() << " " << result.itemsPerSec / 1e3
+               << " (" << result.readNsPerItem << " ns)";
+        }
+        ss << ", " << hybrid.Steals() << " steals" << endl;
+    }
+    Print(ss.str().c_str());
+    return RET_OK;
+}
+
+} // namespace MT
@@ -1,132 +1,668 @@
-#pragma once
-
-namespace MT { 
-
-class ThreadRunner {
-public:
-    static const long long m_defInterval   = -160000000LL; // 16 seconds
-    static int InitTimer(long long interval= m_defInterval);
-
-    int Init() const;
-    virtual int RunThreads() const =0;
-    virtual int InitSyncObjects() const =0;
-
-    // common helpers
-    static void Wait(int ms) {
-        ::Sleep(ms);
-    }
-    static void Produce(int ms = rand()%10 * 50) {
-        Wait(ms);
-    }
-
-    // protected by lock to synchronise output
-    static void Print(const char* msg) {
-        Lock lock(m_cout_cs);
-        cout << msg << endl;
-    }
-    static void Print(const char* msg, int value) {
-        Lock lock(m_cout_cs);
-        cout << msg << value << endl;
-    }
-
-    static void PutThreadFinishMsg(const char* msg, unsigned int timeout=0) {
-        Lock lock(m_cout_cs);
-        cout << endl << msg;
-        if (timeout != 0)
-            cout << timeout << " sec.";
-        cout << " Thread Id: " << ::GetCurrentThreadId() << endl << endl;
-    }
-
-private:
-    static CriticalSection m_cout_cs;
-};
-
-class  ThreadRunnerCreator {  // Factory Method GOF Pattern
-public:
-    static ThreadRunner* Create(SyncType syncType);
-};
-
-// mutlithreaded access to shared read/write memory: producer-consumer problem
-
-class ProducerConsumerRunner : public ThreadRunner {
-public:
-    static void Consume(int msg) { // consume item #msg
-        int ms = rand()%14 * 50;
-        Wait(ms);
-    }
-    static const unsigned m_maxTasks     = 30; // number of tasks to produce (model empty buffer condition)
-
-    virtual int RunThreads() const;
-    virtual int InitSyncObjects() const = 0;
-    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const = 0;
-    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const = 0;
-
-private:
-    static const unsigned m_totalThreads = 2;  // producer and consumer
-
-};
-
-// only locking shared memory with Critical Sections
-class ProducerConsumerCSRunner : public ProducerConsumerRunner {
-public:
-    static THREAD_FUNCTION Producer;
-    static THREAD_FUNCTION Consumer;
-
-    virtual int InitSyncObjects() const {
-        return RET_OK;
-    }
-    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
-        return &Producer;
-    }
-    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
-        return &Consumer;
-    }
-};
-
-// using Events for synchronisation
-class ProducerConsumerEventRunner : public ProducerConsumerRunner {
-public:
-    static THREAD_FUNCTION Producer;
-    static THREAD_FUNCTION Consumer;
-
-    virtual int InitSyncObjects() const ;
-    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
-        return &Producer;
-    }
-    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
-        return &Consumer;
-    }
-};
-
-// using Mutex for synchronisation
-class ProducerConsumerMutexRunner : public ProducerConsumerRunner {
-public:
-    static THREAD_FUNCTION Producer;
-    static THREAD_FUNCTION Consumer;
-
-    virtual int InitSyncObjects() const;
-    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
-        return &Producer;
-    }
-    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
-        return &Consumer;
-    }
-};
-
-class SemaphoreRunner : public ThreadRunner { // sample usage of Semaphore
-public:
-    static const int defTotalThreads = 3;
-    static THREAD_FUNCTION SemaphoreThreadFunction;
-
-    SemaphoreRunner(int totalThreads=defTotalThreads) : m_totalThreads(totalThreads),
-        m_semInitCount(m_totalThreads-1) { // initialisation in the order of declaration
-    }
-    virtual int RunThreads() const;
-    virtual int InitSyncObjects() const;
-
-private:
-    const int  m_totalThreads;
-    const long m_semInitCount; // initial semaphore object counter
-};
-
-} // namespace MT
+#pragma once
+
+#include <climits>
+#include "filesink.h"
+#include "journal.h"
+#include "future.h"
+#include "ratelimiter.h"
+#include "perfcounters.h"
+#include "pubsub.h"
+#include "combining.h"
+#include "msqueue.h"
+#include "topology.h"
+#include "waitstrategy.h"
+#include "loadgen.h"
+#include "workload.h"
+#include "memstats.h"
+#include "batchkernel.h"
+#include "workstack.h"
+
+namespace MT { 
+
+class ThreadRunner {
+public:
+    static const long long m_defInterval   = -160000000LL; // 16 seconds
+    static int InitTimer(long long interval= m_defInterval);
+
+    // placement of the producer and consumer threads (topology.h), set from the command line
+    static Placement m_placement;
+    static void PlaceThreads(const HANDLE* threadHandles, unsigned count);
+
+    // how the producer and consumer threads wait for the buffer, set from the command line
+    static WaitStrategy m_wait;
+    static void PrintWaitStrategy(std::ostream& out);
+
+    // arrivals of the produced items: replayed from a trace instead of the imitated work,
+    // and recorded to a trace (workload.h), set from the command line
+    static WorkloadReplay   m_replay;
+    static WorkloadRecorder m_recorder;
+
+    int Init() const;
+    virtual int RunThreads() const =0;
+    virtual int InitSyncObjects() const =0;
+
+    // common helpers
+    static void Wait(int ms) {
+        ::Sleep(ms);
+    }
+    static void Produce(int ms = rand()%10 * 50) { // imitates work
+        TraceScope scope(TE_PRODUCE);
+        Wait(ms);
+    }
+    // once per produced item, before it is pushed: waits for the arrival of the next item of
+    // the replayed trace instead of the imitated work, false if the trace is over
+    static bool Arrive(WorkloadRecord& item, int ms = rand()%10 * 50) {
+        const WorkloadRecord imitated = { 0, sizeof(int), 0, 0 };
+        item = imitated;
+        if (m_replay.isEnabled()) {
+            TraceScope scope(TE_PRODUCE);
+            return m_replay.Produce(item);
+        }
+        Produce(ms);
+        return true;
+    }
+    // items a producer sends: its count, or as many as the replayed trace has (it ends the
+    // run by Arrive(), a looped one by the timeout)
+    static int ItemCount(int count) {
+        return m_replay.isEnabled() ? INT_MAX : count;
+    }
+    static void Record(const WorkloadRecord& item) { // once per pushed item
+        if (m_recorder.isEnabled())
+            m_recorder.Append(item.size, item.priority);
+    }
+
+    // console output of the threads goes through the logger service
+    static void Print(const char* msg) {
+        Logger::Instance().Print(msg);
+    }
+    static void Print(const char* msg, int value) {
+        Logger::Instance().Print(msg, value);
+    }
+    static void PutThreadFinishMsg(const char* msg, unsigned int timeout=0) {
+        Logger::Instance().PutThreadFinishMsg(msg, timeout);
+    }
+};
+
+class  ThreadRunnerCreator {  // Factory Method GOF Pattern
+public:
+    static ThreadRunner* Create(SyncType syncType);
+};
+
+// mutlithreaded access to shared read/write memory: producer-consumer problem
+
+class ProducerConsumerRunner : public ThreadRunner {
+public:
+    static void Consume(int msg) { // consume item #msg
+        TraceScope scope(TE_CONSUME);
+        int ms = rand()%14 * 50;
+        Wait(ms);
+        Stats::Instance().Add(SC_CONSUMED);
+    }
+    static const unsigned m_maxTasks     = 30; // number of tasks to produce (model empty buffer condition)
+
+    // Shutdown phases: the timer stops the intake (producer exits), then the consumer
+    // drains the buffer until it is empty or the grace deadline passes, then it is
+    // stopped after the current item. Items left in the buffer are dropped.
+    enum ShutdownPhase { SP_RUN, SP_DRAIN, SP_STOP };
+    static const DWORD m_drainMs = 3000; // grace deadline
+    static volatile LONG m_phase;
+
+    // consumer keeps working after the timeout until the primary thread stops it
+    static SyncTimerState ConsumerState(const SyncTimer& syncTimer) {
+        if (syncTimer.State() == ST_ERR)
+            return ST_ERR;
+        return m_phase == SP_STOP ? ST_STOP : ST_WORK;
+    }
+    static bool Draining() { // nothing is produced any more: empty buffer means done
+        return m_phase == SP_DRAIN;
+    }
+
+    // Conditions of the buffer waits (m_wait). They are also true when the waiting
+    // thread is to stop, so a spinning thread does not miss the end of the run.
+    class ItemReady { // the consumer has an item
+    public:
+        ItemReady(const Queue<int>& queue, CriticalSection& cs) : m_queue(queue), m_cs(cs) {
+        }
+        bool operator()() const {
+            if (m_phase != SP_RUN)
+                return true;
+            Lock lock(m_cs);
+            return !m_queue.empty();
+        }
+    private:
+        const Queue<int>& m_queue;
+        CriticalSection&  m_cs;
+    };
+    class SlotReady { // the producer has a free slot
+    public:
+        SlotReady(const Queue<int>& queue, CriticalSection& cs) : m_queue(queue), m_cs(cs) {
+        }
+        bool operator()() const {
+            if (SyncTimer::Instance().State() != ST_WORK)
+                return true;
+            Lock lock(m_cs);
+            return !m_queue.isFull();
+        }
+    private:
+        const Queue<int>& m_queue;
+        CriticalSection&  m_cs;
+    };
+    // the buffer is guarded by a mutex: the other side is seen by the count of its signals,
+    // incremented beside the SetEvent of its auto-reset event, so the spinning thread reads
+    // memory instead of polling the event in the kernel; the event is for blocking (park)
+    class SignalReady {
+    public:
+        SignalReady(const volatile LONG& signals, LONG seen, bool consumer) :
+            m_signals(signals), m_seen(seen), m_consumer(consumer) {
+        }
+        bool operator()() const {
+            if (m_consumer ? m_phase != SP_RUN : SyncTimer::Instance().State() != ST_WORK)
+                return true;
+            return m_signals != m_seen;
+        }
+    private:
+        const volatile LONG& m_signals;
+        const LONG           m_seen; // read under the mutex when the buffer was checked
+        bool                 m_consumer;
+    };
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const = 0;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const = 0;
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const = 0;
+
+    virtual void   WakeConsumer() const { // consumer waiting for items is to see the drain phase
+    }
+    virtual size_t Backlog() const;       // items not consumed yet
+    virtual size_t DropBacklog() const;   // called when all threads have exited, returns dropped items
+
+    // depth of g_msgs for the stats page (Stats::SetQueueDepth), called after each push and
+    // pop under the lock of the buffer
+    static void SampleDepth();
+
+    // drops the items left when all threads have exited and prints the drain of the buffer
+    void ReportDrain(size_t backlog, double drainMs, bool forced) const;
+
+private:
+    static const unsigned m_totalThreads = 2;  // producer and consumer
+
+    DWORD Shutdown(HANDLE hProducer, HANDLE hConsumer) const; // WAIT_FAILED if a wait failed
+
+};
+
+// only locking shared memory with Critical Sections
+class ProducerConsumerCSRunner : public ProducerConsumerRunner {
+public:
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+};
+
+// using Events for synchronisation
+class ProducerConsumerEventRunner : public ProducerConsumerRunner {
+public:
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int InitSyncObjects() const ;
+    virtual void WakeConsumer() const;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+};
+
+// using Mutex for synchronisation
+class ProducerConsumerMutexRunner : public ProducerConsumerRunner {
+public:
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    // signals of g_hEmptyMutEvent and g_hFullMutEvent for the spinning threads (SignalReady)
+    static volatile LONG m_emptySignals;
+    static volatile LONG m_fullSignals;
+    static void Signal(HANDLE hEvent, volatile LONG& signals) {
+        ::InterlockedIncrement(&signals);
+        ::SetEvent(hEvent);
+    }
+
+    virtual int InitSyncObjects() const;
+    virtual void WakeConsumer() const;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+};
+
+// consumer persists received items with batched asynchronous file writes
+class ProducerConsumerFileSinkRunner : public ProducerConsumerEventRunner {
+public:
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+
+private:
+    static AsyncFileSink m_sink;
+};
+
+// persistent queue: unconsumed items survive the restart of the application
+class ProducerConsumerJournalRunner : public ProducerConsumerRunner {
+public:
+    static const unsigned m_durabilityMs = 20; // group commit interval
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+
+    virtual size_t Backlog() const {
+        return static_cast<size_t>(m_journal.Unconsumed());
+    }
+    virtual size_t DropBacklog() const { // unconsumed items are recovered by the next run
+        return 0;
+    }
+
+private:
+    static Journal m_journal;
+};
+
+// Consumers are added when the backlog builds and retired after an idle period.
+// The primary thread is the controller: each control interval it samples the queue depth
+// and utilisation of the consumers (share of time spent consuming). Hysteresis avoids
+// thrashing: scaling up needs the depth at the high water mark for several samples in
+// a row, scaling down needs empty queue and low utilisation for the whole idle period,
+// and nothing is changed within the cooldown after the previous scaling.
+// On timeout the pool drains the buffer as the producer-consumer runs do (ShutdownPhase).
+class ElasticConsumerRunner : public ProducerConsumerRunner {
+public:
+    static const unsigned m_minConsumers = 1;
+    static const unsigned m_maxConsumers = 4;
+    static const unsigned m_bursts       = 3;    // producer sends items in bursts
+    static const unsigned m_burstSize    = 20;
+    static const DWORD    m_burstPauseMs = 3000;
+    static const DWORD    m_controlMs    = 100;  // sampling interval of the controller
+    static const unsigned m_highWater    = 6;    // of 8 queue slots
+    static const unsigned m_upSamples    = 2;    // in a row at the high water mark
+    static const unsigned m_lowUtilPct   = 30;
+    static const DWORD    m_idleMs       = 2000;
+    static const DWORD    m_cooldownMs   = 500;
+
+    struct MT_CACHE_ALIGN ConsumerSlot { // busyUs is written by own consumer only
+        HANDLE        hThread;
+        volatile LONG retire;   // set by the controller
+        volatile LONG busyUs;   // time spent consuming items
+        volatile LONG consumed;
+    };
+
+    struct ScalingEvent {
+        double   timeSec;
+        bool     up;
+        unsigned depth;
+        unsigned utilPct;
+        unsigned consumers; // after the event
+    };
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const;
+    virtual THREAD_FUNCTION* GetProducerThreadFunctionPtr() const {
+        return &Producer;
+    }
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+
+private:
+    static bool AddConsumer(ConsumerSlot& slot);
+    static int  RetireConsumer(ConsumerSlot& slot); // waits for the thread to exit
+
+    static CriticalSection m_cs;      // protects g_msgs, shared by all threads
+    static HandleWrapper   m_hItems;  // auto-reset: item added
+    static HandleWrapper   m_hSpace;  // auto-reset: item removed
+    static volatile LONG   m_stallUs; // producer waiting for a free slot
+};
+
+// request/response: clients submit tasks and wait for the results fulfilled by servers
+class RequestResponseRunner : public ThreadRunner {
+public:
+    static const unsigned m_clients   = 2;
+    static const unsigned m_servers   = 2;
+    static const unsigned m_requests  = 3000; // per client and synchronisation type
+    static const unsigned m_queueSize = 8;
+    static const DWORD    m_replyTimeout = 5000; // ms
+
+    // how the client gets the result
+    enum CompletionMode { CM_WAIT, CM_POLL, CM_CONTINUATION, CM_TOTAL };
+
+    struct MT_CACHE_ALIGN ClientArgs { // written by own client thread only
+        std::vector<double> latencyUs[CM_TOTAL]; // request round trip
+    };
+
+    static THREAD_FUNCTION Client;
+    static THREAD_FUNCTION Server;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+
+private:
+    static const unsigned m_poolSize  = 64; // >= queued and outstanding tasks
+
+    static TaskPool  m_pool;
+    static TaskQueue m_queue;
+};
+
+// Publishers send messages to named topics, every topic fans out to subscriber groups
+// with own bounded queues, subscribers of a group share its load. A message is shared
+// by all groups through reference counting, not copied.
+class PubSubRunner : public ThreadRunner {
+public:
+    static const unsigned m_messages     = 300;  // per publisher
+    static const unsigned m_payloadSize  = 1024;
+    static const unsigned m_queueSize    = 8;    // of each subscriber group
+    static const DWORD    m_queueTimeout = 5000; // ms, the other side does not respond
+
+    struct PublisherArgs {
+        Broker*     broker;
+        const char* topic;
+        int         firstId;
+        ULONG       published;
+    };
+
+    struct MT_CACHE_ALIGN SubscriberArgs {
+        SubscriberGroup* group;
+        DWORD            workMs;    // imitation of message processing
+        ULONG            received;
+        double           latencyUs; // total from publishing to receiving
+    };
+
+    static THREAD_FUNCTION Publisher;
+    static THREAD_FUNCTION Subscriber;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+};
+
+class SemaphoreRunner : public ThreadRunner { // sample usage of Semaphore
+public:
+    static const int defTotalThreads = 3;
+    static THREAD_FUNCTION SemaphoreThreadFunction;
+
+    SemaphoreRunner(int totalThreads=defTotalThreads) : m_totalThreads(totalThreads),
+        m_semInitCount(m_totalThreads-1) { // initialisation in the order of declaration
+    }
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const;
+
+private:
+    const int  m_totalThreads;
+    const long m_semInitCount; // initial semaphore object counter
+};
+
+// Many worker threads limited by rate (ops/sec) instead of the number of permits.
+// Workers acquire the rate limiter blocking in one phase and non-blocking (polling)
+// in the other, achieved rate and acquire cost are reported for each phase.
+class RateLimiterRunner : public ThreadRunner {
+public:
+    static const int      defWorkers = 32;
+    static const unsigned m_rate     = 2000; // ops/sec
+    static const unsigned m_burst    = 20;
+    static const DWORD    m_phaseMs  = 3000;
+
+    struct MT_CACHE_ALIGN WorkerStats {
+        ULONGLONG granted;
+        ULONGLONG attempts;  // TryAcquire() or Acquire() calls
+        double    acquireNs; // total time of the calls
+    };
+
+    static THREAD_FUNCTION RateLimitedThreadFunction;
+
+    RateLimiterRunner(int totalThreads=defWorkers) : m_totalThreads(totalThreads) {
+    }
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+
+private:
+    const int            m_totalThreads;
+    static RateLimiter   m_limiter;
+    static volatile LONG m_blocking; // phase
+    static volatile LONG m_stop;
+};
+
+
+// Many threads push and pop items of one shared queue. FIFO queues locked by a critical
+// section and by a mutex, the lock-free Michael-Scott queue and flat combining queue are
+// compared for growing numbers of threads: with many threads a lock spends most of the
+// time passing its cache line between processors, a combiner applies the requests of
+// all threads in one pass.
+class FlatCombiningRunner : public ThreadRunner {
+public:
+    static const unsigned m_minThreads = 8;
+    static const unsigned m_maxThreads = MAXIMUM_WAIT_OBJECTS;
+    static const unsigned m_pairs      = 10000; // push/pop pairs per thread
+    static const unsigned m_queueSize  = 1024;  // more than threads: push never fails
+
+    struct MT_CACHE_ALIGN WorkerArgs { // pairs are counted on own cache line
+        SharedQueue* queue;
+        unsigned     slot;
+        HANDLE       hStart; // manual-reset event releasing all threads at once
+        ULONG        pairs;  // output
+    };
+
+    static THREAD_FUNCTION Worker;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+
+private:
+    int Measure(SharedQueue& queue, unsigned threads, double& pairsPerSec) const;
+};
+
+
+// Producers push faster than consumers pop: the backlog in the unbounded lock-free
+// queue grows without blocking the producers, then producers stop and consumers drain
+// it. The next cycle reuses the nodes recycled by the previous one, so the footprint
+// grows only with the peak backlog.
+class UnboundedQueueRunner : public ThreadRunner {
+public:
+    static const unsigned m_producers   = 2;
+    static const unsigned m_consumers   = 2;
+    static const unsigned m_cycles      = 2;
+    static const DWORD    m_imbalanceMs = 2000; // producers are running
+    static const DWORD    m_sampleMs    = 100;  // backlog sampling
+    static const unsigned m_produceSpin = 500;  // work per item, consumers are twice slower
+    static const unsigned m_consumeSpin = 1000;
+
+    struct MT_CACHE_ALIGN WorkerArgs {
+        MSQueue*       queue;
+        unsigned       slot;
+        volatile ULONG items; // pushed or popped
+    };
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    static void Work(unsigned spins) { // imitate work shorter than a time slice
+        for (volatile unsigned i = 0; i < spins; i++)
+            ;
+    }
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+
+private:
+    static volatile LONG m_stopProducers;
+    static volatile LONG m_stopConsumers;
+};
+
+// Open-loop load: the producer sends items on the schedule of the target rate whatever
+// the state of the queue, latency is measured from the intended send time (loadgen.h).
+// The rate is doubled until the queue of the synchronisation type cannot keep it, then
+// the saturation throughput is refined by bisection.
+class OpenLoopRunner : public ThreadRunner {
+public:
+    static const unsigned m_queueSize    = 64;
+    static const DWORD    m_stepMs       = 500;     // of the schedule of one rate
+    static const unsigned m_maxStepItems = 500000;
+    static const unsigned m_startRate    = 1000;    // items per second
+    static const unsigned m_maxRate      = 4000000;
+    static const unsigned m_refineSteps  = 3;
+    static const unsigned m_maxP99Us     = 10000;   // the rate is not kept if queueing delay grows beyond
+    static const unsigned m_serviceSpin  = 200;     // consumer work per item
+    static const DWORD    m_sleepAheadMs = 20;      // producer sleeps only if the next item is further
+    static const DWORD    m_queueTimeout = 5000;    // ms, the other side does not respond
+
+    static ArrivalProcess m_arrival; // set from the command line
+
+    struct StepArgs {
+        double              rate;
+        const Stopwatch*    clock;      // common start of the step
+        std::vector<double> intendedNs; // by item, written by the producer
+        std::vector<double> sentNs;
+        std::vector<double> doneNs;     // written by the consumer
+    };
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+
+private:
+    int RunStep(double rate, LoadStepResult& result) const;
+
+    static TaskQueue m_queue;
+};
+
+// Soak: the producer keeps the queue of critical sections and events busy for hours,
+// every interval the primary thread reports throughput, latency percentiles, queue depth,
+// memory of the process and allocation counts (memstats.h). The summary compares the
+// first and the last interval: slow leaks, drift and throughput degradation show there.
+class SoakRunner : public ThreadRunner {
+public:
+    static const unsigned m_queueSize    = 64;
+    static const unsigned m_stampRing    = 256;  // send times of the items in flight, > m_queueSize + 2
+    static const unsigned m_serviceSpin  = 200;  // consumer work per item
+    static const DWORD    m_pollMs       = 100;  // samples of the queue depth and checks of the end
+    static const DWORD    m_queueTimeout = 100;  // push and pop are retried while the run lasts
+    static const DWORD    m_stopTimeout  = 5000; // for the last item after the end of the run
+    static const unsigned m_defDurationMin = 60;
+    static const unsigned m_defIntervalSec = 10;
+
+    static unsigned m_durationMin; // set from the command line
+    static unsigned m_intervalSec;
+
+    static THREAD_FUNCTION Producer;
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return m_queue.Init(CS_EVENT);
+    }
+
+private:
+    struct Sample { // counters at the end of an interval
+        double        elapsedNs;
+        unsigned long consumed;
+        MemoryCounts  memory;
+    };
+    static void Report(const Sample& from, const Sample& to, const LatencyHistogram& latency,
+                       unsigned long depth, unsigned long maxDepth);
+    static void Summary(const Sample& first, const Sample& firstEnd, const Sample& last,
+                        const Sample& lastEnd);
+
+    static TaskQueue        m_queue;
+    static Stopwatch        m_clock;                // started with the run
+    static double           m_sentNs[m_stampRing];  // by Task::request
+    static volatile LONG    m_produced;             // single writers, wrap: compared as differences
+    static volatile LONG    m_consumed;
+    static CriticalSection  m_latencyCs;            // the consumer records, the primary thread takes
+    static LatencyHistogram m_latency;              // of the current interval
+};
+
+// Batch consumer: all items in the buffer (up to m_maxBatch) are popped under one lock,
+// their records are decoded into a contiguous aligned buffer and the vectorised kernel
+// (batchkernel.h) checksums, filters and aggregates them at once. The imitated work is
+// paid once per batch, so the more the producer is ahead, the less each item costs.
+class ProducerConsumerBatchRunner : public ProducerConsumerEventRunner {
+public:
+    static const unsigned m_maxBatch  = 8; // the whole buffer
+    static const int      m_threshold = 0; // the filter selects the words above it
+
+    static KernelLevel m_kernel; // the highest level to use, set from the command line
+
+    static THREAD_FUNCTION Consumer;
+
+    virtual int RunThreads() const;
+    virtual THREAD_FUNCTION* GetConsumerThreadFunctionPtr() const {
+        return &Consumer;
+    }
+
+private:
+    struct Totals { // written by the consumer only, read when it has exited
+        unsigned  batches;
+        unsigned  items;
+        unsigned  checksum; // of the checksums of the batches in order
+        unsigned  selected;
+        long long sum;
+        double    kernelNs;
+    };
+    static void ConsumeBatch(const int* msgs, size_t count, AlignedArray<int>& records);
+
+    static Totals m_totals;
+};
+
+
+// Dispatch order of a bulk job against the cache (BulkJob, workstack.h): the same job
+// runs over the FIFO queue under a critical section, the lock-free LIFO stack and the
+// per-thread deques with stealing (LIFO locally, FIFO stealing). The backlog is bigger
+// than the cache, the LIFO workers read the payloads while they are still in it.
+class WorkStackRunner : public ThreadRunner {
+public:
+    static const unsigned m_maxWorkers = 8;
+
+    virtual int RunThreads() const;
+    virtual int InitSyncObjects() const {
+        return RET_OK;
+    }
+};
+
+} // namespace MT
@@ -1,91 +1,162 @@
-#include "stdafx.h"
-#include "threads.h"
-#include "threadrunner.h"
-
-MT::Queue<int> g_msgs(8); // queue with limitied size (8 items here) to model full buffer
-
-// synchronisation objects - must be visible to all threads where they will be used
-// see: http://msdn.microsoft.com/en-us/library/windows/desktop/ms686908(v=vs.85).aspx
-
-MT::HandleWrapper   g_hEmptyEvent, g_hFullEvent, g_hEmptyMutEvent, g_hFullMutEvent,
-                    g_hMutex, g_hSemaphore;
-
-namespace MT {
-
-CriticalSection SyncTimer::m_cs;
-CriticalSection ThreadRunner::m_cout_cs;
-
-int ProducerConsumerEventRunner::InitSyncObjects() const {
-
-    // see: http://msdn.microsoft.com/en-us/library/windows/desktop/ms686915(v=vs.85).aspx
-    if (!g_hEmptyEvent.isValid())
-        g_hEmptyEvent.SetHandle( ::CreateEvent(
-            NULL,               // default security attributes
-            FALSE,              // auto-reset (TRUE - manual-reset) event
-            FALSE,              // initial state is nonsignaled
-            TEXT("EmptyEvent")) // object name
-        );
-
-    if (!g_hEmptyEvent.isValid())
-        return ERR_API;
-
-    if (!g_hFullEvent.isValid())
-        g_hFullEvent.SetHandle( ::CreateEvent(
-            NULL,              // default security attributes
-            FALSE,             // auto-reset event
-            FALSE,             // initial state is nonsignaled
-            TEXT("FullEvent")) // object name - must be different in all events, elsewhere they 
-         );                    // cannot be distinguished by the system
-
-    if (!g_hFullEvent.isValid())
-        return ERR_API;
-    return RET_OK;
-}
-
-int ProducerConsumerMutexRunner::InitSyncObjects() const {
-
-    if (!g_hEmptyMutEvent.isValid())
-        g_hEmptyMutEvent.SetHandle( ::CreateEvent(NULL,
-                FALSE, FALSE, TEXT("EmptyMutEvent")) );
-
-    if (!g_hEmptyMutEvent.isValid())
-        return ERR_API;
-
-    if (!g_hFullMutEvent.isValid())
-        g_hFullMutEvent.SetHandle( ::CreateEvent(NULL,
-                FALSE, FALSE, TEXT("FullMutEvent")) );
-
-    if (!g_hFullMutEvent.isValid())
-        return ERR_API;
-
-    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686927(v=vs.85).aspx
-    if (!g_hMutex.isValid())
-        g_hMutex.SetHandle( ::CreateMutex( 
-            NULL,     // default security attributes
-            FALSE,    // initially not owned
-            NULL )    // unnamed mutex
-        );
-
-    if (!g_hMutex.isValid())
-        return ERR_API;
-
-    return RET_OK;
-}
-
-int SemaphoreRunner::InitSyncObjects() const {
-
-    if (!g_hSemaphore.isValid())
-        g_hSemaphore.SetHandle( ::CreateSemaphore(
-            NULL,             // default security attributes
-            m_semInitCount,   // initial count - no more than m_semInitCount of objects allowed
-            m_totalThreads,   // maximum count = maximim number of objects working simultaneuously
-           _T("SampleSemaphore")) // NULL - unnamed semaphore
-        );
-
-    if (!g_hSemaphore.isValid())
-        return ERR_API;
-
-    return RET_OK;
-}
-
+#include "stdafx.h"
+#include "threads.h"
+#include "threadrunner.h"
+
+MT::Queue<int> g_msgs(8); // queue with limitied size (8 items here) to model full buffer
+
+// synchronisation objects - must be visible to all threads where they will be used
+// see: http://msdn.microsoft.com/en-us/library/windows/desktop/ms686908(v=vs.85).aspx
+
+MT::CriticalSection g_cs; // buffer lock of the critical section runners, shared by both sides
+MT::HandleWrapper   g_hEmptyEvent, g_hFullEvent, g_hEmptyMutEvent, g_hFullMutEvent,
+                    g_hMutex, g_hSemaphore;
+
+namespace MT {
+
+Placement       ThreadRunner::m_placement = PL_DEFAULT;
+WaitStrategy    ThreadRunner::m_wait;
+WorkloadReplay  ThreadRunner::m_replay;
+WorkloadRecorder ThreadRunner::m_recorder;
+volatile LONG   ProducerConsumerRunner::m_phase    = ProducerConsumerRunner::SP_RUN;
+volatile LONG   ProducerConsumerMutexRunner::m_emptySignals = 0;
+volatile LONG   ProducerConsumerMutexRunner::m_fullSignals  = 0;
+AsyncFileSink   ProducerConsumerFileSinkRunner::m_sink;
+Journal         ProducerConsumerJournalRunner::m_journal;
+TaskPool        RequestResponseRunner::m_pool(RequestResponseRunner::m_poolSize);
+TaskQueue       RequestResponseRunner::m_queue(RequestResponseRunner::m_queueSize);
+RateLimiter     RateLimiterRunner::m_limiter(RateLimiterRunner::m_rate, RateLimiterRunner::m_burst);
+volatile LONG   RateLimiterRunner::m_blocking = 0;
+volatile LONG   RateLimiterRunner::m_stop     = 0;
+CriticalSection ElasticConsumerRunner::m_cs;
+HandleWrapper   ElasticConsumerRunner::m_hItems;
+HandleWrapper   ElasticConsumerRunner::m_hSpace;
+volatile LONG   ElasticConsumerRunner::m_stallUs = 0;
+volatile LONG   UnboundedQueueRunner::m_stopProducers = 0;
+volatile LONG   UnboundedQueueRunner::m_stopConsumers = 0;
+ArrivalProcess  OpenLoopRunner::m_arrival = AP_CONSTANT;
+TaskQueue       OpenLoopRunner::m_queue(OpenLoopRunner::m_queueSize);
+unsigned        SoakRunner::m_durationMin = SoakRunner::m_defDurationMin;
+unsigned        SoakRunner::m_intervalSec = SoakRunner::m_defIntervalSec;
+TaskQueue       SoakRunner::m_queue(SoakRunner::m_queueSize);
+Stopwatch       SoakRunner::m_clock;
+double          SoakRunner::m_sentNs[SoakRunner::m_stampRing] = { 0 };
+volatile LONG   SoakRunner::m_produced = 0;
+volatile LONG   SoakRunner::m_consumed = 0;
+CriticalSection SoakRunner::m_latencyCs;
+LatencyHistogram SoakRunner::m_latency;
+KernelLevel     ProducerConsumerBatchRunner::m_kernel = KL_AVX2;
+ProducerConsumerBatchRunner::Totals ProducerConsumerBatchRunner::m_totals;
+
+size_t ProducerConsumerRunner::Backlog() const {
+    return g_msgs.size();
+}
+
+size_t ProducerConsumerRunner::DropBacklog() const {
+    size_t dropped = g_msgs.size();
+    while (!g_msgs.empty())
+        g_msgs.pop();
+    SampleDepth();
+    return dropped;
+}
+
+void ProducerConsumerRunner::SampleDepth() {
+    Stats::Instance().SetQueueDepth(static_cast<LONG>(g_msgs.size()));
+}
+
+void ProducerConsumerEventRunner::WakeConsumer() const {
+    ::SetEvent(g_hFullEvent);
+}
+
+void ProducerConsumerMutexRunner::WakeConsumer() const {
+    Signal(g_hFullMutEvent, m_fullSignals);
+}
+
+int ProducerConsumerEventRunner::InitSyncObjects() const {
+
+    // see: http://msdn.microsoft.com/en-us/library/windows/desktop/ms686915(v=vs.85).aspx
+    if (!g_hEmptyEvent.isValid())
+        g_hEmptyEvent.SetHandle( ::CreateEvent(
+            NULL,               // default security attributes
+            FALSE,              // auto-reset (TRUE - manual-reset) event
+            FALSE,              // initial state is nonsignaled
+            TEXT("EmptyEvent")) // object name
+        );
+
+    if (!g_hEmptyEvent.isValid())
+        return ERR_API;
+
+    if (!g_hFullEvent.isValid())
+        g_hFullEvent.SetHandle( ::CreateEvent(
+            NULL,              // default security attributes
+            FALSE,             // auto-reset event
+            FALSE,             // initial state is nonsignaled
+            TEXT("FullEvent")) // object name - must be different in all events, elsewhere they 
+         );                    // cannot be distinguished by the system
+
+    if (!g_hFullEvent.isValid())
+        return ERR_API;
+    return RET_OK;
+}
+
+int ProducerConsumerMutexRunner::InitSyncObjects() const {
+
+    if (!g_hEmptyMutEvent.isValid())
+        g_hEmptyMutEvent.SetHandle( ::CreateEvent(NULL,
+                FALSE, FALSE, TEXT("EmptyMutEvent")) );
+
+    if (!g_hEmptyMutEvent.isValid())
+        return ERR_API;
+
+    if (!g_hFullMutEvent.isValid())
+        g_hFullMutEvent.SetHandle( ::CreateEvent(NULL,
+                FALSE, FALSE, TEXT("FullMutEvent")) );
+
+    if (!g_hFullMutEvent.isValid())
+        return ERR_API;
+
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686927(v=vs.85).aspx
+    if (!g_hMutex.isValid())
+        g_hMutex.SetHandle( ::CreateMutex( 
+            NULL,     // default security attributes
+            FALSE,    // initially not owned
+            NULL )    // unnamed mutex
+        );
+
+    if (!g_hMutex.isValid())
+        return ERR_API;
+
+    return RET_OK;
+}
+
+int ElasticConsumerRunner::InitSyncObjects() const {
+
+    if (!m_cs.isValid())
+        return ERR_API;
+
+    if (!m_hItems.isValid())
+        m_hItems.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) ); // auto-reset, unnamed
+    if (!m_hSpace.isValid())
+        m_hSpace.SetHandle( ::CreateEvent(NULL, FALSE, FALSE, NULL) );
+
+    if (!m_hItems.isValid() || !m_hSpace.isValid())
+        return ERR_API;
+    return RET_OK;
+}
+
+int SemaphoreRunner::InitSyncObjects() const {
+
+    if (!g_hSemaphore.isValid())
+        g_hSemaphore.SetHandle( ::CreateSemaphore(
+            NULL,             // default security attributes
+            m_semInitCount,   // initial count - no more than m_semInitCount of objects allowed
+            m_totalThreads,   // maximum count = maximim number of objects working simultaneuously
+           _T("SampleSemaphore")) // NULL - unnamed semaphore
+        );
+
+    if (!g_hSemaphore.isValid())
+        return ERR_API;
+
+    return RET_OK;
+}
+
 } // namespace MT
\ No newline at end of file
@@ -1,225 +1,449 @@
-#pragma once
-
-#include <queue>
-
-// chose different synchronisation objects
-enum SyncType {
-    CS    = 1, // only critical sections
-    CS_EVENT,  // critical sections with events
-    MUTEX,     // mutex
-    SEMAPHORE
-};
-
-// error return types
-const int RET_OK      = 0;
-const int ERR_SYNC    = 1; // error with thread syncshronisation
-const int ERR_STD     = 2; // std::exception
-const int ERR_API     = 3; // API function failed
-const int ERR_UNKNOWN = 4; // catched by catch (...)
-
-typedef unsigned (__stdcall THREAD_FUNCTION)(void*);  // function to pass to _beginthreadex
-
-const char TIMEOUT[] = "Exiting thread, timeout: ";
-
-namespace MT {
-
-class HandleWrapper { // using RAAI idiom
-public:
-    HandleWrapper(HANDLE handle = INVALID_HANDLE_VALUE) : m_handle(handle) {
-    }
-    ~HandleWrapper() {
-        if (isValid())               // with invalid handle values ::CloseHandle returns FALSE 
-            ::CloseHandle(m_handle); // with ERROR_INVALIDE_HANDLE GetLastError() code
-    }
-
-    void SetHandle(HANDLE handle) { // needed for global objects. Although it is no acquisition,
-        if (isValid())              // RAII idea is also releasing resources in the destructor
-            ::CloseHandle(m_handle);
-        m_handle = handle;
-    }
-
-    operator HANDLE() const {
-        return m_handle;
-    }
-
-    bool isValid() const {
-        return ( m_handle != INVALID_HANDLE_VALUE && m_handle != NULL );
-    }
-
-private:
-    // disable copy constructor and assignment operator
-    HandleWrapper(const HandleWrapper&);
-    HandleWrapper& operator=(const HandleWrapper&);
-
-    HANDLE m_handle;
-};
-
-class CriticalSection {
-public:
-    CriticalSection() {
-        m_isValid = ( ::InitializeCriticalSectionAndSpinCount(&m_cs, 0x00000400) != 0 );
-    }
-    ~CriticalSection() {
-        if (m_isValid)
-            ::DeleteCriticalSection(&m_cs);
-    }
-
-    bool isValid() {
-        return m_isValid;
-    }
-
-    bool Enter() {
-        if (m_isValid)
-            ::EnterCriticalSection(&m_cs);
-        return m_isValid;
-    }
-
-    bool Leave() {
-        if (m_isValid)
-            ::LeaveCriticalSection(&m_cs);
-        return m_isValid;
-    }
-
-private:
-    CriticalSection(const CriticalSection&);
-    CriticalSection& operator=(const CriticalSection&);
-
-    CRITICAL_SECTION m_cs;
-    bool m_isValid;
-};
-
-
-class Lock {
-
-public:
-   Lock(CriticalSection& cs) : m_cs(cs) { // RAAI idiom
-       m_cs.Enter();
-    }
-    ~Lock() {
-        m_cs.Leave();
-    }
-private:
-    Lock(const Lock&);
-    Lock& operator=(const Lock&);
-
-    CriticalSection& m_cs;
-};
-
-// controlling the upper size of the queue
-template <class T> class Queue : public std::queue<T> {
-public:
-    Queue(int _bs) : m_buf_size(_bs) {}
-    bool isFull() const {        // exception safe
-        return m_buf_size == size();
-    }
-
-    // crash-safe version
-    const T& front() {
-        if (empty())
-            throw std::underflow_error("Queue buffer is empty");
-        return std::queue<T>::front();
-    }
-
-    // for limiting Producer
-    void push (const T& t) {
-        if (isFull())    // disaster
-            throw std::overflow_error("Queue buffer is full");
-        std::queue<T>::push(t);
-    }
-
-private:
-    const int m_buf_size;
-};
-
-enum SyncTimerState { ST_WORK, ST_STOP, ST_ERR };
-
-// using Singleton GOF pattern
-class SyncTimer {
-public:
-    // Thread-safe Singleton implementation.
-    // see (Meyers, Alexandresku) http://www.aristeia.com/Papers/DDJ_Jul_Aug_2004_revised.pdf
-    // and (Raymond Chen) http://blogs.msdn.com/b/oldnewthing/archive/2004/03/08/85901.aspx
-    // about initialisation of static variables in multithreaded environment
-
-    // Alternative implementation with pointers and lazy initialisation
-    // as described in GOF book involves that the destructor will not be called
-    static SyncTimer& Instance() {
-        Lock lock(m_cs);
-        static SyncTimer syncTimer;
-        return syncTimer;
-    }
-
-    SyncTimer::~SyncTimer() {
-    }
-
-    bool isValid() const {
-        return m_hTimer.isValid();
-    }
-
-    bool SetTimer(const LARGE_INTEGER& t) {
-        Lock lock(m_cs);
-        m_timeout = t;
-        convertTimeOutToSeconds();
-        BOOL ret = ::SetWaitableTimer(m_hTimer, &m_timeout, 0, NULL, NULL, 0);
-        return ret != 0;
-    }
-
-    unsigned int GetTimeoutInsSec() const { 
-        return m_timeoutSec;
-    }
-
-    SyncTimerState State() const {
-        switch (::WaitForSingleObject(m_hTimer, 0)) {
-            case WAIT_OBJECT_0: // signalled
-                return ST_STOP;
-            case WAIT_TIMEOUT:
-                return ST_WORK;
-            case WAIT_FAILED:
-            default:
-                return ST_ERR;
-        }
-    }
-
-protected:
-    SyncTimer() : m_timeoutSec(0),
-        m_hTimer ( ::CreateWaitableTimer(
-            NULL,    // security attributes 
-            TRUE,    // manual reset: will be signalled for all threads 
-            _T("SyncTimer")
-        ))
-    {   
-        m_timeout.QuadPart = 0;
-    }
-
-private:
-    SyncTimer(const SyncTimer&);
-    SyncTimer& operator=(const SyncTimer&);
-
-    static CriticalSection m_cs;
-
-    LARGE_INTEGER m_timeout;
-    unsigned m_timeoutSec;
-    HandleWrapper m_hTimer;
-
-    void convertTimeOutToSeconds() {
-        const int intervalsInSec = 10000000; // timeout is set in 100ns intervals (1 ns == 1,000,000,000)
-        if (m_timeout.QuadPart == 0) {
-            m_timeoutSec = 0;
-        } else if (m_timeout.QuadPart < 0) {
-            // received relative to current clock time
-            m_timeoutSec = static_cast<unsigned int>( ( -m_timeout.QuadPart ) / intervalsInSec );
-        } else {
-            // received absolute time
-            FILETIME fileTime;
-            ULARGE_INTEGER current, timeoutInSec;
-            ::GetSystemTimeAsFileTime(&fileTime);
-            current.LowPart = fileTime.dwLowDateTime;
-            current.HighPart= fileTime.dwHighDateTime;
-
-            timeoutInSec.QuadPart = m_timeout.QuadPart - current.QuadPart;
-            m_timeoutSec = static_cast<unsigned int>( timeoutInSec.QuadPart / intervalsInSec );
-        }
-    }
-};
-
-} // namespace Multithreading
+#pragma once
+
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include "trace.h"
+#include "allocation.h"
+#include "stats.h"
+
+// chose different synchronisation objects
+enum SyncType {
+    CS    = 1, // only critical sections
+    CS_EVENT,  // critical sections with events
+    MUTEX,     // mutex
+    SEMAPHORE,
+    FILE_SINK, // critical sections with events, consumer writes items to a file
+    JOURNAL,   // persistent queue in memory-mapped files
+    REQUEST_RESPONSE, // tasks with futures over the queues of the types above
+    RATE_LIMITER,     // many threads limited by lock-free token bucket
+    ELASTIC,          // critical section and events, consumers scale with the backlog
+    PUB_SUB,          // topics fan out to subscriber groups with bounded queues
+    FLAT_COMBINING,   // many threads share one queue: locks, lock-free FIFO, flat combining
+    UNBOUNDED,        // lock-free unbounded queue, producers never block
+    OPEN_LOOP,        // producer sends on the schedule of the target rate, queues of the first types
+    SOAK,             // sustained load for hours, stats of each interval
+    BATCH,            // critical sections and events, consumer pops batches and runs a vectorised kernel
+    WORK_STACK        // bulk job dispatched FIFO, LIFO by a lock-free stack and by work stealing
+};
+
+// error return types
+const int RET_OK      = 0;
+const int ERR_SYNC    = 1; // error with thread syncshronisation
+const int ERR_STD     = 2; // std::exception
+const int ERR_API     = 3; // API function failed
+const int ERR_UNKNOWN = 4; // catched by catch (...)
+
+typedef unsigned (__stdcall THREAD_FUNCTION)(void*);  // function to pass to _beginthreadex
+
+const char TIMEOUT[] = "Exiting thread, timeout: ";
+
+namespace MT {
+
+class HandleWrapper { // using RAAI idiom
+public:
+    HandleWrapper(HANDLE handle = INVALID_HANDLE_VALUE) : m_handle(handle) {
+    }
+    ~HandleWrapper() {
+        if (isValid())               // with invalid handle values ::CloseHandle returns FALSE 
+            ::CloseHandle(m_handle); // with ERROR_INVALIDE_HANDLE GetLastError() code
+    }
+
+    void SetHandle(HANDLE handle) { // needed for global objects. Although it is no acquisition,
+        if (isValid())              // RAII idea is also releasing resources in the destructor
+            ::CloseHandle(m_handle);
+        m_handle = handle;
+    }
+
+    operator HANDLE() const {
+        return m_handle;
+    }
+
+    bool isValid() const {
+        return ( m_handle != INVALID_HANDLE_VALUE && m_handle != NULL );
+    }
+
+private:
+    // disable copy constructor and assignment operator
+    HandleWrapper(const HandleWrapper&);
+    HandleWrapper& operator=(const HandleWrapper&);
+
+    HANDLE m_handle;
+};
+
+class CriticalSection {
+public:
+    CriticalSection() {
+        m_isValid = ( ::InitializeCriticalSectionAndSpinCount(&m_cs, 0x00000400) != 0 );
+    }
+    ~CriticalSection() {
+        if (m_isValid)
+            ::DeleteCriticalSection(&m_cs);
+    }
+
+    bool isValid() {
+        return m_isValid;
+    }
+
+    bool Enter() {
+        if (m_isValid)
+            ::EnterCriticalSection(&m_cs);
+        return m_isValid;
+    }
+
+    bool Leave() {
+        if (m_isValid)
+            ::LeaveCriticalSection(&m_cs);
+        return m_isValid;
+    }
+
+    bool TryEnter() { // false if owned by another thread
+        return m_isValid && ::TryEnterCriticalSection(&m_cs) != 0;
+    }
+
+private:
+    CriticalSection(const CriticalSection&);
+    CriticalSection& operator=(const CriticalSection&);
+
+    CRITICAL_SECTION m_cs;
+    bool m_isValid;
+};
+
+
+class Lock {
+
+public:
+   Lock(CriticalSection& cs) : m_cs(cs) { // RAAI idiom
+       if (!m_cs.TryEnter()) { // only contended lock is shown on the trace timeline
+           Stats::Instance().Add(SC_CONTENDED);
+           TraceScope wait(TE_LOCK_WAIT);
+           m_cs.Enter();
+       }
+    }
+    ~Lock() {
+        m_cs.Leave();
+    }
+private:
+    Lock(const Lock&);
+    Lock& operator=(const Lock&);
+
+    CriticalSection& m_cs;
+};
+
+// Global service created on the first call and read without a lock afterwards.
+//
+// Visual C++ 2008 does not make the initialisation of local statics thread-safe, so the
+// first callers are serialised, but by a zero-initialised flag rather than a critical
+// section: the flag needs no constructor and may be used during the initialisation of
+// other statics. The pointer is published by an interlocked exchange (full barrier) after
+// the object is constructed, so every later call is one load of the pointer.
+// see (Meyers, Alexandresku) http://www.aristeia.com/Papers/DDJ_Jul_Aug_2004_revised.pdf
+// and (Raymond Chen) http://blogs.msdn.com/b/oldnewthing/archive/2004/03/08/85901.aspx
+template <class T> class Singleton {
+public:
+    static T& Instance() {
+        T* instance = m_instance; // volatile read has acquire semantics in Visual C++ 2005 and later
+        if (instance == NULL)
+            instance = Create();
+        return *instance;
+    }
+
+private:
+    static T* Create() {
+        while (::InterlockedCompareExchange(&m_creating, 1, 0) != 0)
+            ::SwitchToThread(); // another thread is constructing the object
+        if (m_instance == NULL) {
+            static T instance; // destroyed at exit as a local static
+            ::InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&m_instance), &instance);
+        }
+        ::InterlockedExchange(&m_creating, 0);
+        return m_instance;
+    }
+
+    static T* volatile   m_instance;
+    static volatile LONG m_creating;
+};
+
+template <class T> T* volatile   Singleton<T>::m_instance = NULL;
+template <class T> volatile LONG Singleton<T>::m_creating = 0;
+
+// C++11 features of the compiler: rvalue references (Visual C++ 2010)
+// and variadic templates (Visual C++ 2013)
+#if (defined(_MSC_VER) && _MSC_VER >= 1600) || __cplusplus >= 201103L
+#define MT_RVALUE_REFS
+#endif
+#if (defined(_MSC_VER) && _MSC_VER >= 1800) || __cplusplus >= 201103L
+#define MT_VARIADIC_TEMPLATES
+#endif
+
+#pragma push_macro("new") // placement new cannot take the debug arguments (stdafx.h)
+#undef new
+
+// Queue with the upper size limit on preallocated contiguous storage.
+// Storage size is rounded up to the power of two, so the ring index is a mask.
+// Items are constructed in place by push()/emplace() and destroyed by pop(),
+// nothing is allocated after construction. Storage starts on a cache line,
+// large rings are placed on large pages if available (allocation.h). With C++11 compiler items can be moved in
+// and out (front() returns non-const reference), so move-only types are supported.
+template <class T> class Queue {
+public:
+    Queue(int _bs) : m_buf_size(_bs), m_mask(Capacity(_bs) - 1), m_head(0), m_size(0),
+        m_items( static_cast<T*>(AllocateBuffer((m_mask + 1) * sizeof(T))) ) {
+        if (m_items == NULL)
+            throw std::bad_alloc();
+    }
+    ~Queue() {
+        while (!empty())
+            pop();
+        FreeBuffer(m_items, (m_mask + 1) * sizeof(T));
+    }
+
+    bool isFull() const {        // exception safe
+        return static_cast<size_t>(m_buf_size) == m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+    size_t size() const {
+        return m_size;
+    }
+
+    // crash-safe version
+    T& front() {
+        if (empty())
+            throw std::underflow_error("Queue buffer is empty");
+        return m_items[m_head];
+    }
+    const T& front() const {
+        if (empty())
+            throw std::underflow_error("Queue buffer is empty");
+        return m_items[m_head];
+    }
+
+    void pop() {
+        if (empty())
+            throw std::underflow_error("Queue buffer is empty");
+        m_items[m_head].~T();
+        m_head = (m_head + 1) & m_mask;
+        m_size--;
+    }
+
+    // for limiting Producer
+    void push(const T& t) {
+        new (Slot()) T(t);
+        m_size++; // only if the constructor did not throw
+    }
+
+#ifdef MT_RVALUE_REFS
+    void push(T&& t) {
+        new (Slot()) T(std::move(t));
+        m_size++;
+    }
+#endif
+
+#ifdef MT_VARIADIC_TEMPLATES
+    template <class... Args> void emplace(Args&&... args) {
+        new (Slot()) T(std::forward<Args>(args)...);
+        m_size++;
+    }
+#else
+    void emplace() {
+        new (Slot()) T();
+        m_size++;
+    }
+    template <class A1> void emplace(const A1& a1) {
+        new (Slot()) T(a1);
+        m_size++;
+    }
+    template <class A1, class A2> void emplace(const A1& a1, const A2& a2) {
+        new (Slot()) T(a1, a2);
+        m_size++;
+    }
+    template <class A1, class A2, class A3> void emplace(const A1& a1, const A2& a2, const A3& a3) {
+        new (Slot()) T(a1, a2, a3);
+        m_size++;
+    }
+#endif
+
+private:
+    Queue(const Queue&);
+    Queue& operator=(const Queue&);
+
+    static size_t Capacity(int bs) { // the power of two
+        size_t capacity = 1;
+        while (capacity < static_cast<size_t>(bs))
+            capacity <<= 1;
+        return capacity;
+    }
+
+    void* Slot() { // memory for the new tail item
+        if (isFull())    // disaster
+            throw std::overflow_error("Queue buffer is full");
+        return m_items + ((m_head + m_size) & m_mask);
+    }
+
+    const int    m_buf_size;
+    const size_t m_mask;
+    size_t       m_head;
+    size_t       m_size;
+    T*           m_items;
+};
+
+#pragma pop_macro("new")
+
+// high resolution interval measurement
+// http://msdn.microsoft.com/en-us/library/windows/desktop/ms644904(v=vs.85).aspx
+class Stopwatch {
+public:
+    Stopwatch() {
+        ::QueryPerformanceFrequency(&m_freq); // fixed at system boot
+        Start();
+    }
+
+    void Start() {
+        ::QueryPerformanceCounter(&m_start);
+    }
+
+    double ElapsedNs() const {
+        LARGE_INTEGER now;
+        ::QueryPerformanceCounter(&now);
+        return static_cast<double>(now.QuadPart - m_start.QuadPart) * 1e9 / m_freq.QuadPart;
+    }
+
+private:
+    LARGE_INTEGER m_freq;
+    LARGE_INTEGER m_start;
+};
+
+enum SyncTimerState { ST_WORK, ST_STOP, ST_ERR };
+
+// using Singleton GOF pattern
+class SyncTimer {
+public:
+    // created once by the first call, later calls take no lock (Singleton above)
+    static SyncTimer& Instance() {
+        return Singleton<SyncTimer>::Instance();
+    }
+
+    SyncTimer::~SyncTimer() {
+    }
+
+    bool isValid() const {
+        return m_hTimer.isValid();
+    }
+
+    bool SetTimer(const LARGE_INTEGER& t) {
+        Lock lock(m_cs);
+        m_timeout = t;
+        convertTimeout();
+        m_deadlineTicks = ::GetTickCount() + m_timeoutMs;
+        BOOL ret = ::SetWaitableTimer(m_hTimer, &m_timeout, 0, NULL, NULL, 0);
+        return ret != 0;
+    }
+
+    unsigned int GetTimeoutInsSec() const { 
+        return m_timeoutSec;
+    }
+
+    // waits until the timer is signalled, false on failure
+    bool Wait(DWORD timeout = INFINITE) const {
+        return ::WaitForSingleObject(m_hTimer, timeout) == WAIT_OBJECT_0;
+    }
+
+    // Polled by the threads in their loops, so it makes no kernel call: the tick count
+    // is read from the memory shared with the kernel and compared with the deadline.
+    // The tick count advances by 10-16 ms, so the state may change up to one tick later
+    // than the timer is signalled. The difference is wrap-safe for deadlines within 24 days.
+    SyncTimerState State() const {
+        if (!isValid())
+            return ST_ERR;
+        const LONG left = static_cast<LONG>(m_deadlineTicks - ::GetTickCount());
+        return left > 0 ? ST_WORK : ST_STOP;
+    }
+
+protected:
+    friend class Singleton<SyncTimer>;
+
+    // until the timer is set the state is ST_WORK, as the waitable timer is not signalled
+    SyncTimer() : m_timeoutSec(0), m_timeoutMs(0),
+        m_deadlineTicks( ::GetTickCount() + std::numeric_limits<LONG>::max() ),
+        m_hTimer ( ::CreateWaitableTimer(
+            NULL,    // security attributes 
+            TRUE,    // manual reset: will be signalled for all threads 
+            _T("SyncTimer")
+        ))
+    {   
+        m_timeout.QuadPart = 0;
+    }
+
+private:
+    SyncTimer(const SyncTimer&);
+    SyncTimer& operator=(const SyncTimer&);
+
+    CriticalSection m_cs; // of SetTimer()
+
+    LARGE_INTEGER  m_timeout;
+    unsigned       m_timeoutSec;
+    DWORD          m_timeoutMs;
+    volatile DWORD m_deadlineTicks; // GetTickCount()
+    HandleWrapper  m_hTimer;
+
+    void convertTimeout() {
+        const LONGLONG intervalsInMs = 10000; // timeout is set in 100ns intervals (1 ns == 1,000,000,000)
+        LONGLONG intervals = 0;
+        if (m_timeout.QuadPart < 0) {
+            // received relative to current clock time
+            intervals = -m_timeout.QuadPart;
+        } else if (m_timeout.QuadPart > 0) {
+            // received absolute time
+            FILETIME fileTime;
+            ULARGE_INTEGER current;
+            ::GetSystemTimeAsFileTime(&fileTime);
+            current.LowPart = fileTime.dwLowDateTime;
+            current.HighPart= fileTime.dwHighDateTime;
+
+            intervals = m_timeout.QuadPart - static_cast<LONGLONG>(current.QuadPart);
+            if (intervals < 0) // already passed
+                intervals = 0;
+        }
+        m_timeoutMs  = static_cast<DWORD>(intervals / intervalsInMs);
+        m_timeoutSec = m_timeoutMs / 1000;
+    }
+};
+
+// Console output shared by the threads: lines are written under the lock,
+// the service itself is found without one (Singleton above).
+class Logger {
+public:
+    static Logger& Instance() {
+        return Singleton<Logger>::Instance();
+    }
+
+    void Print(const char* msg) {
+        Lock lock(m_cs);
+        cout << msg << endl;
+    }
+    void Print(const char* msg, int value) {
+        Lock lock(m_cs);
+        cout << msg << value << endl;
+    }
+    void PutThreadFinishMsg(const char* msg, unsigned int timeout=0) {
+        Lock lock(m_cs);
+        cout << endl << msg;
+        if (timeout != 0)
+            cout << timeout << " sec.";
+        cout << " Thread Id: " << ::GetCurrentThreadId() << endl << endl;
+    }
+
+private:
+    friend class Singleton<Logger>;
+
+    Logger() {
+    }
+    Logger(const Logger&);
+    Logger& operator=(const Logger&);
+
+    CriticalSection m_cs;
+};
+
+} // namespace Multithreading
@@ -0,0 +1,142 @@
+#include "stdafx.h"
+#include <fstream>
+#include "threads.h"
+
+namespace MT {
+
+Tracer Tracer::m_instance;
+
+const char* const traceEventNames[TE_TOTAL] = {
+    "produce", "consume", "lock wait", "full buffer wait", "empty buffer wait", "wakeup"
+};
+
+Tracer::Tracer() : m_enabled(false), m_generation(0), m_buffers(NULL), m_capacity(0), m_start(0) {
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms686749(v=vs.85).aspx
+    m_tlsBuffer     = ::TlsAlloc();
+    m_tlsGeneration = ::TlsAlloc();
+
+    LARGE_INTEGER freq;
+    ::QueryPerformanceFrequency(&freq);
+    m_freq = freq.QuadPart;
+}
+
+Tracer::~Tracer() {
+    Free();
+    if (m_tlsBuffer != TLS_OUT_OF_INDEXES)
+        ::TlsFree(m_tlsBuffer);
+    if (m_tlsGeneration != TLS_OUT_OF_INDEXES)
+        ::TlsFree(m_tlsGeneration);
+}
+
+void Tracer::Free() {
+    ThreadBuffer* buffer = m_buffers;
+    m_buffers = NULL;
+    while (buffer != NULL) {
+        ThreadBuffer* next = buffer->next;
+        delete buffer;
+        buffer = next;
+    }
+}
+
+bool Tracer::Start(unsigned eventsPerThread) {
+    if (m_tlsBuffer == TLS_OUT_OF_INDEXES || m_tlsGeneration == TLS_OUT_OF_INDEXES)
+        return false;
+
+    m_enabled = false;
+    Free();
+    m_capacity = eventsPerThread;
+    ::InterlockedIncrement(&m_generation); // buffers in TLS of all threads are obsolete
+
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    m_start   = now.QuadPart;
+    m_enabled = true;
+    return true;
+}
+
+void Tracer::Stop() {
+    m_enabled = false;
+}
+
+Tracer::ThreadBuffer* Tracer::GetBuffer() {
+    const LONG generation = m_generation;
+    if (reinterpret_cast<LONG_PTR>(::TlsGetValue(m_tlsGeneration)) == generation)
+        return static_cast<ThreadBuffer*>(::TlsGetValue(m_tlsBuffer));
+
+    // the first event of the thread: memory is allocated once, not by recording
+    ThreadBuffer* buffer = new ThreadBuffer;
+    buffer->threadId = ::GetCurrentThreadId();
+    buffer->name     = NULL;
+    buffer->count    = 0;
+    buffer->dropped  = 0;
+    buffer->events.resize(m_capacity);
+
+    ThreadBuffer* head = m_buffers;
+    do {
+        buffer->next = head;
+        head = static_cast<ThreadBuffer*>( ::InterlockedCompareExchangePointer(
+            reinterpret_cast<PVOID volatile*>(&m_buffers), buffer, head) );
+    } while (head != buffer->next);
+
+    ::TlsSetValue(m_tlsBuffer, buffer);
+    ::TlsSetValue(m_tlsGeneration, reinterpret_cast<LPVOID>(static_cast<LONG_PTR>(generation)));
+    return buffer;
+}
+
+void Tracer::Record(TraceEventType type, char phase) {
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+
+    ThreadBuffer* buffer = GetBuffer();
+    if (buffer->count == buffer->events.size()) {
+        buffer->dropped++;
+        return;
+    }
+    Event& e = buffer->events[buffer->count++];
+    e.ts    = now.QuadPart;
+    e.type  = static_cast<short>(type);
+    e.phase = phase;
+}
+
+void Tracer::SetThreadName(const char* name) {
+    if (m_enabled)
+        GetBuffer()->name = name;
+}
+
+int Tracer::Write(const char* fileName) const {
+    std::ofstream out(fileName);
+    if (!out)
+        return ERR_STD;
+
+    const DWORD pid = ::GetCurrentProcessId();
+    unsigned dropped = 0;
+    bool first = true;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const ThreadBuffer* b = m_buffers; b != NULL; b = b->next) {
+        dropped += b->dropped;
+
+        // metadata: thread name shown on the track
+        out << (first ? "" : ",") << endl
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << b->threadId
+            << ",\"args\":{\"name\":\"" << (b->name != NULL ? b->name : "Thread") << " "
+            << b->threadId << "\"}}";
+        first = false;
+
+        for (unsigned i = 0; i < b->count; i++) {
+            const Event& e = b->events[i];
+            const double us = static_cast<double>(e.ts - m_start) * 1e6 / m_freq;
+            out << "," << endl
+                << "{\"name\":\"" << traceEventNames[e.type] << "\",\"cat\":\"mt\",\"ph\":\""
+                << e.phase << "\",\"ts\":" << std::fixed << us << ",\"pid\":" << pid
+                << ",\"tid\":" << b->threadId;
+            if (e.phase == 'i')
+                out << ",\"s\":\"t\""; // instant event of the thread
+            out << "}";
+        }
+    }
+    out << endl << "],\"otherData\":{\"droppedEvents\":" << dropped << "}}" << endl;
+    return out ? RET_OK : ERR_STD;
+}
+
+} // namespace MT
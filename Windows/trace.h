@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+
+namespace MT {
+
+// activities of the threads shown on the timeline
+enum TraceEventType {
+    TE_PRODUCE,
+    TE_CONSUME,
+    TE_LOCK_WAIT,   // contended lock
+    TE_FULL_WAIT,   // producer waits for a free slot
+    TE_EMPTY_WAIT,  // consumer waits for an item
+    TE_WAKEUP,      // instant event
+    TE_TOTAL
+};
+
+// Timeline of thread activity in Chrome trace-event format (chrome://tracing, Perfetto).
+//
+// Each thread records begin/end events into its own buffer found through thread local
+// storage, so recording takes no lock and no interlocked operation: the buffer has the
+// single writer. Buffers are linked into the list of the tracer by compare-and-swap when
+// the thread records its first event. When a buffer is full new events are dropped.
+// When tracing is not started recording costs a single check.
+//
+// see: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+class Tracer {
+public:
+    static const unsigned defEventsPerThread = 64 * 1024;
+
+    static Tracer& Instance() {
+        return m_instance;
+    }
+
+    // discards recorded events, traced threads must not be running
+    bool Start(unsigned eventsPerThread = defEventsPerThread);
+    void Stop();
+
+    bool isEnabled() const {
+        return m_enabled;
+    }
+
+    void Begin(TraceEventType type) {
+        if (m_enabled)
+            Record(type, 'B');
+    }
+    void End(TraceEventType type) {
+        if (m_enabled)
+            Record(type, 'E');
+    }
+    void Instant(TraceEventType type) {
+        if (m_enabled)
+            Record(type, 'i');
+    }
+    void SetThreadName(const char* name); // string literal
+
+    // writes JSON, traced threads must be finished
+    int Write(const char* fileName) const;
+
+    ~Tracer();
+
+private:
+    Tracer();
+    Tracer(const Tracer&);
+    Tracer& operator=(const Tracer&);
+
+    struct Event {
+        LONGLONG ts;    // QueryPerformanceCounter
+        short    type;  // TraceEventType
+        char     phase; // 'B', 'E', 'i'
+    };
+
+    struct ThreadBuffer {
+        ThreadBuffer*      next;
+        DWORD              threadId;
+        const char*        name;
+        unsigned           count;
+        unsigned           dropped;
+        std::vector<Event> events;
+    };
+
+    static Tracer m_instance;
+
+    ThreadBuffer* GetBuffer(); // of the calling thread
+    void Record(TraceEventType type, char phase);
+    void Free();
+
+    volatile bool          m_enabled;
+    DWORD                  m_tlsBuffer;     // ThreadBuffer* of the thread
+    DWORD                  m_tlsGeneration; // Start() number the buffer belongs to
+    volatile LONG          m_generation;
+    ThreadBuffer* volatile m_buffers;       // lock-free list
+    unsigned               m_capacity;
+    LONGLONG               m_start;
+    LONGLONG               m_freq;
+};
+
+// records begin and end events of the scope (RAII)
+class TraceScope {
+public:
+    TraceScope(TraceEventType type) : m_type(type) {
+        Tracer::Instance().Begin(m_type);
+    }
+    ~TraceScope() {
+        Tracer::Instance().End(m_type);
+    }
+
+private:
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+
+    TraceEventType m_type;
+};
+
+} // namespace MT
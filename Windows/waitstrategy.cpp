@@ -0,0 +1,25 @@
+#include "stdafx.h"
+#include "threads.h"
+#include "waitstrategy.h"
+
+namespace MT {
+
+const char* const waitPolicyNames[WP_TOTAL] = {
+    "block", "spin", "yield", "backoff", "park"
+};
+
+const char* WaitPolicyName(WaitPolicy policy) {
+    return waitPolicyNames[policy];
+}
+
+bool ParseWaitPolicy(const std::string& name, WaitPolicy& policy) {
+    for (int p = 0; p < WP_TOTAL; p++) {
+        if (name == waitPolicyNames[p]) {
+            policy = static_cast<WaitPolicy>(p);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace MT
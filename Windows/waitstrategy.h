@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include "threads.h"
+
+namespace MT {
+
+// how an idle thread waits for the other side: for an item in the buffer or a free slot
+enum WaitPolicy {
+    WP_BLOCK,   // block on the kernel object at once (sleep if the other side signals none)
+    WP_SPIN,    // check with the pause instruction until ready: the lowest latency, a whole processor
+    WP_YIELD,   // spin, then give the rest of the time slice to other threads between the checks
+    WP_BACKOFF, // spin, then sleep between the checks for periods doubled up to the limit
+    WP_PARK,    // spin, then block on the kernel object
+    WP_TOTAL
+};
+
+const char* WaitPolicyName(WaitPolicy policy); // as given on the command line
+bool ParseWaitPolicy(const std::string& name, WaitPolicy& policy);
+
+struct WaitBudget {
+    static const unsigned defSpins        = 4000; // a few microseconds
+    static const unsigned defMaxBackoffMs = 16;   // about one tick of the system timer
+
+    unsigned spins;        // checks before yielding, backing off or parking
+    unsigned maxBackoffMs; // longest sleep of the backoff
+
+    WaitBudget() : spins(defSpins), maxBackoffMs(defMaxBackoffMs) {
+    }
+};
+
+// Wait of a thread for a condition made true by another thread, by the policy.
+//
+// The condition is a functor: bool operator()() const, checked at least once before the
+// thread blocks. Spinning threads check it without entering the kernel, so they see the
+// change within the time of one check, but they keep their processor busy all the time;
+// a blocked thread takes no processor time, but is woken up by the scheduler.
+class WaitStrategy {
+public:
+    WaitStrategy(WaitPolicy policy = WP_BLOCK, const WaitBudget& budget = WaitBudget()) :
+        m_policy(policy), m_budget(budget) {
+    }
+
+    WaitPolicy Policy() const {
+        return m_policy;
+    }
+    const WaitBudget& Budget() const {
+        return m_budget;
+    }
+
+    // Waits until ready() is true, the kernel object hWake is signalled or timeoutMs passes.
+    // hWake is NULL if the other side signals nothing, then blocking is sleeping for the rest
+    // of the timeout. Returns WAIT_OBJECT_0, WAIT_TIMEOUT or WAIT_FAILED as WaitForSingleObject.
+    template <class Ready> DWORD Wait(const Ready& ready, HANDLE hWake, DWORD timeoutMs) const;
+
+private:
+    static const unsigned m_clockPeriod = 1024; // spins between the reads of the tick count
+
+    static DWORD Remaining(DWORD start, DWORD timeoutMs) {
+        if (timeoutMs == INFINITE)
+            return INFINITE;
+        const DWORD elapsed = ::GetTickCount() - start; // wrap-safe
+        return elapsed >= timeoutMs ? 0 : timeoutMs - elapsed;
+    }
+
+    template <class Ready> static DWORD Block(const Ready& ready, HANDLE hWake, DWORD timeoutMs) {
+        if (hWake != NULL)
+            return ::WaitForSingleObject(hWake, timeoutMs);
+        ::Sleep(timeoutMs);
+        return ready() ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+    }
+
+    WaitPolicy m_policy;
+    WaitBudget m_budget;
+};
+
+template <class Ready> DWORD WaitStrategy::Wait(const Ready& ready, HANDLE hWake, DWORD timeoutMs) const {
+    if (m_policy == WP_BLOCK)
+        return Block(ready, hWake, timeoutMs);
+
+    const DWORD start = ::GetTickCount();
+    for (unsigned i = 1; m_policy == WP_SPIN || i <= m_budget.spins; i++) {
+        if (ready())
+            return WAIT_OBJECT_0;
+        YieldProcessor(); // spin-wait hint
+        if (i % m_clockPeriod == 0 && Remaining(start, timeoutMs) == 0)
+            return WAIT_TIMEOUT;
+    }
+
+    switch (m_policy) {
+        case WP_YIELD:
+            for (;;) {
+                if (ready())
+                    return WAIT_OBJECT_0;
+                if (Remaining(start, timeoutMs) == 0)
+                    return WAIT_TIMEOUT;
+                ::SwitchToThread(); // returns at once if no other thread is ready to run here
+            }
+        case WP_BACKOFF:
+            for (DWORD sleepMs = 1; ; sleepMs = std::min<DWORD>(2 * sleepMs, m_budget.maxBackoffMs)) {
+                if (ready())
+                    return WAIT_OBJECT_0;
+                const DWORD remaining = Remaining(start, timeoutMs);
+                if (remaining == 0)
+                    return WAIT_TIMEOUT;
+                ::Sleep(std::min(sleepMs, remaining));
+            }
+        case WP_PARK:
+        default:
+            return Block(ready, hWake, Remaining(start, timeoutMs));
+    }
+}
+
+} // namespace MT
@@ -0,0 +1,281 @@
+#include "stdafx.h"
+#include <intrin.h>
+#include <vector>
+#include "threads.h"
+#include "workstack.h"
+
+namespace MT {
+
+TreiberStack::TreiberStack(size_t capacity) : m_nodes(capacity) {
+    m_top.value  = Tagged(m_nil, 0);
+    m_free.value = Tagged(m_nil, 0);
+    if (!m_nodes.isValid())
+        return;
+    for (size_t i = 0; i < capacity; i++)
+        PushNode(m_free.value, static_cast<ULONG>(i));
+}
+
+bool TreiberStack::Push(unsigned, int item) {
+    const ULONG index = PopNode(m_free.value);
+    if (index == m_nil)
+        return false;
+    m_nodes[index].item = item;
+    PushNode(m_top.value, index); // the swap is a full barrier: the item is seen before the node
+    return true;
+}
+
+bool TreiberStack::Pop(unsigned, int& item) {
+    const ULONG index = PopNode(m_top.value);
+    if (index == m_nil)
+        return false;
+    item = m_nodes[index].item;
+    PushNode(m_free.value, index);
+    return true;
+}
+
+// On 32-bit system the read of the top may be torn. Each half is read whole, so the
+// index is still of a node, and the swap fails unless the pair is the current top.
+ULONG TreiberStack::PopNode(volatile LONGLONG& top) {
+    for (;;) {
+        const LONGLONG old   = top;
+        const ULONG    index = IndexOf(old);
+        if (index == m_nil)
+            return m_nil;
+        const ULONG next = m_nodes[index].next; // stale if the node is popped meanwhile: the tag differs
+        // compiler intrinsic: InterlockedCompareExchange64 API is not available on Windows XP
+        if (_InterlockedCompareExchange64(&top, Tagged(next, TagOf(old) + 1), old) == old)
+            return index;
+    }
+}
+
+void TreiberStack::PushNode(volatile LONGLONG& top, ULONG index) {
+    for (;;) {
+        const LONGLONG old = top;
+        m_nodes[index].next = IndexOf(old);
+        if (_InterlockedCompareExchange64(&top, Tagged(index, TagOf(old) + 1), old) == old)
+            return;
+    }
+}
+
+static LONG RingSize(size_t capacity) { // the power of two: the index is masked
+    LONG size = 1;
+    while (static_cast<size_t>(size) < capacity)
+        size *= 2;
+    return size;
+}
+
+WorkStealingPool::WorkStealingPool(size_t capacity, unsigned threads) : m_threads(threads),
+    m_capacity(static_cast<LONG>(capacity)), m_mask(RingSize(capacity) - 1),
+    m_deques(threads), m_items(threads * (m_mask + 1)) {
+}
+
+// the ring is written before the bottom moves: volatile store has release semantics
+bool WorkStealingPool::Push(unsigned slot, int item) {
+    Deque& d = m_deques[slot];
+    const LONG b = d.bottom;
+    if (b - d.top >= m_capacity) // the top only grows: a stale one errs on the full side
+        return false;
+    m_items[slot * (m_mask + 1) + (b & m_mask)] = item;
+    d.bottom = b + 1;
+    return true;
+}
+
+bool WorkStealingPool::Pop(unsigned slot, int& item) {
+    if (PopBottom(slot, item))
+        return true;
+    for (unsigned i = 1; i < m_threads; i++) {
+        if (Steal((slot + i) % m_threads, item)) {
+            Deque& d = m_deques[slot];
+            d.steals = d.steals + 1; // the only writer
+            return true;
+        }
+    }
+    return false;
+}
+
+ULONGLONG WorkStealingPool::Steals() const {
+    ULONGLONG steals = 0;
+    for (unsigned i = 0; i < m_threads; i++)
+        steals += m_deques[i].steals;
+    return steals;
+}
+
+// The bottom is lowered before the top is read: a thief reading the top after it sees
+// the lowered bottom, so the owner and a thief cannot take one item both, except the
+// last one which they take by the swap of the top.
+bool WorkStealingPool::PopBottom(unsigned slot, int& item) {
+    Deque& d = m_deques[slot];
+    const LONG b = d.bottom - 1;
+    ::InterlockedExchange(&d.bottom, b); // full barrier
+    const LONG t = d.top;
+    if (b - t < 0) { // empty
+        d.bottom = b + 1;
+        return false;
+    }
+    item = m_items[slot * (m_mask + 1) + (b & m_mask)];
+    if (b != t)
+        return true; // more items left: no thief reaches this one
+    const bool taken = ::InterlockedCompareExchange(&d.top, t + 1, t) == t;
+    d.bottom = t + 1; // empty either way
+    return taken;
+}
+
+bool WorkStealingPool::Steal(unsigned victim, int& item) {
+    Deque& d = m_deques[victim];
+    const LONG t = d.top;
+    MemoryBarrier(); // the top is read before the bottom
+    const LONG b = d.bottom;
+    if (b - t <= 0)
+        return false;
+    item = m_items[victim * (m_mask + 1) + (t & m_mask)];
+    return ::InterlockedCompareExchange(&d.top, t + 1, t) == t; // lost to another thief or the owner
+}
+
+BulkJob::BulkJob(unsigned workers) : m_workers(workers),
+    m_bytes(Capacity(workers) * m_payloadBytes), m_payloads( static_cast<char*>(AllocateBuffer(m_bytes)) ),
+    m_claimed(0), m_remaining(0) {
+}
+
+BulkJob::~BulkJob() {
+    FreeBuffer(m_payloads, m_bytes);
+}
+
+bool BulkJob::ClaimBurst(int& first) {
+    const LONG total = static_cast<LONG>(m_workers * m_items); // a multiple of the burst
+    if (m_claimed >= total)
+        return false;
+    first = ::InterlockedExchangeAdd(&m_claimed, m_burst);
+    return first < total;
+}
+
+// the checksum of the payload is the sum of its words
+long long BulkJob::Write(int item, int seed) {
+    int* words = reinterpret_cast<int*>(m_payloads + static_cast<size_t>(item) * m_payloadBytes);
+    const int count = m_payloadBytes / sizeof(int);
+    for (int i = 0; i < count; i++)
+        words[i] = seed + i;
+    return static_cast<long long>(seed) * count + static_cast<long long>(count) * (count - 1) / 2;
+}
+
+long long BulkJob::Read(int item) const {
+    const int* words = reinterpret_cast<const int*>(m_payloads + static_cast<size_t>(item) * m_payloadBytes);
+    long long sum = 0;
+    for (unsigned i = 0; i < m_payloadBytes / sizeof(int); i++)
+        sum += words[i];
+    return sum;
+}
+
+void BulkJob::Process(WorkerArgs& a, const Stopwatch& sw, int item) {
+    ::InterlockedDecrement(&m_remaining);
+    const double start = sw.ElapsedNs();
+    a.read   += Read(item);
+    a.readNs += sw.ElapsedNs() - start;
+}
+
+int BulkJob::Run(SharedQueue& dispatch, BulkJobResult& result) {
+    if (!isValid() || !dispatch.isValid() || m_workers == 0 || m_workers > m_maxWorkers)
+        return ERR_STD;
+
+    HandleWrapper hStart( ::CreateEvent(NULL, TRUE, FALSE, NULL) );
+    if (!hStart.isValid())
+        return ERR_API;
+
+    long long written = 0;
+    for (unsigned i = 0; i < m_backlog; i++) { // dealt out to the deques of all workers
+        written += Write(static_cast<int>(i), static_cast<int>(i));
+        if (!dispatch.Push(i % m_workers, static_cast<int>(i)))
+            return ERR_SYNC;
+    }
+    m_claimed   = 0;
+    m_remaining = static_cast<LONG>(TotalItems());
+
+    AlignedArray<WorkerArgs> args(m_workers); // zeroed
+    if (!args.isValid())
+        return ERR_STD;
+    for (unsigned i = 0; i < m_workers; i++) {
+        args[i].job      = this;
+        args[i].dispatch = &dispatch;
+        args[i].slot     = i;
+        args[i].hStart   = hStart;
+    }
+
+    std::vector<HANDLE> threadHandles;
+    for (unsigned i = 0; i < m_workers; i++) {
+        HANDLE h = (HANDLE) _beginthreadex(NULL, 0, &Worker, &args[i], 0, NULL);
+        if (h == 0)
+            break;
+        threadHandles.push_back(h);
+    }
+    if (threadHandles.size() != m_workers)
+        m_remaining = 0; // the created workers exit at once
+
+    Stopwatch sw;
+    ::SetEvent(hStart); // also releases already created threads if some creation failed
+    int ret = RET_OK;
+    if (!threadHandles.empty() &&
+        ::WaitForMultipleObjects(static_cast<DWORD>(threadHandles.size()), &threadHandles[0],
+                                 TRUE, INFINITE) == WAIT_FAILED)
+        ret = ERR_SYNC;
+    const double elapsedNs = sw.ElapsedNs();
+
+    for (size_t i = 0; i < threadHandles.size(); i++) {
+        DWORD exitCode = RET_OK;
+        if (::GetExitCodeThread(threadHandles[i], &exitCode) && exitCode != RET_OK && ret == RET_OK)
+            ret = static_cast<int>(exitCode);
+        ::CloseHandle(threadHandles[i]);
+    }
+    if (threadHandles.size() != m_workers)
+        return ERR_API;
+    if (ret != RET_OK)
+        return ret;
+
+    long long read = 0;
+    double readNs  = 0;
+    for (unsigned i = 0; i < m_workers; i++) {
+        written += args[i].written;
+        read    += args[i].read;
+        readNs  += args[i].readNs;
+    }
+    if (read != written)
+        return ERR_SYNC;
+
+    result.itemsPerSec   = TotalItems() * 1e9 / elapsedNs;
+    result.readNsPerItem = readNs / TotalItems();
+    return RET_OK;
+}
+
+// A worker makes a burst when it has the slots for one and processes an item in between:
+// it pops the items of its bursts, or of the backlog, or of the bursts of the others.
+unsigned __stdcall BulkJob::Worker(void* args) {
+
+    WorkerArgs& a = *static_cast<WorkerArgs*>(args);
+    BulkJob& job = *a.job;
+    std::vector<int> free; // slots of the next bursts
+    for (unsigned i = 0; i < m_burst; i++)
+        free.push_back(static_cast<int>(m_backlog + a.slot * m_burst + i));
+    Stopwatch sw;
+    ::WaitForSingleObject(a.hStart, INFINITE);
+
+    int first = 0;
+    while (job.m_remaining > 0) {
+        if (free.size() >= m_burst && job.ClaimBurst(first)) {
+            for (unsigned i = 0; i < m_burst; i++) {
+                const int item = free.back();
+                free.pop_back();
+                a.written += job.Write(item, first + static_cast<int>(i));
+                if (!a.dispatch->Push(a.slot, item))
+                    return ERR_SYNC; // sized for all slots
+            }
+        }
+        int item = 0;
+        if (a.dispatch->Pop(a.slot, item)) {
+            job.Process(a, sw, item);
+            free.push_back(item);
+        } else {
+            ::SwitchToThread(); // the items are being made or lost the race for the last one
+        }
+    }
+    return RET_OK;
+}
+
+} // namespace MT
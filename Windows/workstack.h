@@ -0,0 +1,172 @@
+#pragma once
+
+#include "threads.h"
+#include "combining.h"
+
+namespace MT {
+
+// Lock-free LIFO stack (Treiber, IBM RJ 5118, 1986) of preallocated nodes, free nodes
+// are kept in the second stack of the same kind.
+//
+// Nodes are addressed by 32-bit indices of one array, so the index of the top node and
+// a tag fit in 64 bits and are replaced together by one compare-and-swap (cmpxchg8b on
+// 32-bit processors). Every change of the top increments the tag: if the top node was
+// popped and pushed again while a thread was preempted between reading the top and its
+// swap (ABA), the tag differs and the swap fails. Nodes are never freed while the stack
+// exists, so reading the link of a node another thread has just popped is safe.
+class TreiberStack : public SharedQueue {
+public:
+    TreiberStack(size_t capacity);
+
+    virtual const char* Name() const {
+        return "Treiber stack";
+    }
+    virtual bool isValid() const {
+        return m_nodes.isValid();
+    }
+    virtual bool Push(unsigned slot, int item);
+    virtual bool Pop(unsigned slot, int& item);
+
+private:
+    static const ULONG m_nil = 0xFFFFFFFF; // index of no node: the stack is empty
+
+    struct Node {
+        volatile ULONG next;
+        int            item;
+    };
+
+    // index of the top node in the low half, the tag in the high half
+    static LONGLONG Tagged(ULONG index, ULONG tag) {
+        return static_cast<LONGLONG>(static_cast<ULONGLONG>(tag) << 32 | index);
+    }
+    static ULONG IndexOf(LONGLONG top) {
+        return static_cast<ULONG>(top);
+    }
+    static ULONG TagOf(LONGLONG top) {
+        return static_cast<ULONG>(static_cast<ULONGLONG>(top) >> 32);
+    }
+
+    ULONG PopNode(volatile LONGLONG& top);
+    void  PushNode(volatile LONGLONG& top, ULONG index);
+
+    AlignedArray<Node>              m_nodes;
+    CacheAligned<volatile LONGLONG> m_top;
+    CacheAligned<volatile LONGLONG> m_free;
+};
+
+// Per-thread deques of work stealing (Chase, Lev, SPAA 2005), bounded.
+//
+// A thread pushes and pops at the bottom of its own deque: it takes its freshest item
+// first (LIFO), whose data is still in its cache. A thread whose deque is empty steals
+// from the top of the others: their oldest items (FIFO), the ones their owners would
+// reach last. The owner synchronises with the thieves only for the last item of its
+// deque, the thieves race for the top with compare-and-swap.
+// http://dl.acm.org/citation.cfm?id=1073974
+class WorkStealingPool : public SharedQueue {
+public:
+    WorkStealingPool(size_t capacity, unsigned threads); // capacity of each deque
+
+    virtual const char* Name() const {
+        return "work stealing";
+    }
+    virtual bool isValid() const {
+        return m_deques.isValid() && m_items.isValid();
+    }
+    virtual bool Push(unsigned slot, int item); // to the deque of the slot
+    virtual bool Pop(unsigned slot, int& item); // own deque first, then steals
+
+    ULONGLONG Steals() const; // read when the threads have exited
+
+private:
+    struct MT_CACHE_ALIGN Deque {
+        volatile LONG top;    // next to steal: the thieves and the owner move it
+        char          pad[CACHE_LINE - sizeof(LONG)];
+        volatile LONG bottom; // next to push: the owner only
+        ULONG         steals; // from the other deques, the owner is the only writer
+    };
+
+    bool PopBottom(unsigned slot, int& item);
+    bool Steal(unsigned victim, int& item);
+
+    const unsigned      m_threads;
+    const LONG          m_capacity;
+    const LONG          m_mask;    // of the ring of a deque
+    AlignedArray<Deque> m_deques;
+    AlignedArray<int>   m_items;   // the rings of all deques one after another
+};
+
+// Bulk job measuring the dispatch order against the cache.
+//
+// The backlog of items is queued before the workers start. Then each worker repeatedly
+// makes a burst of items, writing their payloads, and processes as many, reading the
+// payloads of the items it pops, until all items are processed. The payloads of the
+// backlog are several times the size of the last level cache: a FIFO worker reads the
+// payloads written a backlog ago, long evicted, a LIFO worker the ones just written.
+// The time of reading the payloads is what the cache misses cost.
+//
+// Items are the numbers of the payload slots: a worker makes its bursts in the slots it
+// has processed, so the slots are never shared by two items. The bursts are claimed from
+// the common count by the worker which has the slots for one: a worker whose items were
+// stolen does not stop the job.
+struct BulkJobResult {
+    double itemsPerSec;
+    double readNsPerItem;
+};
+
+class BulkJob {
+public:
+    static const unsigned m_backlog      = 8192;  // 32 MB of payloads
+    static const unsigned m_items        = 32768; // made and processed after the backlog, per worker
+    static const unsigned m_burst        = 16;
+    static const unsigned m_payloadBytes = 4096;
+    static const unsigned m_maxWorkers   = MAXIMUM_WAIT_OBJECTS;
+
+    static size_t Capacity(unsigned workers) { // payload slots: all items fit in any structure
+        return m_backlog + workers * m_burst;
+    }
+
+    BulkJob(unsigned workers);
+    ~BulkJob();
+
+    bool isValid() const {
+        return m_payloads != NULL;
+    }
+    unsigned Workers() const {
+        return m_workers;
+    }
+    unsigned long TotalItems() const {
+        return m_backlog + static_cast<unsigned long>(m_workers) * m_items;
+    }
+
+    // ERR_SYNC if the dispatch lost or duplicated an item, ERR_API if threads are not created
+    int Run(SharedQueue& dispatch, BulkJobResult& result);
+
+private:
+    BulkJob(const BulkJob&);
+    BulkJob& operator=(const BulkJob&);
+
+    struct MT_CACHE_ALIGN WorkerArgs {
+        BulkJob*     job;
+        SharedQueue* dispatch;
+        unsigned     slot;
+        HANDLE       hStart;  // manual-reset event releasing all threads at once
+        long long    written; // output: checksum of the payloads written
+        long long    read;    // output: checksum of the payloads read
+        double       readNs;  // output
+    };
+
+    static THREAD_FUNCTION Worker;
+
+    bool      ClaimBurst(int& first); // false if all bursts are made
+    long long Write(int item, int seed);
+    long long Read(int item) const;
+    void      Process(WorkerArgs& a, const Stopwatch& sw, int item);
+
+    const unsigned m_workers;
+    const size_t   m_bytes;
+    char*          m_payloads;
+    volatile LONG  m_claimed;   // items of the bursts claimed by the workers
+    volatile LONG  m_remaining; // items not popped yet
+};
+
+} // namespace MT